@@ -3,6 +3,7 @@
 
 #include "stdafx.h"
 
+#include "../Crucible/CommandDispatch.hpp"
 #include "../Crucible/IPC.hpp"
 #include "../Crucible/ProtectedObject.hpp"
 #include "../Crucible/ThreadTools.hpp"
@@ -420,22 +421,28 @@ static void HandleSharedTextureIncompatible(Object &obj)
 	luid.high = luid_high;
 }
 
+static constexpr CommandDispatch::Entry<void(*)(Object&)> handlers[] = {
+	CommandDispatch::Command("indicator", HandleIndicatorCommand),
+	CommandDispatch::Command("disable_native_indicators", DisableIndicators),
+	CommandDispatch::Command("forge_info", HandleForgeInfo),
+	CommandDispatch::Command("update_settings", HandleUpdateSettings),
+	CommandDispatch::Command("set_cursor", HandleSetCursor),
+	CommandDispatch::Command("dismiss_overlay", HandleDismissOverlay),
+	CommandDispatch::Command("stream_status", HandleStreamStatus),
+	CommandDispatch::Command("update_forward_buffer_indicator", HandleForwardBufferIndicatorUpdate),
+	CommandDispatch::Command("dismiss_quick_select", HandleDismissQuickSelect),
+	CommandDispatch::Command("begin_quick_select_timeout", HandleBeginQuickSelectTimeout),
+	CommandDispatch::Command("shared_texture_incompatible", HandleSharedTextureIncompatible),
+};
+
+static_assert(CommandDispatch::HandlersValid(handlers), "handlers contains a command without handler");
+static_assert(CommandDispatch::HashesUnique(handlers), "handlers contains duplicate commands or a hash collision");
+static_assert(CommandDispatch::HasPerfectLayout(handlers), "no collision free bucket layout for handlers");
+
+static const auto handlers_table = CommandDispatch::MakeTable(handlers);
+
 static void HandleCommands(uint8_t *data, size_t size)
 {
-	static const map<string, void(*)(Object&)> handlers = {
-		{ "indicator", HandleIndicatorCommand },
-		{ "disable_native_indicators", DisableIndicators },
-		{ "forge_info", HandleForgeInfo },
-		{ "update_settings", HandleUpdateSettings },
-		{ "set_cursor", HandleSetCursor },
-		{ "dismiss_overlay", HandleDismissOverlay },
-		{ "stream_status", HandleStreamStatus },
-		{ "update_forward_buffer_indicator", HandleForwardBufferIndicatorUpdate },
-		{ "dismiss_quick_select", HandleDismissQuickSelect },
-		{ "begin_quick_select_timeout", HandleBeginQuickSelectTimeout },
-		{ "shared_texture_incompatible", HandleSharedTextureIncompatible },
-	};
-
 	if (!data) {
 		hlog("AnvilRender: command connection died");
 		DismissOverlay(false);
@@ -455,9 +462,9 @@ static void HandleCommands(uint8_t *data, size_t size)
 		if (!cmd.length())
 			return hlog("Got invalid command with 0 length");
 
-		auto handler = handlers.find(cmd);
-		if (handler != cend(handlers))
-			handler->second(obj);
+		auto handler = handlers_table.Find(cmd.c_str(), cmd.length());
+		if (handler)
+			handler->handler(obj);
 		else
 			hlog("Got unknown command '%s' (%d)", cmd.c_str(), cmd.length());
 
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <functional>
 #include <vector>
+#include "../Crucible/IPCBuffer.hpp"
 #include "../Crucible/ProtectedObject.hpp"
 
 #define ANVIL_HOTKEYS
@@ -164,7 +165,42 @@ namespace ForgeEvent
 	bool SendDecline();
 }
 
-std::vector<uint8_t> *ReadNewFramebuffer(ActiveOverlay ov);
+// overlay frame as received from the browser; the IPC thread hashes it in
+// bands of band_rows rows so renderers can skip uploading unchanged content
+struct OverlayFramebuffer {
+	static const uint32_t band_rows = 64;
+
+	IPCBufferLease lease;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint64_t> band_hashes;
+
+	uint8_t *data() const { return lease.data(); }
+	size_t size() const { return lease.size(); }
+};
+
+// what a renderer last uploaded for one overlay, plus hit rate stats that
+// are logged every few hundred frames
+struct OverlayUploadTracker {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint64_t> band_hashes;
+
+	uint64_t frames = 0;
+	uint64_t skipped = 0;
+	uint64_t bands = 0;
+	uint64_t bands_uploaded = 0;
+
+	// true if `fb` is identical to the frame passed in last time
+	bool Unchanged(const char *renderer, const OverlayFramebuffer &fb);
+
+	// the next frame is uploaded in full, e.g. after recreating textures
+	void Invalidate();
+
+	void CountBands(size_t total, size_t uploaded);
+};
+
+const OverlayFramebuffer *ReadNewFramebuffer(ActiveOverlay ov);
 void StartFramebufferServer(std::array<void *, OVERLAY_COUNT> *shared_handles, ForgeEvent::LUID *luid);
 void StartFramebufferServer();
 
@@ -15,6 +15,8 @@
 
 #include <memory>
 
+#include "../../Crucible/PitchedCopy.hpp"
+
 typedef HRESULT (WINAPI *PFN_D3D10_COMPILESHADER)(LPCSTR pSrcData, SIZE_T SrcDataSize, LPCSTR pFileName, CONST D3D10_SHADER_MACRO* pDefines, LPD3D10INCLUDE pInclude, 
     LPCSTR pFunctionName, LPCSTR pProfile, UINT Flags, ID3D10Blob** ppShader, ID3D10Blob** ppErrorMsgs);
 
@@ -416,6 +418,7 @@ bool DX10Renderer::InitRenderer( IDXGISwapChain *pSwapChain, IndicatorManager &m
 	shared_desc.MiscFlags = D3D10_RESOURCE_MISC_SHARED;
 
 	for (uint32_t a = OVERLAY_HIGHLIGHTER; a < OVERLAY_COUNT; a++) {
+		overlay_uploads[a].Invalidate();
 		overlay_textures[a].Apply([&](D3D10Texture &tex)
 		{
 			HRESULT hRes;
@@ -861,20 +864,32 @@ void DX10Renderer::UpdateOverlay()
 			else
 				return false;
 
+			// the window may have been resized since the frame was received,
+			// only frames matching the texture can be uploaded
+			D3D10_TEXTURE2D_DESC desc;
+			tex.tex->GetDesc(&desc);
+			if (desc.Width != vec->width || desc.Height != vec->height)
+				return false;
+
+			// identical to what's already buffered, keep drawing that
+			if (overlay_uploads[i].Unchanged("DX10Renderer", *vec))
+				return false;
+
 			D3D10_MAPPED_TEXTURE2D mt;
 			auto hr = tex.tex->Map(0, D3D10_MAP_WRITE_DISCARD, 0, &mt);
 			if (FAILED(hr))
 			{
 				LOG_MSG("UpdateOverlay: texture data lock (%d) failed!" LOG_CR, i);
+				overlay_uploads[i].Invalidate();
 				return false;
 			}
 
 			// these probably won't match, gpus are fussy about even dimensions and stuff. we have to copy line by line to compensate
 			//LOG_MSG("InitIndicatorTextures: d3d surface pitch is %d, image stride is %d" LOG_CR, lr.Pitch, data.Stride);
-			for (UINT y = 0; y < g_Proc.m_Stats.m_SizeWnd.cy; y++)
-				memcpy((BYTE *)mt.pData + (y * mt.RowPitch), (BYTE *)vec->data() + (y * g_Proc.m_Stats.m_SizeWnd.cx * 4), g_Proc.m_Stats.m_SizeWnd.cx * 4);
+			PitchedCopy::Copy(static_cast<uint8_t*>(mt.pData), mt.RowPitch, vec->data(), vec->width * 4, vec->width * 4, vec->height);
 
 			tex.tex->Unmap(0);
+			overlay_uploads[i].CountBands(vec->band_hashes.size(), vec->band_hashes.size());
 
 			return true;
 		});
@@ -80,6 +80,7 @@ private:
 	IRefPtr<ID3D10Texture2D> m_pIndicatorTexture[INDICATE_NONE]; // textures for new indicators
 
 	TextureBufferingHelper<D3D10Texture> overlay_textures[OVERLAY_COUNT];
+	OverlayUploadTracker overlay_uploads[OVERLAY_COUNT];
 	std::array<D3D10Texture, OVERLAY_COUNT> shared_overlay_textures;
 
 	IRefPtr<ID3D10Buffer> m_pVBSquareIndicator;
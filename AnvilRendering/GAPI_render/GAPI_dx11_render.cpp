@@ -17,6 +17,7 @@
 
 #include <memory>
 
+#include "../../Crucible/PitchedCopy.hpp"
 #include "../../Crucible/scopeguard.hpp"
 
 extern pD3DCompile s_D3DCompile;
@@ -435,6 +436,7 @@ bool DX11Renderer::InitRenderer( IndicatorManager &manager )
 	shared_desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
 
 	for (uint32_t a = OVERLAY_HIGHLIGHTER; a < OVERLAY_COUNT; a++) {
+		overlay_uploads[a].Invalidate();
 		overlay_textures[a].Apply([&](D3D11Texture &tex)
 		{
 			HRESULT hRes;
@@ -935,6 +937,17 @@ void DX11Renderer::UpdateOverlay()
 					shared_handles[i] = nullptr;
 			}
 
+			// the window may have been resized since the frame was received,
+			// only frames matching the texture can be uploaded
+			D3D11_TEXTURE2D_DESC desc;
+			tex.tex->GetDesc(&desc);
+			if (desc.Width != vec->width || desc.Height != vec->height)
+				return false;
+
+			// identical to what's already buffered, keep drawing that
+			if (overlay_uploads[i].Unchanged("DX11Renderer", *vec))
+				return false;
+
 			IRefPtr<ID3D11DeviceContext> pContext;
 			m_pDevice->GetImmediateContext(IREF_GETPPTR(pContext, ID3D11DeviceContext));
 
@@ -945,15 +958,16 @@ void DX11Renderer::UpdateOverlay()
 			if (FAILED(hr))
 			{
 				LOG_MSG("UpdateOverlay: texture data lock (%d) failed!" LOG_CR, i);
+				overlay_uploads[i].Invalidate();
 				return false;
 			}
 
 			// these probably won't match, gpus are fussy about even dimensions and stuff. we have to copy line by line to compensate
 			//LOG_MSG("InitIndicatorTextures: d3d surface pitch is %d, image stride is %d" LOG_CR, lr.Pitch, data.Stride);
-			for (UINT y = 0; y < g_Proc.m_Stats.m_SizeWnd.cy; y++)
-				memcpy((BYTE *)mr.pData + (y * mr.RowPitch), (BYTE *)vec->data() + (y * g_Proc.m_Stats.m_SizeWnd.cx * 4), g_Proc.m_Stats.m_SizeWnd.cx * 4);
+			PitchedCopy::Copy(static_cast<uint8_t*>(mr.pData), mr.RowPitch, vec->data(), vec->width * 4, vec->width * 4, vec->height);
 
 			pContext->Unmap(tex.tex, 0);
+			overlay_uploads[i].CountBands(vec->band_hashes.size(), vec->band_hashes.size());
 
 			return true;
 		});
@@ -78,6 +78,7 @@ private:
 	IRefPtr<ID3D11Texture2D> m_pIndicatorTexture[INDICATE_NONE]; // textures for new indicators
 
 	TextureBufferingHelper<D3D11Texture> overlay_textures[OVERLAY_COUNT];
+	OverlayUploadTracker overlay_uploads[OVERLAY_COUNT];
 	std::array<D3D11Texture, OVERLAY_COUNT> shared_overlay_textures;
 
 	IRefPtr<ID3D11Buffer> m_pVBSquareIndicator;
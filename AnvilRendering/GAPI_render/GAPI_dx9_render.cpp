@@ -17,6 +17,8 @@
 
 #include <mutex>
 
+#include "../../Crucible/PitchedCopy.hpp"
+
 struct NEWVERTEX 
 { 
 #define D3DFVF_NEWVERTEX (D3DFVF_XYZRHW|D3DFVF_DIFFUSE|D3DFVF_TEX1)
@@ -88,6 +90,7 @@ bool DX9Renderer::InitRenderer( IDirect3DDevice9 *pDevice, IndicatorManager &man
 
 	// create textures
 	for (uint32_t a = OVERLAY_HIGHLIGHTER; a < OVERLAY_COUNT; a++) {
+		overlay_uploads[a].Invalidate();
 		overlay_textures[a].Apply([&](OverlayTexture_t &tex)
 		{
 			m_pDevice->CreateTexture(g_Proc.m_Stats.m_SizeWnd.cx, g_Proc.m_Stats.m_SizeWnd.cy, 1, D3DUSAGE_DYNAMIC, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, IREF_GETPPTR(tex, IDirect3DTexture9), NULL);
@@ -612,21 +615,32 @@ void DX9Renderer::UpdateOverlay()
 					shared_handles[i] = nullptr;
 			}
 
+			// the window may have been resized since the frame was received,
+			// only frames matching the texture can be uploaded
+			D3DSURFACE_DESC desc;
+			if (FAILED(tex->GetLevelDesc(0, &desc)) || desc.Width != vec->width || desc.Height != vec->height)
+				return false;
+
+			// identical to what's already buffered, keep drawing that
+			if (overlay_uploads[i].Unchanged("DX9Renderer", *vec))
+				return false;
+
 			D3DLOCKED_RECT lr;
 			HRESULT hr = tex->LockRect(0, &lr, NULL, D3DLOCK_DISCARD);
 			if (FAILED(hr))
 			{
 				LOG_MSG("InitIndicatorTextures: texture data lock (%d) failed!" LOG_CR, i);
+				overlay_uploads[i].Invalidate();
 				return false;
 			}
 
 			// these probably won't match, gpus are fussy about even dimensions and stuff. we have to copy line by line to compensate
 			//LOG_MSG("InitIndicatorTextures: d3d surface pitch is %d, image stride is %d" LOG_CR, lr.Pitch, data.Stride);
-			for (UINT y = 0; y < g_Proc.m_Stats.m_SizeWnd.cy; y++)
-				memcpy((BYTE *)lr.pBits + (y * lr.Pitch), (BYTE *)vec->data() + (y * g_Proc.m_Stats.m_SizeWnd.cx * 4), g_Proc.m_Stats.m_SizeWnd.cx * 4);
+			PitchedCopy::Copy(static_cast<uint8_t*>(lr.pBits), lr.Pitch, vec->data(), vec->width * 4, vec->width * 4, vec->height);
 
 
 			tex->UnlockRect(0);
+			overlay_uploads[i].CountBands(vec->band_hashes.size(), vec->band_hashes.size());
 			return true;
 		});
 }
@@ -26,6 +26,7 @@ private:
 	IRefPtr<IDirect3DTexture9> m_pIndicatorTexture[INDICATE_NONE]; // indicator images
 	using OverlayTexture_t = IRefPtr<IDirect3DTexture9>;
 	TextureBufferingHelper<OverlayTexture_t> overlay_textures[OVERLAY_COUNT];
+	OverlayUploadTracker overlay_uploads[OVERLAY_COUNT];
 	OverlayTexture_t shared_overlay_textures[OVERLAY_COUNT];
 
 	void UpdateSquareBorderVB( IDirect3DVertexBuffer9 *pVB, int x, int y, int w, int h, DWORD color ); // update the square indicator border vertex buffer (it's bigger than the solid/textured quad ones)
@@ -657,6 +657,16 @@ static HGLRC render_context = nullptr;
 static TextureBufferingHelper<GLuint> overlay_textures[OVERLAY_COUNT];
 static bool overlay_tex_initialized = false;
 
+// band hashes of what each buffered texture currently holds, so only bands
+// that differ from it have to be uploaded
+struct OverlayTextureContents {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint64_t> band_hashes;
+};
+static std::array<OverlayTextureContents, 3> overlay_texture_contents[OVERLAY_COUNT];
+static OverlayUploadTracker overlay_uploads[OVERLAY_COUNT];
+
 static struct SharedTexturesHelper {
 	IRefPtr<ID3D11Device> device;
 	IRefPtr<ID3D11DeviceContext> context;
@@ -706,6 +716,9 @@ void overlay_gl_free()
 				s_glDeleteTextures(1, &tex);
 				tex = 0;
 			});
+
+			overlay_texture_contents[a] = {};
+			overlay_uploads[a].Invalidate();
 		}
 
 		if (vshader && s_glDeleteShader)
@@ -900,22 +913,63 @@ static void update_overlay()
 		overlay_textures[i].Buffer([&](GLuint &tex)
 		{
 			auto vec = ReadNewFramebuffer(static_cast<ActiveOverlay>(i));
-			if (!vec || vec->size() != g_Proc.m_Stats.m_SizeWnd.cx * g_Proc.m_Stats.m_SizeWnd.cy * 4)
+			if (!vec || vec->size() != static_cast<size_t>(vec->width) * vec->height * 4)
 				return false;
 
+			// identical to what's already buffered, keep drawing that
+			if (overlay_uploads[i].Unchanged("OpenGLRenderer", *vec))
+				return false;
+
+			auto &contents = overlay_texture_contents[i][&tex - overlay_textures[i].textures.data()];
+
 			s_glBindTexture(GL_TEXTURE_2D, tex);
 			s_glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-			s_glPixelStorei(GL_UNPACK_ROW_LENGTH, g_Proc.m_Stats.m_SizeWnd.cx);
+			s_glPixelStorei(GL_UNPACK_ROW_LENGTH, vec->width);
 			s_glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
 			s_glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
-			s_glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, g_Proc.m_Stats.m_SizeWnd.cx,
-				g_Proc.m_Stats.m_SizeWnd.cy, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, vec->data());
+
+			auto bands = vec->band_hashes.size();
+			size_t uploaded = 0;
+			// a frame of a different size (e.g. received before a resize)
+			// recreates the texture with the frame's own dimensions
+			if (contents.width != vec->width || contents.height != vec->height || contents.band_hashes.size() != bands) {
+				s_glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, static_cast<GLsizei>(vec->width),
+					static_cast<GLsizei>(vec->height), 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, vec->data());
+				uploaded = bands;
+			} else {
+				// upload runs of changed bands
+				for (size_t band = 0; band < bands; band++) {
+					if (contents.band_hashes[band] == vec->band_hashes[band])
+						continue;
+
+					auto first = band;
+					while (band + 1 < bands && contents.band_hashes[band + 1] != vec->band_hashes[band + 1])
+						band += 1;
+
+					auto y = static_cast<GLint>(first * OverlayFramebuffer::band_rows);
+					auto end = static_cast<GLint>((band + 1) * OverlayFramebuffer::band_rows);
+					if (end > static_cast<GLint>(vec->height))
+						end = static_cast<GLint>(vec->height);
+
+					s_glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, static_cast<GLsizei>(vec->width), end - y, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+						vec->data() + static_cast<size_t>(y) * vec->width * 4);
+					uploaded += band - first + 1;
+				}
+			}
+
 			auto err = s_glGetError();
 			if (err) {
 				LOG_WARN("update_overlay: unable to update OpenGL texture %d (%d)" LOG_CR, i, err);
+				contents = {};
+				overlay_uploads[i].Invalidate();
 				return false;
 			}
 
+			contents.width = vec->width;
+			contents.height = vec->height;
+			contents.band_hashes = vec->band_hashes;
+			overlay_uploads[i].CountBands(bands, uploaded);
+
 			return true;
 		});
 	}
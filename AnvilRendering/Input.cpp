@@ -7,6 +7,7 @@
 #include "GAPI_render/NewIndicator.h"
 
 #include "../Crucible/IPC.hpp"
+#include "../Crucible/TripleBuffer.hpp"
 
 #include <array>
 #include <atomic>
@@ -80,19 +81,114 @@ static POINT mouse_position;
 #define CONCAT(x, y) CONCAT2(x, y)
 #define LOCK(x) lock_guard<decltype(x)> CONCAT(lockGuard, __LINE__){x}
 
+// XXH64, only used to detect changed bands, so the exact function doesn't
+// matter as long as it's fast and spreads well
+namespace BandHash {
+	const uint64_t prime1 = 11400714785074694791ULL;
+	const uint64_t prime2 = 14029467366897019727ULL;
+	const uint64_t prime3 = 1609587929392839161ULL;
+	const uint64_t prime4 = 9650029242287828579ULL;
+	const uint64_t prime5 = 2870177450012600261ULL;
+
+	static uint64_t Rotl(uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	static uint64_t Read64(const uint8_t *p)
+	{
+		uint64_t val;
+		memcpy(&val, p, sizeof(val));
+		return val;
+	}
+
+	static uint32_t Read32(const uint8_t *p)
+	{
+		uint32_t val;
+		memcpy(&val, p, sizeof(val));
+		return val;
+	}
+
+	static uint64_t Round(uint64_t acc, uint64_t input)
+	{
+		return Rotl(acc + input * prime2, 31) * prime1;
+	}
+
+	static uint64_t Merge(uint64_t acc, uint64_t val)
+	{
+		return (acc ^ Round(0, val)) * prime1 + prime4;
+	}
+
+	static uint64_t Hash(const uint8_t *p, size_t size, uint64_t seed = 0)
+	{
+		auto end = p + size;
+		uint64_t h;
+
+		if (size >= 32) {
+			uint64_t v1 = seed + prime1 + prime2;
+			uint64_t v2 = seed + prime2;
+			uint64_t v3 = seed;
+			uint64_t v4 = seed - prime1;
+
+			for (; end - p >= 32; p += 32) {
+				v1 = Round(v1, Read64(p));
+				v2 = Round(v2, Read64(p + 8));
+				v3 = Round(v3, Read64(p + 16));
+				v4 = Round(v4, Read64(p + 24));
+			}
+
+			h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+			h = Merge(h, v1);
+			h = Merge(h, v2);
+			h = Merge(h, v3);
+			h = Merge(h, v4);
+		} else {
+			h = seed + prime5;
+		}
+
+		h += size;
+
+		for (; end - p >= 8; p += 8)
+			h = Rotl(h ^ Round(0, Read64(p)), 27) * prime1 + prime4;
+
+		if (end - p >= 4) {
+			h = Rotl(h ^ (Read32(p) * prime1), 23) * prime2 + prime3;
+			p += 4;
+		}
+
+		for (; p < end; p++)
+			h = Rotl(h ^ (*p * prime5), 11) * prime1;
+
+		h ^= h >> 33;
+		h *= prime2;
+		h ^= h >> 29;
+		h *= prime3;
+		h ^= h >> 32;
+		return h;
+	}
+}
+
+static void HashBands(OverlayFramebuffer &fb)
+{
+	auto band_size = static_cast<size_t>(fb.width) * 4 * OverlayFramebuffer::band_rows;
+	auto count = (fb.height + OverlayFramebuffer::band_rows - 1) / OverlayFramebuffer::band_rows;
+
+	// bands past the end of the data (if the lease is shorter than
+	// width * height suggests) are left out
+	fb.band_hashes.clear();
+	for (size_t i = 0, offset = 0; i < count && offset < fb.size(); i++, offset += band_size)
+		fb.band_hashes.push_back(BandHash::Hash(fb.data() + offset, min(band_size, fb.size() - offset)));
+}
+
 struct ForgeFramebufferServer {
 	IPCServer server;
 
 	std::string name;
 
 	atomic<bool> died = true;
-	atomic<bool> new_data = false;
 
-	vector<uint8_t> read_data;
-	vector<uint8_t> incoming_data;
-
-	mutex share_mutex;
-	vector<uint8_t> shared_data;
+	// written by the IPC thread, read by the render thread on Present
+	TripleBuffer<OverlayFramebuffer> framebuffers;
 
 #pragma optimize("tsg", on)
 	void Start()
@@ -104,7 +200,7 @@ struct ForgeFramebufferServer {
 
 		auto expected = g_Proc.m_Stats.m_SizeWnd.cx * g_Proc.m_Stats.m_SizeWnd.cy * 4;
 
-		server.Start(name, [&](uint8_t *data, size_t size)
+		server.StartLeased(name, [&](IPCBufferLease data)
 		{
 			if (!data) {
 				died = true;
@@ -112,36 +208,44 @@ struct ForgeFramebufferServer {
 				return;
 			}
 
-			if (size != g_Proc.m_Stats.m_SizeWnd.cx * g_Proc.m_Stats.m_SizeWnd.cy * 4) {
-				hlog("AnvilFramebufferServer: got invalid size: %d, expected %d", size, g_Proc.m_Stats.m_SizeWnd.cx * g_Proc.m_Stats.m_SizeWnd.cy * 4);
+			// the game thread may resize the window meanwhile, read the
+			// size once so the check and the framebuffer agree
+			auto width = g_Proc.m_Stats.m_SizeWnd.cx;
+			auto height = g_Proc.m_Stats.m_SizeWnd.cy;
+			if (width <= 0 || height <= 0 || data.size() != static_cast<size_t>(width) * height * 4) {
+				hlog("AnvilFramebufferServer: got invalid size: %d, expected %d", data.size(), width * height * 4);
 				return;
 			}
 
-			//hlog("AnvilFramebufferServer: got size %d", size);
-
-			incoming_data.assign(data, data + size);
+			//hlog("AnvilFramebufferServer: got size %d", data.size());
 
-			{
-				LOCK(share_mutex);
-				swap(incoming_data, shared_data);
-				new_data = true;
-			}
+			auto &fb = framebuffers.Back();
+			fb.lease = move(data);
+			fb.width = static_cast<uint32_t>(width);
+			fb.height = static_cast<uint32_t>(height);
+			HashBands(fb);
+			framebuffers.Publish();
 		}, expected > 1024 ? expected : -1);
 	}
 
 	void Stop()
 	{
-		server.server.reset();
+		server.Stop();
 		died = true;
-		new_data = false;
 
-		LOCK(share_mutex);
-		read_data.clear();
-		incoming_data.clear();
+		// the IPC thread is gone, act as producer and publish an empty lease,
+		// which also releases the frame the render thread hasn't picked up;
+		// the render thread drops its current frame on the next read
+		framebuffers.Back().lease.Release();
+		framebuffers.Publish();
+		framebuffers.Back().lease.Release();
 	}
 };
 
-static std::array<ProtectedObject<ForgeFramebufferServer>, OVERLAY_COUNT> forgeFramebufferServer;
+// the render thread reads framebuffers without taking this lock, it only
+// serializes starting/stopping the servers
+static recursive_mutex forgeFramebufferServerMutex;
+static std::array<ForgeFramebufferServer, OVERLAY_COUNT> forgeFramebufferServer;
 
 static const char *name_for_overlay[OVERLAY_COUNT] = {
 	"highlighter",
@@ -167,14 +271,12 @@ void StartFramebufferServer()
 	for (size_t i = OVERLAY_HIGHLIGHTER; i < OVERLAY_COUNT; i++) {
 		browsers[i].name = name_for_overlay[i];
 
-		auto fbs = forgeFramebufferServer[i].Lock();
-		if (!fbs)
-			continue;
-
-		if (fbs->died)
-			fbs->Start();
+		LOCK(forgeFramebufferServerMutex);
+		auto &fbs = forgeFramebufferServer[i];
+		if (fbs.died)
+			fbs.Start();
 
-		browsers[i].server = fbs->name;
+		browsers[i].server = fbs.name;
 	}
 
 	ForgeEvent::InitBrowser(browsers, g_Proc.m_Stats.m_SizeWnd.cx, g_Proc.m_Stats.m_SizeWnd.cy);
@@ -185,27 +287,51 @@ void StopFramebufferServer()
 	for (size_t i = OVERLAY_HIGHLIGHTER; i < OVERLAY_COUNT; i++) {
 		browsers[i].name = name_for_overlay[i];
 
-		auto fbs = forgeFramebufferServer[i].Lock();
-		if (!fbs)
-			continue;
-
-		fbs->Stop();
+		LOCK(forgeFramebufferServerMutex);
+		forgeFramebufferServer[i].Stop();
 	}
 }
 
-vector<uint8_t> *ReadNewFramebuffer(ActiveOverlay ov)
+const OverlayFramebuffer *ReadNewFramebuffer(ActiveOverlay ov)
 {
-	auto fbs = forgeFramebufferServer[ov].Lock();
-	if (!fbs || !fbs->new_data)
+	auto &framebuffers = forgeFramebufferServer[ov].framebuffers;
+	if (!framebuffers.Consume())
 		return nullptr;
 
-	{
-		LOCK(fbs->share_mutex);
-		swap(fbs->shared_data, fbs->read_data);
-		fbs->new_data = false;
+	auto &fb = framebuffers.Front();
+	return fb.lease ? &fb : nullptr;
+}
+
+bool OverlayUploadTracker::Unchanged(const char *renderer, const OverlayFramebuffer &fb)
+{
+	frames += 1;
+
+	auto unchanged = fb.width == width && fb.height == height && fb.band_hashes == band_hashes;
+	if (unchanged) {
+		skipped += 1;
+	} else {
+		width = fb.width;
+		height = fb.height;
+		band_hashes = fb.band_hashes;
 	}
 
-	return &fbs->read_data;
+	if (frames % 600 == 0)
+		hlog("%s: skipped %llu of %llu overlay uploads, uploaded %llu of %llu bands", renderer, skipped, frames, bands_uploaded, bands);
+
+	return unchanged;
+}
+
+void OverlayUploadTracker::Invalidate()
+{
+	width = 0;
+	height = 0;
+	band_hashes.clear();
+}
+
+void OverlayUploadTracker::CountBands(size_t total, size_t uploaded)
+{
+	bands += total;
+	bands_uploaded += uploaded;
 }
 
 extern void ResetOverlayCursor();
@@ -267,24 +393,20 @@ void ShowOverlayCursor();
 
 void ToggleOverlay(ActiveOverlay overlay)
 {
-	auto fbs = forgeFramebufferServer[overlay].Lock();
-	if (g_bBrowserShowing && fbs && fbs->died)
-		fbs->Start();
+	LOCK(forgeFramebufferServerMutex);
+	auto &fbs = forgeFramebufferServer[overlay];
+	if (g_bBrowserShowing && fbs.died)
+		fbs.Start();
 
 	if (!g_bBrowserShowing || active_overlay != overlay) {
-		if (!fbs) {
-			hlog("Requested browser for overlay %d ignored because browser could not be locked", overlay);
-			return;
-		}
-
-		if (fbs->died)
-			fbs->Start();
+		if (fbs.died)
+			fbs.Start();
 
 		if (overlay != active_overlay)
 			ForgeEvent::HideBrowser();
 
 		browsers[overlay].name = name_for_overlay[overlay];
-		browsers[overlay].server = fbs->name;
+		browsers[overlay].server = fbs.name;
 
 		active_overlay = overlay;
 		ForgeEvent::ShowBrowser(browsers[overlay], g_Proc.m_Stats.m_SizeWnd.cx, g_Proc.m_Stats.m_SizeWnd.cy);
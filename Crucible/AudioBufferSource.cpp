@@ -4,12 +4,15 @@
 
 #include "OBSHelpers.hpp"
 
+#include "AudioConvert.hpp"
+#include "AudioTimestampSmoother.hpp"
 #include "IPC.hpp"
+#include "SharedMemoryIPC.hpp"
 
+#include <algorithm>
 #include <atomic>
 #include <mutex>
 #include <vector>
-#include <map>
 
 #define CONCAT2(x, y) x ## y
 #define CONCAT(x, y) CONCAT2(x, y)
@@ -22,9 +25,12 @@ static const string info_header_fragment = "AudioBufferInfo";
 struct CrucibleAudioBufferServer {
 	std::string name;
 
+	bool shared_memory = false;
+
 	atomic<bool> died = true;
 
 	IPCServer server;
+	SharedMemoryIPCServer shm_server;
 
 	template <typename Fun>
 	void Start(Fun fun)
@@ -32,7 +38,7 @@ struct CrucibleAudioBufferServer {
 		static atomic<int> restarts = 0;
 		died = false;
 
-		server.Start(name, [&, fun](uint8_t *data, size_t size)
+		auto handler = [&, fun](uint8_t *data, size_t size)
 		{
 			if (!data) {
 				died = true;
@@ -41,12 +47,23 @@ struct CrucibleAudioBufferServer {
 			}
 
 			fun(data, size);
-		}, -1);
+		};
+
+		if (!shared_memory) {
+			server.Start(name, handler, -1);
+			return;
+		}
+
+		if (!shm_server.Start(name, handler)) {
+			died = true;
+			blog(LOG_WARNING, "CrucibleAudioBufferServer: failed to create shared memory ring '%s'", name.c_str());
+		}
 	}
 
 	void Stop()
 	{
 		server.server.reset();
+		shm_server.server.reset();
 		died = true;
 	}
 };
@@ -79,8 +96,27 @@ struct AudioBufferSource {
 
 	obs_source_audio frame = {};
 
-	map<uint64_t, obs_source_audio_stream_t*> streams;
+	// libobs has no way to remove an audio stream, so streams that stopped
+	// receiving packets are expired and their slot is handed to the next new
+	// stream id instead of adding another stream
+	static const uint64_t stream_idle_timeout_ns = 10000000000ULL;
+	static const uint64_t expiry_check_interval_ns = 1000000000ULL;
+
+	struct Stream {
+		uint64_t id;
+		bool live;
+		uint64_t last_packet_ns;
+		obs_source_audio_stream_t *stream;
+		AudioTimestampSmoother smoother;
+	};
+
+	mutex streams_mutex;
+	vector<Stream> streams;
+	size_t last_stream = 0;
+	uint64_t next_expiry_check_ns = 0;
 	atomic<uint32_t> num_streams = 0;
+	atomic<uint32_t> live_streams = 0;
+	atomic<uint32_t> expired_streams = 0;
 
 	CrucibleAudioBufferServer server;
 
@@ -88,14 +124,41 @@ struct AudioBufferSource {
 	AudioBufferSource(obs_data_t *settings, obs_source_t *source)
 		: source(source)
 	{
-		proc_handler_add(obs_source_get_proc_handler(source), "void num_audio_streams(out int num)", [](void *context, calldata_t *data)
+		proc_handler_add(obs_source_get_proc_handler(source), "void num_audio_streams(out int num, out int live, out int expired)", [](void *context, calldata_t *data)
 		{
 			auto self = cast(context);
 			calldata_set_int(data, "num", self->num_streams);
+			calldata_set_int(data, "live", self->live_streams);
+			calldata_set_int(data, "expired", self->expired_streams);
+		}, this);
+
+		proc_handler_add(obs_source_get_proc_handler(source), "void audio_stream_stats(out int packets, out int underruns, out int overruns, out int resyncs, out int max_jitter_ns)", [](void *context, calldata_t *data)
+		{
+			auto self = cast(context);
+
+			AudioTimestampSmoother::Stats total;
+			{
+				LOCK(self->streams_mutex);
+				for (auto &stream : self->streams) {
+					auto &stats = stream.smoother.stats;
+					total.packets += stats.packets;
+					total.underruns += stats.underruns;
+					total.overruns += stats.overruns;
+					total.resyncs += stats.resyncs;
+					total.max_jitter_ns = max(total.max_jitter_ns, stats.max_jitter_ns);
+				}
+			}
+
+			calldata_set_int(data, "packets", total.packets);
+			calldata_set_int(data, "underruns", total.underruns);
+			calldata_set_int(data, "overruns", total.overruns);
+			calldata_set_int(data, "resyncs", total.resyncs);
+			calldata_set_int(data, "max_jitter_ns", total.max_jitter_ns);
 		}, this);
 
 
 		server.name = obs_data_get_string(settings, "pipe_name");
+		server.shared_memory = strcmp(obs_data_get_string(settings, "transport"), "shared_memory") == 0;
 		if (!server.name.empty())
 			StartServer();
 	}
@@ -105,29 +168,138 @@ protected:
 	{
 		server.Start([&](uint8_t *data, size_t size)
 		{
-			auto read_ptr = data;
 			uint64_t id;
 
+			// id, samples_per_sec, speakers, format, frames
+			const size_t header_size = sizeof(id) + sizeof(frame.samples_per_sec) + 2 * sizeof(uint8_t) + sizeof(frame.frames);
+			if (!data || size < header_size)
+				return;
+
+			auto read_ptr = data;
 			read(read_ptr, id);
 			read(read_ptr, frame.samples_per_sec);
 			read<uint8_t>(read_ptr, frame.speakers);
 			read<uint8_t>(read_ptr, frame.format);
 			read(read_ptr, frame.frames);
-			frame.data[0] = read_ptr;			
+			frame.data[0] = read_ptr;
 
-			frame.timestamp = os_gettime_ns();
+			// frames must not claim more samples than the packet contains
+			auto channels = get_audio_channels(frame.speakers);
+			auto bytes_per_channel = get_audio_bytes_per_channel(frame.format);
+			if (!channels || channels > MAX_AV_PLANES || !bytes_per_channel ||
+				(size - header_size) / channels / bytes_per_channel < frame.frames)
+				return;
 
-			auto it = streams.find(id);
-			if (it == end(streams)) {
-				auto stream = obs_source_add_audio_stream(source);
-				blog(LOG_INFO, "[AudioBufferSource '%s']: adding new stream %llu (%p)", obs_source_get_name(source), id, stream);
-				it = streams.emplace(id, stream).first;
-				num_streams += 1;
-			}
+			ConvertFrame();
+
+			auto receive_time = os_gettime_ns();
+
+			LOCK(streams_mutex);
+			ExpireIdleStreams(receive_time);
 
-			obs_source_output_audio_stream(source, it->second, &frame);
+			auto &stream = FindStream(id);
+			stream.last_packet_ns = receive_time;
+
+			frame.timestamp = stream.smoother.Timestamp(receive_time, frame.frames, frame.samples_per_sec);
+
+			obs_source_output_audio_stream(source, stream.stream, &frame);
 		});
 	}
+
+	vector<float> planar;
+
+	// converts interleaved 16 bit/float input to planar float and 5.1 to
+	// stereo (the output mix is stereo) instead of leaving it to the libobs
+	// resampler; other formats are passed through. The payload size was
+	// checked against frames by the caller
+	void ConvertFrame()
+	{
+		for (size_t i = 1; i < MAX_AV_PLANES; i++)
+			frame.data[i] = nullptr;
+
+		if (frame.format != AUDIO_FORMAT_16BIT && frame.format != AUDIO_FORMAT_FLOAT)
+			return;
+
+		auto channels = get_audio_channels(frame.speakers);
+		auto &kernels = AudioConvert::BestKernels();
+
+		planar.resize(static_cast<size_t>(frame.frames) * channels);
+		float *planes[MAX_AV_PLANES] = {};
+		for (size_t i = 0; i < channels; i++)
+			planes[i] = planar.data() + i * frame.frames;
+
+		if (frame.format == AUDIO_FORMAT_16BIT)
+			kernels.s16_to_planar(reinterpret_cast<const int16_t*>(frame.data[0]), planes, channels, frame.frames);
+		else
+			kernels.f32_to_planar(reinterpret_cast<const float*>(frame.data[0]), planes, channels, frame.frames);
+
+		if (frame.speakers == SPEAKERS_5POINT1) {
+			kernels.downmix_5_1(planes, planes[0], planes[1], frame.frames);
+			frame.speakers = SPEAKERS_STEREO;
+			channels = 2;
+		}
+
+		frame.format = AUDIO_FORMAT_FLOAT_PLANAR;
+		for (size_t i = 0; i < MAX_AV_PLANES; i++)
+			frame.data[i] = i < channels ? reinterpret_cast<uint8_t*>(planes[i]) : nullptr;
+	}
+
+	// requires streams_mutex
+	Stream &FindStream(uint64_t id)
+	{
+		if (last_stream < streams.size() && streams[last_stream].id == id && streams[last_stream].live)
+			return streams[last_stream];
+
+		Stream *expired = nullptr;
+		for (auto &stream : streams) {
+			if (stream.live && stream.id == id)
+				return UseStream(stream);
+
+			if (!stream.live && !expired)
+				expired = &stream;
+		}
+
+		if (expired) {
+			blog(LOG_INFO, "[AudioBufferSource '%s']: reusing stream %llu (%p) for new stream %llu", obs_source_get_name(source), expired->id, expired->stream, id);
+			expired->id = id;
+			expired->live = true;
+			expired->smoother.Reset();
+			live_streams += 1;
+			return UseStream(*expired);
+		}
+
+		auto stream = obs_source_add_audio_stream(source);
+		blog(LOG_INFO, "[AudioBufferSource '%s']: adding new stream %llu (%p)", obs_source_get_name(source), id, stream);
+		streams.push_back(Stream{ id, true, 0, stream });
+		num_streams += 1;
+		live_streams += 1;
+		return UseStream(streams.back());
+	}
+
+	Stream &UseStream(Stream &stream)
+	{
+		last_stream = &stream - streams.data();
+		return stream;
+	}
+
+	// requires streams_mutex
+	void ExpireIdleStreams(uint64_t now)
+	{
+		if (now < next_expiry_check_ns)
+			return;
+
+		next_expiry_check_ns = now + expiry_check_interval_ns;
+
+		for (auto &stream : streams) {
+			if (!stream.live || now - stream.last_packet_ns < stream_idle_timeout_ns)
+				continue;
+
+			blog(LOG_INFO, "[AudioBufferSource '%s']: stream %llu (%p) expired", obs_source_get_name(source), stream.id, stream.stream);
+			stream.live = false;
+			live_streams -= 1;
+			expired_streams += 1;
+		}
+	}
 };
 
 void RegisterAudioBufferSource()
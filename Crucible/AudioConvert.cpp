@@ -0,0 +1,287 @@
+#include "AudioConvert.hpp"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define AUDIO_CONVERT_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef _MSC_VER
+#define TARGET(x)
+#else
+#define TARGET(x) __attribute__((target(x)))
+#endif
+
+namespace AudioConvert {
+	static const float s16_scale = 1.f / 32768.f;
+
+	namespace Scalar {
+		static void S16ToPlanar(const int16_t *in, float *const *out, size_t channels, size_t frames, size_t start = 0)
+		{
+			for (size_t i = start; i < frames; i++)
+				for (size_t c = 0; c < channels; c++)
+					out[c][i] = in[i * channels + c] * s16_scale;
+		}
+
+		static void F32ToPlanar(const float *in, float *const *out, size_t channels, size_t frames, size_t start = 0)
+		{
+			for (size_t i = start; i < frames; i++)
+				for (size_t c = 0; c < channels; c++)
+					out[c][i] = in[i * channels + c];
+		}
+
+		static void Downmix51(const float *const *in, float *left, float *right, size_t frames, size_t start = 0)
+		{
+			for (size_t i = start; i < frames; i++) {
+				float center = in[2][i] * downmix_center;
+				float l = in[0][i] + center + in[4][i] * downmix_surround;
+				float r = in[1][i] + center + in[5][i] * downmix_surround;
+				left[i] = l;
+				right[i] = r;
+			}
+		}
+
+		static void S16ToPlanarKernel(const int16_t *in, float *const *out, size_t channels, size_t frames)
+		{
+			S16ToPlanar(in, out, channels, frames);
+		}
+
+		static void F32ToPlanarKernel(const float *in, float *const *out, size_t channels, size_t frames)
+		{
+			F32ToPlanar(in, out, channels, frames);
+		}
+
+		static void Downmix51Kernel(const float *const *in, float *left, float *right, size_t frames)
+		{
+			Downmix51(in, left, right, frames);
+		}
+	}
+
+	const Kernels &ScalarKernels()
+	{
+		static const Kernels kernels = { "scalar", Scalar::S16ToPlanarKernel, Scalar::F32ToPlanarKernel, Scalar::Downmix51Kernel };
+		return kernels;
+	}
+
+#ifdef AUDIO_CONVERT_X86
+	namespace SSE2 {
+		TARGET("sse2")
+		static void S16ToPlanar(const int16_t *in, float *const *out, size_t channels, size_t frames)
+		{
+			size_t i = 0;
+			auto scale = _mm_set1_ps(s16_scale);
+
+			if (channels == 1) {
+				for (; i + 8 <= frames; i += 8) {
+					auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+					auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+					auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+					_mm_storeu_ps(out[0] + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+					_mm_storeu_ps(out[0] + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+				}
+			} else if (channels == 2) {
+				// one 32 bit lane per frame: left in the low, right in the high half
+				for (; i + 4 <= frames; i += 4) {
+					auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * 2));
+					auto l = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+					auto r = _mm_srai_epi32(v, 16);
+					_mm_storeu_ps(out[0] + i, _mm_mul_ps(_mm_cvtepi32_ps(l), scale));
+					_mm_storeu_ps(out[1] + i, _mm_mul_ps(_mm_cvtepi32_ps(r), scale));
+				}
+			}
+
+			Scalar::S16ToPlanar(in, out, channels, frames, i);
+		}
+
+		TARGET("sse2")
+		static void F32ToPlanar(const float *in, float *const *out, size_t channels, size_t frames)
+		{
+			size_t i = 0;
+
+			if (channels == 2) {
+				for (; i + 4 <= frames; i += 4) {
+					auto a = _mm_loadu_ps(in + i * 2);
+					auto b = _mm_loadu_ps(in + i * 2 + 4);
+					_mm_storeu_ps(out[0] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+					_mm_storeu_ps(out[1] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+				}
+			}
+
+			Scalar::F32ToPlanar(in, out, channels, frames, i);
+		}
+
+		TARGET("sse2")
+		static void Downmix51(const float *const *in, float *left, float *right, size_t frames)
+		{
+			size_t i = 0;
+			auto center_scale = _mm_set1_ps(downmix_center);
+			auto surround_scale = _mm_set1_ps(downmix_surround);
+
+			for (; i + 4 <= frames; i += 4) {
+				auto center = _mm_mul_ps(_mm_loadu_ps(in[2] + i), center_scale);
+				auto l = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(in[0] + i), center), _mm_mul_ps(_mm_loadu_ps(in[4] + i), surround_scale));
+				auto r = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(in[1] + i), center), _mm_mul_ps(_mm_loadu_ps(in[5] + i), surround_scale));
+				_mm_storeu_ps(left + i, l);
+				_mm_storeu_ps(right + i, r);
+			}
+
+			Scalar::Downmix51(in, left, right, frames, i);
+		}
+	}
+
+	namespace AVX2 {
+		TARGET("avx2")
+		static void S16ToPlanar(const int16_t *in, float *const *out, size_t channels, size_t frames)
+		{
+			size_t i = 0;
+			auto scale = _mm256_set1_ps(s16_scale);
+
+			if (channels == 1) {
+				for (; i + 8 <= frames; i += 8) {
+					auto v = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+					_mm256_storeu_ps(out[0] + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+				}
+			} else if (channels == 2) {
+				for (; i + 8 <= frames; i += 8) {
+					auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i * 2));
+					auto l = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+					auto r = _mm256_srai_epi32(v, 16);
+					_mm256_storeu_ps(out[0] + i, _mm256_mul_ps(_mm256_cvtepi32_ps(l), scale));
+					_mm256_storeu_ps(out[1] + i, _mm256_mul_ps(_mm256_cvtepi32_ps(r), scale));
+				}
+			}
+
+			Scalar::S16ToPlanar(in, out, channels, frames, i);
+		}
+
+		TARGET("avx2")
+		static void F32ToPlanar(const float *in, float *const *out, size_t channels, size_t frames)
+		{
+			size_t i = 0;
+
+			if (channels == 2) {
+				for (; i + 8 <= frames; i += 8) {
+					auto a = _mm256_loadu_ps(in + i * 2);
+					auto b = _mm256_loadu_ps(in + i * 2 + 8);
+					// shuffle_ps works per 128 bit lane: [0 1 4 5 | 2 3 6 7], fix the order up
+					auto l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+					auto r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+					_mm256_storeu_ps(out[0] + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l), _MM_SHUFFLE(3, 1, 2, 0))));
+					_mm256_storeu_ps(out[1] + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0))));
+				}
+			}
+
+			Scalar::F32ToPlanar(in, out, channels, frames, i);
+		}
+
+		TARGET("avx2")
+		static void Downmix51(const float *const *in, float *left, float *right, size_t frames)
+		{
+			size_t i = 0;
+			auto center_scale = _mm256_set1_ps(downmix_center);
+			auto surround_scale = _mm256_set1_ps(downmix_surround);
+
+			for (; i + 8 <= frames; i += 8) {
+				auto center = _mm256_mul_ps(_mm256_loadu_ps(in[2] + i), center_scale);
+				auto l = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(in[0] + i), center), _mm256_mul_ps(_mm256_loadu_ps(in[4] + i), surround_scale));
+				auto r = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(in[1] + i), center), _mm256_mul_ps(_mm256_loadu_ps(in[5] + i), surround_scale));
+				_mm256_storeu_ps(left + i, l);
+				_mm256_storeu_ps(right + i, r);
+			}
+
+			Scalar::Downmix51(in, left, right, frames, i);
+		}
+	}
+
+	static void CPUID(int leaf, int subleaf, int regs[4])
+	{
+#ifdef _MSC_VER
+		__cpuidex(regs, leaf, subleaf);
+#else
+		unsigned a = 0, b = 0, c = 0, d = 0;
+		__cpuid_count(leaf, subleaf, a, b, c, d);
+		regs[0] = a;
+		regs[1] = b;
+		regs[2] = c;
+		regs[3] = d;
+#endif
+	}
+
+	static uint64_t XGETBV()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		uint32_t lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		return (uint64_t(hi) << 32) | lo;
+#endif
+	}
+
+	static bool HasSSE2()
+	{
+		int regs[4];
+		CPUID(1, 0, regs);
+		return (regs[3] & (1 << 26)) != 0;
+	}
+
+	static bool HasAVX2()
+	{
+		int regs[4];
+		CPUID(0, 0, regs);
+		if (regs[0] < 7)
+			return false;
+
+		CPUID(1, 0, regs);
+		bool osxsave = (regs[2] & (1 << 27)) != 0;
+		bool avx = (regs[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx || (XGETBV() & 6) != 6) // OS saves xmm and ymm state
+			return false;
+
+		CPUID(7, 0, regs);
+		return (regs[1] & (1 << 5)) != 0;
+	}
+
+	const Kernels *SSE2Kernels()
+	{
+		static const Kernels kernels = { "sse2", SSE2::S16ToPlanar, SSE2::F32ToPlanar, SSE2::Downmix51 };
+		static const bool supported = HasSSE2();
+		return supported ? &kernels : nullptr;
+	}
+
+	const Kernels *AVX2Kernels()
+	{
+		static const Kernels kernels = { "avx2", AVX2::S16ToPlanar, AVX2::F32ToPlanar, AVX2::Downmix51 };
+		static const bool supported = HasAVX2();
+		return supported ? &kernels : nullptr;
+	}
+#else
+	const Kernels *SSE2Kernels()
+	{
+		return nullptr;
+	}
+
+	const Kernels *AVX2Kernels()
+	{
+		return nullptr;
+	}
+#endif
+
+	const Kernels &BestKernels()
+	{
+		static const Kernels &kernels = []() -> const Kernels&
+		{
+			if (auto avx2 = AVX2Kernels())
+				return *avx2;
+			if (auto sse2 = SSE2Kernels())
+				return *sse2;
+			return ScalarKernels();
+		}();
+
+		return kernels;
+	}
+}
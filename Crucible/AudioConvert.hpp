@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Sample format conversion for AudioBufferSource input. Every kernel set
+// produces bit-identical results; the SIMD variants only speed up the mono
+// and stereo cases and fall back to the scalar code for other layouts and
+// for the frames left over at the end.
+namespace AudioConvert {
+	// 5.1 (FL, FR, FC, LFE, RL, RR) to stereo, LFE is dropped
+	const float downmix_center = 0.70710678f;
+	const float downmix_surround = 0.70710678f;
+
+	struct Kernels {
+		const char *name;
+
+		// interleaved signed 16 bit -> planar float
+		void (*s16_to_planar)(const int16_t *in, float *const *out, size_t channels, size_t frames);
+
+		// interleaved float -> planar float
+		void (*f32_to_planar)(const float *in, float *const *out, size_t channels, size_t frames);
+
+		// planar 5.1 -> planar stereo; left/right may alias in[0]/in[1]
+		void (*downmix_5_1)(const float *const *in, float *left, float *right, size_t frames);
+	};
+
+	const Kernels &ScalarKernels();
+
+	// nullptr if not compiled in or not supported by the CPU
+	const Kernels *SSE2Kernels();
+	const Kernels *AVX2Kernels();
+
+	// fastest kernels supported by the CPU, picked on first use
+	const Kernels &BestKernels();
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+
+// Derives audio timestamps from the sample count instead of the packet
+// receive time, so IPC scheduling jitter doesn't end up in the timestamps.
+//
+// The offset between the sample clock (samples since the stream (re)started)
+// and the receive clock is tracked with an asymmetric filter that follows
+// early packets quickly and late packets slowly, i.e. it converges on the
+// least delayed path and still follows clock drift between sender and us.
+// Timestamps are placed `latency_ns` behind that estimate, which acts as a
+// jitter buffer: packets arriving up to `latency_ns` late still get their
+// timestamp. Larger deviations resync the stream:
+//   gap:   packet is more than `resync_ns` late (sender stalled or stopped)
+//   burst: packet is more than `resync_ns` early (sender caught up)
+struct AudioTimestampSmoother {
+	struct Config {
+		uint64_t latency_ns = 20000000;  // 20 ms
+		uint64_t resync_ns = 200000000;  // 200 ms
+		int fast_shift = 3;              // early packets, weight 1/8
+		int slow_shift = 7;              // late packets, weight 1/128
+		int64_t max_correction_ns = 1000000; // per packet, 1 ms
+	};
+
+	struct Stats {
+		uint64_t packets = 0;
+		uint64_t underruns = 0; // arrived later than the jitter buffer allows
+		uint64_t overruns = 0;  // arrived earlier than the jitter buffer allows (burst)
+		uint64_t resyncs = 0;
+		uint64_t max_jitter_ns = 0;
+	};
+
+	Config config;
+	Stats stats;
+
+	AudioTimestampSmoother() = default;
+	explicit AudioTimestampSmoother(const Config &config)
+		: config(config)
+	{}
+
+	// `receive_ns`: time the packet was received, `frames` and
+	// `samples_per_sec` describe the packet; returns the timestamp of the
+	// first frame of the packet
+	uint64_t Timestamp(uint64_t receive_ns, uint32_t frames, uint32_t samples_per_sec)
+	{
+		stats.packets += 1;
+
+		if (!samples_per_sec)
+			return receive_ns;
+
+		if (samples_per_sec != rate || !synced)
+			return Resync(receive_ns, frames, samples_per_sec, false);
+
+		// the packet is complete once its last frame was produced
+		auto end_ns = SamplesToNs(sample_count + frames);
+		auto err = static_cast<int64_t>(receive_ns - base_ns) - static_cast<int64_t>(end_ns) - offset_ns;
+
+		auto jitter = static_cast<uint64_t>(err < 0 ? -err : err);
+		if (jitter > stats.max_jitter_ns)
+			stats.max_jitter_ns = jitter;
+
+		if (err > static_cast<int64_t>(config.resync_ns) || -err > static_cast<int64_t>(config.resync_ns))
+			return Resync(receive_ns, frames, samples_per_sec, true);
+
+		if (err > static_cast<int64_t>(config.latency_ns))
+			stats.underruns += 1;
+		else if (-err > static_cast<int64_t>(config.latency_ns))
+			stats.overruns += 1;
+
+		auto correction = err < 0 ? Scale(err, config.fast_shift) : Scale(err, config.slow_shift);
+		if (correction > config.max_correction_ns)
+			correction = config.max_correction_ns;
+		else if (correction < -config.max_correction_ns)
+			correction = -config.max_correction_ns;
+		offset_ns += correction;
+
+		auto timestamp = base_ns + offset_ns + SamplesToNs(sample_count) + config.latency_ns;
+		sample_count += frames;
+		return timestamp;
+	}
+
+	void Reset()
+	{
+		synced = false;
+	}
+
+protected:
+	bool synced = false;
+	uint32_t rate = 0;
+	uint64_t base_ns = 0;       // receive clock at sample 0
+	int64_t offset_ns = 0;      // smoothed receive delay relative to base_ns
+	uint64_t sample_count = 0;
+
+	uint64_t Resync(uint64_t receive_ns, uint32_t frames, uint32_t samples_per_sec, bool count)
+	{
+		if (count)
+			stats.resyncs += 1;
+
+		rate = samples_per_sec;
+		synced = true;
+		offset_ns = 0;
+		sample_count = frames;
+
+		auto duration = SamplesToNs(frames);
+		base_ns = receive_ns > duration ? receive_ns - duration : 0;
+		return base_ns + config.latency_ns;
+	}
+
+	uint64_t SamplesToNs(uint64_t samples) const
+	{
+		return samples / rate * 1000000000ULL + samples % rate * 1000000000ULL / rate;
+	}
+
+	static int64_t Scale(int64_t val, int shift)
+	{
+		return val < 0 ? -((-val) >> shift) : val >> shift;
+	}
+};
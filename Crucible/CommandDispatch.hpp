@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Compile time checked command -> handler tables shared by Crucible and
+// AnvilRendering. Command names are hashed with FNV-1a; the bucket layout
+// ((hash >> shift) & mask) is searched for at compile time so every command
+// lands in its own bucket, a lookup is one hash, one bucket read and one
+// memcmp without allocating.
+//
+// Usage:
+//
+//   static constexpr CommandDispatch::Entry<Handler_t> commands[] = {
+//   	CommandDispatch::Command("name", Handler),
+//   	...
+//   };
+//   static_assert(CommandDispatch::HandlersValid(commands), "...");
+//   static_assert(CommandDispatch::HashesUnique(commands), "...");
+//   static_assert(CommandDispatch::HasPerfectLayout(commands), "...");
+//
+//   static const auto table = CommandDispatch::MakeTable(commands);
+namespace CommandDispatch {
+	const uint32_t fnv_offset = 2166136261u;
+	const uint32_t fnv_prime = 16777619u;
+
+	const unsigned no_shift = ~0u;
+	const unsigned max_bucket_bits = 16;
+
+	constexpr uint32_t HashFrom(const char *str, uint32_t hash)
+	{
+		return *str ? HashFrom(str + 1, (hash ^ static_cast<uint8_t>(*str)) * fnv_prime) : hash;
+	}
+
+	constexpr uint32_t Hash(const char *str)
+	{
+		return HashFrom(str, fnv_offset);
+	}
+
+	inline uint32_t Hash(const char *str, size_t size)
+	{
+		uint32_t hash = fnv_offset;
+		for (size_t i = 0; i < size; i++)
+			hash = (hash ^ static_cast<uint8_t>(str[i])) * fnv_prime;
+		return hash;
+	}
+
+	constexpr size_t Length(const char *str, size_t size = 0)
+	{
+		return *str ? Length(str + 1, size + 1) : size;
+	}
+
+	template <typename Handler>
+	struct Entry {
+		const char *name;
+		size_t size;
+		uint32_t hash;
+		Handler handler;
+		uint32_t flags;
+		const char *key; // optional per command argument, e.g. a field name
+	};
+
+	template <typename Handler>
+	constexpr Entry<Handler> Command(const char *name, Handler handler, uint32_t flags = 0, const char *key = nullptr)
+	{
+		return { name, Length(name), Hash(name), handler, flags, key };
+	}
+
+	template <typename T, size_t N>
+	constexpr bool HandlersValid(const T (&entries)[N], size_t i = 0)
+	{
+		return i >= N || (entries[i].handler != nullptr && entries[i].size && HandlersValid(entries, i + 1));
+	}
+
+	template <typename T, size_t N>
+	constexpr bool HashUnique(const T (&entries)[N], size_t i, size_t j)
+	{
+		return j >= N || (entries[i].hash != entries[j].hash && HashUnique(entries, i, j + 1));
+	}
+
+	// also catches duplicate command names
+	template <typename T, size_t N>
+	constexpr bool HashesUnique(const T (&entries)[N], size_t i = 0)
+	{
+		return i >= N || (HashUnique(entries, i, i + 1) && HashesUnique(entries, i + 1));
+	}
+
+	constexpr uint32_t Bucket(uint32_t hash, unsigned bits, unsigned shift)
+	{
+		return (hash >> shift) & ((1u << bits) - 1);
+	}
+
+	// smallest power of two >= n^2, which makes a collision free shift likely
+	constexpr unsigned BucketBits(size_t n, unsigned bits = 1)
+	{
+		return bits >= max_bucket_bits || (size_t(1) << bits) >= n * n ? bits : BucketBits(n, bits + 1);
+	}
+
+	template <typename T, size_t N>
+	constexpr bool Collides(const T (&entries)[N], unsigned bits, unsigned shift, size_t i, size_t j)
+	{
+		return j < N && (Bucket(entries[i].hash, bits, shift) == Bucket(entries[j].hash, bits, shift) || Collides(entries, bits, shift, i, j + 1));
+	}
+
+	template <typename T, size_t N>
+	constexpr bool Perfect(const T (&entries)[N], unsigned bits, unsigned shift, size_t i = 0)
+	{
+		return i >= N || (!Collides(entries, bits, shift, i, i + 1) && Perfect(entries, bits, shift, i + 1));
+	}
+
+	template <typename T, size_t N>
+	constexpr unsigned FindShift(const T (&entries)[N], unsigned bits, unsigned shift = 0)
+	{
+		return shift + bits > 32 ? no_shift : Perfect(entries, bits, shift) ? shift : FindShift(entries, bits, shift + 1);
+	}
+
+	template <typename T, size_t N>
+	constexpr bool HasPerfectLayout(const T (&entries)[N])
+	{
+		return N < 255 && FindShift(entries, BucketBits(N)) != no_shift;
+	}
+
+	template <typename Handler, size_t N>
+	struct Table {
+		using Entry_t = Entry<Handler>;
+
+		const Entry_t (&entries)[N];
+		unsigned bits;
+		unsigned shift;
+		std::vector<uint8_t> buckets; // entry index + 1, 0 = empty
+
+		explicit Table(const Entry_t (&entries)[N])
+			: entries(entries), bits(BucketBits(N)), shift(FindShift(entries, bits)), buckets(size_t(1) << bits)
+		{
+			for (size_t i = 0; i < N; i++)
+				buckets[Bucket(entries[i].hash, bits, shift)] = static_cast<uint8_t>(i + 1);
+		}
+
+		const Entry_t *Find(const char *name, size_t size) const
+		{
+			auto hash = Hash(name, size);
+			auto index = buckets[Bucket(hash, bits, shift)];
+			if (!index)
+				return nullptr;
+
+			auto &entry = entries[index - 1];
+			if (entry.hash != hash || entry.size != size || memcmp(entry.name, name, size) != 0)
+				return nullptr;
+
+			return &entry;
+		}
+
+		const Entry_t *Find(const char *name) const
+		{
+			return Find(name, strlen(name));
+		}
+
+		const Entry_t *begin() const { return entries; }
+		const Entry_t *end() const { return entries + N; }
+		size_t size() const { return N; }
+
+		size_t IndexOf(const Entry_t &entry) const
+		{
+			return &entry - entries;
+		}
+	};
+
+	template <typename Handler, size_t N>
+	Table<Handler, N> MakeTable(const Entry<Handler> (&entries)[N])
+	{
+		return Table<Handler, N>{ entries };
+	}
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <obs.hpp>
+
+#include "OBSHelpers.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+// Compact binary alternative to the JSON command messages on the
+// ForgeCrucible channel. Forge opts in by sending "binary_commands": <version>
+// with the connect command; if that is binary_version Crucible answers with a
+// "command_protocol" event that maps command names to the ids used below,
+// otherwise the event has version 0 and binary frames stay rejected. JSON
+// messages keep working either way, binary frames are recognized by their
+// first byte.
+//
+// All integers are little endian:
+//
+//   frame:  u8 magic (0xC7), u8 version, u16 command id, fields
+//   fields: u16 count, count * field
+//   field:  u8 type, u8 name length, name (including the terminating NUL), value
+//
+//   value by type:
+//     null:   -
+//     bool:   u8
+//     int:    i64
+//     double: f64
+//     string: u32 length, bytes (including the terminating NUL)
+//     object: fields
+//     array:  u32 count, count * fields
+namespace CommandProtocol {
+	const uint8_t binary_magic = 0xC7;
+	const uint8_t binary_version = 1;
+
+	const int max_depth = 16;
+
+	enum FieldType : uint8_t {
+		FIELD_NULL,
+		FIELD_BOOL,
+		FIELD_INT,
+		FIELD_DOUBLE,
+		FIELD_STRING,
+		FIELD_OBJECT,
+		FIELD_ARRAY,
+	};
+
+	inline bool IsBinary(const uint8_t *data, size_t size)
+	{
+		return data && size >= 4 && data[0] == binary_magic;
+	}
+
+	struct Reader {
+		const uint8_t *ptr;
+		const uint8_t *end;
+
+		template <typename T>
+		bool Read(T &val)
+		{
+			if (static_cast<size_t>(end - ptr) < sizeof(T))
+				return false;
+
+			memcpy(&val, ptr, sizeof(T));
+			ptr += sizeof(T);
+			return true;
+		}
+
+		// reads `size` bytes that have to end in a NUL terminator
+		bool ReadString(size_t size, const char *&str)
+		{
+			if (!size || static_cast<size_t>(end - ptr) < size || ptr[size - 1] != 0)
+				return false;
+
+			str = reinterpret_cast<const char*>(ptr);
+			ptr += size;
+			return true;
+		}
+	};
+
+	inline bool DecodeFields(Reader &reader, obs_data_t *obj, int depth);
+
+	inline bool DecodeField(Reader &reader, obs_data_t *obj, int depth)
+	{
+		uint8_t type;
+		uint8_t name_size;
+		const char *name;
+		if (!reader.Read(type) || !reader.Read(name_size) || !reader.ReadString(name_size, name))
+			return false;
+
+		switch (type) {
+		case FIELD_NULL:
+			return true;
+
+		case FIELD_BOOL: {
+			uint8_t val;
+			if (!reader.Read(val))
+				return false;
+			obs_data_set_bool(obj, name, !!val);
+			return true;
+		}
+
+		case FIELD_INT: {
+			int64_t val;
+			if (!reader.Read(val))
+				return false;
+			obs_data_set_int(obj, name, val);
+			return true;
+		}
+
+		case FIELD_DOUBLE: {
+			double val;
+			if (!reader.Read(val))
+				return false;
+			obs_data_set_double(obj, name, val);
+			return true;
+		}
+
+		case FIELD_STRING: {
+			uint32_t size;
+			const char *val;
+			if (!reader.Read(size) || !reader.ReadString(size, val))
+				return false;
+			obs_data_set_string(obj, name, val);
+			return true;
+		}
+
+		case FIELD_OBJECT: {
+			auto child = OBSDataCreate();
+			if (!DecodeFields(reader, child, depth + 1))
+				return false;
+			obs_data_set_obj(obj, name, child);
+			return true;
+		}
+
+		case FIELD_ARRAY: {
+			uint32_t count;
+			if (!reader.Read(count))
+				return false;
+
+			auto arr = OBSDataArrayCreate();
+			for (uint32_t i = 0; i < count; i++) {
+				auto item = OBSDataCreate();
+				if (!DecodeFields(reader, item, depth + 1))
+					return false;
+				obs_data_array_push_back(arr, item);
+			}
+			obs_data_set_array(obj, name, arr);
+			return true;
+		}
+		}
+
+		return false;
+	}
+
+	inline bool DecodeFields(Reader &reader, obs_data_t *obj, int depth)
+	{
+		if (depth > max_depth)
+			return false;
+
+		uint16_t count;
+		if (!reader.Read(count))
+			return false;
+
+		for (uint16_t i = 0; i < count; i++)
+			if (!DecodeField(reader, obj, depth))
+				return false;
+
+		return true;
+	}
+
+	// fills `obj` with the fields of a binary command frame; fails on a
+	// version mismatch or malformed/truncated data
+	inline bool DecodeCommand(const uint8_t *data, size_t size, uint16_t &id, OBSData &obj)
+	{
+		if (!IsBinary(data, size))
+			return false;
+
+		Reader reader{ data + 1, data + size };
+
+		uint8_t version;
+		if (!reader.Read(version) || version != binary_version || !reader.Read(id))
+			return false;
+
+		obj = OBSDataCreate();
+		return DecodeFields(reader, obj, 0) && reader.ptr == reader.end;
+	}
+}
@@ -16,6 +16,8 @@
 
 #include <algorithm>
 #include <atomic>
+#include <deque>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
@@ -38,7 +40,11 @@ using namespace std;
 
 #include "RemoteDisplay.h"
 
+#include "CommandDispatch.hpp"
+#include "CommandProtocol.hpp"
+#include "EventBacklog.hpp"
 #include "IPC.hpp"
+#include "OperationQueue.hpp"
 #include "ProtectedObject.hpp"
 #include "scopeguard.hpp"
 #include "ThreadTools.hpp"
@@ -96,7 +102,7 @@ static const vector<pair<string, string>> allowed_hardware_encoder_names = {
 #define LOCK(x) lock_guard<decltype(x)> CONCAT(lockGuard, __LINE__){x};
 
 template <typename Fun>
-static void QueueOperation(Fun &&f);
+static void QueueOperation(Fun &&f, OperationPriority priority=OPERATION_PRIORITY_NORMAL);
 
 struct OutputResolution {
 	uint32_t width;
@@ -296,38 +302,282 @@ struct Bookmark {
 };
 
 namespace ForgeEvents {
-	mutex eventMutex;
-	vector<OBSData> queuedEvents;
+	// events are serialized and written by a dedicated sender thread;
+	// undelivered events are kept (serialized) until Forge reconnects
+	const size_t max_batch_size = 64 * 1024;
+	const auto audio_level_interval = chrono::milliseconds(50);
+
+	mutex eventMutex; // guards event_client writes and backlog
+	EventBacklog backlog;
+	atomic<bool> batchEvents = false;
+
+	struct AudioLevel {
+		string source;
+		float level;
+		float magnitude;
+		float peak;
+		bool muted;
+		bool updated;
+	};
+
+	ProtectedObject<vector<AudioLevel>> audioLevels;
+	atomic<bool> audioLevelsPending = false;
+
+	struct PendingEvent {
+		string json;
+		EventDropPolicy policy;
+	};
+
+	shared_ptr<void> senderEvent{ CreateEvent(nullptr, false, false, nullptr), HandleDeleter{} };
+	OperationQueue senderQueue{[] { SetEvent(senderEvent.get()); }, 256};
+	vector<PendingEvent> pendingEvents; // sender thread, drainMutex once stopped
+	JoiningThread senderThread;
+	once_flag senderStarted;
+	atomic<bool> senderStopped = false;
+	mutex drainMutex; // consumer of senderQueue after StopSender
+
+	static const pair<const char*, EventDropPolicy> event_drop_policies[] = {
+		{ "started_recording", EVENT_NEVER_DROP },
+		{ "stopped_recording", EVENT_NEVER_DROP },
+		{ "buffer_ready", EVENT_NEVER_DROP },
+		{ "buffer_save_failed", EVENT_NEVER_DROP },
+		{ "bookmark_finalized", EVENT_NEVER_DROP },
+		{ "saved_game_screenshot", EVENT_NEVER_DROP },
+		{ "screenshot_saved", EVENT_NEVER_DROP },
+		{ "started_streaming", EVENT_NEVER_DROP },
+		{ "stopped_streaming", EVENT_NEVER_DROP },
+		{ "game_session_started", EVENT_NEVER_DROP },
+		{ "game_session_ended", EVENT_NEVER_DROP },
+		{ "audio_source_level", EVENT_DROP_STALE },
+		{ "push_to_talk_status", EVENT_DROP_STALE },
+		{ "operation_queue_stats", EVENT_DROP_STALE },
+		{ "display_stats", EVENT_DROP_STALE },
+	};
+
+	static EventDropPolicy DropPolicy(const char *event)
+	{
+		if (event)
+			for (auto &policy : event_drop_policies)
+				if (strcmp(policy.first, event) == 0)
+					return policy.second;
+
+		return EVENT_DROP_OLDEST;
+	}
+
+	static void AppendPendingEvent(obs_data_t *event)
+	{
+		if (auto json = obs_data_get_json(event))
+			pendingEvents.push_back(PendingEvent{ json, DropPolicy(obs_data_get_string(event, "event")) });
+	}
+
+	static bool WriteBacklogLocked()
+	{
+		if (backlog.Empty())
+			return true;
+
+		auto spilled = backlog.spilled;
+		auto dropped = backlog.dropped;
+		auto size = backlog.Size();
+
+		if (!backlog.Replay([](const char *data, size_t size) { return event_client.Write(data, size); }))
+			return false;
+
+		blog(LOG_INFO, "Replayed %llu queued events (%llu spilled to disk, %llu dropped)", static_cast<unsigned long long>(size),
+			static_cast<unsigned long long>(spilled), static_cast<unsigned long long>(dropped));
+		backlog.spilled = 0;
+		backlog.dropped = 0;
+		return true;
+	}
+
+	// writes all pending events, as "batch" events if Forge asked for them
+	static void FlushPendingEvents()
+	{
+		if (pendingEvents.empty())
+			return;
+
+		DEFER{ pendingEvents.clear(); };
+
+		LOCK(eventMutex);
+		auto i = begin(pendingEvents);
+		auto end_ = end(pendingEvents);
+
+		if (WriteBacklogLocked()) {
+			while (i != end_) {
+				auto batch_end = next(i);
+
+				string batch;
+				if (batchEvents && batch_end != end_) {
+					batch = "{\"event\":\"batch\",\"timestamp\":" + to_string(GetTickCount64()) + ",\"events\":[" + i->json;
+					for (; batch_end != end_ && batch.size() + batch_end->json.size() < max_batch_size; batch_end++)
+						batch += "," + batch_end->json;
+					batch += "]}";
+				}
+
+				if (!event_client.Write(batch.empty() ? i->json : batch))
+					break;
+
+				i = batch_end;
+			}
+		}
+
+		if (i == end_)
+			return;
+
+		if (backlog.Empty())
+			blog(LOG_INFO, "event_client.Write failed, queueing events");
+
+		for (; i != end_; i++)
+			backlog.Push(move(i->json), i->policy);
+	}
+
+	// appends the latest level of every source that changed since the last call
+	static void AppendAudioLevels()
+	{
+		audioLevelsPending = false;
+
+		auto levels = audioLevels.Lock();
+		for (auto &level : *levels) {
+			if (!level.updated)
+				continue;
+
+			level.updated = false;
+
+			auto event = OBSDataCreate();
+			obs_data_set_string(event, "event", "audio_source_level");
+			obs_data_set_int(event, "timestamp", GetTickCount64());
+			obs_data_set_string(event, "source", level.source.c_str());
+			obs_data_set_double(event, "level", level.level);
+			obs_data_set_double(event, "magnitude", level.magnitude);
+			obs_data_set_double(event, "peak", level.peak);
+			obs_data_set_bool(event, "muted", level.muted);
+
+			if (auto json = obs_data_get_json(event))
+				pendingEvents.push_back(PendingEvent{ json, EVENT_DROP_STALE });
+		}
+	}
+
+	static void RunSender(HANDLE stop_event)
+	{
+		using clock = chrono::steady_clock;
+
+		HANDLE handles[] = { stop_event, senderEvent.get() };
+		auto next_audio_levels = clock::now();
+		DWORD timeout = INFINITE;
+
+		for (;;) {
+			auto res = WaitForMultipleObjects(2, handles, false, timeout);
+
+			while (senderQueue.Run()) {}
+
+			timeout = INFINITE;
+			if (audioLevelsPending) {
+				auto now = clock::now();
+				if (now >= next_audio_levels) {
+					AppendAudioLevels();
+					next_audio_levels = now + audio_level_interval;
+				} else {
+					timeout = max<DWORD>(1, static_cast<DWORD>(chrono::duration_cast<chrono::milliseconds>(next_audio_levels - now).count()));
+				}
+			}
+
+			FlushPendingEvents();
+
+			if (res == WAIT_OBJECT_0)
+				return;
+		}
+	}
+
+	static void StartSender()
+	{
+		call_once(senderStarted, []
+		{
+			shared_ptr<void> stop_event{ CreateEvent(nullptr, true, false, nullptr), HandleDeleter{} };
+			senderThread.make_joinable = [=] { SetEvent(stop_event.get()); };
+			senderThread.Run([=]
+			{
+				RunSender(stop_event.get());
+			});
+		});
+	}
+
+	// requires drainMutex and a stopped sender thread
+	static void DrainSenderLocked()
+	{
+		while (senderQueue.Run()) {}
+		FlushPendingEvents();
+	}
+
+	template <typename Fun>
+	static void PushToSender(Fun &&f)
+	{
+		StartSender();
+		senderQueue.Push(forward<Fun>(f));
+
+		// nothing drains the queue after StopSender, do it here; pairs with
+		// the fence in StopSender, so either this sees the flag or
+		// StopSender's drain sees the push
+		atomic_thread_fence(memory_order_seq_cst);
+		if (senderStopped.load(memory_order_relaxed)) {
+			LOCK(drainMutex);
+			DrainSenderLocked();
+		}
+	}
+
+	// flushes pending events and stops the sender thread; events sent later
+	// are written (or backlogged) synchronously by the sending thread
+	void StopSender()
+	{
+		call_once(senderStarted, [] {}); // the thread can't start anymore
+
+		senderStopped.store(true, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+
+		LOCK(drainMutex);
+		senderThread.Join();
+		DrainSenderLocked();
+	}
 
 	void SendEvent(obs_data_t *event)
 	{
 		if (!event)
 			return;
 
-		auto data = obs_data_get_json(event);
-		if (!data)
-			return;
+		OBSData data = event;
+		PushToSender([data]
+		{
+			AppendPendingEvent(data);
+		});
+	}
 
+	bool Connect(const char *name, bool batch_events)
+	{
 		LOCK(eventMutex);
-		if (event_client.Write(data, strlen(data) + 1))
-			return;
+		if (!event_client.Open(name))
+			return false;
 
-		queuedEvents.push_back(event);
-		blog(LOG_INFO, "event_client.Write failed, queueing event");
+		batchEvents = batch_events;
+		return true;
 	}
 
-	void SendQueuedEvents()
+	// 0 keeps the current limit
+	void SetBacklogLimits(size_t memory_events, uint64_t file_size)
 	{
 		LOCK(eventMutex);
-		auto i = begin(queuedEvents);
-		auto end_ = end(queuedEvents);
-		for (; i != end_; i++) {
-			auto data = obs_data_get_json(*i);
-			if (!event_client.Write(data, strlen(data) + 1))
-				break;
-		}
+		if (memory_events)
+			backlog.max_memory_events = memory_events;
+		if (file_size)
+			backlog.max_file_size = file_size;
 
-		queuedEvents.erase(begin(queuedEvents), i);
+		backlog.Trim();
+	}
+
+	void SendQueuedEvents()
+	{
+		PushToSender([]
+		{
+			LOCK(eventMutex);
+			WriteBacklogLocked();
+		});
 	}
 
 	static void SendFileCompleteEvent(obs_data_t *event, const char *filename, int total_frames, double duration, const vector<double> &bookmarks,
@@ -644,6 +894,44 @@ namespace ForgeEvents {
 		SendEvent(event);
 	}
 
+	void SendCommandProtocol(int version, obs_data_t *commands)
+	{
+		auto event = EventCreate("command_protocol");
+
+		obs_data_set_int(event, "version", version);
+		obs_data_set_obj(event, "commands", commands);
+
+		SendEvent(event);
+	}
+
+	void SendOperationQueueStats(obs_data_array_t *lanes, uint64_t coalesced)
+	{
+		auto event = EventCreate("operation_queue_stats");
+
+		obs_data_set_array(event, "lanes", lanes);
+		obs_data_set_int(event, "coalesced", coalesced);
+
+		SendEvent(event);
+	}
+
+	void SendDisplayStats(const string &name, const Display::Stats &stats)
+	{
+		auto event = EventCreate("display_stats");
+
+		obs_data_set_string(event, "name", name.c_str());
+		obs_data_set_double(event, "fps", stats.fps);
+		obs_data_set_double(event, "target_fps", stats.target_fps);
+		obs_data_set_double(event, "latency_ms", stats.latency_ms);
+		obs_data_set_double(event, "max_latency_ms", stats.max_latency_ms);
+		obs_data_set_int(event, "frames_sent", stats.frames_sent);
+		obs_data_set_int(event, "frames_failed", stats.frames_failed);
+		obs_data_set_int(event, "frames_paced", stats.frames_paced);
+		obs_data_set_int(event, "frames_replaced", stats.frames_replaced);
+		obs_data_set_int(event, "frames_dropped", stats.frames_dropped);
+
+		SendEvent(event);
+	}
+
 	void SendCanvasSize(uint32_t width, uint32_t height)
 	{
 		auto event = EventCreate("canvas_size");
@@ -663,17 +951,29 @@ namespace ForgeEvents {
 		SendEvent(event);
 	}
 
+	// coalesced to the latest value per source, see AppendAudioLevels
 	void SendAudioSourceLevel(const char *source, float level, float magnitude, float peak, bool muted)
 	{
-		auto event = EventCreate("audio_source_level");
-
-		obs_data_set_string(event, "source", source);
-		obs_data_set_double(event, "level", level);
-		obs_data_set_double(event, "magnitude", magnitude);
-		obs_data_set_double(event, "peak", peak);
-		obs_data_set_bool(event, "muted", muted);
+		{
+			auto levels = audioLevels.Lock();
+			auto it = find_if(begin(*levels), end(*levels), [&](const AudioLevel &entry)
+			{
+				return entry.source == source;
+			});
+			if (it == end(*levels))
+				it = levels->insert(end(*levels), AudioLevel{ source });
+
+			it->level = level;
+			it->magnitude = magnitude;
+			it->peak = peak;
+			it->muted = muted;
+			it->updated = true;
+		}
 
-		SendEvent(event);
+		if (!audioLevelsPending.exchange(true)) {
+			StartSender();
+			SetEvent(senderEvent.get());
+		}
 	}
 
 	void SendGameSessionStarted()
@@ -1806,6 +2106,16 @@ struct CrucibleContext {
 
 	vector<pair<string, long long>> requested_screenshots;
 
+	// pending save_screenshot requests for cancel_screenshot, keyed by a token
+	// since the Screenshot::Request id is 0 while the request is being
+	// submitted (it may complete before Request returns)
+	struct PendingScreenshot {
+		string filename;
+		uint64_t id;
+	};
+	ProtectedObject<map<uint64_t, PendingScreenshot>> screenshot_requests;
+	uint64_t next_screenshot_token = 0;
+
 	decltype(ProfileSnapshotCreate()) game_session_snapshot;
 
 	bool ResetVideo()
@@ -4383,7 +4693,7 @@ struct CrucibleContext {
 		calldata_free(&data);
 	}
 
-	void SaveScreenshot(const string &source_name, int width, int height, const char *filename)
+	void SaveScreenshot(const string &source_name, int width, int height, const char *filename, const Screenshot::Options &options, chrono::milliseconds timeout)
 	{
 		OBSSource source;
 		if (source_name == "output") {
@@ -4397,7 +4707,40 @@ struct CrucibleContext {
 			return;
 		}
 
-		Screenshot::Request(source, width, height, filename, ForgeEvents::SendScreenshotSaved);
+		auto token = next_screenshot_token++;
+		screenshot_requests.Lock()->emplace(token, PendingScreenshot{ filename, 0 });
+
+		auto id = Screenshot::Request(source, width, height, filename, [this, token](boost::optional<string> error, uint32_t cx, uint32_t cy, const string filename_)
+		{
+			screenshot_requests.Lock()->erase(token);
+			ForgeEvents::SendScreenshotSaved(error, cx, cy, filename_);
+		}, options, timeout);
+
+		// the request may have completed already
+		auto requests = screenshot_requests.Lock();
+		auto it = requests->find(token);
+		if (it != end(*requests))
+			it->second.id = id;
+	}
+
+	// cancels every pending request for filename
+	void CancelScreenshot(const string &filename)
+	{
+		vector<uint64_t> ids;
+		{
+			auto requests = screenshot_requests.Lock();
+			for (auto &request : *requests)
+				if (request.second.filename == filename && request.second.id)
+					ids.push_back(request.second.id);
+		}
+
+		if (ids.empty()) {
+			blog(LOG_INFO, "cancel_screenshot: no pending screenshot for '%s'", filename.c_str());
+			return;
+		}
+
+		for (auto id : ids)
+			Screenshot::Cancel(id);
 	}
 
 	bool RecordingActive()
@@ -4555,6 +4898,9 @@ struct CrucibleContext {
 	}
 };
 
+static void SendCommandProtocolInfo();
+static void RejectCommandProtocol(long long requested);
+
 static void HandleConnectCommand(CrucibleContext &cc, OBSData &obj)
 {
 	const char *str = nullptr;
@@ -4579,14 +4925,24 @@ static void HandleConnectCommand(CrucibleContext &cc, OBSData &obj)
 		}
 	}
 
+	ForgeEvents::SetBacklogLimits(static_cast<size_t>(obs_data_get_int(obj, "event_backlog_events")),
+		static_cast<uint64_t>(obs_data_get_int(obj, "event_backlog_size")));
+
 	if ((str = obs_data_get_string(obj, "event"))) {
-		if (event_client.Open(str)) {
+		if (ForgeEvents::Connect(str, obs_data_get_bool(obj, "event_batching"))) {
 			blog(LOG_INFO, "Connected event to '%s'", str);
 
 			ForgeEvents::SendQueuedEvents();
 		}
 	}
 
+	if (auto version = obs_data_get_int(obj, "binary_commands")) {
+		if (version == CommandProtocol::binary_version)
+			SendCommandProtocolInfo();
+		else
+			RejectCommandProtocol(version);
+	}
+
 	if ((str = obs_data_get_string(obj, "anvil_event"))) {
 		AnvilCommands::SendForgeInfo(str);
 	}
@@ -4907,7 +5263,23 @@ static void HandleConnectDisplay(CrucibleContext&, OBSData &obj)
 	auto cx = obs_data_get_int(obj, "width");
 	auto cy = obs_data_get_int(obj, "height");
 
-	Display::Connect(name, channel);
+	// before connecting, so the first frames already use these settings
+	Display::SetPacing(name, static_cast<uint32_t>(obs_data_get_int(obj, "max_fps")), static_cast<uint32_t>(obs_data_get_int(obj, "stats_interval")));
+
+	auto shared_memory = obs_data_get_bool(obj, "shared_memory");
+
+	auto quality = obs_data_get_int(obj, "quality");
+	auto compression = obs_data_get_string(obj, "compression");
+	// shared memory slots always carry raw frames
+	if (shared_memory && compression && *compression && strcmp(compression, "none") != 0) {
+		blog(LOG_WARNING, "connect_display: compression '%s' does not apply to shared memory delivery, sending uncompressed frames", compression);
+		compression = "none";
+	}
+
+	if (!Display::SetCompression(name, compression, quality > 0 ? static_cast<int>(quality) : 80))
+		blog(LOG_WARNING, "connect_display: unknown compression '%s', sending uncompressed frames", compression);
+
+	Display::Connect(name, channel, obs_data_get_bool(obj, "binary_framing"), shared_memory);
 	if (cx && cy)
 		Display::Resize(name, cx, cy);
 
@@ -4950,7 +5322,26 @@ static void HandleEnableSourceLevelMeters(CrucibleContext &cc, OBSData &data)
 
 static void HandleSaveScreenshot(CrucibleContext &cc, OBSData &data)
 {
-	cc.SaveScreenshot(obs_data_get_string(data, "source"), obs_data_get_int(data, "width"), obs_data_get_int(data, "height"), obs_data_get_string(data, "filename"));
+	Screenshot::Options options;
+	options.encoder.format = ImageEncoder::ParseFormat(obs_data_get_string(data, "format"));
+	if (obs_data_has_user_value(data, "quality"))
+		options.encoder.jpeg_quality = static_cast<int>(obs_data_get_int(data, "quality"));
+	if (obs_data_has_user_value(data, "compression_level"))
+		options.encoder.png_compression = static_cast<int>(obs_data_get_int(data, "compression_level"));
+
+	options.thumbnail = obs_data_get_bool(data, "thumbnail");
+	if (obs_data_has_user_value(data, "thumbnail_size"))
+		options.thumbnail_size = static_cast<uint32_t>(max<long long>(1, obs_data_get_int(data, "thumbnail_size")));
+	options.thumbnail_filename = obs_data_get_string(data, "thumbnail_filename");
+
+	auto timeout = chrono::milliseconds(obs_data_has_user_value(data, "timeout") ? obs_data_get_int(data, "timeout") : 30000);
+
+	cc.SaveScreenshot(obs_data_get_string(data, "source"), obs_data_get_int(data, "width"), obs_data_get_int(data, "height"), obs_data_get_string(data, "filename"), options, timeout);
+}
+
+static void HandleCancelScreenshot(CrucibleContext &cc, OBSData &data)
+{
+	cc.CancelScreenshot(obs_data_get_string(data, "filename"));
 }
 
 static void HandleUpdateRecordingBufferSettings(CrucibleContext &cc, OBSData &data)
@@ -5096,114 +5487,326 @@ namespace {
 static SkippedMessageLog::LogType skipped_message_log;
 static JoiningThread skipped_message_log_announcer;
 
-static void HandleCommand(CrucibleContext &cc, const uint8_t *data, size_t size)
+static HANDLE operation_queue_event = CreateEvent(nullptr, false, false, nullptr);
+static OperationQueue operation_queue{[] { SetEvent(operation_queue_event); }};
+
+template <typename Fun>
+static void QueueOperation(Fun &&f, OperationPriority priority)
 {
-	static const map<string, pair<bool, void(*)(CrucibleContext&, OBSData&)>> known_commands = {
-		{ "connect", {false, HandleConnectCommand} },
-		{ "capture_new_process", {false, HandleCaptureCommand} },
-		{ "query_mics", {false, HandleQueryMicsCommand} },
-		{ "update_settings", {false, HandleUpdateSettingsCommand} },
-		{ "save_recording_buffer", {false, HandleSaveRecordingBuffer} },
-		{ "create_bookmark", {false, HandleCreateBookmark} },
-		{ "stop_recording", {false, HandleStopRecording} },
-		{ "injector_result", {false, HandleInjectorResult} },
-		{ "monitored_process_exit", {false, HandleMonitoredProcessExit} },
-		{ "update_video_settings", {false, HandleUpdateVideoSettingsCommand} },
-		{ "set_cursor", {false, HandleSetCursor} },
-		{ "dismiss_overlay", {false, [](CrucibleContext&, OBSData &data) { AnvilCommands::DismissOverlay(data); }} },
-		{ "clip_accepted", {false, [](CrucibleContext&, OBSData&) { AnvilCommands::ShowClipping(); }} },
-		{ "clip_finished", {false, HandleClipFinished} },
-		{ "forge_will_close", {false, HandleForgeWillClose} },
-		{ "create_webrtc_output", {false, HandleCreateWebRTCOutput} },
-		{ "remote_webrtc_offer", {false, HandleRemoteWebRTCOffer} },
-		{ "get_webrtc_stats", {true, HandleGetWebRTCStats} },
-		{ "stop_webrtc_output", {false, HandleStopWebRTCOutput} },
-		{ "add_remote_ice_candidate", {false, HandleAddRemoteICECandidate} },
-		{ "start_recording_stream", {false, HandleStartRecordingStream} },
-		{ "stop_recording_stream", {false, HandleStopRecordingStream} },
-		{ "start_streaming", {false, HandleStartStreaming} },
-		{ "stop_streaming", {false, HandleStopStreaming} },
-		{ "save_game_screenshot", {false, HandleGameScreenshot} },
-		{ "query_webcams", {false, HandleQueryWebcams} },
-		{ "query_desktop_audio_devices", {false, HandleQueryDesktopAudioDevices} },
-		{ "query_windows", {false, HandleQueryWindows} },
-		{ "capture_window", {false, HandleCaptureWindow} },
-		{ "select_scene", {false, HandleSelectScene} },
-		{ "connect_display", {false, HandleConnectDisplay} },
-		{ "resize_display", {false, HandleResizeDisplay} },
-		{ "query_canvas_size", {false, HandleQueryCanvasSize} },
-		{ "query_scene_info", {false, HandleQuerySceneInfo} },
-		{ "update_scenes", {false, HandleUpdateScenes} },
-		{ "set_source_volume", {false, HandleSetSourceVolume} },
-		{ "enable_source_level_meters", {false, HandleEnableSourceLevelMeters} },
-		{ "save_screenshot", {false, HandleSaveScreenshot} },
-		{ "update_recording_buffer_settings", {false, HandleUpdateRecordingBufferSettings} },
-		{ "query_hardware_encoders", {false, HandleQueryHardwareEncoders} },
-		{ "update_disallowed_hardware_encoders", {false, HandleUpdateDisallowedHardwareEncoders} },
-		{ "screenshot_uploading", {false, ShowScreenshotUploading} },
-		{ "show_first_time_tutorial", {false, ShowFirstTimeTutorial} },
-		{ "screenshot_saved", {false, ShowScreenshotSaved} },
-		{ "start_forward_buffer", {false, StartForwardBuffer} },
-		{ "stop_forward_buffer", {false, StopForwardBuffer} },
-		{ "dismiss_quick_select", {false, HandleDismissQuickSelect} },
-		{ "begin_quick_select_timeout", {false, HandleBeginQuickSelectTimeout} },
-		{ "shared_texture_incompatible", {false, HandleSharedTextureIncompatible} },
-	};
-	if (!data)
-		return;
+	operation_queue.Push(forward<Fun>(f), priority);
+}
 
-	auto obj = OBSDataCreate({data, data+size});
+static const char *operation_priority_names[OPERATION_PRIORITY_COUNT] = {
+	"high",
+	"normal",
+	"low",
+};
 
-	unique_ptr<obs_data_item_t> item{obs_data_item_byname(obj, "command")};
-	if (!item) {
-		blog(LOG_WARNING, "Missing command element on command channel in message: %s", data);
-		return;
-	}
+static atomic<uint64_t> commands_coalesced = 0;
 
-	const char *str = obs_data_item_get_string(item.get());
-	if (!str) {
-		blog(LOG_WARNING, "Invalid command element in message: %s", data);
-		return;
+static void LogOperationQueueStats()
+{
+	for (size_t i = 0; i < OPERATION_PRIORITY_COUNT; i++) {
+		auto &stats = operation_queue.GetStats(static_cast<OperationPriority>(i));
+		blog(LOG_INFO, "Operation queue (%s): %llu queued, %llu executed, %llu overflowed, %llu heap allocated; "
+			"enqueue p50/p99: %llu/%llu ns; wait p50/p99: %llu/%llu ns", operation_priority_names[i],
+			stats.pushed.load(), stats.executed.load(), stats.overflowed.load(), stats.heap_allocated.load(),
+			stats.enqueue.Percentile(50), stats.enqueue.Percentile(99),
+			stats.wait.Percentile(50), stats.wait.Percentile(99));
 	}
 
-	auto elem = known_commands.find(str);
-	if (elem == cend(known_commands))
-		return blog(LOG_WARNING, "Unknown command: %s in message: %s", str, data);
+	blog(LOG_INFO, "Operation queue: %llu commands coalesced", commands_coalesced.load());
+}
 
-	if (!elem->second.first || !SkippedMessageLog::SkipMessage(skipped_message_log, str))
-		blog(LOG_INFO, "got: %s", data);
+static void HandleQueryOperationQueueStats(CrucibleContext&, OBSData&)
+{
+	auto lanes = OBSDataArrayCreate();
+	for (size_t i = 0; i < OPERATION_PRIORITY_COUNT; i++) {
+		auto &stats = operation_queue.GetStats(static_cast<OperationPriority>(i));
+
+		auto lane = OBSDataCreate();
+		obs_data_set_string(lane, "priority", operation_priority_names[i]);
+		obs_data_set_int(lane, "queued", stats.pushed.load());
+		obs_data_set_int(lane, "executed", stats.executed.load());
+		obs_data_set_int(lane, "overflowed", stats.overflowed.load());
+		obs_data_set_int(lane, "heap_allocated", stats.heap_allocated.load());
+		obs_data_set_int(lane, "enqueue_p50_ns", stats.enqueue.Percentile(50));
+		obs_data_set_int(lane, "enqueue_p99_ns", stats.enqueue.Percentile(99));
+		obs_data_set_int(lane, "wait_p50_ns", stats.wait.Percentile(50));
+		obs_data_set_int(lane, "wait_p99_ns", stats.wait.Percentile(99));
+		obs_data_array_push_back(lanes, lane);
+	}
+
+	ForgeEvents::SendOperationQueueStats(lanes, commands_coalesced.load());
+}
 
-	QueueOperation([=, &cc]() mutable
-	{
-		elem->second.second(cc, obj);
-	});
+static void HandleDismissOverlay(CrucibleContext&, OBSData &data)
+{
+	AnvilCommands::DismissOverlay(data);
+}
 
-	// TODO: Handle changes to frame rate, target resolution, encoder type,
-	//       ...
+static void HandleClipAccepted(CrucibleContext&, OBSData&)
+{
+	AnvilCommands::ShowClipping();
 }
 
-static DWORD main_thread_id = 0;
+// the priority flags pick the lane of a command's operation; commands keep
+// their order within a lane, but a higher lane overtakes a lower one.
+// Commands that depend on each other (recording/output state and what it is
+// configured by) are COMMAND_ORDERED, they run in the order they were
+// received whatever their lanes (see RunOrderedCommandsUpTo); everything else
+// may be overtaken
+enum CommandFlags : uint32_t {
+	COMMAND_SKIP_LOG = 1 << 0,
+	COMMAND_PRIORITY_HIGH = 1 << 1,
+	COMMAND_PRIORITY_LOW = 1 << 2,
+	COMMAND_COALESCE = 1 << 3, // only run the latest pending command per value of the key field
+	COMMAND_ORDERED = 1 << 4,
+};
 
-template <typename Fun>
-static void QueueOperation(Fun &&f)
+using CommandHandler_t = void(*)(CrucibleContext&, OBSData&);
+
+// binary command ids are the positions in this table, Forge learns them from
+// the command_protocol event (see CommandProtocol.hpp); only append new commands
+static constexpr CommandDispatch::Entry<CommandHandler_t> known_commands[] = {
+	CommandDispatch::Command("connect", HandleConnectCommand, COMMAND_ORDERED),
+	CommandDispatch::Command("capture_new_process", HandleCaptureCommand, COMMAND_ORDERED),
+	CommandDispatch::Command("query_mics", HandleQueryMicsCommand, COMMAND_PRIORITY_LOW),
+	CommandDispatch::Command("update_settings", HandleUpdateSettingsCommand, COMMAND_ORDERED),
+	CommandDispatch::Command("save_recording_buffer", HandleSaveRecordingBuffer, COMMAND_PRIORITY_HIGH | COMMAND_ORDERED),
+	CommandDispatch::Command("create_bookmark", HandleCreateBookmark, COMMAND_PRIORITY_HIGH | COMMAND_ORDERED),
+	CommandDispatch::Command("stop_recording", HandleStopRecording, COMMAND_PRIORITY_HIGH | COMMAND_ORDERED),
+	CommandDispatch::Command("injector_result", HandleInjectorResult),
+	CommandDispatch::Command("monitored_process_exit", HandleMonitoredProcessExit),
+	CommandDispatch::Command("update_video_settings", HandleUpdateVideoSettingsCommand, COMMAND_ORDERED),
+	CommandDispatch::Command("set_cursor", HandleSetCursor),
+	CommandDispatch::Command("dismiss_overlay", HandleDismissOverlay),
+	CommandDispatch::Command("clip_accepted", HandleClipAccepted),
+	CommandDispatch::Command("clip_finished", HandleClipFinished),
+	CommandDispatch::Command("forge_will_close", HandleForgeWillClose),
+	CommandDispatch::Command("create_webrtc_output", HandleCreateWebRTCOutput),
+	CommandDispatch::Command("remote_webrtc_offer", HandleRemoteWebRTCOffer),
+	CommandDispatch::Command("get_webrtc_stats", HandleGetWebRTCStats, COMMAND_SKIP_LOG | COMMAND_PRIORITY_LOW),
+	CommandDispatch::Command("stop_webrtc_output", HandleStopWebRTCOutput),
+	CommandDispatch::Command("add_remote_ice_candidate", HandleAddRemoteICECandidate),
+	CommandDispatch::Command("start_recording_stream", HandleStartRecordingStream, COMMAND_ORDERED),
+	CommandDispatch::Command("stop_recording_stream", HandleStopRecordingStream, COMMAND_ORDERED),
+	CommandDispatch::Command("start_streaming", HandleStartStreaming, COMMAND_ORDERED),
+	CommandDispatch::Command("stop_streaming", HandleStopStreaming, COMMAND_ORDERED),
+	CommandDispatch::Command("save_game_screenshot", HandleGameScreenshot),
+	CommandDispatch::Command("query_webcams", HandleQueryWebcams, COMMAND_PRIORITY_LOW),
+	CommandDispatch::Command("query_desktop_audio_devices", HandleQueryDesktopAudioDevices, COMMAND_PRIORITY_LOW),
+	CommandDispatch::Command("query_windows", HandleQueryWindows, COMMAND_PRIORITY_LOW),
+	CommandDispatch::Command("capture_window", HandleCaptureWindow),
+	CommandDispatch::Command("select_scene", HandleSelectScene),
+	CommandDispatch::Command("connect_display", HandleConnectDisplay),
+	CommandDispatch::Command("resize_display", HandleResizeDisplay, COMMAND_COALESCE, "name"),
+	CommandDispatch::Command("query_canvas_size", HandleQueryCanvasSize),
+	CommandDispatch::Command("query_scene_info", HandleQuerySceneInfo),
+	CommandDispatch::Command("update_scenes", HandleUpdateScenes),
+	CommandDispatch::Command("set_source_volume", HandleSetSourceVolume, COMMAND_COALESCE, "source"),
+	CommandDispatch::Command("enable_source_level_meters", HandleEnableSourceLevelMeters),
+	CommandDispatch::Command("save_screenshot", HandleSaveScreenshot),
+	CommandDispatch::Command("update_recording_buffer_settings", HandleUpdateRecordingBufferSettings, COMMAND_ORDERED),
+	CommandDispatch::Command("query_hardware_encoders", HandleQueryHardwareEncoders, COMMAND_PRIORITY_LOW),
+	CommandDispatch::Command("update_disallowed_hardware_encoders", HandleUpdateDisallowedHardwareEncoders),
+	CommandDispatch::Command("screenshot_uploading", ShowScreenshotUploading),
+	CommandDispatch::Command("show_first_time_tutorial", ShowFirstTimeTutorial),
+	CommandDispatch::Command("screenshot_saved", ShowScreenshotSaved),
+	CommandDispatch::Command("start_forward_buffer", StartForwardBuffer, COMMAND_ORDERED),
+	CommandDispatch::Command("stop_forward_buffer", StopForwardBuffer, COMMAND_ORDERED),
+	CommandDispatch::Command("dismiss_quick_select", HandleDismissQuickSelect),
+	CommandDispatch::Command("begin_quick_select_timeout", HandleBeginQuickSelectTimeout),
+	CommandDispatch::Command("shared_texture_incompatible", HandleSharedTextureIncompatible),
+	CommandDispatch::Command("query_operation_queue_stats", HandleQueryOperationQueueStats, COMMAND_SKIP_LOG | COMMAND_PRIORITY_LOW),
+	CommandDispatch::Command("cancel_screenshot", HandleCancelScreenshot),
+};
+
+static_assert(CommandDispatch::HandlersValid(known_commands), "known_commands contains a command without handler");
+static_assert(CommandDispatch::HashesUnique(known_commands), "known_commands contains duplicate commands or a hash collision");
+static_assert(CommandDispatch::HasPerfectLayout(known_commands), "no collision free bucket layout for known_commands");
+
+template <size_t N>
+static constexpr bool CoalesceKeysValid(const CommandDispatch::Entry<CommandHandler_t> (&commands)[N], size_t i = 0)
 {
-	auto ptr = make_unique<function<void()>>(f);
-	PostThreadMessageA(main_thread_id, WM_APP, reinterpret_cast<WPARAM>(ptr.release()), 0);
+	return i >= N || ((!(commands[i].flags & COMMAND_COALESCE) || commands[i].key) && CoalesceKeysValid(commands, i + 1));
 }
+static_assert(CoalesceKeysValid(known_commands), "known_commands contains a coalesced command without key field");
+
+static const auto known_commands_table = CommandDispatch::MakeTable(known_commands);
 
-static bool HandleQueuedOperation(MSG &msg)
+static OperationPriority CommandPriority(const CommandDispatch::Entry<CommandHandler_t> &command)
 {
-	if (msg.hwnd)
-		return false;
+	if (command.flags & COMMAND_PRIORITY_HIGH)
+		return OPERATION_PRIORITY_HIGH;
+	if (command.flags & COMMAND_PRIORITY_LOW)
+		return OPERATION_PRIORITY_LOW;
+	return OPERATION_PRIORITY_NORMAL;
+}
 
-	if (msg.message != WM_APP)
-		return false;
+// latest pending data per "<command>:<key field value>"
+static ProtectedObject<unordered_map<string, OBSData>> coalesced_commands;
+
+struct PendingCommand {
+	uint64_t sequence;
+	function<void()> run;
+};
+
+// COMMAND_ORDERED commands in the order they were received, each one's
+// operation is queued in the lane for its priority
+static ProtectedObject<deque<PendingCommand>> ordered_commands;
+static uint64_t next_command_sequence = 0; // command pipe thread
+
+// runs the ordered command with the given sequence number after the ordered
+// commands received before it, so a high priority command takes the ones it
+// depends on along instead of overtaking them; the operations of commands
+// that already ran this way find nothing left to do
+static void RunOrderedCommandsUpTo(uint64_t sequence)
+{
+	for (;;) {
+		function<void()> run;
+		{
+			auto pending = ordered_commands.Lock();
+			if (pending->empty() || pending->front().sequence > sequence)
+				return;
 
-	unique_ptr<function<void()>> ptr;
-	ptr.reset(reinterpret_cast<function<void()>*>(msg.wParam));
-	(*ptr)();
+			run = move(pending->front().run);
+			pending->pop_front();
+		}
 
-	return true;
+		run();
+	}
+}
+
+static void QueueOrderedCommand(function<void()> run, OperationPriority priority)
+{
+	auto sequence = next_command_sequence++;
+	ordered_commands.Lock()->push_back(PendingCommand{ sequence, move(run) });
+
+	QueueOperation([sequence]
+	{
+		RunOrderedCommandsUpTo(sequence);
+	}, priority);
+}
+
+// set once Forge asked for the binary version we speak; binary frames are
+// rejected until then
+static atomic<bool> binary_commands_negotiated = false;
+
+static void SendCommandProtocolInfo()
+{
+	auto ids = OBSDataCreate();
+	for (auto &command : known_commands_table)
+		obs_data_set_int(ids, command.name, known_commands_table.IndexOf(command));
+
+	binary_commands_negotiated = true;
+	ForgeEvents::SendCommandProtocol(CommandProtocol::binary_version, ids);
+}
+
+// version 0 tells Forge to stay with JSON
+static void RejectCommandProtocol(long long requested)
+{
+	blog(LOG_WARNING, "connect: binary commands version %lld requested, only version %d is supported; using JSON",
+		requested, CommandProtocol::binary_version);
+
+	binary_commands_negotiated = false;
+	ForgeEvents::SendCommandProtocol(0, OBSDataCreate());
+}
+
+static void HandleCommand(CrucibleContext &cc, const uint8_t *data, size_t size)
+{
+	if (!data)
+		return;
+
+	OBSData obj;
+	const CommandDispatch::Entry<CommandHandler_t> *command = nullptr;
+
+	if (CommandProtocol::IsBinary(data, size)) {
+		if (!binary_commands_negotiated)
+			return blog(LOG_WARNING, "Binary command received without negotiating binary_commands on connect (%llu bytes)", static_cast<unsigned long long>(size));
+
+		uint16_t id = 0;
+		if (!CommandProtocol::DecodeCommand(data, size, id, obj)) {
+			blog(LOG_WARNING, "Malformed binary command (version %d, %llu bytes)", size > 1 ? data[1] : 0, static_cast<unsigned long long>(size));
+			return;
+		}
+
+		if (id >= known_commands_table.size())
+			return blog(LOG_WARNING, "Unknown binary command id: %d", id);
+
+		command = &known_commands[id];
+		obs_data_set_string(obj, "command", command->name);
+
+		if (!(command->flags & COMMAND_SKIP_LOG) || !SkippedMessageLog::SkipMessage(skipped_message_log, command->name))
+			blog(LOG_INFO, "got: %s (binary, %llu bytes)", command->name, static_cast<unsigned long long>(size));
+	} else {
+		obj = OBSDataCreate({data, data+size});
+
+		unique_ptr<obs_data_item_t> item{obs_data_item_byname(obj, "command")};
+		if (!item) {
+			blog(LOG_WARNING, "Missing command element on command channel in message: %s", data);
+			return;
+		}
+
+		const char *str = obs_data_item_get_string(item.get());
+		if (!str) {
+			blog(LOG_WARNING, "Invalid command element in message: %s", data);
+			return;
+		}
+
+		command = known_commands_table.Find(str);
+		if (!command)
+			return blog(LOG_WARNING, "Unknown command: %s in message: %s", str, data);
+
+		if (!(command->flags & COMMAND_SKIP_LOG) || !SkippedMessageLog::SkipMessage(skipped_message_log, str))
+			blog(LOG_INFO, "got: %s", data);
+	}
+
+	auto handler = command->handler;
+	auto priority = CommandPriority(*command);
+
+	if (command->flags & COMMAND_COALESCE) {
+		auto key = string(command->name) + ":" + obs_data_get_string(obj, command->key);
+		{
+			auto pending = coalesced_commands.Lock();
+			auto res = pending->emplace(key, obj);
+			if (!res.second) {
+				res.first->second = obj;
+				commands_coalesced += 1;
+				return;
+			}
+		}
+
+		return QueueOperation([=, &cc]
+		{
+			OBSData latest;
+			{
+				auto pending = coalesced_commands.Lock();
+				auto it = pending->find(key);
+				if (it == end(*pending))
+					return;
+
+				latest = move(it->second);
+				pending->erase(it);
+			}
+
+			handler(cc, latest);
+		}, priority);
+	}
+
+	if (command->flags & COMMAND_ORDERED)
+		return QueueOrderedCommand([=, &cc]() mutable
+		{
+			handler(cc, obj);
+		}, priority);
+
+	QueueOperation([=, &cc]() mutable
+	{
+		handler(cc, obj);
+	}, priority);
+
+	// TODO: Handle changes to frame rate, target resolution, encoder type,
+	//       ...
 }
 
 
@@ -5341,6 +5944,10 @@ void TestVideoRecording(TestWindow &window, ProcessHandle &forge, HANDLE start_e
 
 		CrucibleContext crucibleContext;
 
+		// screenshot callbacks call into crucibleContext, no request may
+		// complete once it's gone (also if an exception leaves this scope)
+		DEFER{ Screenshot::Shutdown(); };
+
 		{
 			ProfileScope("CrucibleContext Init");
 
@@ -5429,7 +6036,10 @@ void TestVideoRecording(TestWindow &window, ProcessHandle &forge, HANDLE start_e
 				ForgeEvents::SendWatchdogInfoName(map_name);
 		}
 
+		Display::SetStatsCallback(ForgeEvents::SendDisplayStats);
+
 		wait_handles.emplace_back(exit_event);
+		wait_handles.emplace_back(operation_queue_event);
 		if (forge)
 			wait_handles.emplace_back(forge.get());
 
@@ -5451,6 +6061,11 @@ void TestVideoRecording(TestWindow &window, ProcessHandle &forge, HANDLE start_e
 					break;
 				}
 
+				if (handle == operation_queue_event) {
+					operation_queue.Run();
+					continue;
+				}
+
 				auto it = handle_callbacks.find(handle);
 				if (it != end(handle_callbacks)) {
 					auto cb = move(it->second);
@@ -5466,8 +6081,6 @@ void TestVideoRecording(TestWindow &window, ProcessHandle &forge, HANDLE start_e
 			if (reason == (WAIT_OBJECT_0 + wait_handles.size())) {
 				while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
 				{
-					if (HandleQueuedOperation(msg))
-						continue;
 					TranslateMessage(&msg);
 					DispatchMessage(&msg);
 				}
@@ -5478,8 +6091,15 @@ void TestVideoRecording(TestWindow &window, ProcessHandle &forge, HANDLE start_e
 		}
 
 		message_watchdog.Join();
+		LogOperationQueueStats();
+		Display::SetStatsCallback(nullptr);
 		crucibleContext.StopVideo();
 		Display::StopAll();
+		// fails pending requests while their screenshot_saved events can
+		// still be sent
+		Screenshot::Shutdown();
+		// after the teardown above, it still sends events (stopped_recording etc.)
+		ForgeEvents::StopSender();
 	}
 	catch (const char *err)
 	{
@@ -5574,8 +6194,6 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	});
 #endif
 
-	main_thread_id = GetCurrentThreadId();
-
 	base_set_log_handler(do_log, nullptr);
 	base_set_crash_handler([](const char*, va_list, void*)
 	{
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ThreadTools.hpp"
+
+enum EventDropPolicy {
+	EVENT_DROP_OLDEST, // kept, but dropped once the backlog file is full
+	EVENT_NEVER_DROP,  // kept, even beyond the backlog limits
+	EVENT_DROP_STALE,  // useless once delivered late, never kept
+};
+
+// Undelivered (serialized) events: the newest max_memory_events are kept in
+// memory, older ones are spilled to an append-only temp file of NUL
+// terminated records. Replay writes the file first, then memory, so
+// events go out in the order they were queued.
+struct EventBacklog {
+	size_t max_memory_events = 1000;
+	uint64_t max_file_size = 64 * 1024 * 1024;
+
+	uint64_t spilled = 0;
+	uint64_t dropped = 0;
+
+	bool Empty() const
+	{
+		return memory.empty() && read_offset == write_offset;
+	}
+
+	size_t Size() const
+	{
+		return memory.size() + file_events;
+	}
+
+	void Push(std::string &&event, EventDropPolicy policy)
+	{
+		if (policy == EVENT_DROP_STALE) {
+			dropped += 1;
+			return;
+		}
+
+		memory.push_back(Entry{ std::move(event), policy });
+		Trim();
+	}
+
+	void Trim()
+	{
+		while (memory.size() > max_memory_events) {
+			if (!Spill(memory.front()))
+				break;
+
+			memory.pop_front();
+		}
+	}
+
+	// `write(data, size)` gets NUL terminated events (size includes the NUL)
+	// and returns false if the event couldn't be delivered; returns true
+	// once the backlog is empty
+	template <typename Write>
+	bool Replay(Write &&write)
+	{
+		while (read_offset < write_offset) {
+			if (!ReadRecord())
+				break;
+
+			if (!write(record.data(), record.size()))
+				return false;
+
+			read_offset += record.size();
+			file_events -= 1;
+		}
+
+		ResetFile();
+
+		while (!memory.empty()) {
+			auto &event = memory.front().event;
+			if (!write(event.c_str(), event.size() + 1))
+				return false;
+
+			memory.pop_front();
+		}
+
+		return true;
+	}
+
+protected:
+	struct Entry {
+		std::string event;
+		EventDropPolicy policy;
+	};
+
+	std::deque<Entry> memory;
+
+	std::unique_ptr<void, HandleDeleter> file;
+	uint64_t read_offset = 0;
+	uint64_t write_offset = 0;
+	size_t file_events = 0;
+	std::vector<char> record;
+
+	// returns false if the entry has to stay in memory
+	bool Spill(const Entry &entry)
+	{
+		if (write_offset - read_offset >= max_file_size && entry.policy != EVENT_NEVER_DROP) {
+			dropped += 1;
+			return true;
+		}
+
+		if (!OpenFile() || !WriteAt(write_offset, entry.event.c_str(), entry.event.size() + 1)) {
+			if (entry.policy == EVENT_NEVER_DROP)
+				return false;
+
+			dropped += 1;
+			return true;
+		}
+
+		write_offset += entry.event.size() + 1;
+		file_events += 1;
+		spilled += 1;
+		return true;
+	}
+
+	bool OpenFile()
+	{
+		if (file)
+			return true;
+
+		char path[MAX_PATH + 1];
+		if (!GetTempPathA(sizeof(path), path))
+			return false;
+
+		auto name = std::string(path) + "CrucibleEventBacklog" + std::to_string(GetCurrentProcessId()) + ".tmp";
+		auto handle = CreateFileA(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+			return false;
+
+		file.reset(handle);
+		return true;
+	}
+
+	static OVERLAPPED Offset(uint64_t offset)
+	{
+		OVERLAPPED ov = {};
+		ov.Offset = static_cast<DWORD>(offset);
+		ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		return ov;
+	}
+
+	bool WriteAt(uint64_t offset, const char *data, size_t size)
+	{
+		auto ov = Offset(offset);
+		DWORD written = 0;
+		return WriteFile(file.get(), data, static_cast<DWORD>(size), &written, &ov) && written == size;
+	}
+
+	// reads the record at read_offset (including its NUL) into `record`
+	bool ReadRecord()
+	{
+		size_t chunk = 4096;
+		for (;;) {
+			auto available = write_offset - read_offset;
+			auto size = static_cast<size_t>(std::min<uint64_t>(chunk, available));
+
+			record.resize(size);
+			auto ov = Offset(read_offset);
+			DWORD read = 0;
+			if (!ReadFile(file.get(), record.data(), static_cast<DWORD>(size), &read, &ov) || read != size)
+				return false;
+
+			auto end = std::find(record.begin(), record.end(), '\0');
+			if (end != record.end()) {
+				record.resize(end - record.begin() + 1);
+				return true;
+			}
+
+			if (size == available)
+				return false;
+
+			chunk *= 2;
+		}
+	}
+
+	void ResetFile()
+	{
+		if (!file)
+			return;
+
+		if (read_offset < write_offset) {
+			// corrupt or unreadable tail, nothing sensible to replay
+			dropped += file_events;
+		}
+
+		LARGE_INTEGER zero = {};
+		SetFilePointerEx(file.get(), zero, nullptr, FILE_BEGIN);
+		SetEndOfFile(file.get());
+
+		read_offset = 0;
+		write_offset = 0;
+		file_events = 0;
+	}
+};
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define FRAME_CODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+// Lossless compression for preview frames (FramebufferProtocol
+// COMPRESSION_DELTA_RLE): each frame is coded against the previous one as
+// runs of unchanged pixels, runs of a single color and literal pixels.
+// Static UI and letterboxing cost next to nothing, full motion game content
+// ends up mostly literal; there is no entropy coding, the point is to be
+// cheaper than copying the frame through the pipe.
+//
+// payload: u32 flags, tokens until the frame is complete
+// token:   varint (count << 2 | op), followed by
+//            OP_SKIP     nothing, count pixels are kept from the previous frame
+//            OP_FILL     one pixel, repeated count times
+//            OP_LITERAL  count pixels
+//
+// Pixels are 4 bytes, in row major order without padding. Frames without
+// flag_keyframe require the receiver to hold the previous frame of the same
+// size; the encoder sends a keyframe after Reset() and whenever the size
+// changes, so senders reset it whenever a frame may not have arrived.
+namespace FrameCodec {
+	const uint32_t flag_keyframe = 1;
+
+	// shortest run the encoder emits as OP_SKIP/OP_FILL (decoders accept any)
+	const size_t min_run = 4;
+
+	enum Op : uint32_t {
+		OP_SKIP,
+		OP_FILL,
+		OP_LITERAL,
+	};
+
+	namespace Detail {
+		inline void PutVarint(std::vector<uint8_t> &out, uint64_t val)
+		{
+			while (val >= 0x80) {
+				out.push_back(static_cast<uint8_t>(val | 0x80));
+				val >>= 7;
+			}
+			out.push_back(static_cast<uint8_t>(val));
+		}
+
+		inline bool GetVarint(const uint8_t *&data, const uint8_t *end, uint64_t &val)
+		{
+			val = 0;
+			for (unsigned shift = 0; shift < 64; shift += 7) {
+				if (data == end)
+					return false;
+
+				auto byte = *data++;
+				val |= uint64_t(byte & 0x7f) << shift;
+				if (!(byte & 0x80))
+					return true;
+			}
+			return false;
+		}
+
+		inline uint32_t Pixel(const uint8_t *data, size_t i)
+		{
+			uint32_t px;
+			memcpy(&px, data + i * 4, 4);
+			return px;
+		}
+
+		// pixels i to i + min_run - 1 equal those of the previous frame
+		inline bool Matches(const uint8_t *cur, const uint8_t *prev, size_t i)
+		{
+#ifdef FRAME_CODEC_SSE2
+			auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + i * 4));
+			auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i * 4));
+			return _mm_movemask_epi8(_mm_cmpeq_epi32(a, b)) == 0xffff;
+#else
+			return memcmp(cur + i * 4, prev + i * 4, min_run * 4) == 0;
+#endif
+		}
+
+		// pixels i to i + min_run - 1 are the same color
+		inline bool Repeats(const uint8_t *cur, size_t i)
+		{
+#ifdef FRAME_CODEC_SSE2
+			auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + i * 4));
+			auto b = _mm_shuffle_epi32(a, 0);
+			return _mm_movemask_epi8(_mm_cmpeq_epi32(a, b)) == 0xffff;
+#else
+			auto px = Pixel(cur, i);
+			for (size_t j = 1; j < min_run; j++)
+				if (Pixel(cur, i + j) != px)
+					return false;
+			return true;
+#endif
+		}
+
+#ifdef FRAME_CODEC_SSE2
+		const size_t scan_block = 32;
+
+		inline uint32_t LowestBit(uint32_t mask)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return index;
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+
+		// one bit per pixel in [i, i + scan_block) that starts a run of
+		// min_run pixels, either unchanged or of one color; reads pixels up
+		// to i + scan_block + min_run. Noisy content rarely has any, this
+		// avoids a mispredicted branch per pixel for it
+		inline uint32_t RunStarts(const uint8_t *cur, const uint8_t *prev, size_t i)
+		{
+			uint64_t same_as_next = 0;
+			uint64_t same_as_prev = 0;
+			for (size_t j = 0; j < scan_block + min_run; j += 4) {
+				auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + (i + j) * 4));
+				auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + (i + j) * 4 + 4));
+				same_as_next |= uint64_t(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b)))) << j;
+				if (prev) {
+					auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + (i + j) * 4));
+					same_as_prev |= uint64_t(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, c)))) << j;
+				}
+			}
+
+			auto fills = same_as_next & (same_as_next >> 1) & (same_as_next >> 2);
+			auto skips = same_as_prev & (same_as_prev >> 1) & (same_as_prev >> 2) & (same_as_prev >> 3);
+			return static_cast<uint32_t>(fills | skips);
+		}
+#endif
+
+		// number of pixels from i on that are identical in a and b
+		inline size_t MatchLength(const uint8_t *a, const uint8_t *b, size_t i, size_t n)
+		{
+			auto start = i;
+#ifdef FRAME_CODEC_SSE2
+			for (; i + 4 <= n; i += 4) {
+				auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i * 4));
+				auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i * 4));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi32(va, vb)) != 0xffff)
+					break;
+			}
+#endif
+			while (i < n && Pixel(a, i) == Pixel(b, i))
+				i++;
+			return i - start;
+		}
+
+		// number of pixels from i on that equal pixel i
+		inline size_t RunLength(const uint8_t *data, size_t i, size_t n)
+		{
+			auto start = i;
+			auto px = Pixel(data, i);
+#ifdef FRAME_CODEC_SSE2
+			auto v = _mm_set1_epi32(static_cast<int>(px));
+			for (; i + 4 <= n; i += 4) {
+				auto vd = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 4));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi32(vd, v)) != 0xffff)
+					break;
+			}
+#endif
+			while (i < n && Pixel(data, i) == px)
+				i++;
+			return i - start;
+		}
+	}
+
+	struct Encoder {
+		// the next frame is a keyframe
+		void Reset()
+		{
+			previous.clear();
+		}
+
+		// appends the encoded frame to `out`
+		void Encode(const uint8_t *src, size_t pitch, uint32_t cx, uint32_t cy, std::vector<uint8_t> &out)
+		{
+			using namespace Detail;
+
+			auto row_size = size_t(cx) * 4;
+			// plain copies, the rows are read again right away (PitchedCopy
+			// would stream them past the cache)
+			current.resize(row_size * cy);
+			for (uint32_t y = 0; y < cy; y++)
+				memcpy(current.data() + y * row_size, src + y * pitch, row_size);
+
+			auto keyframe = previous.size() != current.size() || cx != previous_cx;
+			auto cur = current.data();
+			auto prev = keyframe ? nullptr : previous.data();
+			auto n = size_t(cx) * cy;
+
+			out.reserve(out.size() + sizeof(uint32_t) + current.size() + current.size() / 8);
+
+			uint32_t flags = keyframe ? flag_keyframe : 0;
+			out.insert(out.end(), reinterpret_cast<const uint8_t*>(&flags), reinterpret_cast<const uint8_t*>(&flags) + sizeof(flags));
+
+			size_t literal_start = 0;
+			auto flush = [&](size_t end)
+			{
+				if (end == literal_start)
+					return;
+
+				PutVarint(out, (uint64_t(end - literal_start) << 2) | OP_LITERAL);
+				out.insert(out.end(), cur + literal_start * 4, cur + end * 4);
+			};
+
+			size_t i = 0;
+			while (i + min_run <= n) {
+#ifdef FRAME_CODEC_SSE2
+				if (i + scan_block + min_run + 1 <= n) {
+					auto starts = RunStarts(cur, prev, i);
+					if (!starts) {
+						i += scan_block;
+						continue;
+					}
+
+					i += LowestBit(starts);
+				}
+#endif
+
+				// shorter runs cost more as tokens than as literals
+				if (prev && Matches(cur, prev, i)) {
+					auto count = MatchLength(cur, prev, i, n);
+					flush(i);
+					PutVarint(out, (uint64_t(count) << 2) | OP_SKIP);
+					literal_start = i += count;
+					continue;
+				}
+
+				if (Repeats(cur, i)) {
+					auto count = RunLength(cur, i, n);
+					flush(i);
+					PutVarint(out, (uint64_t(count) << 2) | OP_FILL);
+					out.insert(out.end(), cur + i * 4, cur + i * 4 + 4);
+					literal_start = i += count;
+					continue;
+				}
+
+				i += 1;
+			}
+			flush(n);
+
+			std::swap(current, previous);
+			previous_cx = cx;
+		}
+
+	protected:
+		std::vector<uint8_t> current;
+		std::vector<uint8_t> previous;
+		uint32_t previous_cx = 0;
+	};
+
+	// reference implementation for receivers
+	struct Decoder {
+		// on failure the next frame has to be a keyframe
+		bool Decode(const uint8_t *data, size_t size, uint32_t cx, uint32_t cy)
+		{
+			using namespace Detail;
+
+			auto valid = this->valid;
+			this->valid = false;
+
+			uint32_t flags;
+			if (!data || size < sizeof(flags))
+				return false;
+
+			memcpy(&flags, data, sizeof(flags));
+			auto keyframe = (flags & flag_keyframe) != 0;
+			if (!keyframe && (!valid || cx != this->cx || cy != this->cy))
+				return false;
+
+			auto n = size_t(cx) * cy;
+			frame.resize(n * 4);
+			this->cx = cx;
+			this->cy = cy;
+
+			auto ptr = data + sizeof(flags);
+			auto end = data + size;
+			size_t pos = 0;
+			while (ptr != end) {
+				uint64_t token;
+				if (!GetVarint(ptr, end, token))
+					return false;
+
+				auto count = token >> 2;
+				if (!count || count > n - pos)
+					return false;
+
+				auto out = frame.data() + pos * 4;
+				switch (token & 3) {
+				case OP_SKIP:
+					if (keyframe)
+						return false;
+					break;
+
+				case OP_FILL:
+					if (end - ptr < 4)
+						return false;
+					for (uint64_t j = 0; j < count; j++)
+						memcpy(out + j * 4, ptr, 4);
+					ptr += 4;
+					break;
+
+				case OP_LITERAL:
+					if (uint64_t(end - ptr) / 4 < count)
+						return false;
+					memcpy(out, ptr, static_cast<size_t>(count) * 4);
+					ptr += count * 4;
+					break;
+
+				default:
+					return false;
+				}
+
+				pos += static_cast<size_t>(count);
+			}
+
+			this->valid = pos == n;
+			return this->valid;
+		}
+
+		// cy rows of cx pixels, tightly packed
+		const std::vector<uint8_t> &Frame() const
+		{
+			return frame;
+		}
+
+	protected:
+		std::vector<uint8_t> frame;
+		uint32_t cx = 0;
+		uint32_t cy = 0;
+		bool valid = false;
+	};
+}
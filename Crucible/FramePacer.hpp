@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+// Paces a frame producer to what its consumer can absorb. The render side
+// asks ShouldRender() once per tick; the send side reports every frame it
+// finished with Sent(). The interval between rendered frames follows the
+// smoothed send cost (time spent handing a frame to the receiver) and backs
+// off multiplicatively while frames wait for the sender or the receiver
+// reports congestion, then creeps back towards the send cost once it
+// keeps up again.
+//
+// ShouldRender is called on the render thread, Sent/Congested on the send
+// thread; the counters may be bumped and read from any thread.
+struct FramePacer {
+	static const uint64_t ms = 1000000;
+
+	// upper bound for the backed off interval (5 fps)
+	uint64_t max_interval = 200 * ms;
+
+	struct Stats {
+		std::atomic<uint64_t> rendered{ 0 };
+		std::atomic<uint64_t> sent{ 0 };
+		std::atomic<uint64_t> failed{ 0 };
+		std::atomic<uint64_t> paced{ 0 };     // ticks skipped to stay under the target rate
+		std::atomic<uint64_t> replaced{ 0 };  // frames replaced by a newer one before they were sent
+		std::atomic<uint64_t> dropped{ 0 };   // frames dropped for lack of surfaces or receiver slots
+	} stats;
+
+	// 0 removes the cap
+	void SetMaxFPS(uint32_t fps)
+	{
+		min_interval.store(fps ? 1000 * ms / fps : 0, std::memory_order_relaxed);
+	}
+
+	// starts over from the cap, e.g. for a new receiver
+	void Reset()
+	{
+		interval.store(min_interval.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+
+	uint64_t Interval() const
+	{
+		return interval.load(std::memory_order_relaxed);
+	}
+
+	// render thread; ticks up to an eighth of the interval early still count,
+	// so a target equal to the tick rate doesn't alternate between skipping
+	// and rendering because of timer jitter
+	bool ShouldRender(uint64_t now)
+	{
+		auto target = Interval();
+		if (last_render && now - last_render < target - target / 8) {
+			stats.paced.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		last_render = now;
+		stats.rendered.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	void Replaced(uint64_t count = 1)
+	{
+		stats.replaced.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	void Dropped(uint64_t count = 1)
+	{
+		stats.dropped.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	// send thread; captured is the frame's timestamp, the send took
+	// [send_start, send_end]. congested means the receiver hadn't picked up
+	// the previous frame yet even though the send itself returned quickly
+	// (e.g. a shared memory slot had to be reclaimed)
+	void Sent(uint64_t captured, uint64_t send_start, uint64_t send_end, bool success, bool congested)
+	{
+		if (!success) {
+			stats.failed.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		stats.sent.fetch_add(1, std::memory_order_relaxed);
+
+		auto cost = send_end - send_start;
+		send_cost = send_cost ? send_cost - send_cost / 8 + cost / 8 : cost;
+
+		// a frame that waited longer than the sender needs per frame means
+		// frames are produced faster than they are sent
+		auto waited = send_start > captured ? send_start - captured : 0;
+		Adjust(congested || waited > std::max(Floor(), 2 * ms));
+	}
+
+	// send thread; the receiver couldn't take the frame at all
+	void Congested()
+	{
+		Dropped();
+		Adjust(true);
+	}
+
+protected:
+	std::atomic<uint64_t> min_interval{ 0 };
+	std::atomic<uint64_t> interval{ 0 };
+	uint64_t send_cost = 0;   // send thread
+	uint64_t last_render = 0; // render thread
+
+	uint64_t Floor() const
+	{
+		return std::max(min_interval.load(std::memory_order_relaxed), send_cost + send_cost / 8);
+	}
+
+	void Adjust(bool backoff)
+	{
+		auto floor = Floor();
+		auto current = std::max(Interval(), floor);
+		if (backoff)
+			current = std::min(current + current / 4 + ms, std::max(max_interval, floor));
+		else
+			current = std::max(floor, current - current / 16);
+
+		interval.store(current, std::memory_order_relaxed);
+	}
+};
@@ -0,0 +1,364 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "SharedMemoryIPC.hpp"
+
+// Shared memory frame delivery for framebuffer channels. Instead of writing
+// every frame through the pipe, the sender copies frames into a ring of
+// slots in a shared mapping and only sends small messages over the pipe:
+//
+//   Announce  once per mapping, names the mapping the receiver should open
+//             (sent again whenever the mapping is recreated for a new size)
+//   Ready     per frame, says which slot holds the next frame
+//
+// Slot ownership is tracked with a state word per slot in the mapping:
+//   FREE -> WRITING (sender) -> READY (sender, then Ready message)
+//        -> READING (receiver) -> FREE (receiver, acknowledging the slot)
+// When no slot is FREE the sender takes back the oldest READY slot the
+// receiver hasn't claimed yet (READY -> WRITING), so a slow receiver gets the
+// newest frame instead of a backlog; the Ready message for the replaced frame
+// then fails to claim its slot, or finds a newer sequence and leaves it. The
+// sender never touches READING slots; if the receiver holds all of them the
+// frame is dropped.
+//
+// All integers are little endian, the mapping starts with MappingHeader and
+// slot i's pixels are at data_offset + i * slot_size.
+namespace FrameSlots {
+	const uint32_t mapping_magic = 0x4c534643;  // "CFSL"
+	const uint32_t announce_magic = 0x41534643; // "CFSA"
+	const uint32_t ready_magic = 0x52534643;    // "CFSR"
+	const uint16_t version = 1;
+
+	const uint32_t max_slots = 8;
+	const uint32_t default_slots = 3;
+	const uint32_t page_size = 4096;
+
+	enum SlotState : uint32_t {
+		SLOT_FREE,
+		SLOT_WRITING,
+		SLOT_READY,
+		SLOT_READING,
+	};
+
+	struct SlotHeader {
+		std::atomic<uint32_t> state;
+		uint32_t width;
+		uint32_t height;
+		uint32_t stride;
+		uint32_t format;            // FramebufferProtocol::Format
+		uint32_t reserved;
+		uint64_t sequence;
+		uint64_t timestamp;
+		uint8_t pad[24];
+	};
+
+	struct MappingHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t slot_count;
+		uint32_t slot_size;
+		uint32_t data_offset;
+		uint8_t pad[44];
+		SlotHeader slots[max_slots];
+	};
+
+	static_assert(sizeof(SlotHeader) == 64, "SlotHeader layout is shared between processes");
+	static_assert(sizeof(MappingHeader) == 64 + 64 * max_slots, "MappingHeader layout is shared between processes");
+
+	struct Announce {
+		uint32_t magic;
+		uint16_t version;
+		uint16_t size;
+		uint32_t generation;        // echoed by Ready messages for this mapping
+		uint32_t slot_count;
+		uint64_t mapping_size;
+		char name[128];             // NUL terminated
+	};
+
+	struct Ready {
+		uint32_t magic;
+		uint16_t version;
+		uint16_t size;
+		uint32_t generation;
+		uint32_t slot;
+		uint64_t sequence;
+	};
+
+	inline bool Is(uint32_t magic, const uint8_t *data, size_t size)
+	{
+		uint32_t val;
+		if (!data || size < sizeof(val))
+			return false;
+
+		memcpy(&val, data, sizeof(val));
+		return val == magic;
+	}
+
+	template <typename T>
+	inline bool Parse(const uint8_t *data, size_t size, uint32_t magic, T &msg)
+	{
+		if (!Is(magic, data, size) || size < sizeof(T))
+			return false;
+
+		memcpy(&msg, data, sizeof(T));
+		return msg.version == version && msg.size >= sizeof(T) && msg.size <= size;
+	}
+
+	inline uint32_t PageAlign(uint64_t size)
+	{
+		return static_cast<uint32_t>((size + page_size - 1) & ~uint64_t(page_size - 1));
+	}
+
+	// sender side, all calls on one thread
+	struct Producer {
+		uint32_t slot_count = default_slots;
+
+		uint64_t mappings_created = 0;
+		uint64_t frames_published = 0;
+		uint64_t frames_replaced = 0;   // unread frame overwritten by a newer one
+		uint64_t frames_dropped = 0;    // receiver held every slot
+
+		// drops the current mapping, the next Prepare creates and announces a new one
+		void Reset()
+		{
+			mapping.reset();
+			header = nullptr;
+		}
+
+		bool Valid() const
+		{
+			return header != nullptr;
+		}
+
+		// makes sure a mapping with slots of at least frame_size bytes exists;
+		// returns true if a new one was created and `announce` has to be sent
+		// before any Ready for it. Mappings are kept unless frames outgrow
+		// them or shrink to less than a quarter of the slot size
+		bool Prepare(size_t frame_size, Announce &announce)
+		{
+			if (header && frame_size <= header->slot_size && PageAlign(frame_size) >= header->slot_size / 4)
+				return false;
+
+			Reset();
+
+			auto slot_size = PageAlign(frame_size);
+			auto data_offset = PageAlign(sizeof(MappingHeader));
+			auto count = slot_count < 1 ? 1 : slot_count > max_slots ? max_slots : slot_count;
+			auto size = data_offset + uint64_t(slot_size) * count;
+			if (!frame_size || frame_size > UINT32_MAX / 2 || size > UINT32_MAX)
+				return false;
+
+			generation += 1;
+
+			static std::atomic<uint32_t> mapping_id{ 0 };
+
+			char name[128];
+			snprintf(name, sizeof(name), "CrucibleFrameSlots-%u-%u", SharedMemoryIPC::CurrentProcessId(), ++mapping_id);
+
+			std::unique_ptr<SharedMemoryIPC::Mapping> new_mapping{ new SharedMemoryIPC::Mapping };
+			if (!new_mapping->Create(name, static_cast<size_t>(size)))
+				return false;
+
+			header = new (new_mapping->data) MappingHeader{};
+			header->version = version;
+			header->slot_count = count;
+			header->slot_size = slot_size;
+			header->data_offset = data_offset;
+			for (auto &slot : header->slots)
+				slot.state.store(SLOT_FREE, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			header->magic = mapping_magic;
+
+			mapping = std::move(new_mapping);
+			mappings_created += 1;
+
+			announce = Announce{};
+			announce.magic = announce_magic;
+			announce.version = version;
+			announce.size = sizeof(Announce);
+			announce.generation = generation;
+			announce.slot_count = count;
+			announce.mapping_size = size;
+			memcpy(announce.name, name, sizeof(name));
+			return true;
+		}
+
+		// returns a slot now owned by the producer, or -1 if the receiver
+		// holds all of them
+		int Acquire()
+		{
+			if (!header)
+				return -1;
+
+			for (uint32_t i = 0; i < header->slot_count; i++) {
+				auto slot = (next_slot + i) % header->slot_count;
+				uint32_t expected = SLOT_FREE;
+				if (header->slots[slot].state.compare_exchange_strong(expected, SLOT_WRITING, std::memory_order_acquire)) {
+					next_slot = slot + 1;
+					return static_cast<int>(slot);
+				}
+			}
+
+			for (;;) {
+				int oldest = -1;
+				for (uint32_t i = 0; i < header->slot_count; i++) {
+					auto &info = header->slots[i];
+					if (info.state.load(std::memory_order_relaxed) == SLOT_READY && (oldest < 0 || info.sequence < header->slots[oldest].sequence))
+						oldest = static_cast<int>(i);
+				}
+
+				if (oldest < 0)
+					break;
+
+				uint32_t expected = SLOT_READY;
+				if (header->slots[oldest].state.compare_exchange_strong(expected, SLOT_WRITING, std::memory_order_acquire)) {
+					frames_replaced += 1;
+					return oldest;
+				}
+			}
+
+			frames_dropped += 1;
+			return -1;
+		}
+
+		uint8_t *Data(int slot)
+		{
+			return mapping->data + header->data_offset + uint64_t(header->slot_size) * slot;
+		}
+
+		Ready Publish(int slot, uint32_t width, uint32_t height, uint32_t stride, uint32_t format, uint64_t sequence, uint64_t timestamp)
+		{
+			auto &info = header->slots[slot];
+			info.width = width;
+			info.height = height;
+			info.stride = stride;
+			info.format = format;
+			info.sequence = sequence;
+			info.timestamp = timestamp;
+			info.state.store(SLOT_READY, std::memory_order_release);
+
+			frames_published += 1;
+
+			Ready ready = {};
+			ready.magic = ready_magic;
+			ready.version = version;
+			ready.size = sizeof(Ready);
+			ready.generation = generation;
+			ready.slot = static_cast<uint32_t>(slot);
+			ready.sequence = sequence;
+			return ready;
+		}
+
+		// takes back a published slot whose Ready message couldn't be sent,
+		// unless the receiver already claimed it
+		void Abort(int slot)
+		{
+			uint32_t expected = SLOT_READY;
+			header->slots[slot].state.compare_exchange_strong(expected, SLOT_FREE, std::memory_order_relaxed);
+		}
+
+	protected:
+		std::unique_ptr<SharedMemoryIPC::Mapping> mapping;
+		MappingHeader *header = nullptr;
+		uint32_t generation = 0;
+		uint32_t next_slot = 0;
+	};
+
+	// receiver side, reference implementation of the protocol
+	struct Consumer {
+		struct Frame {
+			uint32_t slot;
+			uint32_t width;
+			uint32_t height;
+			uint32_t stride;
+			uint32_t format;
+			uint64_t sequence;
+			uint64_t timestamp;
+			const uint8_t *data;
+		};
+
+		bool Open(const Announce &announce)
+		{
+			Close();
+
+			std::string name(announce.name, strnlen(announce.name, sizeof(announce.name)));
+			std::unique_ptr<SharedMemoryIPC::Mapping> new_mapping{ new SharedMemoryIPC::Mapping };
+			if (!new_mapping->Open(name) || new_mapping->size < sizeof(MappingHeader))
+				return false;
+
+			auto new_header = reinterpret_cast<MappingHeader*>(new_mapping->data);
+			if (new_header->magic != mapping_magic || new_header->version != version)
+				return false;
+
+			if (!new_header->slot_count || new_header->slot_count > max_slots || new_header->data_offset < sizeof(MappingHeader))
+				return false;
+
+			if (new_header->data_offset + uint64_t(new_header->slot_size) * new_header->slot_count > new_mapping->size)
+				return false;
+
+			mapping = std::move(new_mapping);
+			header = new_header;
+			generation = announce.generation;
+			return true;
+		}
+
+		void Close()
+		{
+			mapping.reset();
+			header = nullptr;
+		}
+
+		// claims the slot a Ready message points to; the frame stays valid
+		// until Release(frame.slot)
+		bool Read(const Ready &ready, Frame &frame)
+		{
+			if (!header || ready.generation != generation || ready.slot >= header->slot_count)
+				return false;
+
+			auto &info = header->slots[ready.slot];
+			uint32_t expected = SLOT_READY;
+			if (!info.state.compare_exchange_strong(expected, SLOT_READING, std::memory_order_acquire))
+				return false;
+
+			frame.slot = ready.slot;
+			frame.width = info.width;
+			frame.height = info.height;
+			frame.stride = info.stride;
+			frame.format = info.format;
+			frame.sequence = info.sequence;
+			frame.timestamp = info.timestamp;
+			frame.data = mapping->data + header->data_offset + uint64_t(header->slot_size) * ready.slot;
+
+			// the producer replaced the frame, its own Ready message follows
+			if (frame.sequence != ready.sequence) {
+				info.state.store(SLOT_READY, std::memory_order_release);
+				return false;
+			}
+
+			if (frame.stride < uint64_t(frame.width) * 4 || uint64_t(frame.stride) * frame.height > header->slot_size) {
+				Release(ready.slot);
+				return false;
+			}
+
+			return true;
+		}
+
+		// acknowledges the slot, the producer may reuse it
+		void Release(uint32_t slot)
+		{
+			if (header && slot < header->slot_count)
+				header->slots[slot].state.store(SLOT_FREE, std::memory_order_release);
+		}
+
+	protected:
+		std::unique_ptr<SharedMemoryIPC::Mapping> mapping;
+		MappingHeader *header = nullptr;
+		uint32_t generation = 0;
+	};
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Single message framing for framebuffer channels. Replaces the
+// "FramebufferInfo" JSON message + payload message pair, which desyncs as
+// soon as one of the two messages is lost. Receivers still accept the JSON
+// pair; binary frames are recognized by their magic.
+//
+// All integers are little endian:
+//
+//   message: header, dirty_rect_count * rect, payload
+//   rect:    u32 x, u32 y, u32 width, u32 height
+//
+//   payload without dirty rects: height rows of stride bytes
+//   payload with dirty rects:    for each rect, height rows of width * 4 bytes
+//
+// Compressed frames (only sent to receivers that asked for it) have no dirty
+// rects and the rest of the message is the compressed payload:
+//   COMPRESSION_DELTA_RLE  FrameCodec stream, decodes to height rows of width * 4 bytes
+//   COMPRESSION_JPEG       JPEG file; format and stride don't apply
+namespace FramebufferProtocol {
+	const uint32_t magic = 0x31424643; // "CFB1"
+	const uint16_t version = 1;
+
+	enum Format : uint32_t {
+		FORMAT_BGRA,
+		FORMAT_RGBA,
+	};
+
+	enum Compression : uint32_t {
+		COMPRESSION_NONE,
+		COMPRESSION_DELTA_RLE,
+		COMPRESSION_JPEG,
+	};
+
+	const uint32_t bytes_per_pixel = 4;
+
+	// no dirty rect may cover more than the frame, this just bounds the
+	// allocation for the rect list
+	const uint32_t max_dirty_rects = 4096;
+
+	struct Header {
+		uint32_t magic;
+		uint16_t version;
+		uint16_t header_size;       // receivers skip unknown trailing fields
+		uint32_t width;
+		uint32_t height;
+		uint32_t stride;
+		uint32_t format;
+		uint32_t dirty_rect_count;
+		uint32_t compression;       // Compression, was reserved (0)
+		uint64_t sequence;          // incremented per frame by the sender
+		uint64_t timestamp;         // os_gettime_ns when the frame was captured
+	};
+
+	struct Rect {
+		uint32_t x;
+		uint32_t y;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	// pixel bytes the rects take up in a payload; false if a rect doesn't fit
+	// into a width x height frame
+	inline bool DirtyRectsSize(const std::vector<Rect> &rects, uint32_t width, uint32_t height, uint64_t &size)
+	{
+		size = 0;
+		for (auto &rect : rects) {
+			if (rect.x > width || rect.width > width - rect.x || rect.y > height || rect.height > height - rect.y)
+				return false;
+
+			size += static_cast<uint64_t>(rect.width) * bytes_per_pixel * rect.height;
+		}
+
+		return true;
+	}
+
+	// copies the pixels of (checked) rects, laid out as in a payload, into
+	// frame, the previous image with `stride` bytes per row
+	inline void ApplyDirtyRects(uint8_t *frame, uint32_t stride, const std::vector<Rect> &rects, const uint8_t *data)
+	{
+		for (auto &rect : rects) {
+			auto row_size = static_cast<size_t>(rect.width) * bytes_per_pixel;
+			auto dst = frame + static_cast<size_t>(rect.y) * stride + static_cast<size_t>(rect.x) * bytes_per_pixel;
+			for (uint32_t row = 0; row < rect.height; row++) {
+				memcpy(dst, data, row_size);
+				dst += stride;
+				data += row_size;
+			}
+		}
+	}
+
+	inline bool IsFramed(const uint8_t *data, size_t size)
+	{
+		uint32_t val;
+		if (!data || size < sizeof(val))
+			return false;
+
+		memcpy(&val, data, sizeof(val));
+		return val == magic;
+	}
+
+	inline Header MakeHeader(uint32_t width, uint32_t height, uint32_t stride, Format format, uint64_t sequence, uint64_t timestamp)
+	{
+		Header header = {};
+		header.magic = magic;
+		header.version = version;
+		header.header_size = sizeof(Header);
+		header.width = width;
+		header.height = height;
+		header.stride = stride;
+		header.format = format;
+		header.sequence = sequence;
+		header.timestamp = timestamp;
+		return header;
+	}
+
+	// validates the whole message; on success `payload` points at the pixel
+	// data, which is at least as large as the header/rects say (or at the
+	// compressed data, which is only checked by decoding it)
+	inline bool Parse(const uint8_t *data, size_t size, Header &header, std::vector<Rect> &rects, const uint8_t *&payload, size_t &payload_size)
+	{
+		if (!data || size < sizeof(Header))
+			return false;
+
+		memcpy(&header, data, sizeof(Header));
+		if (header.magic != magic || header.version != version || header.header_size < sizeof(Header) || header.header_size > size)
+			return false;
+
+		if (header.format != FORMAT_BGRA && header.format != FORMAT_RGBA)
+			return false;
+
+		if (!header.width || !header.height || header.stride < static_cast<uint64_t>(header.width) * bytes_per_pixel)
+			return false;
+
+		if (header.dirty_rect_count > max_dirty_rects)
+			return false;
+
+		if (header.compression != COMPRESSION_NONE) {
+			if (header.compression > COMPRESSION_JPEG || header.dirty_rect_count || size == header.header_size)
+				return false;
+
+			payload = data + header.header_size;
+			payload_size = size - header.header_size;
+			rects.clear();
+			return true;
+		}
+
+		auto ptr = data + header.header_size;
+		auto remaining = size - header.header_size;
+
+		auto rects_size = static_cast<size_t>(header.dirty_rect_count) * sizeof(Rect);
+		if (remaining < rects_size)
+			return false;
+
+		rects.resize(header.dirty_rect_count);
+		if (rects_size)
+			memcpy(rects.data(), ptr, rects_size);
+
+		ptr += rects_size;
+		remaining -= rects_size;
+
+		uint64_t needed = 0;
+		if (rects.empty())
+			needed = static_cast<uint64_t>(header.stride) * header.height;
+		else if (!DirtyRectsSize(rects, header.width, header.height, needed))
+			return false;
+
+		if (remaining < needed)
+			return false;
+
+		payload = ptr;
+		payload_size = remaining;
+		return true;
+	}
+}
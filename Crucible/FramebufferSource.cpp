@@ -5,9 +5,17 @@
 
 #include "OBSHelpers.hpp"
 
+#include "FramebufferProtocol.hpp"
 #include "IPC.hpp"
+#include "SharedMemoryIPC.hpp"
+#include "ThreadTools.hpp"
 
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -24,17 +32,51 @@ struct CrucibleFramebufferServer {
 
 	atomic<bool> died = true;
 
+	using Rect = FramebufferProtocol::Rect;
+
 	struct Metadata {
 		uint32_t width;
 		uint32_t height;
 		uint32_t line_size;
 		uint32_t shared_handle;
+		video_format format;
+
+		// sequence/timestamp are only sent with the binary framing, 0 otherwise;
+		// timestamp is converted to os_gettime_ns (see LocalTime)
+		uint64_t sequence;
+		uint64_t timestamp;
+
+		// if not empty the payload only contains these rects (rows of
+		// width * 4 bytes each, rect after rect), everything else is
+		// unchanged since the previous frame
+		vector<Rect> dirty_rects;
 	};
 
 	Metadata incoming_data;
 	bool have_metadata = false;
 
+	uint64_t last_sequence = 0;
+
+	// sender clock -> our clock; the smallest receive time - timestamp seen
+	// from the current sender, i.e. its least delayed frame counts as on time
+	int64_t clock_offset = 0;
+	bool clock_offset_known = false;
+
+	// the previous frame was accepted, dirty rects may be applied on top of
+	// it; the image itself is kept by the receiver of the frames
+	bool frame_valid = false;
+	size_t frame_size = 0;
+
+	atomic<uint64_t> full_frames = 0;
+	atomic<uint64_t> partial_frames = 0;
+	atomic<uint64_t> rejected_frames = 0;
+	atomic<uint64_t> bytes_received = 0;
+
 	IPCServer server;
+	SharedMemoryIPCServer shm_server;
+
+	// 0 uses the pipe transport, otherwise the size of the shared memory ring
+	uint32_t shared_memory_capacity = 0;
 
 #pragma optimize("tsg", on)
 	template <typename Fun>
@@ -42,10 +84,14 @@ struct CrucibleFramebufferServer {
 	{
 		static atomic<int> restarts = 0;
 		died = false;
+		have_metadata = false;
+		frame_valid = false;
+		last_sequence = 0;
+		clock_offset_known = false;
 
-		name = "CrucibleFramebufferServer" + to_string(GetCurrentProcessId()) + "-" + to_string(restarts++);
+		name = (shared_memory_capacity ? "CrucibleFramebufferShm" : "CrucibleFramebufferServer") + to_string(GetCurrentProcessId()) + "-" + to_string(restarts++);
 
-		server.Start(name, [&, fun](uint8_t *data, size_t size)
+		auto handler = [&, fun](uint8_t *data, size_t size)
 		{
 			if (!data) {
 				died = true;
@@ -53,6 +99,21 @@ struct CrucibleFramebufferServer {
 				return;
 			}
 
+			if (FramebufferProtocol::IsFramed(data, size)) {
+				have_metadata = false;
+
+				const uint8_t *payload = nullptr;
+				size_t payload_size = 0;
+				if (!ParseFramedMessage(data, size, payload, payload_size)) {
+					frame_valid = false;
+					rejected_frames += 1;
+					return;
+				}
+
+				HandleFrame(payload, payload_size, fun);
+				return;
+			}
+
 			if (!have_metadata)	{
 				if (size < info_header_fragment.size() + 2 || memcmp(info_header_fragment.data(), data, info_header_fragment.size()) != 0)
 					return;
@@ -63,6 +124,11 @@ struct CrucibleFramebufferServer {
 				incoming_data.height = static_cast<uint32_t>(obs_data_get_int(info, "height"));
 				incoming_data.line_size = static_cast<uint32_t>(obs_data_get_int(info, "line_size"));
 				incoming_data.shared_handle = static_cast<uint32_t>(obs_data_get_int(info, "shared_handle"));
+				incoming_data.format = VIDEO_FORMAT_BGRA;
+				incoming_data.sequence = 0;
+				incoming_data.timestamp = 0;
+
+				ParseDirtyRects(info);
 
 				if (incoming_data.shared_handle) {
 					fun(nullptr, 0, incoming_data);
@@ -73,20 +139,127 @@ struct CrucibleFramebufferServer {
 				return;
 			}
 
-			if (size < incoming_data.line_size * incoming_data.height) {
-				have_metadata = false;
+			have_metadata = false;
+			HandleFrame(data, size, fun);
+		};
+
+		if (!shared_memory_capacity) {
+			server.Start(name, handler, -1);
+			return;
+		}
+
+		if (!shm_server.Start(name, handler, shared_memory_capacity)) {
+			died = true;
+			blog(LOG_WARNING, "CrucibleFramebufferServer: failed to create shared memory ring '%s'", name.c_str());
+		}
+	}
+
+	template <typename Fun>
+	void HandleFrame(const uint8_t *data, size_t size, Fun &fun)
+	{
+		bytes_received += size;
+
+		// fun returns false if it no longer has the image dirty rects apply to
+		if (!incoming_data.dirty_rects.empty()) {
+			if (!CheckDirtyRects(size) || !fun(data, size, incoming_data)) {
+				frame_valid = false;
+				rejected_frames += 1;
 				return;
 			}
 
-			have_metadata = false;
+			partial_frames += 1;
+			return;
+		}
 
-			fun(data, size, incoming_data);
-		}, -1);
+		frame_size = static_cast<size_t>(incoming_data.line_size) * incoming_data.height;
+		if (size < frame_size) {
+			frame_valid = false;
+			rejected_frames += 1;
+			return;
+		}
+
+		frame_valid = true;
+		full_frames += 1;
+
+		fun(data, size, incoming_data);
+	}
+
+	bool ParseFramedMessage(const uint8_t *data, size_t size, const uint8_t *&payload, size_t &payload_size)
+	{
+		FramebufferProtocol::Header header;
+		if (!FramebufferProtocol::Parse(data, size, header, incoming_data.dirty_rects, payload, payload_size))
+			return false;
+
+		// only the preview stream to Forge is compressed
+		if (header.compression != FramebufferProtocol::COMPRESSION_NONE)
+			return false;
+
+		// dirty rects only apply on top of the directly preceding frame
+		auto sequence_gap = header.sequence != last_sequence + 1;
+		last_sequence = header.sequence;
+		if (sequence_gap && !incoming_data.dirty_rects.empty())
+			return false;
+
+		incoming_data.width = header.width;
+		incoming_data.height = header.height;
+		incoming_data.line_size = header.stride;
+		incoming_data.shared_handle = 0;
+		incoming_data.format = header.format == FramebufferProtocol::FORMAT_RGBA ? VIDEO_FORMAT_RGBA : VIDEO_FORMAT_BGRA;
+		incoming_data.sequence = header.sequence;
+		incoming_data.timestamp = header.timestamp ? LocalTime(header.timestamp) : 0;
+		return true;
+	}
+
+	// the sender's timestamps come from its own clock, comparing them with
+	// ours directly would count any offset between the two as latency
+	uint64_t LocalTime(uint64_t timestamp)
+	{
+		auto offset = static_cast<int64_t>(os_gettime_ns() - timestamp);
+		if (!clock_offset_known || offset < clock_offset) {
+			clock_offset = offset;
+			clock_offset_known = true;
+		}
+
+		return timestamp + clock_offset;
+	}
+
+	void ParseDirtyRects(obs_data_t *info)
+	{
+		incoming_data.dirty_rects.clear();
+
+		auto rects = OBSDataGetArray(info, "dirty_rects");
+		if (!rects)
+			return;
+
+		auto count = obs_data_array_count(rects);
+		incoming_data.dirty_rects.reserve(count);
+		for (size_t i = 0; i < count; i++) {
+			auto rect = OBSDataArrayItem(rects, i);
+			incoming_data.dirty_rects.push_back(Rect{
+				static_cast<uint32_t>(obs_data_get_int(rect, "x")),
+				static_cast<uint32_t>(obs_data_get_int(rect, "y")),
+				static_cast<uint32_t>(obs_data_get_int(rect, "width")),
+				static_cast<uint32_t>(obs_data_get_int(rect, "height")),
+			});
+		}
+	}
+
+	// dirty rects require a previous full frame of the same size, the caller
+	// has to send a full frame otherwise
+	bool CheckDirtyRects(size_t size)
+	{
+		auto &info = incoming_data;
+		if (!frame_valid || frame_size != static_cast<size_t>(info.line_size) * info.height || static_cast<uint64_t>(info.width) * 4 > info.line_size)
+			return false;
+
+		uint64_t needed = 0;
+		return FramebufferProtocol::DirtyRectsSize(info.dirty_rects, info.width, info.height, needed) && size >= needed;
 	}
 
 	void Stop()
 	{
 		server.server.reset();
+		shm_server.server.reset();
 		died = true;
 	}
 };
@@ -101,46 +274,274 @@ static FramebufferSource *cast(void *context)
 struct FramebufferSource {
 	obs_source_t *source;
 
-	obs_source_frame frame = {};
-
 	CrucibleFramebufferServer server;
+	CrucibleFramebufferServer shm_server;
+
+	// frames are copied into a pooled buffer on the IPC thread and handed to
+	// libobs on the delivery thread, so a slow obs_source_output_video
+	// doesn't stall the pipe/ring reader; if libobs falls behind the oldest
+	// pending frame is dropped. Each server's latest image stays in the slot
+	// it was delivered from, dirty rects of the next frame are applied on top
+	// of it: in place if the slot is free again, otherwise a copy of it
+	static const size_t frame_pool_size = 3;
+	static const uint64_t late_frame_threshold_ns = 50000000; // 50 ms
+
+	struct PooledFrame {
+		vector<uint8_t> data;
+		uint32_t width;
+		uint32_t height;
+		uint32_t line_size;
+		uint32_t shared_handle;
+		video_format format;
+		uint64_t receive_time;
+		uint64_t capture_time; // os_gettime_ns, see CrucibleFramebufferServer::LocalTime
+
+		// pool_mutex; the server whose latest image this is, and whether
+		// it is being copied from (must not be reused until then)
+		const CrucibleFramebufferServer *base_of;
+		bool pinned;
+	};
+
+	mutex pool_mutex;
+	condition_variable pool_cv;
+	vector<PooledFrame*> all_frames;
+	vector<unique_ptr<PooledFrame>> free_frames;
+	deque<unique_ptr<PooledFrame>> pending_frames;
+	bool exit_delivery = false;
+
+	atomic<uint64_t> delivered_frames = 0;
+	atomic<uint64_t> dropped_frames = 0;
+	atomic<uint64_t> late_frames = 0;
+
+	JoiningThread delivery_thread;
 
 	FramebufferSource() = default;
 	FramebufferSource(obs_source_t *source)
 		: source(source)
 	{
-		StartServer();
+		for (size_t i = 0; i < frame_pool_size; i++) {
+			free_frames.emplace_back(new PooledFrame{});
+			all_frames.push_back(free_frames.back().get());
+		}
+
+		StartDeliveryThread();
+		StartServer(server);
 
 		auto proc = obs_source_get_proc_handler(source);
 		proc_handler_add(proc, "void get_server_name(out string name)", [](void *context, calldata_t *data)
 		{
 			auto self = cast(context);
 			if (self->server.died)
-				self->StartServer();
+				self->StartServer(self->server);
 
 			calldata_set_string(data, "name", self->server.name.c_str());
 		}, this);
+
+		proc_handler_add(proc, "void get_shared_memory_server_name(in int capacity, out string name)", [](void *context, calldata_t *data)
+		{
+			auto self = cast(context);
+			auto capacity = static_cast<uint32_t>(calldata_int(data, "capacity"));
+			if (self->shm_server.died || (capacity && capacity != self->shm_server.shared_memory_capacity)) {
+				self->shm_server.Stop();
+				self->shm_server.shared_memory_capacity = capacity ? capacity : 64 * 1024 * 1024;
+				self->StartServer(self->shm_server);
+			}
+
+			calldata_set_string(data, "name", self->shm_server.died ? "" : self->shm_server.name.c_str());
+		}, this);
+
+		proc_handler_add(proc, "void framebuffer_stats(out int full_frames, out int partial_frames, out int rejected_frames, out int bytes_received)", [](void *context, calldata_t *data)
+		{
+			auto self = cast(context);
+			calldata_set_int(data, "full_frames", self->server.full_frames + self->shm_server.full_frames);
+			calldata_set_int(data, "partial_frames", self->server.partial_frames + self->shm_server.partial_frames);
+			calldata_set_int(data, "rejected_frames", self->server.rejected_frames + self->shm_server.rejected_frames);
+			calldata_set_int(data, "bytes_received", self->server.bytes_received + self->shm_server.bytes_received);
+		}, this);
+
+		proc_handler_add(proc, "void frame_delivery_stats(out int delivered, out int dropped, out int late)", [](void *context, calldata_t *data)
+		{
+			auto self = cast(context);
+			calldata_set_int(data, "delivered", self->delivered_frames);
+			calldata_set_int(data, "dropped", self->dropped_frames);
+			calldata_set_int(data, "late", self->late_frames);
+		}, this);
+	}
+
+	~FramebufferSource()
+	{
+		server.Stop();
+		shm_server.Stop();
+		delivery_thread.Join();
 	}
 
 protected:
-	void StartServer()
+	void StartServer(CrucibleFramebufferServer &server)
 	{
-		frame.format = VIDEO_FORMAT_BGRA;
-		frame.full_range = true;
+		auto stream = &server;
+		server.Start([&, stream](const uint8_t *data, size_t size, const CrucibleFramebufferServer::Metadata &metadata)
+		{
+			auto receive_time = os_gettime_ns();
+			auto partial = data && !metadata.dirty_rects.empty();
+
+			unique_ptr<PooledFrame> frame;
+			PooledFrame *base = nullptr;
+			bool copy_base = false;
+			{
+				LOCK(pool_mutex);
+				for (auto pooled : all_frames)
+					if (pooled->base_of == stream)
+						base = pooled;
+
+				if (partial && (!base || base->data.size() != static_cast<size_t>(metadata.line_size) * metadata.height))
+					return false;
+
+				frame = TakeFrame(base);
+				if (!frame) {
+					// every slot is being delivered right now; the next
+					// dirty rects would apply to an outdated image
+					if (base)
+						base->base_of = nullptr;
+					dropped_frames += 1;
+					return true;
+				}
+
+				// another server's image is about to be overwritten
+				if (frame->base_of != stream)
+					frame->base_of = nullptr;
+
+				copy_base = partial && frame.get() != base;
+				if (copy_base)
+					base->pinned = true;
+			}
 
-		server.Start([&](uint8_t *data, size_t size, CrucibleFramebufferServer::Metadata metadata)
+			frame->width = metadata.width;
+			frame->height = metadata.height;
+			frame->line_size = metadata.line_size;
+			frame->shared_handle = metadata.shared_handle;
+			frame->format = metadata.format;
+			frame->receive_time = receive_time;
+			frame->capture_time = metadata.timestamp ? metadata.timestamp : receive_time;
+			if (partial) {
+				if (copy_base)
+					frame->data.assign(begin(base->data), end(base->data));
+				FramebufferProtocol::ApplyDirtyRects(frame->data.data(), metadata.line_size, metadata.dirty_rects, data);
+			} else if (data) {
+				frame->data.assign(data, data + min(size, static_cast<size_t>(metadata.line_size) * metadata.height));
+			} else {
+				frame->data.clear();
+			}
+
+			{
+				LOCK(pool_mutex);
+				// unless pinned, another server may have taken base by now
+				if (copy_base)
+					base->pinned = false;
+				if (base && base->base_of == stream)
+					base->base_of = nullptr;
+				if (data)
+					frame->base_of = stream;
+
+				pending_frames.push_back(move(frame));
+			}
+			pool_cv.notify_one();
+			return true;
+		});
+	}
+
+	// pool_mutex must be held; free slots come first, preferring base (dirty
+	// rects can be applied in place) and slots not holding any server's
+	// image, else the oldest pending frame is dropped. Another server's image
+	// is only overwritten if there is nothing else
+	unique_ptr<PooledFrame> TakeFrame(const PooledFrame *base)
+	{
+		unique_ptr<PooledFrame> frame;
+		auto take_free = [&](function<bool(const PooledFrame&)> pred)
+		{
+			auto it = find_if(begin(free_frames), end(free_frames), [&](const unique_ptr<PooledFrame> &pooled) { return pred(*pooled); });
+			if (it == end(free_frames))
+				return false;
+
+			frame = move(*it);
+			free_frames.erase(it);
+			return true;
+		};
+		auto take_pending = [&](function<bool(const PooledFrame&)> pred)
+		{
+			auto it = find_if(begin(pending_frames), end(pending_frames), [&](const unique_ptr<PooledFrame> &pooled) { return pred(*pooled); });
+			if (it == end(pending_frames))
+				return false;
+
+			frame = move(*it);
+			pending_frames.erase(it);
+			dropped_frames += 1;
+			return true;
+		};
+
+		auto own = [&](const PooledFrame &pooled) { return &pooled == base; };
+		auto unused = [](const PooledFrame &pooled) { return !pooled.base_of; };
+		auto unpinned = [](const PooledFrame &pooled) { return !pooled.pinned; };
+
+		take_free(own) || take_free(unused) ||
+			take_pending(unused) || take_pending(own) ||
+			take_free(unpinned) || take_pending(unpinned);
+		return frame;
+	}
+
+	void StartDeliveryThread()
+	{
+		delivery_thread.make_joinable = [&]
 		{
-			frame.width = metadata.width;
-			frame.height = metadata.height;
-			frame.linesize[0] = metadata.line_size;
-			frame.data[0] = data;
-			frame.shared_handle = metadata.shared_handle;
+			{
+				LOCK(pool_mutex);
+				exit_delivery = true;
+			}
+			pool_cv.notify_one();
+		};
+
+		delivery_thread.t = thread([&]
+		{
+			for (;;) {
+				unique_ptr<PooledFrame> pooled;
+				{
+					unique_lock<mutex> lock(pool_mutex);
+					pool_cv.wait(lock, [&] { return exit_delivery || !pending_frames.empty(); });
+					if (exit_delivery)
+						return;
+
+					pooled = move(pending_frames.front());
+					pending_frames.pop_front();
+				}
 
-			frame.timestamp = os_gettime_ns();
+				DeliverFrame(*pooled);
 
-			obs_source_output_video(source, &frame);
+				LOCK(pool_mutex);
+				free_frames.push_back(move(pooled));
+			}
 		});
 	}
+
+	void DeliverFrame(const PooledFrame &pooled)
+	{
+		obs_source_frame frame = {};
+		frame.format = pooled.format;
+		frame.full_range = true;
+		frame.width = pooled.width;
+		frame.height = pooled.height;
+		frame.linesize[0] = pooled.line_size;
+		frame.data[0] = pooled.data.empty() ? nullptr : const_cast<uint8_t*>(pooled.data.data());
+		frame.shared_handle = pooled.shared_handle;
+
+		frame.timestamp = pooled.receive_time;
+
+		auto now = os_gettime_ns();
+		if (now > pooled.capture_time && now - pooled.capture_time > late_frame_threshold_ns)
+			late_frames += 1;
+
+		// libobs copies the frame before returning, the slot is free afterwards
+		obs_source_output_video(source, &frame);
+		delivered_frames += 1;
+	}
 };
 
 void RegisterFramebufferSource()
@@ -2,9 +2,12 @@
 
 #include <../deps/ipc-util/ipc-util/pipe.h>
 
+#include "IPCBuffer.hpp"
+
 #include <functional>
 #include <memory>
 #include <string>
+#include <thread>
 
 namespace std {
 
@@ -28,9 +31,164 @@ struct default_delete<ipc_pipe_client>
 
 }
 
+// Pipe server for IPCServer::StartLeased, set up like ipc-util's (inbound,
+// message mode, single instance, accessible to everyone) so ipc-util clients
+// can write to it, but reading every message straight into a pooled buffer:
+// a zero byte read waits for the next message, PeekNamedPipe reports its
+// size, then the whole message is read into a lease of that size
+struct IPCLeasedPipe {
+	std::function<void(IPCBufferLease)> func;
+
+	IPCLeasedPipe() = default;
+	IPCLeasedPipe(const IPCLeasedPipe &) = delete;
+	IPCLeasedPipe &operator=(const IPCLeasedPipe &) = delete;
+
+	~IPCLeasedPipe()
+	{
+		if (stop_event)
+			SetEvent(stop_event);
+
+		if (thread.joinable())
+			thread.join();
+
+		for (auto handle : { stop_event, io_event })
+			if (handle)
+				CloseHandle(handle);
+
+		if (pipe != INVALID_HANDLE_VALUE)
+			CloseHandle(pipe);
+	}
+
+	bool Start(const std::string &name, int buf)
+	{
+		stop_event = CreateEvent(nullptr, true, false, nullptr);
+		io_event = CreateEvent(nullptr, true, false, nullptr);
+		if (!stop_event || !io_event)
+			return false;
+
+		SECURITY_DESCRIPTOR sd;
+		if (!InitializeSecurityDescriptor(&sd, SECURITY_DESCRIPTOR_REVISION) || !SetSecurityDescriptorDacl(&sd, true, nullptr, false))
+			return false;
+
+		SECURITY_ATTRIBUTES sa = { sizeof(sa), &sd, false };
+		auto size = static_cast<DWORD>(buf > 0 ? buf : default_buffer_size);
+		pipe = CreateNamedPipeA(("\\\\.\\pipe\\" + name).c_str(), PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED,
+			PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT, 1, size, size, 0, &sa);
+		if (pipe == INVALID_HANDLE_VALUE)
+			return false;
+
+		overlapped.hEvent = io_event;
+		bool connected = !!ConnectNamedPipe(pipe, &overlapped);
+		if (!connected) {
+			auto err = GetLastError();
+			if (err == ERROR_PIPE_CONNECTED)
+				connected = true;
+			else if (err != ERROR_IO_PENDING)
+				return false;
+		}
+
+		thread = std::thread([this, connected] { Run(connected); });
+		return true;
+	}
+
+protected:
+	static const DWORD default_buffer_size = 1024;
+
+	HANDLE pipe = INVALID_HANDLE_VALUE;
+	HANDLE stop_event = nullptr;
+	HANDLE io_event = nullptr;
+	OVERLAPPED overlapped = {};
+	IPCBufferPool pool;
+	std::thread thread;
+
+	enum IOResult {
+		IO_DONE,
+		IO_MORE_DATA,
+		IO_FAILED,
+		IO_STOPPED,
+	};
+
+	// waits for the operation pending on `overlapped`; on stop it is
+	// cancelled, the OVERLAPPED must not be in use once the thread exits
+	IOResult WaitPending(DWORD *bytes = nullptr)
+	{
+		DWORD transferred = 0;
+		HANDLE handles[] = { stop_event, io_event };
+		if (WaitForMultipleObjects(2, handles, false, INFINITE) != WAIT_OBJECT_0 + 1) {
+			CancelIoEx(pipe, &overlapped);
+			GetOverlappedResult(pipe, &overlapped, &transferred, true);
+			return IO_STOPPED;
+		}
+
+		if (!GetOverlappedResult(pipe, &overlapped, &transferred, false))
+			return GetLastError() == ERROR_MORE_DATA ? IO_MORE_DATA : IO_FAILED;
+
+		if (bytes)
+			*bytes = transferred;
+		return IO_DONE;
+	}
+
+	// `started` is the result of the ReadFile call that was just issued
+	IOResult Wait(BOOL started, DWORD *bytes = nullptr)
+	{
+		if (started) {
+			DWORD transferred = 0;
+			GetOverlappedResult(pipe, &overlapped, &transferred, false);
+			if (bytes)
+				*bytes = transferred;
+			return IO_DONE;
+		}
+
+		auto err = GetLastError();
+		if (err == ERROR_MORE_DATA)
+			return IO_MORE_DATA;
+		if (err != ERROR_IO_PENDING)
+			return IO_FAILED;
+
+		return WaitPending(bytes);
+	}
+
+	void Run(bool connected)
+	{
+		// ConnectNamedPipe was issued by Start
+		auto res = connected ? IO_DONE : WaitPending();
+
+		uint8_t dummy;
+		while (res == IO_DONE) {
+			// completes once a message arrived, without consuming it
+			res = Wait(ReadFile(pipe, &dummy, 0, nullptr, &overlapped));
+			if (res == IO_DONE)
+				continue; // zero length message
+
+			if (res != IO_MORE_DATA)
+				break;
+
+			DWORD size = 0;
+			if (!PeekNamedPipe(pipe, nullptr, 0, nullptr, nullptr, &size) || !size) {
+				res = IO_FAILED;
+				break;
+			}
+
+			auto lease = pool.Acquire(size);
+			DWORD read = 0;
+			res = Wait(ReadFile(pipe, lease.data(), size, nullptr, &overlapped), &read);
+			if (res != IO_DONE || read != size) {
+				res = IO_FAILED;
+				break;
+			}
+
+			func(std::move(lease));
+		}
+
+		if (res != IO_STOPPED)
+			func(IPCBufferLease{});
+	}
+};
+
 struct IPCServer {
 	std::unique_ptr<std::function<void(uint8_t*, size_t)>> func_;
 	std::unique_ptr<ipc_pipe_server> server;
+	std::unique_ptr<IPCLeasedPipe> leased;
 
 	IPCServer() = default;
 
@@ -39,6 +197,7 @@ struct IPCServer {
 	{
 		server = std::move(other.server);
 		func_ = std::move(other.func_);
+		leased = std::move(other.leased);
 	}
 
 	//IPCServer &operator=(IPCServer &&) = default;
@@ -46,6 +205,7 @@ struct IPCServer {
 	{
 		server = std::move(other.server);
 		func_ = std::move(other.func_);
+		leased = std::move(other.leased);
 
 		return *this;
 	}
@@ -58,6 +218,7 @@ struct IPCServer {
 
 	bool Start(const std::string &name, void (*func)(uint8_t*, size_t))
 	{
+		leased.reset();
 		server.reset(new ipc_pipe_server{});
 
 		func_.reset(new std::function<void(uint8_t*, size_t)>{func});
@@ -72,6 +233,7 @@ struct IPCServer {
 	template <typename Func>
 	bool Start(const std::string &name, Func &&func, int buf=-1)
 	{
+		leased.reset();
 		server.reset(new ipc_pipe_server{});
 
 		func_.reset(new std::function<void(uint8_t*, size_t)>{func});
@@ -84,6 +246,31 @@ struct IPCServer {
 			(*static_cast<NoRef_t*>(param))(data, size);
 		}, static_cast<void*>(func_->target<NoRef_t>()), buf);
 	}
+
+	// func receives an IPCBufferLease that may be kept after the callback
+	// returned; messages are read from the pipe directly into recycled pool
+	// buffers (see IPCLeasedPipe). An empty lease signals that the client
+	// disconnected
+	template <typename Func>
+	bool StartLeased(const std::string &name, Func &&func, int buf=-1)
+	{
+		server.reset();
+		func_.reset();
+
+		leased.reset(new IPCLeasedPipe);
+		leased->func = std::forward<Func>(func);
+		if (leased->Start(name, buf))
+			return true;
+
+		leased.reset();
+		return false;
+	}
+
+	void Stop()
+	{
+		server.reset();
+		leased.reset();
+	}
 };
 
 struct IPCClient {
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct IPCBufferEntry {
+	std::atomic<uint32_t> refs;
+	uint8_t *data = nullptr;
+	size_t size = 0;
+	void (*recycle)(IPCBufferEntry *entry) = nullptr;
+
+	IPCBufferEntry()
+		: refs(0)
+	{}
+};
+
+// Ref-counted handle to a received message; unlike the pointer passed to a raw
+// IPCServer callback it stays valid after the callback returns, the storage is
+// recycled once the last copy of the lease is released
+struct IPCBufferLease {
+	IPCBufferLease() = default;
+
+	explicit IPCBufferLease(IPCBufferEntry *entry)
+		: entry(entry)
+	{
+		if (entry)
+			entry->refs += 1;
+	}
+
+	IPCBufferLease(const IPCBufferLease &other)
+		: IPCBufferLease(other.entry)
+	{}
+
+	IPCBufferLease(IPCBufferLease &&other)
+		: entry(other.entry)
+	{
+		other.entry = nullptr;
+	}
+
+	IPCBufferLease &operator=(const IPCBufferLease &other)
+	{
+		// other may be *this, Release clears it
+		auto other_entry = other.entry;
+		if (other_entry)
+			other_entry->refs += 1;
+
+		Release();
+		entry = other_entry;
+
+		return *this;
+	}
+
+	IPCBufferLease &operator=(IPCBufferLease &&other)
+	{
+		if (this == &other)
+			return *this;
+
+		Release();
+		entry = other.entry;
+		other.entry = nullptr;
+
+		return *this;
+	}
+
+	~IPCBufferLease()
+	{
+		Release();
+	}
+
+	void Release()
+	{
+		if (entry && --entry->refs == 0)
+			entry->recycle(entry);
+
+		entry = nullptr;
+	}
+
+	uint8_t *data() const
+	{
+		return entry ? entry->data : nullptr;
+	}
+
+	size_t size() const
+	{
+		return entry ? entry->size : 0;
+	}
+
+	explicit operator bool() const
+	{
+		return !!entry;
+	}
+
+protected:
+	IPCBufferEntry *entry = nullptr;
+};
+
+// Recycles message buffers for leased receive callbacks, so a steady stream of
+// same sized messages (framebuffers) doesn't allocate after warming up; copies
+// of an IPCBufferPool share the same free list
+struct IPCBufferPool {
+	IPCBufferPool(size_t max_free = 4)
+		: state(std::make_shared<State>())
+	{
+		state->max_free = max_free;
+	}
+
+	IPCBufferLease Acquire(size_t size)
+	{
+		std::unique_ptr<Entry> entry;
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			if (!state->free.empty()) {
+				entry = std::move(state->free.back());
+				state->free.pop_back();
+			}
+		}
+
+		if (!entry) {
+			entry.reset(new Entry);
+			entry->recycle = Recycle;
+			state->allocated += 1;
+		}
+
+		entry->storage.resize(size);
+		entry->data = entry->storage.data();
+		entry->size = size;
+		entry->state = state;
+
+		return IPCBufferLease{ entry.release() };
+	}
+
+	IPCBufferLease Copy(const uint8_t *data, size_t size)
+	{
+		auto lease = Acquire(size);
+		memcpy(lease.data(), data, size);
+		return lease;
+	}
+
+	// number of buffers created over the lifetime of the pool
+	size_t Allocated() const
+	{
+		return state->allocated;
+	}
+
+protected:
+	struct State;
+
+	struct Entry : IPCBufferEntry {
+		std::vector<uint8_t> storage;
+		std::shared_ptr<State> state;
+	};
+
+	struct State {
+		std::mutex mutex;
+		std::vector<std::unique_ptr<Entry>> free;
+		size_t max_free = 4;
+		std::atomic<size_t> allocated;
+
+		State()
+			: allocated(0)
+		{}
+	};
+
+	std::shared_ptr<State> state;
+
+	static void Recycle(IPCBufferEntry *entry_)
+	{
+		std::unique_ptr<Entry> entry{ static_cast<Entry*>(entry_) };
+		auto state_ = std::move(entry->state);
+
+		std::lock_guard<std::mutex> lock(state_->mutex);
+		if (state_->free.size() < state_->max_free)
+			state_->free.push_back(std::move(entry));
+	}
+};
@@ -0,0 +1,243 @@
+#define NOMINMAX
+#include "ImageEncoder.hpp"
+
+#include <util/windows/ComPtr.hpp>
+
+#include <wincodec.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#pragma comment(lib, "windowscodecs.lib")
+
+using namespace std;
+
+namespace ImageEncoder {
+	static bool EndsWith(const string &str, const char *suffix)
+	{
+		auto len = strlen(suffix);
+		if (str.size() < len)
+			return false;
+
+		return equal(str.end() - len, str.end(), suffix, [](char a, char b)
+		{
+			return tolower(static_cast<unsigned char>(a)) == b;
+		});
+	}
+
+	Format ParseFormat(const string &name)
+	{
+		if (name == "png")
+			return FORMAT_PNG;
+		if (name == "jpeg" || name == "jpg")
+			return FORMAT_JPEG;
+		return FORMAT_AUTO;
+	}
+
+	static Format ResolveFormat(const string &filename, Format format)
+	{
+		if (format != FORMAT_AUTO)
+			return format;
+
+		return EndsWith(filename, ".jpg") || EndsWith(filename, ".jpeg") ? FORMAT_JPEG : FORMAT_PNG;
+	}
+
+	static wstring Widen(const string &str)
+	{
+		auto size = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, nullptr, 0);
+		if (size <= 0)
+			return {};
+
+		wstring result(size, L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, &result[0], size);
+		result.resize(size - 1);
+		return result;
+	}
+
+	static WICPngFilterOption PngFilter(int compression)
+	{
+		if (compression == 0)
+			return WICPngFilterNone;
+		if (compression <= 5)
+			return WICPngFilterSub;
+		return WICPngFilterAdaptive;
+	}
+
+	static boost::optional<string> Failed(const char *what, HRESULT hr)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), " failed (0x%08lx)", static_cast<unsigned long>(hr));
+		return string(what) + buf;
+	}
+
+	static HRESULT WriteProperty(IPropertyBag2 *props, const wchar_t *name, VARIANT &value)
+	{
+		PROPBAG2 option = {};
+		option.pstrName = const_cast<LPOLESTR>(name);
+		return props->Write(1, &option, &value);
+	}
+
+	static boost::optional<string> Encode(IWICImagingFactory *factory, IStream *stream, Format format, const uint8_t *bgra, uint32_t cx, uint32_t cy, const Options &options)
+	{
+		HRESULT hr;
+		ComPtr<IWICBitmapEncoder> encoder;
+		if (FAILED(hr = factory->CreateEncoder(format == FORMAT_JPEG ? GUID_ContainerFormatJpeg : GUID_ContainerFormatPng, nullptr, encoder.Assign())))
+			return Failed("CreateEncoder", hr);
+
+		if (FAILED(hr = encoder->Initialize(stream, WICBitmapEncoderNoCache)))
+			return Failed("IWICBitmapEncoder::Initialize", hr);
+
+		ComPtr<IWICBitmapFrameEncode> frame;
+		ComPtr<IPropertyBag2> props;
+		if (FAILED(hr = encoder->CreateNewFrame(frame.Assign(), props.Assign())))
+			return Failed("CreateNewFrame", hr);
+
+		VARIANT value;
+		VariantInit(&value);
+		if (format == FORMAT_JPEG) {
+			value.vt = VT_R4;
+			value.fltVal = max(0, min(options.jpeg_quality, 100)) / 100.f;
+			WriteProperty(props, L"ImageQuality", value);
+		} else if (options.png_compression >= 0) {
+			value.vt = VT_UI1;
+			value.bVal = static_cast<BYTE>(PngFilter(options.png_compression));
+			WriteProperty(props, L"FilterOption", value);
+		}
+
+		if (FAILED(hr = frame->Initialize(props)))
+			return Failed("IWICBitmapFrameEncode::Initialize", hr);
+
+		if (FAILED(hr = frame->SetSize(cx, cy)))
+			return Failed("SetSize", hr);
+
+		// WriteSource converts to whatever the encoder wants (24 bpp for JPEG)
+		ComPtr<IWICBitmap> bitmap;
+		if (FAILED(hr = factory->CreateBitmapFromMemory(cx, cy, GUID_WICPixelFormat32bppBGRA, cx * 4, cx * 4 * cy, const_cast<BYTE*>(bgra), bitmap.Assign())))
+			return Failed("CreateBitmapFromMemory", hr);
+
+		if (FAILED(hr = frame->WriteSource(bitmap, nullptr)))
+			return Failed("WriteSource", hr);
+
+		if (FAILED(hr = frame->Commit()))
+			return Failed("IWICBitmapFrameEncode::Commit", hr);
+
+		if (FAILED(hr = encoder->Commit()))
+			return Failed("IWICBitmapEncoder::Commit", hr);
+
+		return boost::none;
+	}
+
+	static boost::optional<string> CreateFactory(ComPtr<IWICImagingFactory> &factory)
+	{
+		auto hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, __uuidof(IWICImagingFactory), reinterpret_cast<void**>(factory.Assign()));
+		if (FAILED(hr))
+			return Failed("CoCreateInstance(WICImagingFactory)", hr);
+
+		return boost::none;
+	}
+
+	boost::optional<string> EncodeToFile(const uint8_t *bgra, uint32_t cx, uint32_t cy, const string &filename, const Options &options)
+	{
+		ComPtr<IWICImagingFactory> factory;
+		if (auto err = CreateFactory(factory))
+			return err;
+
+		HRESULT hr;
+		ComPtr<IWICStream> stream;
+		if (FAILED(hr = factory->CreateStream(stream.Assign())))
+			return Failed("CreateStream", hr);
+
+		if (FAILED(hr = stream->InitializeFromFilename(Widen(filename).c_str(), GENERIC_WRITE)))
+			return Failed("InitializeFromFilename", hr);
+
+		return Encode(factory, stream, ResolveFormat(filename, options.format), bgra, cx, cy, options);
+	}
+
+	boost::optional<string> EncodeToMemory(const uint8_t *bgra, uint32_t cx, uint32_t cy, vector<uint8_t> &out, const Options &options)
+	{
+		ComPtr<IWICImagingFactory> factory;
+		if (auto err = CreateFactory(factory))
+			return err;
+
+		HRESULT hr;
+		ComPtr<IStream> stream;
+		if (FAILED(hr = CreateStreamOnHGlobal(nullptr, true, stream.Assign())))
+			return Failed("CreateStreamOnHGlobal", hr);
+
+		if (auto err = Encode(factory, stream, options.format == FORMAT_JPEG ? FORMAT_JPEG : FORMAT_PNG, bgra, cx, cy, options))
+			return err;
+
+		// the HGLOBAL may be larger than what was written
+		LARGE_INTEGER zero = {};
+		ULARGE_INTEGER size;
+		if (FAILED(hr = stream->Seek(zero, STREAM_SEEK_CUR, &size)))
+			return Failed("IStream::Seek", hr);
+
+		HGLOBAL memory;
+		if (FAILED(hr = GetHGlobalFromStream(stream, &memory)))
+			return Failed("GetHGlobalFromStream", hr);
+
+		auto data = static_cast<const uint8_t*>(GlobalLock(memory));
+		if (!data)
+			return string("GlobalLock failed");
+
+		out.insert(out.end(), data, data + size.QuadPart);
+		GlobalUnlock(memory);
+		return boost::none;
+	}
+
+	WorkerPool::WorkerPool(size_t count)
+	{
+		if (!count)
+			count = min<size_t>(max(thread::hardware_concurrency(), 2u) - 1, 4);
+
+		threads.resize(count);
+		for (auto &thread : threads)
+			thread.t = std::thread([this] { Run(); });
+	}
+
+	WorkerPool::~WorkerPool()
+	{
+		{
+			lock_guard<std::mutex> lock(mutex);
+			exit = true;
+		}
+		cv.notify_all();
+
+		for (auto &thread : threads)
+			thread.Join();
+	}
+
+	void WorkerPool::Submit(function<void()> job)
+	{
+		{
+			lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(move(job));
+		}
+		cv.notify_one();
+	}
+
+	void WorkerPool::Run()
+	{
+		auto com = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+		for (;;) {
+			function<void()> job;
+			{
+				unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&] { return exit || !jobs.empty(); });
+				if (jobs.empty())
+					break;
+
+				job = move(jobs.front());
+				jobs.pop_front();
+			}
+
+			job();
+		}
+
+		if (SUCCEEDED(com))
+			CoUninitialize();
+	}
+}
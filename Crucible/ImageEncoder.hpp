@@ -0,0 +1,58 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include "ThreadTools.hpp"
+
+// Image file encoding through WIC, off the graphics thread. WIC has no WebP
+// encoder (Windows only ships a WebP decoder), so PNG and JPEG are the
+// supported formats.
+namespace ImageEncoder {
+	enum Format {
+		FORMAT_AUTO, // from the file extension, PNG unless it's .jpg/.jpeg
+		FORMAT_PNG,
+		FORMAT_JPEG,
+	};
+
+	struct Options {
+		Format format = FORMAT_AUTO;
+		int jpeg_quality = 90;        // 0-100
+		int png_compression = -1;     // 0 (fastest) - 9 (smallest), -1 for the WIC default
+	};
+
+	Format ParseFormat(const std::string &name);
+
+	// `bgra` holds `cy` rows of `cx` pixels, tightly packed
+	boost::optional<std::string> EncodeToFile(const uint8_t *bgra, uint32_t cx, uint32_t cy, const std::string &filename, const Options &options);
+
+	// appends the encoded image to `out`; FORMAT_AUTO is PNG. Requires COM on
+	// the calling thread
+	boost::optional<std::string> EncodeToMemory(const uint8_t *bgra, uint32_t cx, uint32_t cy, std::vector<uint8_t> &out, const Options &options);
+
+	// fixed set of threads (with COM initialized) that run encode jobs in
+	// submission order; the destructor finishes queued jobs before joining
+	struct WorkerPool {
+		explicit WorkerPool(size_t threads = 0);
+		~WorkerPool();
+
+		void Submit(std::function<void()> job);
+
+	protected:
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::deque<std::function<void()>> jobs;
+		bool exit = false;
+
+		std::vector<JoiningThread> threads;
+
+		void Run();
+	};
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define IMAGE_SCALE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Downscaling of 32 bit pixel images (channel order doesn't matter) on the
+// CPU, for frames that were already read back at full size.
+//
+// Large reductions halve the image with a 2x2 box filter until it's less
+// than twice the target size, the rest is a bilinear pass; so every source
+// pixel contributes like it would with a mip chain, without the aliasing a
+// single bilinear pass has.
+namespace ImageScale {
+	// largest size with the source aspect ratio that fits into max_edge x max_edge
+	inline void Fit(uint32_t src_cx, uint32_t src_cy, uint32_t max_edge, uint32_t &cx, uint32_t &cy)
+	{
+		if (src_cx >= src_cy) {
+			cx = std::min(src_cx, max_edge);
+			cy = static_cast<uint32_t>((uint64_t(src_cy) * cx + src_cx / 2) / src_cx);
+		} else {
+			cy = std::min(src_cy, max_edge);
+			cx = static_cast<uint32_t>((uint64_t(src_cx) * cy + src_cy / 2) / src_cy);
+		}
+
+		cx = std::max(cx, 1u);
+		cy = std::max(cy, 1u);
+	}
+
+	namespace Detail {
+		inline uint32_t BoxPixel(const uint8_t *a, const uint8_t *b)
+		{
+			uint32_t result = 0;
+			for (int c = 0; c < 4; c++) {
+				uint32_t sum = a[c] + a[c + 4] + b[c] + b[c + 4] + 2;
+				result |= (sum >> 2) << (c * 8);
+			}
+			return result;
+		}
+
+		// dst has (cx / 2) x (cy / 2) pixels, an odd last row/column is dropped
+		inline void Halve(uint8_t *dst, size_t dst_pitch, const uint8_t *src, size_t src_pitch, uint32_t cx, uint32_t cy)
+		{
+			auto dst_cx = cx / 2;
+			auto dst_cy = cy / 2;
+
+			for (uint32_t y = 0; y < dst_cy; y++) {
+				auto row0 = src + 2 * y * src_pitch;
+				auto row1 = row0 + src_pitch;
+				auto out = dst + y * dst_pitch;
+
+				uint32_t x = 0;
+#ifdef IMAGE_SCALE_SSE2
+				auto zero = _mm_setzero_si128();
+				auto bias = _mm_set1_epi16(2);
+				for (; x + 4 <= dst_cx; x += 4) {
+					auto a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+					auto a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8 + 16));
+					auto b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+					auto b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8 + 16));
+
+					// vertical sums, two source pixels per register
+					auto s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+					auto s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+					auto s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+					auto s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+					// horizontal sums of neighbouring pixels
+					auto h01 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+					auto h23 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+
+					h01 = _mm_srli_epi16(_mm_add_epi16(h01, bias), 2);
+					h23 = _mm_srli_epi16(_mm_add_epi16(h23, bias), 2);
+
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(h01, h23));
+				}
+#endif
+				for (; x < dst_cx; x++) {
+					auto px = BoxPixel(row0 + x * 8, row1 + x * 8);
+					memcpy(out + x * 4, &px, 4);
+				}
+			}
+		}
+
+		// 16.16 source position of the first output pixel's center and step
+		struct Axis {
+			int64_t start;
+			int64_t step;
+			uint32_t limit;
+
+			Axis(uint32_t src, uint32_t dst)
+				: step((int64_t(src) << 16) / dst), limit(src - 1)
+			{
+				start = step / 2 - (1 << 15);
+			}
+
+			// index of the left/top sample and 8 bit weight of the right/bottom one
+			void At(uint32_t i, uint32_t &index, uint32_t &weight) const
+			{
+				auto pos = start + step * i;
+				if (pos <= 0) {
+					index = 0;
+					weight = 0;
+					return;
+				}
+
+				index = static_cast<uint32_t>(pos >> 16);
+				weight = static_cast<uint32_t>((pos & 0xffff) >> 8);
+				if (index >= limit) {
+					index = limit;
+					weight = 0;
+				}
+			}
+		};
+
+		inline void Bilinear(uint8_t *dst, size_t dst_pitch, uint32_t dst_cx, uint32_t dst_cy, const uint8_t *src, size_t src_pitch, uint32_t src_cx, uint32_t src_cy)
+		{
+			Axis ax(src_cx, dst_cx);
+			Axis ay(src_cy, dst_cy);
+
+			std::vector<uint32_t> xs(dst_cx);
+			std::vector<uint32_t> wxs(dst_cx);
+			for (uint32_t x = 0; x < dst_cx; x++)
+				ax.At(x, xs[x], wxs[x]);
+
+			for (uint32_t y = 0; y < dst_cy; y++) {
+				uint32_t sy, wy;
+				ay.At(y, sy, wy);
+
+				auto row0 = src + sy * src_pitch;
+				auto row1 = sy < src_cy - 1 ? row0 + src_pitch : row0;
+				auto out = dst + y * dst_pitch;
+
+#ifdef IMAGE_SCALE_SSE2
+				auto zero = _mm_setzero_si128();
+				auto wy1 = _mm_set1_epi16(static_cast<short>(wy));
+				auto wy0 = _mm_set1_epi16(static_cast<short>(256 - wy));
+				for (uint32_t x = 0; x < dst_cx; x++) {
+					auto sx = xs[x];
+					auto wx = static_cast<short>(wxs[x]);
+					auto next = sx < src_cx - 1 ? 4 : 0;
+
+					// [left, right] pixel pairs as 16 bit channels
+					uint32_t p[4];
+					memcpy(&p[0], row0 + sx * 4, 4);
+					memcpy(&p[1], row0 + sx * 4 + next, 4);
+					memcpy(&p[2], row1 + sx * 4, 4);
+					memcpy(&p[3], row1 + sx * 4 + next, 4);
+					auto top = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, static_cast<int>(p[1]), static_cast<int>(p[0])), zero);
+					auto bottom = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, static_cast<int>(p[3]), static_cast<int>(p[2])), zero);
+
+					auto wx0 = static_cast<short>(256 - wx);
+					auto wxv = _mm_set_epi16(wx, wx, wx, wx, wx0, wx0, wx0, wx0);
+					top = _mm_mullo_epi16(top, wxv);
+					bottom = _mm_mullo_epi16(bottom, wxv);
+					top = _mm_srli_epi16(_mm_add_epi16(top, _mm_srli_si128(top, 8)), 8);
+					bottom = _mm_srli_epi16(_mm_add_epi16(bottom, _mm_srli_si128(bottom, 8)), 8);
+
+					auto v = _mm_add_epi16(_mm_mullo_epi16(top, wy0), _mm_mullo_epi16(bottom, wy1));
+					v = _mm_srli_epi16(_mm_add_epi16(v, _mm_set1_epi16(128)), 8);
+
+					auto px = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(v, v)));
+					memcpy(out + x * 4, &px, 4);
+				}
+#else
+				for (uint32_t x = 0; x < dst_cx; x++) {
+					auto sx = xs[x];
+					auto wx = wxs[x];
+					auto next = sx < src_cx - 1 ? 4 : 0;
+					for (int c = 0; c < 4; c++) {
+						auto top = (row0[sx * 4 + c] * (256 - wx) + row0[sx * 4 + next + c] * wx) >> 8;
+						auto bottom = (row1[sx * 4 + c] * (256 - wx) + row1[sx * 4 + next + c] * wx) >> 8;
+						out[x * 4 + c] = static_cast<uint8_t>((top * (256 - wy) + bottom * wy + 128) >> 8);
+					}
+				}
+#endif
+			}
+		}
+	}
+
+	// scales `src` to a tightly packed dst_cx x dst_cy image in `dst`
+	inline void Resize(const uint8_t *src, size_t src_pitch, uint32_t src_cx, uint32_t src_cy, std::vector<uint8_t> &dst, uint32_t dst_cx, uint32_t dst_cy)
+	{
+		using namespace Detail;
+
+		if (!dst_cx || !dst_cy || !src_cx || !src_cy) {
+			dst.clear();
+			return;
+		}
+
+		std::vector<uint8_t> levels[2];
+		size_t level = 0;
+
+		while (src_cx / 2 >= dst_cx && src_cy / 2 >= dst_cy) {
+			auto &next = levels[level];
+			next.resize(size_t(src_cx / 2) * (src_cy / 2) * 4);
+			Halve(next.data(), (src_cx / 2) * 4, src, src_pitch, src_cx, src_cy);
+
+			src = next.data();
+			src_cx /= 2;
+			src_cy /= 2;
+			src_pitch = src_cx * 4;
+			level ^= 1;
+		}
+
+		dst.resize(size_t(dst_cx) * dst_cy * 4);
+		if (src_cx == dst_cx && src_cy == dst_cy) {
+			for (uint32_t y = 0; y < dst_cy; y++)
+				memcpy(dst.data() + y * dst_cx * 4, src + y * src_pitch, dst_cx * 4);
+			return;
+		}
+
+		Bilinear(dst.data(), dst_cx * 4, dst_cx, dst_cy, src, src_pitch, src_cx, src_cy);
+	}
+}
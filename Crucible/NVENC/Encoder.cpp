@@ -5,11 +5,12 @@
 
 #include "dynlink_cuda.h"
 #include "nvEncodeAPI.h"
+#include "SurfaceQueue.hpp"
 
+#include "../PitchedCopy.hpp"
 #include "../scopeguard.hpp"
 
 #include <array>
-#include <deque>
 #include <map>
 #include <memory>
 #include <utility>
@@ -263,18 +264,16 @@ namespace {
 		video_format input_format = VIDEO_FORMAT_NV12;
 
 		vector<Surface> surfaces;
-
-		deque<Surface*> idle;
-		deque<Surface*> processing;
-		deque<Surface*> ready;
+		SurfaceQueue<Surface> queue;
 
 		vector<uint8_t> headers;
 
-		deque<uint64_t> timestamps;
-		bool b_frame_pts_calculated = false;
+		// output thread retrieves bitstreams, so Encode doesn't wait for them
+		JoiningThread output_thread;
+		unique_ptr<void, HandleDeleter> stop_output;
+		vector<uint32_t> slice_offsets; // sized before the output thread starts
 
-		vector<uint32_t> slice_offsets;
-		vector<uint8_t> slice_data;
+		EncodedPacket packet; // returned by the last Encode call
 
 		Encoder(obs_encoder_t *encoder) : encoder(encoder)
 		{
@@ -314,6 +313,8 @@ namespace {
 
 		void Release()
 		{
+			output_thread.Join();
+
 			if (!nvenc)
 				return;
 
@@ -379,6 +380,7 @@ namespace {
 			}
 
 			surfaces.clear();
+			queue.Clear();
 		}
 	};
 
@@ -1113,7 +1115,7 @@ static bool InitSurfaces(Encoder *enc, IDXGIAdapter *adapter)
 			surface.output = alloc_out.bitstreamBuffer;
 		}
 
-		enc->idle.push_back(&surface);
+		enc->queue.Add(&surface);
 	}
 
 	return true;
@@ -1294,6 +1296,9 @@ try {
 	if (!InitSPSPPS(enc.get()))
 		return nullptr;
 
+	if (!StartOutputThread(enc.get()))
+		return nullptr;
+
 
 	{
 		auto preset_name = "default"s;
@@ -1468,8 +1473,7 @@ static bool UploadFrame(Encoder *enc, encoder_frame *frame, Surface *surface)
 
 		auto base_target = reinterpret_cast<uint8_t*>(lock.bufferDataPtr) + plane * lock.pitch * surface->height;
 		auto copy_size = min(lock.pitch, frame->linesize[plane]);
-		for (uint32_t line = 0; line < lines; line++)
-			memcpy(base_target + lock.pitch * line, frame->data[plane] + frame->linesize[plane] * line, copy_size);
+		PitchedCopy::Copy(base_target, lock.pitch, frame->data[plane], frame->linesize[plane], copy_size, lines);
 	}
 
 	if (sts = enc->funcs.nvEncUnlockInputBuffer(enc->nv_encoder, lock.inputBuffer)) {
@@ -1480,88 +1484,69 @@ static bool UploadFrame(Encoder *enc, encoder_frame *frame, Surface *surface)
 	return true;
 }
 
-static bool ProcessOutput(Encoder *enc, encoder_packet *packet)
+static bool WaitForCompletion(Encoder *enc, Surface *surface)
 {
-	if (!enc->b_frame_pts_calculated && enc->b_frames_actual && enc->timestamps.size() < 2)
+	HANDLE handles[] = { enc->stop_output.get(), surface->event.get() };
+	switch (WaitForMultipleObjects(2, handles, false, INFINITE)) {
+	case WAIT_OBJECT_0:
 		return false;
-
-	if ((enc->init_params.enableEncodeAsync && enc->processing.empty()) || (!enc->init_params.enableEncodeAsync && enc->ready.empty()))
+	case WAIT_OBJECT_0 + 1:
+		return true;
+	default:
+		error("RetrieveOutput: WaitForMultipleObjects failed: %#x", GetLastError());
 		return false;
-
-	Surface *output;
-
-	if (enc->init_params.enableEncodeAsync) {
-		output = enc->processing.front();
-		if (WaitForSingleObject(output->event.get(), enc->idle.empty() ? INFINITE : 0) != WAIT_OBJECT_0)
-			return false;
-		enc->processing.pop_front();
-		enc->idle.push_back(output);
-	} else {
-		output = enc->ready.front();
-		enc->ready.pop_front();
-		enc->idle.push_back(output);
 	}
+}
 
-	// always handle dts, even if this particular bitstream errors in some way?
-	DEFER{
-		if (enc->b_frames_actual && !enc->b_frame_pts_calculated) {
-			auto ts0 = static_cast<int64_t>(enc->timestamps[0]);
-			auto ts1 = static_cast<int64_t>(enc->timestamps[1]);
-			auto delta = ts1 - ts0;
-
-			enc->b_frame_pts_calculated = true;
-
-			packet->dts = ts0 - delta;
-		} else {
-			packet->dts = enc->timestamps.front();
-			enc->timestamps.pop_front();
-		}
-	};
-
-	NV_ENC_LOCK_BITSTREAM lock = { 0 };
-	lock.version = NV_ENC_LOCK_BITSTREAM_VER;
+static void RetrieveOutput(Encoder *enc)
+{
+	EncodedPacket packet;
 
-	{
-		enc->slice_offsets.resize(enc->encode_config.encodeCodecConfig.h264Config.sliceModeData);
+	for (;;) {
+		auto output = enc->queue.Next();
+		if (!output)
+			return;
 
-		lock.outputBitstream = output->output;
-		lock.sliceOffsets = enc->slice_offsets.data();
+		if (enc->init_params.enableEncodeAsync && !WaitForCompletion(enc, output))
+			return;
 
-		if (NVENCStatus sts = enc->funcs.nvEncLockBitstream(enc->nv_encoder, &lock)) {
+		NVENCStatus unlock_sts;
+		NVENCStatus sts = ReadBitstream(enc->funcs, enc->nv_encoder, output->output, enc->slice_offsets, packet, unlock_sts.sts);
+		if (sts)
 			sts.Warn(enc, "nvEncLockBitstream");
-			return false;
-		}
-
-		auto unlock_bitstream_impl = [&]
-		{
-			if (NVENCStatus sts = enc->funcs.nvEncUnlockBitstream(enc->nv_encoder, output->output)) {
-				sts.Warn(enc, "nvEncUnlockBitstream");
-				return false;
-			}
+		else if (unlock_sts)
+			unlock_sts.Warn(enc, "nvEncUnlockBitstream");
 
-			return true;
-		};
-
-		DEFER{ unlock_bitstream_impl(); };
+		if (enc->use_texture_input && output->input) {
+			if (NVENCStatus sts = enc->funcs.nvEncUnmapInputResource(enc->nv_encoder, output->input))
+				sts.Warn(enc, "nvEncUnmapInputResource");
+			output->input = nullptr;
+		}
 
-		enc->slice_data.resize(lock.bitstreamSizeInBytes);
+		if (!sts)
+			packet.keyframe = obs_avc_keyframe(packet.data.data(), packet.data.size());
 
-		auto bitstream_ptr = reinterpret_cast<uint8_t*>(lock.bitstreamBufferPtr);
-		enc->slice_data.assign(bitstream_ptr, bitstream_ptr + lock.bitstreamSizeInBytes);
+		enc->queue.Finish(output, packet, !sts);
 	}
+}
 
-	if (enc->use_texture_input && output->input) {
-		if (NVENCStatus sts = enc->funcs.nvEncUnmapInputResource(enc->nv_encoder, output->input))
-			sts.Warn(enc, "nvEncUnmapInputResource");
-		output->input = nullptr;
+static bool StartOutputThread(Encoder *enc)
+{
+	enc->stop_output.reset(CreateEvent(nullptr, true, false, nullptr));
+	if (!enc->stop_output) {
+		warn("StartOutputThread: CreateEvent failed: %#x", GetLastError());
+		return false;
 	}
 
-	packet->data = enc->slice_data.data();
-	packet->size = enc->slice_data.size();
-	packet->type = OBS_ENCODER_VIDEO;
-	packet->keyframe = obs_avc_keyframe(packet->data, packet->size);
+	enc->queue.Configure(enc->init_params.enableEncodeAsync != 0, enc->b_frames_actual != 0);
+	enc->slice_offsets.resize(enc->encode_config.encodeCodecConfig.h264Config.sliceModeData);
 
-	packet->pts = lock.outputTimeStamp;
+	enc->output_thread.make_joinable = [enc]
+	{
+		enc->queue.Stop();
+		SetEvent(enc->stop_output.get());
+	};
+	enc->output_thread.t = thread([enc] { RetrieveOutput(enc); });
 
 	return true;
 }
@@ -1570,19 +1555,15 @@ static bool Encode(void *context, encoder_frame *frame, encoder_packet *packet,
 try {
 	auto enc = cast(context);
 
-	bool have_output = false;
-	if (enc->init_params.enableEncodeAsync && enc->idle.empty())
-		have_output = *received_packet = ProcessOutput(enc, packet);
-
-	bool encode_success = false; // as opposed to NEED_MORE_INPUT
-
 	if (frame) {
-		if (enc->idle.empty()) {
+		// only blocks if every surface is still being encoded
+		auto input = enc->queue.Acquire(chrono::seconds(2));
+		if (!input) {
 			error("Encode: no idle surfaces while trying to encode frame");
 			return false;
 		}
 
-		auto input = enc->idle.front();
+		auto return_surface = guard([&] { enc->queue.Return(input); });
 
 		CUDAResult res(enc->cuda);
 		if (res = enc->cuda->cuCtxPushCurrent(enc->ctx.get())) {
@@ -1642,6 +1623,8 @@ try {
 		if (enc->init_params.enableEncodeAsync)
 			pic.completionEvent = input->event.get();
 
+		bool encode_success = false; // as opposed to NEED_MORE_INPUT
+
 		if (NVENCStatus sts = enc->funcs.nvEncEncodePicture(enc->nv_encoder, &pic)) {
 			if (sts.sts != NV_ENC_ERR_NEED_MORE_INPUT) {
 				sts.Error(enc, "nvEncEncodePicture");
@@ -1651,23 +1634,24 @@ try {
 			encode_success = true;
 		}
 
-		enc->timestamps.push_back(frame->pts);
-
-		enc->processing.push_back(input);
-		enc->idle.pop_front();
+		return_surface.dismiss();
+		enc->queue.Submit(input, frame->pts, encode_success);
 
 		if (!pop_context())
 			return false;
 	}
 
-	if (encode_success && !enc->init_params.enableEncodeAsync) {
-		enc->ready.insert(end(enc->ready), begin(enc->processing), end(enc->processing));
-		enc->processing.clear();
+	// packet data stays valid until the next call
+	*received_packet = enc->queue.Pop(enc->packet);
+	if (*received_packet) {
+		packet->data = enc->packet.data.data();
+		packet->size = enc->packet.data.size();
+		packet->type = OBS_ENCODER_VIDEO;
+		packet->keyframe = enc->packet.keyframe;
+		packet->pts = enc->packet.pts;
+		packet->dts = enc->packet.dts;
 	}
 
-	if (!have_output)
-		*received_packet = ProcessOutput(enc, packet);
-
 	return true;
 
 } catch (...) {
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "nvEncodeAPI.h"
+
+// Surface and timestamp bookkeeping for the NVENC encoder. The encode thread
+// (libobs) fills idle surfaces and submits them, the output thread waits for
+// their bitstreams and hands finished packets back:
+//
+//   idle -> Acquire      encode thread, the surface gets filled
+//        -> Submit       nvEncEncodePicture was called, surface is processing
+//        -> ready        sync mode only, once nvEncEncodePicture returned
+//                        output for everything processing (not
+//                        NEED_MORE_INPUT); async surfaces are done when their
+//                        completion event fires
+//        -> Next/Finish  output thread, bitstream copied into a packet
+//        -> idle
+//
+// Bitstreams are retrieved in submission order, NVENC fills the output
+// buffers in that order even when b-frames reorder pictures. Packet pts come
+// from the bitstream, dts are the submitted timestamps in order; with
+// b-frames the first packet's dts is moved back by one frame interval so dts
+// never passes pts, so output waits until two frames were submitted.
+struct EncodedPacket {
+	std::vector<uint8_t> data;
+	int64_t pts = 0;
+	int64_t dts = 0;
+	bool keyframe = false;
+};
+
+template <typename Surface>
+struct SurfaceQueue {
+	// before the threads start
+	void Configure(bool async, bool b_frames)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->async = async;
+		this->b_frames = b_frames;
+		dts_known = false;
+		stopping = false;
+	}
+
+	void Add(Surface *surface)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		idle.push_back(surface);
+	}
+
+	// Acquire and Next return nullptr from now on
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		surface_available.notify_all();
+		output_available.notify_all();
+	}
+
+	// forgets all surfaces, timestamps and packets; the output thread must
+	// not be running
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		idle.clear();
+		processing.clear();
+		ready.clear();
+		timestamps.clear();
+		packets.clear();
+		spare.clear();
+		dts_known = false;
+	}
+
+	// encode thread; waits up to timeout for the output thread to free a
+	// surface if all of them are in flight
+	Surface *Acquire(std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!surface_available.wait_for(lock, timeout, [&] { return stopping || !idle.empty(); }) || stopping)
+			return nullptr;
+
+		auto surface = idle.front();
+		idle.pop_front();
+		return surface;
+	}
+
+	// encode thread; the surface wasn't submitted after all
+	void Return(Surface *surface)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		idle.push_front(surface);
+	}
+
+	// encode thread; has_output is false if nvEncEncodePicture returned
+	// NV_ENC_ERR_NEED_MORE_INPUT
+	void Submit(Surface *surface, int64_t pts, bool has_output)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			timestamps.push_back(pts);
+			processing.push_back(surface);
+
+			if (!async && has_output) {
+				ready.insert(ready.end(), processing.begin(), processing.end());
+				processing.clear();
+			}
+		}
+		output_available.notify_one();
+	}
+
+	// encode thread; the oldest finished packet, the buffer previously held
+	// by `packet` is reused for later packets
+	bool Pop(EncodedPacket &packet)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (packets.empty())
+			return false;
+
+		if (packet.data.capacity())
+			spare.push_back(std::move(packet.data));
+
+		packet = std::move(packets.front());
+		packets.pop_front();
+		return true;
+	}
+
+	// output thread; the next surface to retrieve the bitstream of, it stays
+	// queued until Finish. In async mode the caller still has to wait for its
+	// completion event
+	Surface *Next()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		output_available.wait(lock, [&] { return stopping || HasOutput(); });
+		if (stopping)
+			return nullptr;
+
+		return async ? processing.front() : ready.front();
+	}
+
+	// output thread; returns the surface from Next to idle and queues the
+	// packet unless retrieving it failed. `packet` gets an empty one with a
+	// recycled buffer
+	void Finish(Surface *surface, EncodedPacket &packet, bool success)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto &queue = async ? processing : ready;
+			if (queue.empty() || queue.front() != surface)
+				return;
+
+			queue.pop_front();
+			idle.push_back(surface);
+
+			// timestamps are consumed even for failed packets, later
+			// packets would get the wrong dts otherwise
+			if (b_frames && !dts_known) {
+				auto ts0 = timestamps[0];
+				auto ts1 = timestamps[1];
+				packet.dts = ts0 - (ts1 - ts0);
+				dts_known = true;
+			} else {
+				packet.dts = timestamps.front();
+				timestamps.pop_front();
+			}
+
+			if (success)
+				packets.push_back(std::move(packet));
+
+			packet.data.clear();
+			if (success && !spare.empty()) {
+				packet.data = std::move(spare.back());
+				spare.pop_back();
+			}
+		}
+		surface_available.notify_one();
+	}
+
+protected:
+	std::mutex mutex;
+	std::condition_variable surface_available;
+	std::condition_variable output_available;
+
+	std::deque<Surface*> idle;
+	std::deque<Surface*> processing;
+	std::deque<Surface*> ready;
+
+	std::deque<int64_t> timestamps;
+	std::deque<EncodedPacket> packets;
+	std::vector<std::vector<uint8_t>> spare;
+
+	bool async = false;
+	bool b_frames = false;
+	bool dts_known = false;
+	bool stopping = false;
+
+	bool HasOutput() const
+	{
+		if (b_frames && !dts_known && timestamps.size() < 2)
+			return false;
+
+		return async ? !processing.empty() : !ready.empty();
+	}
+};
+
+// locks `output`, copies the bitstream into packet.data and its timestamp
+// into packet.pts; the packet is valid if locking succeeded, unlock_sts is
+// the result of unlocking it again
+inline NVENCSTATUS ReadBitstream(const NV_ENCODE_API_FUNCTION_LIST &funcs, void *nv_encoder, NV_ENC_OUTPUT_PTR output,
+	std::vector<uint32_t> &slice_offsets, EncodedPacket &packet, NVENCSTATUS &unlock_sts)
+{
+	NV_ENC_LOCK_BITSTREAM lock = { 0 };
+	lock.version = NV_ENC_LOCK_BITSTREAM_VER;
+	lock.outputBitstream = output;
+	lock.sliceOffsets = slice_offsets.data();
+
+	unlock_sts = NV_ENC_SUCCESS;
+	if (auto sts = funcs.nvEncLockBitstream(nv_encoder, &lock))
+		return sts;
+
+	auto bitstream_ptr = reinterpret_cast<uint8_t*>(lock.bitstreamBufferPtr);
+	packet.data.assign(bitstream_ptr, bitstream_ptr + lock.bitstreamSizeInBytes);
+	packet.pts = static_cast<int64_t>(lock.outputTimeStamp);
+
+	unlock_sts = funcs.nvEncUnlockBitstream(nv_encoder, output);
+	return NV_ENC_SUCCESS;
+}
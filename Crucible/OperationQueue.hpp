@@ -0,0 +1,400 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Callable with inline storage; callables that don't fit are moved to the
+// heap, which is reported by Emplace so callers can count it
+template <size_t Size>
+struct InplaceFunction {
+	InplaceFunction() = default;
+	InplaceFunction(const InplaceFunction &) = delete;
+	InplaceFunction &operator=(const InplaceFunction &) = delete;
+
+	~InplaceFunction()
+	{
+		Reset();
+	}
+
+	template <typename Fun>
+	bool Emplace(Fun &&f)
+	{
+		using F = typename std::decay<Fun>::type;
+
+		Reset();
+		return Store<F>(std::forward<Fun>(f), std::integral_constant<bool, Fits<F>()>{});
+	}
+
+	void operator()()
+	{
+		invoke(&storage);
+	}
+
+	void Reset()
+	{
+		if (destroy)
+			destroy(&storage);
+
+		invoke = nullptr;
+		destroy = nullptr;
+	}
+
+	explicit operator bool() const
+	{
+		return !!invoke;
+	}
+
+protected:
+	typename std::aligned_storage<Size, alignof(std::max_align_t)>::type storage;
+	void (*invoke)(void *storage) = nullptr;
+	void (*destroy)(void *storage) = nullptr;
+
+	template <typename F>
+	static constexpr bool Fits()
+	{
+		return sizeof(F) <= Size && alignof(F) <= alignof(std::max_align_t);
+	}
+
+	template <typename F, typename Fun>
+	bool Store(Fun &&f, std::true_type)
+	{
+		new (&storage) F(std::forward<Fun>(f));
+		invoke = [](void *p) { (*static_cast<F*>(p))(); };
+		destroy = [](void *p) { static_cast<F*>(p)->~F(); };
+		return false;
+	}
+
+	template <typename F, typename Fun>
+	bool Store(Fun &&f, std::false_type)
+	{
+		new (&storage) F*(new F(std::forward<Fun>(f)));
+		invoke = [](void *p) { (**static_cast<F**>(p))(); };
+		destroy = [](void *p) { delete *static_cast<F**>(p); };
+		return true;
+	}
+};
+
+// log2 buckets over nanoseconds, bucket i counts values in [2^i, 2^(i+1))
+struct LatencyHistogram {
+	static const size_t bucket_count = 40;
+
+	std::array<std::atomic<uint64_t>, bucket_count> buckets;
+
+	LatencyHistogram()
+	{
+		for (auto &bucket : buckets)
+			bucket = 0;
+	}
+
+	static size_t Bucket(uint64_t ns)
+	{
+		size_t bucket = 0;
+		while (ns >>= 1)
+			bucket += 1;
+		return bucket < bucket_count ? bucket : bucket_count - 1;
+	}
+
+	void Add(uint64_t ns)
+	{
+		buckets[Bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	std::array<uint64_t, bucket_count> Snapshot() const
+	{
+		std::array<uint64_t, bucket_count> res;
+		for (size_t i = 0; i < bucket_count; i++)
+			res[i] = buckets[i].load(std::memory_order_relaxed);
+		return res;
+	}
+
+	// upper bound (in ns) of the bucket containing the given percentile
+	uint64_t Percentile(double percentile) const
+	{
+		auto snapshot = Snapshot();
+
+		uint64_t total = 0;
+		for (auto count : snapshot)
+			total += count;
+
+		if (!total)
+			return 0;
+
+		uint64_t target = static_cast<uint64_t>(total * percentile / 100.);
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucket_count; i++) {
+			seen += snapshot[i];
+			if (seen > target)
+				return (uint64_t(2) << i) - 1;
+		}
+
+		return (uint64_t(2) << (bucket_count - 1)) - 1;
+	}
+};
+
+// Bounded multi producer, single consumer queue of operations (Vyukov style,
+// per slot sequence numbers). Producers never block on each other; when the
+// ring is full operations spill into a locked overflow list which keeps
+// per producer ordering until the consumer has drained it.
+struct OperationLane {
+	using clock = std::chrono::steady_clock;
+
+	static const size_t inline_size = 128;
+	static const size_t default_capacity = 1024;
+
+	struct Stats {
+		std::atomic<uint64_t> pushed;
+		std::atomic<uint64_t> executed;
+		std::atomic<uint64_t> overflowed;
+		std::atomic<uint64_t> heap_allocated;
+
+		LatencyHistogram enqueue; // time spent in Push
+		LatencyHistogram wait;    // Push -> start of execution
+
+		Stats()
+			: pushed(0), executed(0), overflowed(0), heap_allocated(0)
+		{}
+	};
+
+	explicit OperationLane(size_t capacity = default_capacity)
+		: mask(RoundCapacity(capacity) - 1), slots(new Slot[mask + 1]), enqueue_pos(0), dequeue_pos(0), overflowing(false)
+	{
+		for (size_t i = 0; i <= mask; i++)
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	OperationLane(const OperationLane &) = delete;
+	OperationLane &operator=(const OperationLane &) = delete;
+
+	template <typename Fun>
+	void Push(Fun &&f)
+	{
+		auto start = clock::now();
+		auto queued_at = Timestamp(start);
+
+		if (overflowing.load(std::memory_order_acquire) || !TryPushRing(std::forward<Fun>(f), queued_at))
+			PushOverflow(std::forward<Fun>(f), queued_at);
+
+		stats.pushed.fetch_add(1, std::memory_order_relaxed);
+		stats.enqueue.Add(Timestamp(clock::now()) - queued_at);
+	}
+
+	// consumer side; runs the oldest operation, returns false if the lane
+	// was empty
+	bool RunOne()
+	{
+		return RunRing() || RunOverflow();
+	}
+
+	const Stats &GetStats() const
+	{
+		return stats;
+	}
+
+	size_t Capacity() const
+	{
+		return mask + 1;
+	}
+
+protected:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		InplaceFunction<inline_size> func;
+		uint64_t queued_at = 0;
+	};
+
+	struct OverflowOp {
+		std::function<void()> func;
+		uint64_t queued_at;
+	};
+
+	const size_t mask;
+	std::unique_ptr<Slot[]> slots;
+
+	std::atomic<size_t> enqueue_pos;
+	size_t dequeue_pos;
+
+	std::atomic<bool> overflowing;
+	std::mutex overflow_mutex;
+	std::deque<OverflowOp> overflow;
+	std::deque<OverflowOp> overflow_batch; // consumer only
+
+	Stats stats;
+
+	static size_t RoundCapacity(size_t capacity)
+	{
+		size_t res = 2;
+		while (res < capacity)
+			res <<= 1;
+		return res;
+	}
+
+	static uint64_t Timestamp(clock::time_point t)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+	}
+
+	template <typename Fun>
+	bool TryPushRing(Fun &&f, uint64_t queued_at)
+	{
+		auto pos = enqueue_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			auto &slot = slots[pos & mask];
+			auto seq = slot.sequence.load(std::memory_order_acquire);
+			auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (diff == 0) {
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		auto &slot = slots[pos & mask];
+		if (slot.func.Emplace(std::forward<Fun>(f)))
+			stats.heap_allocated.fetch_add(1, std::memory_order_relaxed);
+		slot.queued_at = queued_at;
+		slot.sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	template <typename Fun>
+	void PushOverflow(Fun &&f, uint64_t queued_at)
+	{
+		std::lock_guard<std::mutex> lock(overflow_mutex);
+		overflow.push_back(OverflowOp{ std::forward<Fun>(f), queued_at });
+		overflowing.store(true, std::memory_order_release);
+
+		stats.overflowed.fetch_add(1, std::memory_order_relaxed);
+		stats.heap_allocated.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	bool RunRing()
+	{
+		auto &slot = slots[dequeue_pos & mask];
+		if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos + 1)
+			return false;
+
+		stats.wait.Add(Timestamp(clock::now()) - slot.queued_at);
+
+		slot.func();
+		slot.func.Reset();
+
+		slot.sequence.store(dequeue_pos + mask + 1, std::memory_order_release);
+		dequeue_pos += 1;
+
+		stats.executed.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// only reached once the ring is empty, so everything in the overflow list
+	// was queued after the operations that were in the ring
+	bool RunOverflow()
+	{
+		if (overflow_batch.empty()) {
+			std::lock_guard<std::mutex> lock(overflow_mutex);
+			if (overflow.empty()) {
+				overflowing.store(false, std::memory_order_release);
+				return false;
+			}
+
+			swap(overflow, overflow_batch);
+		}
+
+		auto op = std::move(overflow_batch.front());
+		overflow_batch.pop_front();
+
+		stats.wait.Add(Timestamp(clock::now()) - op.queued_at);
+
+		op.func();
+
+		stats.executed.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+};
+
+enum OperationPriority : uint8_t {
+	OPERATION_PRIORITY_HIGH,
+	OPERATION_PRIORITY_NORMAL,
+	OPERATION_PRIORITY_LOW,
+
+	OPERATION_PRIORITY_COUNT
+};
+
+// One OperationLane per priority; the consumer always runs the oldest
+// operation of the highest priority lane that has work. `wake` is called
+// when the queue goes from idle to having work (at most once per Run).
+struct OperationQueue {
+	explicit OperationQueue(std::function<void()> wake, size_t capacity = OperationLane::default_capacity)
+		: wake(std::move(wake)), wake_pending(false)
+	{
+		for (auto &lane : lanes)
+			lane.reset(new OperationLane(capacity));
+	}
+
+	OperationQueue(const OperationQueue &) = delete;
+	OperationQueue &operator=(const OperationQueue &) = delete;
+
+	template <typename Fun>
+	void Push(Fun &&f, OperationPriority priority = OPERATION_PRIORITY_NORMAL)
+	{
+		lanes[priority < OPERATION_PRIORITY_COUNT ? priority : OPERATION_PRIORITY_NORMAL]->Push(std::forward<Fun>(f));
+
+		if (!wake_pending.exchange(true, std::memory_order_acq_rel) && wake)
+			wake();
+	}
+
+	// consumer side; runs up to `max_ops` operations and returns true if
+	// there may be more work left (the caller should call Run again soon)
+	bool Run(size_t max_ops = 256)
+	{
+		// an RMW, not a store: the lane loads below must not be satisfied
+		// before `false` is visible, otherwise a Push in between sees the
+		// stale `true` and skips wake() while we miss its operation
+		wake_pending.exchange(false, std::memory_order_acq_rel);
+
+		size_t ran = 0;
+		for (; ran < max_ops; ran++) {
+			if (!RunOne())
+				break;
+		}
+
+		if (ran < max_ops)
+			return false;
+
+		if (!wake_pending.exchange(true, std::memory_order_acq_rel) && wake)
+			wake();
+		return true;
+	}
+
+	const OperationLane::Stats &GetStats(OperationPriority priority) const
+	{
+		return lanes[priority]->GetStats();
+	}
+
+protected:
+	std::function<void()> wake;
+	std::atomic<bool> wake_pending;
+
+	std::array<std::unique_ptr<OperationLane>, OPERATION_PRIORITY_COUNT> lanes;
+
+	bool RunOne()
+	{
+		for (auto &lane : lanes)
+			if (lane->RunOne())
+				return true;
+
+		return false;
+	}
+};
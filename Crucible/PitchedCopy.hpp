@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define PITCHED_COPY_SSE2
+#include <emmintrin.h>
+#endif
+
+// 2D copies between buffers with different row pitches, e.g. a tightly
+// packed framebuffer into a mapped texture or encoder input surface.
+//
+// Surfaces of at least `streaming_threshold` bytes are written with
+// non-temporal stores: the destination is usually write-combined GPU memory
+// or at least won't be read back by the CPU, so there is no point in
+// evicting the cache for it.
+namespace PitchedCopy {
+	enum Swizzle {
+		SWIZZLE_NONE,
+		SWIZZLE_BGRA_RGBA, // swaps bytes 0 and 2 of every 32 bit pixel, works both ways
+	};
+
+	const size_t streaming_threshold = 1024 * 1024;
+
+	namespace Detail {
+		inline uint32_t SwapRB(uint32_t px)
+		{
+			return (px & 0xff00ff00) | ((px >> 16) & 0xff) | ((px & 0xff) << 16);
+		}
+
+		inline void SwizzleRow(uint8_t *dst, const uint8_t *src, size_t size)
+		{
+			for (size_t i = 0; i + 4 <= size; i += 4) {
+				uint32_t px;
+				memcpy(&px, src + i, 4);
+				px = SwapRB(px);
+				memcpy(dst + i, &px, 4);
+			}
+		}
+
+#ifdef PITCHED_COPY_SSE2
+		inline __m128i SwapRB(__m128i v)
+		{
+			auto ga = _mm_and_si128(v, _mm_set1_epi32(0xff00ff00));
+			auto r = _mm_and_si128(_mm_srli_epi32(v, 16), _mm_set1_epi32(0xff));
+			auto b = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xff)), 16);
+			return _mm_or_si128(ga, _mm_or_si128(r, b));
+		}
+
+		// `dst` must be 16 byte aligned
+		template <bool Stream, bool Swap>
+		inline void CopyBlocks(uint8_t *dst, const uint8_t *src, size_t size)
+		{
+			size_t i = 0;
+			for (; i + 64 <= size; i += 64) {
+				auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+				auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 32));
+				auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 48));
+				if (Swap) {
+					a = SwapRB(a);
+					b = SwapRB(b);
+					c = SwapRB(c);
+					d = SwapRB(d);
+				}
+				if (Stream) {
+					_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), a);
+					_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 16), b);
+					_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 32), c);
+					_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 48), d);
+				} else {
+					_mm_store_si128(reinterpret_cast<__m128i*>(dst + i), a);
+					_mm_store_si128(reinterpret_cast<__m128i*>(dst + i + 16), b);
+					_mm_store_si128(reinterpret_cast<__m128i*>(dst + i + 32), c);
+					_mm_store_si128(reinterpret_cast<__m128i*>(dst + i + 48), d);
+				}
+			}
+
+			for (; i + 16 <= size; i += 16) {
+				auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				if (Swap)
+					a = SwapRB(a);
+				if (Stream)
+					_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), a);
+				else
+					_mm_store_si128(reinterpret_cast<__m128i*>(dst + i), a);
+			}
+
+			if (Swap)
+				SwizzleRow(dst + i, src + i, size - i);
+			else
+				memcpy(dst + i, src + i, size - i);
+		}
+
+		template <bool Stream, bool Swap>
+		inline void CopyRows(uint8_t *dst, size_t dst_pitch, const uint8_t *src, size_t src_pitch, size_t row_size, size_t rows)
+		{
+			for (size_t y = 0; y < rows; y++, dst += dst_pitch, src += src_pitch) {
+				// align the destination, swizzling needs whole pixels for that
+				auto head = static_cast<size_t>(-reinterpret_cast<uintptr_t>(dst) & 15);
+				if (Swap && head % 4) {
+					SwizzleRow(dst, src, row_size);
+					continue;
+				}
+
+				if (head > row_size)
+					head = row_size;
+
+				if (Swap)
+					SwizzleRow(dst, src, head);
+				else
+					memcpy(dst, src, head);
+
+				CopyBlocks<Stream, Swap>(dst + head, src + head, row_size - head);
+			}
+
+			if (Stream)
+				_mm_sfence();
+		}
+#endif
+	}
+
+	// copies `rows` rows of `row_size` bytes; with a swizzle `row_size` has
+	// to be a multiple of 4
+	inline void Copy(uint8_t *dst, size_t dst_pitch, const uint8_t *src, size_t src_pitch, size_t row_size, size_t rows, Swizzle swizzle = SWIZZLE_NONE)
+	{
+		using namespace Detail;
+
+		bool stream = row_size * rows >= streaming_threshold;
+
+#ifdef PITCHED_COPY_SSE2
+		if (swizzle == SWIZZLE_BGRA_RGBA) {
+			if (stream)
+				CopyRows<true, true>(dst, dst_pitch, src, src_pitch, row_size, rows);
+			else
+				CopyRows<false, true>(dst, dst_pitch, src, src_pitch, row_size, rows);
+			return;
+		}
+
+		if (stream) {
+			CopyRows<true, false>(dst, dst_pitch, src, src_pitch, row_size, rows);
+			return;
+		}
+#else
+		(void)stream;
+
+		if (swizzle == SWIZZLE_BGRA_RGBA) {
+			for (size_t y = 0; y < rows; y++)
+				SwizzleRow(dst + y * dst_pitch, src + y * src_pitch, row_size);
+			return;
+		}
+#endif
+
+		if (dst_pitch == row_size && src_pitch == row_size) {
+			memcpy(dst, src, row_size * rows);
+			return;
+		}
+
+		for (size_t y = 0; y < rows; y++)
+			memcpy(dst + y * dst_pitch, src + y * src_pitch, row_size);
+	}
+}
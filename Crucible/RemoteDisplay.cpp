@@ -11,14 +11,22 @@
 
 #include "OBSHelpers.hpp"
 
+#include "FrameCodec.hpp"
+#include "FramePacer.hpp"
+#include "FrameSlots.hpp"
+#include "FramebufferProtocol.hpp"
 #include "IPC.hpp"
+#include "ImageEncoder.hpp"
+#include "PitchedCopy.hpp"
 #include "ProtectedObject.hpp"
 #include "ThreadTools.hpp"
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <condition_variable>
 #include <deque>
+#include <functional>
 #include <map>
 #include <thread>
 
@@ -32,18 +40,31 @@ static const std::string info_header_fragment = "FramebufferInfo";
 
 #define LOCK(x) std::lock_guard<decltype(x)> CONCAT(lockGuard, __LINE__){x};
 
+static ProtectedObject<Display::stats_callback_t> stats_callback;
+
 struct RemoteDisplay {
 	std::string remote_display_name = "";
 	OBSDisplay display;
 	OBSView view;
 	OBSSource source;
 
-	bool Connect(const std::string &name)
+	bool Connect(const std::string &name, bool binary_framing_, bool shared_memory_)
 	{
 		LOCK(send_mutex);
 		if (!framebuffer_client.Open(name))
 			return false;
 
+		binary_framing = binary_framing_;
+		shared_memory = shared_memory_;
+
+		// the new client has to be told about the mapping
+		frame_slots.Reset();
+		slots_exhausted_logged = false;
+		slots_failed_logged = false;
+
+		pacer.Reset();
+		delta_encoder.Reset();
+
 		StartSendThread();
 		return true;
 	}
@@ -103,6 +124,22 @@ struct RemoteDisplay {
 		draw_cy = cy;
 	}
 
+	void SetCompression(FramebufferProtocol::Compression compression_, int jpeg_quality_)
+	{
+		LOCK(send_mutex);
+		compression = compression_;
+		jpeg_quality = jpeg_quality_;
+		delta_encoder.Reset();
+		compression_failed_logged = false;
+	}
+
+	void SetPacing(uint32_t max_fps, uint32_t stats_interval_ms)
+	{
+		pacer.SetMaxFPS(max_fps);
+		pacer.Reset();
+		stats_interval = stats_interval_ms * 1000000ULL;
+	}
+
 protected:
 	std::vector<gs_texrender_t*> texrender;
 	std::vector<gs_stagesurf_t*> stagesurf;
@@ -112,6 +149,7 @@ protected:
 		uint32_t height;
 		uint32_t line_size;
 		uint8_t *data = nullptr;
+		uint64_t timestamp = 0;
 	};
 
 	using Mapped_t = std::pair<gs_stagesurf_t*, MappingInfo>;
@@ -131,6 +169,29 @@ protected:
 	std::mutex send_mutex;
 	IPCClient framebuffer_client;
 
+	// send FramebufferProtocol messages instead of the info + payload pair
+	bool binary_framing = false;
+	uint64_t frame_sequence = 0;
+	std::vector<uint8_t> send_buffer;
+
+	// compress framed messages (not frames in shared memory, copying them
+	// there is cheaper than encoding)
+	FramebufferProtocol::Compression compression = FramebufferProtocol::COMPRESSION_NONE;
+	int jpeg_quality = 80;
+	FrameCodec::Encoder delta_encoder;
+	std::vector<uint8_t> jpeg_input;
+	bool compression_failed_logged = false;
+
+	// copy frames into shared memory slots, only notifications go through the pipe
+	bool shared_memory = false;
+	FrameSlots::Producer frame_slots;
+	bool slots_exhausted_logged = false;
+	bool slots_failed_logged = false;
+
+	// renders only as often as the receiver takes frames
+	FramePacer pacer;
+	std::atomic<uint64_t> stats_interval{ 0 };
+
 	JoiningThread send_thread;
 
 	uint32_t draw_cx = 0;
@@ -149,8 +210,17 @@ protected:
 
 		send_thread.t = std::thread([&]
 		{
+			// WIC for JPEG compression
+			auto com = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+			DEFER
+			{
+				if (SUCCEEDED(com))
+					CoUninitialize();
+			};
+
 			OBSData data = OBSDataCreate();
 			bool last_send_failed = false;
+			StatsWindow window;
 			for (;;) {
 				{
 					std::unique_lock<std::mutex> lk(mutex);
@@ -183,8 +253,29 @@ protected:
 				obs_data_set_int(data, "height", info.height);
 
 				bool success = false;
+				bool congested = false;
+				bool dropped = false;
+				auto send_start = os_gettime_ns();
 				do {
 					LOCK(send_mutex);
+					if (shared_memory) {
+						success = SendSlot(info, congested, dropped);
+						if (success && last_send_failed)
+							blog(LOG_INFO, "RemoteDisplay[%s]: resumed sending", remote_display_name.c_str());
+						else if (!success && !last_send_failed)
+							blog(LOG_WARNING, "RemoteDisplay[%s]: failed to send slot notification", remote_display_name.c_str());
+						break;
+					}
+
+					if (binary_framing || compression != FramebufferProtocol::COMPRESSION_NONE) {
+						success = SendFramed(info);
+						if (success && last_send_failed)
+							blog(LOG_INFO, "RemoteDisplay[%s]: resumed sending (size: %zu)", remote_display_name.c_str(), send_buffer.size());
+						else if (!success && !last_send_failed)
+							blog(LOG_WARNING, "RemoteDisplay[%s]: failed to send (size: %zu)", remote_display_name.c_str(), send_buffer.size());
+						break;
+					}
+
 					auto json = obs_data_get_json(data);
 					success = !!json;
 					if (!json) {
@@ -205,6 +296,16 @@ protected:
 						blog(LOG_WARNING, "RemoteDisplay[%s]: failed to send (size: %u, payload: %u)", remote_display_name.c_str(), info.line_size * info.height, info.width * info.height * 4);
 				} while (false);
 
+				auto send_end = os_gettime_ns();
+				if (dropped)
+					pacer.Congested();
+				else
+					pacer.Sent(info.timestamp, send_start, send_end, success, congested);
+
+				if (success && !dropped)
+					window.Add(send_end - info.timestamp);
+				ReportStats(window, send_end);
+
 				last_send_failed = !success;
 
 				if (!success)
@@ -213,6 +314,163 @@ protected:
 		});
 	}
 
+	// requires send_mutex; header and tightly packed (or compressed) rows in one message
+	bool SendFramed(const MappingInfo &info)
+	{
+		auto row_size = info.width * FramebufferProtocol::bytes_per_pixel;
+		auto header = FramebufferProtocol::MakeHeader(info.width, info.height, row_size, FramebufferProtocol::FORMAT_RGBA, ++frame_sequence, info.timestamp);
+
+		if (compression == FramebufferProtocol::COMPRESSION_NONE || !Compress(info, header)) {
+			send_buffer.resize(sizeof(header) + static_cast<size_t>(row_size) * info.height);
+			memcpy(send_buffer.data(), &header, sizeof(header));
+
+			auto dst = send_buffer.data() + sizeof(header);
+			auto src = info.data;
+			for (uint32_t y = 0; y < info.height; y++) {
+				memcpy(dst, src, row_size);
+				dst += row_size;
+				src += info.line_size;
+			}
+		}
+
+		if (!framebuffer_client.Write(send_buffer.data(), send_buffer.size())) {
+			// the client may not have the frame the next delta refers to
+			delta_encoder.Reset();
+			return false;
+		}
+
+		return true;
+	}
+
+	struct StatsWindow {
+		uint64_t start = 0;
+		uint64_t frames = 0;
+		uint64_t latency_sum = 0;
+		uint64_t latency_max = 0;
+
+		void Add(uint64_t latency)
+		{
+			frames += 1;
+			latency_sum += latency;
+			latency_max = std::max(latency_max, latency);
+		}
+	};
+
+	// send thread
+	void ReportStats(StatsWindow &window, uint64_t now)
+	{
+		auto interval = stats_interval.load();
+		if (!window.start || !interval) {
+			window = {};
+			window.start = now;
+			return;
+		}
+
+		auto elapsed = now - window.start;
+		if (elapsed < interval)
+			return;
+
+		Display::Stats stats = {};
+		stats.fps = window.frames * 1e9 / elapsed;
+		stats.target_fps = pacer.Interval() ? 1e9 / pacer.Interval() : 0.;
+		stats.latency_ms = window.frames ? window.latency_sum / 1e6 / window.frames : 0.;
+		stats.max_latency_ms = window.latency_max / 1e6;
+		stats.frames_sent = pacer.stats.sent;
+		stats.frames_failed = pacer.stats.failed;
+		stats.frames_paced = pacer.stats.paced;
+		stats.frames_replaced = pacer.stats.replaced;
+		stats.frames_dropped = pacer.stats.dropped;
+
+		window = {};
+		window.start = now;
+
+		auto callback = *stats_callback.Lock();
+		if (callback)
+			callback(remote_display_name, stats);
+	}
+
+	// requires send_mutex; fills send_buffer with the compressed message,
+	// returns false if the frame has to be sent uncompressed instead
+	bool Compress(const MappingInfo &info, FramebufferProtocol::Header header)
+	{
+		header.compression = compression;
+
+		send_buffer.resize(sizeof(header));
+		memcpy(send_buffer.data(), &header, sizeof(header));
+
+		if (compression == FramebufferProtocol::COMPRESSION_DELTA_RLE) {
+			delta_encoder.Encode(info.data, info.line_size, info.width, info.height, send_buffer);
+		} else {
+			auto row_size = info.width * FramebufferProtocol::bytes_per_pixel;
+			jpeg_input.resize(static_cast<size_t>(row_size) * info.height);
+			PitchedCopy::Copy(jpeg_input.data(), row_size, info.data, info.line_size, row_size, info.height, PitchedCopy::SWIZZLE_BGRA_RGBA);
+
+			ImageEncoder::Options options;
+			options.format = ImageEncoder::FORMAT_JPEG;
+			options.jpeg_quality = jpeg_quality;
+			if (auto err = ImageEncoder::EncodeToMemory(jpeg_input.data(), info.width, info.height, send_buffer, options)) {
+				if (!compression_failed_logged)
+					blog(LOG_WARNING, "RemoteDisplay[%s]: JPEG compression failed, sending uncompressed frames: %s", remote_display_name.c_str(), err->c_str());
+				compression_failed_logged = true;
+				return false;
+			}
+		}
+
+		compression_failed_logged = false;
+		return true;
+	}
+
+	// requires send_mutex; falls back to SendFramed if no mapping can be created.
+	// congested: an unread frame had to be replaced, dropped: the client holds
+	// every slot
+	bool SendSlot(const MappingInfo &info, bool &congested, bool &dropped)
+	{
+		auto row_size = info.width * FramebufferProtocol::bytes_per_pixel;
+
+		FrameSlots::Announce announce;
+		if (frame_slots.Prepare(static_cast<size_t>(row_size) * info.height, announce)) {
+			blog(LOG_INFO, "RemoteDisplay[%s]: created frame slots '%s' (%ux%u, %u slots)", remote_display_name.c_str(), announce.name, info.width, info.height, announce.slot_count);
+			if (!framebuffer_client.Write(&announce, sizeof(announce))) {
+				frame_slots.Reset();
+				return false;
+			}
+		}
+
+		if (!frame_slots.Valid()) {
+			if (!slots_failed_logged)
+				blog(LOG_WARNING, "RemoteDisplay[%s]: could not create frame slots, sending frames through the pipe", remote_display_name.c_str());
+			slots_failed_logged = true;
+			return SendFramed(info);
+		}
+
+		auto replaced = frame_slots.frames_replaced;
+		auto slot = frame_slots.Acquire();
+		if (slot < 0) {
+			if (!slots_exhausted_logged)
+				blog(LOG_WARNING, "RemoteDisplay[%s]: all frame slots are held by the client, dropping frames", remote_display_name.c_str());
+			slots_exhausted_logged = true;
+			dropped = true;
+			return true;
+		}
+
+		slots_exhausted_logged = false;
+
+		if (frame_slots.frames_replaced != replaced) {
+			pacer.Replaced();
+			congested = true;
+		}
+
+		PitchedCopy::Copy(frame_slots.Data(slot), row_size, info.data, info.line_size, row_size, info.height);
+
+		auto ready = frame_slots.Publish(slot, info.width, info.height, row_size, FramebufferProtocol::FORMAT_RGBA, ++frame_sequence, info.timestamp);
+		if (!framebuffer_client.Write(&ready, sizeof(ready))) {
+			frame_slots.Abort(slot);
+			return false;
+		}
+
+		return true;
+	}
+
 	std::recursive_mutex draw_mutex;
 	bool staging_error_logged = false;
 	bool stage_exhaustion_logged = false;
@@ -257,11 +515,14 @@ protected:
 
 				mapped.second.width = gs_stagesurface_get_width(staging.second);
 				mapped.second.height = gs_stagesurface_get_height(staging.second);
+				mapped.second.timestamp = os_gettime_ns();
 				mapped.first = staging.second;
 
 				staging_texrender.pop_front();
 
 				auto css = copyable_stagesurface.Lock();
+				if (!css->empty())
+					pacer.Replaced(css->size());
 				for (auto &cs : *css) {
 					gs_stagesurface_unmap(cs.first);
 					almost_idle_stagesurface.push_back(cs.first);
@@ -291,6 +552,7 @@ protected:
 						blog(LOG_WARNING, "RemoteDisplay[%s]: Exhausted stagesurfaces (%d)", remote_display_name.c_str(), stagesurf.size());
 						stage_exhaustion_logged = true;
 					}
+					pacer.Dropped();
 					almost_idle_texrender.push_back(rendering_texrender.front());
 					rendering_texrender.pop_front();
 					break;
@@ -349,6 +611,9 @@ protected:
 		if (!cx || !cy)
 			return;
 
+		if (!pacer.ShouldRender(os_gettime_ns()))
+			return;
+
 		do {
 			if (texrender.size() > 3 && idle_texrender.empty()) {
 				if (!texrender_exhaustion_logged) {
@@ -461,11 +726,11 @@ namespace Display {
 		display.Display(source);
 	}
 
-	bool Connect(const char *name, const char *server)
+	bool Connect(const char *name, const char *server, bool binary_framing, bool shared_memory)
 	{
 		auto &display = displays[name];
 		display.UpdateName(name);
-		return display.Connect(server);
+		return display.Connect(server, binary_framing, shared_memory);
 	}
 
 	void SetEnabled(const char *name, bool enable)
@@ -482,6 +747,36 @@ namespace Display {
 		display.Resize(cx, cy);
 	}
 
+	bool SetCompression(const char *name, const char *codec, int jpeg_quality)
+	{
+		std::string str = codec ? codec : "";
+
+		auto compression = FramebufferProtocol::COMPRESSION_NONE;
+		if (str == "lossless")
+			compression = FramebufferProtocol::COMPRESSION_DELTA_RLE;
+		else if (str == "jpeg")
+			compression = FramebufferProtocol::COMPRESSION_JPEG;
+
+		auto known = compression != FramebufferProtocol::COMPRESSION_NONE || str.empty() || str == "none";
+
+		auto &display = displays[name];
+		display.UpdateName(name);
+		display.SetCompression(compression, jpeg_quality);
+		return known;
+	}
+
+	void SetPacing(const char *name, uint32_t max_fps, uint32_t stats_interval_ms)
+	{
+		auto &display = displays[name];
+		display.UpdateName(name);
+		display.SetPacing(max_fps, stats_interval_ms);
+	}
+
+	void SetStatsCallback(stats_callback_t callback)
+	{
+		*stats_callback.Lock() = std::move(callback);
+	}
+
 	std::vector<std::string> List()
 	{
 		std::vector<std::string> result;
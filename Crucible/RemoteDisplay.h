@@ -2,12 +2,38 @@
 
 namespace Display {
 	void SetSource(const char *name, obs_source_t *source);
-	bool Connect(const char *name, const char *server);
+	// shared_memory: frames go through FrameSlots, only notifications use the pipe
+	bool Connect(const char *name, const char *server, bool binary_framing = false, bool shared_memory = false);
 
 	void SetEnabled(const char *name, bool enable);
 
 	void Resize(const char *name, uint32_t cx, uint32_t cy);
 
+	// codec: "none" (or empty), "lossless" (FrameCodec) or "jpeg"; applies to
+	// frames sent through the pipe. Unknown codecs disable compression and
+	// return false
+	bool SetCompression(const char *name, const char *codec, int jpeg_quality = 80);
+
+	// max_fps caps the adaptive frame rate (0: only limited by the receiver);
+	// stats are reported every stats_interval_ms while frames are sent (0: off)
+	void SetPacing(const char *name, uint32_t max_fps, uint32_t stats_interval_ms);
+
+	struct Stats {
+		double fps;
+		double target_fps;
+		double latency_ms;      // mean time from readback to the frame being handed to the receiver
+		double max_latency_ms;
+		uint64_t frames_sent;
+		uint64_t frames_failed;
+		uint64_t frames_paced;
+		uint64_t frames_replaced;
+		uint64_t frames_dropped;
+	};
+
+	// called on the display's send thread
+	using stats_callback_t = std::function<void(const std::string &name, const Stats &stats)>;
+	void SetStatsCallback(stats_callback_t callback);
+
 	std::vector<std::string> List();
 
 	void Stop(const char *name);
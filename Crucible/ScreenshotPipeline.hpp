@@ -0,0 +1,503 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+// Staging surfaces of one size are expensive to create, so idle ones are
+// kept around and handed to the next request of the same size; the oldest
+// idle surfaces are destroyed once more than max_idle are kept.
+template <typename Backend>
+struct StagingRing {
+	using Surface = typename Backend::Stagesurf;
+
+	Backend &backend;
+	size_t max_idle = 4;
+
+	uint64_t created = 0;
+	uint64_t reused = 0;
+
+	explicit StagingRing(Backend &backend)
+		: backend(backend)
+	{}
+
+	~StagingRing()
+	{
+		Clear();
+	}
+
+	Surface Acquire(uint32_t cx, uint32_t cy)
+	{
+		for (auto it = begin(idle); it != end(idle); it++) {
+			if (it->cx != cx || it->cy != cy)
+				continue;
+
+			auto surface = it->surface;
+			idle.erase(it);
+			reused += 1;
+			return surface;
+		}
+
+		auto surface = backend.CreateStagesurf(cx, cy);
+		if (surface)
+			created += 1;
+		return surface;
+	}
+
+	void Release(Surface surface, uint32_t cx, uint32_t cy)
+	{
+		if (!surface)
+			return;
+
+		idle.push_back(Entry{ surface, cx, cy });
+		while (idle.size() > max_idle) {
+			backend.DestroyStagesurf(idle.front().surface);
+			idle.erase(begin(idle));
+		}
+	}
+
+	void Clear()
+	{
+		for (auto &entry : idle)
+			backend.DestroyStagesurf(entry.surface);
+		idle.clear();
+	}
+
+	size_t Idle() const
+	{
+		return idle.size();
+	}
+
+protected:
+	struct Entry {
+		Surface surface;
+		uint32_t cx;
+		uint32_t cy;
+	};
+
+	std::vector<Entry> idle;
+};
+
+// Intrusive multi-producer/single-consumer stack: any thread pushes without
+// locking, the consumer takes everything at once, oldest first. T needs a
+// `T *next` member and is owned by the stack while pushed.
+template <typename T>
+struct AtomicStack {
+	AtomicStack() = default;
+	AtomicStack(const AtomicStack &) = delete;
+	AtomicStack &operator=(const AtomicStack &) = delete;
+
+	~AtomicStack()
+	{
+		DeleteAll(TakeAll());
+	}
+
+	void Push(T *node)
+	{
+		node->next = head.load(std::memory_order_relaxed);
+		while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	static void DeleteAll(T *node)
+	{
+		while (node) {
+			auto next = node->next;
+			delete node;
+			node = next;
+		}
+	}
+
+	T *TakeAll()
+	{
+		auto node = head.exchange(nullptr, std::memory_order_acquire);
+
+		T *oldest = nullptr;
+		while (node) {
+			auto next = node->next;
+			node->next = oldest;
+			oldest = node;
+			node = next;
+		}
+		return oldest;
+	}
+
+protected:
+	std::atomic<T*> head{ nullptr };
+};
+
+// Screenshot request bookkeeping, independent of the graphics API. Every
+// Tick() (one per frame on the graphics thread) moves requests along
+//   queued -> staged (rendered and copied to a staging surface)
+//          -> saving (staging copy had a frame to finish, pixels were read
+//                     back and the surface recycled, encoded off-thread)
+//          -> completed
+// with up to max_in_flight requests in different stages at once.
+//
+// Request() and Cancel() may be called from any thread; they only push onto
+// lock-free stacks that Tick() drains. Every request's callback runs exactly
+// once: with the save result, or with an error when the request is cancelled,
+// times out or the pipeline shuts down first. Encodes that already started
+// can't be interrupted, so cancelling or timing out only affects requests
+// whose encode hasn't been picked up by a worker yet.
+//
+// Backend provides:
+//   Source, Stagesurf, Image, Options
+//   bool SourceSize(const Source&, uint32_t &cx, uint32_t &cy)
+//   void DefaultSize(const Options&, source_cx, source_cy, uint32_t &cx, uint32_t &cy)  (for requests without a size)
+//   Stagesurf CreateStagesurf(cx, cy), void DestroyStagesurf(Stagesurf)
+//   boost::optional<std::string> Render(const Source&, cx, cy, const Options&, Stagesurf)
+//   boost::optional<std::string> Read(Stagesurf, cx, cy, Image&)
+//   boost::optional<std::string> Save(const Image&, cx, cy, const std::string &filename, const Options&)  (any thread)
+//   void Submit(std::function<void()>)  (runs the function on a worker thread)
+template <typename Backend>
+struct ScreenshotPipeline {
+	using Source = typename Backend::Source;
+	using Stagesurf = typename Backend::Stagesurf;
+	using Image = typename Backend::Image;
+	using Options = typename Backend::Options;
+	using Clock = std::chrono::steady_clock;
+
+	// same as request_completion_t
+	using Callback = std::function<void(boost::optional<std::string> error, uint32_t cx, uint32_t cy, const std::string filename)>;
+
+	Backend &backend;
+	StagingRing<Backend> ring;
+
+	size_t max_in_flight = 4;
+
+	explicit ScreenshotPipeline(Backend &backend)
+		: backend(backend), ring(backend)
+	{}
+
+	~ScreenshotPipeline()
+	{
+		Shutdown();
+	}
+
+	// returns the id for Cancel()
+	uint64_t Request(Source source, uint32_t cx, uint32_t cy, const std::string &filename, const Options &options, std::chrono::milliseconds timeout, Callback callback)
+	{
+		std::unique_ptr<Job> job{ new Job{} };
+		job->id = next_id.fetch_add(1, std::memory_order_relaxed);
+		job->source = std::move(source);
+		job->cx = cx;
+		job->cy = cy;
+		job->filename = filename;
+		job->options = options;
+		job->callback = std::move(callback);
+		job->deadline = Clock::now() + timeout;
+
+		auto id = job->id;
+		if (shut_down.load(std::memory_order_acquire)) {
+			Complete(*job, std::string("screenshot provider is shutting down"));
+			return id;
+		}
+
+		submitted.Push(job.release());
+		return id;
+	}
+
+	void Cancel(uint64_t id)
+	{
+		cancelled.Push(new Cancellation{ id });
+	}
+
+	// returns true while requests are queued or in flight
+	bool Tick()
+	{
+		tick += 1;
+
+		TakeSubmitted();
+		ApplyCancellations();
+		ExpireTimedOut();
+
+		CompleteSaved();
+		ReadStaged();
+		StageQueued();
+
+		return !in_flight.empty() || !queued.empty();
+	}
+
+	// fails everything that hasn't started encoding and waits for running
+	// encodes to finish, so no worker touches the pipeline afterwards; has
+	// to be called on the graphics thread (or with graphics entered) and
+	// leaves the staging ring empty
+	void Shutdown()
+	{
+		shut_down.store(true, std::memory_order_release);
+
+		TakeSubmitted();
+		AtomicStack<Cancellation>::DeleteAll(cancelled.TakeAll());
+
+		const std::string error = "screenshot provider is shutting down";
+		for (auto &job : queued)
+			Complete(*job, error);
+		queued.clear();
+
+		for (auto it = begin(in_flight); it != end(in_flight);) {
+			if (Abandon(**it, error))
+				it = in_flight.erase(it);
+			else
+				it++;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(done_mutex);
+			done_cv.wait(lock, [&]
+			{
+				return std::all_of(begin(in_flight), end(in_flight), [](const std::unique_ptr<Job> &job)
+				{
+					return job->saved.load(std::memory_order_acquire);
+				});
+			});
+		}
+
+		CompleteSaved();
+		ring.Clear();
+	}
+
+	size_t InFlight() const
+	{
+		return in_flight.size();
+	}
+
+protected:
+	enum JobState {
+		JOB_STAGED,
+		JOB_SAVING,
+		JOB_ABANDONED, // callback already ran, waiting for the worker to let go
+	};
+
+	struct Job {
+		Job *next = nullptr;
+
+		uint64_t id = 0;
+		Source source;
+		uint32_t cx;
+		uint32_t cy;
+		std::string filename;
+		Options options;
+		Callback callback;
+		Clock::time_point deadline;
+
+		JobState state = JOB_STAGED;
+		Stagesurf stage = Stagesurf();
+		uint64_t staged_tick = 0;
+		Image image;
+		boost::optional<std::string> error;
+
+		// whoever sets `claimed` first decides whether the encode runs
+		// (worker) or the request fails (cancellation/timeout/shutdown)
+		std::atomic<bool> claimed{ false };
+		std::atomic<bool> saved{ false }; // worker is done with the job
+	};
+
+	struct Cancellation {
+		Cancellation *next = nullptr;
+		uint64_t id;
+
+		explicit Cancellation(uint64_t id)
+			: id(id)
+		{}
+	};
+
+	std::atomic<uint64_t> next_id{ 1 };
+	std::atomic<bool> shut_down{ false };
+	AtomicStack<Job> submitted;
+	AtomicStack<Cancellation> cancelled;
+
+	std::mutex done_mutex;
+	std::condition_variable done_cv;
+
+	// graphics thread only
+	std::deque<std::unique_ptr<Job>> queued;
+	std::deque<std::unique_ptr<Job>> in_flight;
+	uint64_t tick = 0;
+
+	static void Complete(Job &job, boost::optional<std::string> error)
+	{
+		if (job.callback)
+			job.callback(error, job.cx, job.cy, job.filename);
+	}
+
+	void TakeSubmitted()
+	{
+		for (auto job = submitted.TakeAll(); job;) {
+			auto next = job->next;
+			job->next = nullptr;
+			queued.emplace_back(job);
+			job = next;
+		}
+	}
+
+	// fails an in-flight job; returns true if it can be dropped right away,
+	// false if a worker still holds on to it
+	bool Abandon(Job &job, const std::string &error)
+	{
+		switch (job.state) {
+		case JOB_STAGED:
+			ring.Release(job.stage, job.cx, job.cy);
+			job.stage = Stagesurf();
+			Complete(job, error);
+			return true;
+
+		case JOB_SAVING: {
+			bool expected = false;
+			if (!job.claimed.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+				return false; // already encoding, completes normally
+
+			job.state = JOB_ABANDONED;
+			Complete(job, error);
+			return false;
+		}
+
+		case JOB_ABANDONED:
+			return false;
+		}
+
+		return false;
+	}
+
+	template <typename Pred>
+	void FailWhere(Pred pred, const std::string &error)
+	{
+		for (auto it = begin(queued); it != end(queued);) {
+			if (!pred(**it)) {
+				it++;
+				continue;
+			}
+
+			Complete(**it, error);
+			it = queued.erase(it);
+		}
+
+		for (auto it = begin(in_flight); it != end(in_flight);) {
+			if (pred(**it) && Abandon(**it, error))
+				it = in_flight.erase(it);
+			else
+				it++;
+		}
+	}
+
+	void ApplyCancellations()
+	{
+		auto cancellation = cancelled.TakeAll();
+		if (!cancellation)
+			return;
+
+		std::vector<uint64_t> ids;
+		for (auto node = cancellation; node; node = node->next)
+			ids.push_back(node->id);
+		AtomicStack<Cancellation>::DeleteAll(cancellation);
+
+		FailWhere([&](const Job &job)
+		{
+			return std::find(begin(ids), end(ids), job.id) != end(ids);
+		}, "screenshot request cancelled");
+	}
+
+	void ExpireTimedOut()
+	{
+		auto now = Clock::now();
+		FailWhere([&](const Job &job)
+		{
+			return job.deadline <= now;
+		}, "screenshot request timed out");
+	}
+
+	void CompleteSaved()
+	{
+		for (auto it = begin(in_flight); it != end(in_flight);) {
+			auto &job = **it;
+			if (job.state == JOB_STAGED || !job.saved.load(std::memory_order_acquire)) {
+				it++;
+				continue;
+			}
+
+			if (job.state == JOB_SAVING)
+				Complete(job, job.error);
+			it = in_flight.erase(it);
+		}
+	}
+
+	// the copy to the staging surface was queued during an earlier tick, so
+	// mapping it no longer stalls on the GPU; only the readback happens here,
+	// encoding runs on a worker without holding the graphics context
+	void ReadStaged()
+	{
+		for (auto it = begin(in_flight); it != end(in_flight);) {
+			auto job = it->get();
+			if (job->state != JOB_STAGED || job->staged_tick >= tick) {
+				it++;
+				continue;
+			}
+
+			auto error = backend.Read(job->stage, job->cx, job->cy, job->image);
+			ring.Release(job->stage, job->cx, job->cy);
+			job->stage = Stagesurf();
+
+			if (error) {
+				Complete(*job, error);
+				it = in_flight.erase(it);
+				continue;
+			}
+
+			job->state = JOB_SAVING;
+			backend.Submit([this, job]
+			{
+				bool expected = false;
+				if (job->claimed.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+					job->error = backend.Save(job->image, job->cx, job->cy, job->filename, job->options);
+				job->image = Image();
+
+				std::lock_guard<std::mutex> lock(done_mutex);
+				job->saved.store(true, std::memory_order_release);
+				done_cv.notify_all();
+			});
+			it++;
+		}
+	}
+
+	void StageQueued()
+	{
+		while (in_flight.size() < max_in_flight && !queued.empty()) {
+			auto job = std::move(queued.front());
+			queued.pop_front();
+
+			uint32_t source_cx = 0;
+			uint32_t source_cy = 0;
+			if (!backend.SourceSize(job->source, source_cx, source_cy) || !source_cx || !source_cy) {
+				Complete(*job, "invalid screenshot dimensions (cx=" + std::to_string(source_cx) + ", cy=" + std::to_string(source_cy) + ")");
+				continue;
+			}
+
+			if (!job->cx || !job->cy)
+				backend.DefaultSize(job->options, source_cx, source_cy, job->cx, job->cy);
+
+			job->stage = ring.Acquire(job->cx, job->cy);
+			if (!job->stage) {
+				Complete(*job, "internal screenshot provider error: could not create stagesurface (cx=" + std::to_string(job->cx) + ", cy=" + std::to_string(job->cy) + ")");
+				continue;
+			}
+
+			if (auto error = backend.Render(job->source, job->cx, job->cy, job->options, job->stage)) {
+				ring.Release(job->stage, job->cx, job->cy);
+				Complete(*job, error);
+				continue;
+			}
+
+			job->staged_tick = tick;
+			in_flight.push_back(std::move(job));
+		}
+	}
+};
@@ -7,11 +7,17 @@
 
 #include "OBSHelpers.hpp"
 
+#include "ImageEncoder.hpp"
+#include "ImageScale.hpp"
+#include "PitchedCopy.hpp"
 #include "ProtectedObject.hpp"
+#include "ScreenshotPipeline.hpp"
 #include "ThreadTools.hpp"
 
 #include <algorithm>
 #include <deque>
+#include <memory>
+#include <vector>
 
 #include "scopeguard.hpp"
 
@@ -21,67 +27,331 @@ using namespace std;
 
 #define LOCK(x) std::lock_guard<decltype(x)> CONCAT(lockGuard, __LINE__){x};
 
-struct ScreenshotProvider
+// libobs side of ScreenshotPipeline, all calls but Save/Submit happen on the
+// graphics thread
+struct OBSScreenshotBackend
 {
-	struct ScreenshotRequest
+	using Source = OBSSource;
+	using Stagesurf = gs_stagesurf_t*;
+	using Image = vector<uint8_t>;
+	using Options = Screenshot::Options;
+
+	OBSView view;
+	gs_texrender_t *tr = nullptr;
+
+	// thumbnail reduction chain, one texrender per halving plus the final pass
+	vector<gs_texrender_t*> levels;
+
+	ImageEncoder::WorkerPool encoders;
+
+	~OBSScreenshotBackend()
 	{
-		OBSSource source;
-		uint32_t cx, cy;
-		string filename;
-		request_completion_t callback;
+		if (!tr && levels.empty())
+			return;
 
-		ScreenshotRequest(OBSSource source, uint32_t cx_, uint32_t cy_, const string& filename_, request_completion_t callback_)
-			: source(source)
-		{
-			filename = filename_;
-			cx = cx_;
-			cy = cy_;
-			callback = callback_;
+		obs_enter_graphics();
+		gs_texrender_destroy(tr);
+		for (auto level : levels)
+			gs_texrender_destroy(level);
+		obs_leave_graphics();
+	}
+
+	bool SourceSize(const OBSSource &source, uint32_t &cx, uint32_t &cy)
+	{
+		cx = obs_source_get_width(source);
+		cy = obs_source_get_height(source);
+		return true;
+	}
+
+	void DefaultSize(const Screenshot::Options &options, uint32_t source_cx, uint32_t source_cy, uint32_t &cx, uint32_t &cy)
+	{
+		if (options.thumbnail) {
+			ImageScale::Fit(source_cx, source_cy, options.thumbnail_size, cx, cy);
+			return;
 		}
 
-		void UpdateSize(uint32_t cx_, uint32_t cy_)
+		cx = source_cx;
+		cy = source_cy;
+	}
+
+	gs_stagesurf_t *CreateStagesurf(uint32_t cx, uint32_t cy)
+	{
+		return gs_stagesurface_create(cx, cy, GS_RGBA);
+	}
+
+	void DestroyStagesurf(gs_stagesurf_t *stage)
+	{
+		gs_stagesurface_destroy(stage);
+	}
+
+	// area of a draw_cx x draw_cy target the source covers with its aspect ratio kept
+	static void Letterbox(uint32_t cx, uint32_t cy, uint32_t draw_cx, uint32_t draw_cy, int &x, int &y, int &width, int &height)
+	{
+		auto display_aspect = draw_cx / static_cast<double>(draw_cy);
+		auto source_aspect = cx / static_cast<double>(cy);
+
+		double scale;
+		if (display_aspect > source_aspect) {
+			scale = draw_cy / static_cast<double>(cy);
+			width = static_cast<int>(draw_cy * source_aspect);
+			height = draw_cy;
+		}
+		else {
+			scale = draw_cx / static_cast<double>(cx);
+			width = draw_cx;
+			height = static_cast<int>(draw_cx / source_aspect);
+		}
+		x = draw_cx / 2 - width / 2;
+		y = draw_cy / 2 - height / 2;
+		width = static_cast<int>(scale * cx);
+		height = static_cast<int>(scale * cy);
+	}
+
+	boost::optional<string> RenderSource(const OBSSource &source, uint32_t draw_cx, uint32_t draw_cy)
+	{
+		if (!view)
+			return "internal screenshot provider error: missing view"s;
+
+		auto cx = obs_source_get_width(source);
+		auto cy = obs_source_get_height(source);
+
+		obs_view_set_source(view, 0, source);
+		DEFER
 		{
-			cx = cx_;
-			cy = cy_;
+			obs_view_set_source(view, 0, nullptr);
+		};
+
+		if (!tr) {
+			tr = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+			if (!tr)
+				return "internal screenshot provider error: could not create texrender"s;
+		}
+
+		int x, y, width, height;
+		Letterbox(cx, cy, draw_cx, draw_cy, x, y, width, height);
+
+		gs_texrender_reset(tr);
+		if (!gs_texrender_begin(tr, draw_cx, draw_cy))
+			return "internal screenshot provider error: could not begin texrender"s;
+
+		gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+		gs_set_viewport(x, y, width, height);
+
+		gs_effect_t    *solid = obs_get_base_effect(OBS_EFFECT_SOLID);
+		gs_eparam_t    *color = gs_effect_get_param_by_name(solid, "color");
+		gs_technique_t *tech = gs_effect_get_technique(solid, "Solid");
+
+		vec4 colorVal;
+		vec4_set(&colorVal, 0.0f, 0.0f, 0.0f, 1.0f);
+		gs_effect_set_vec4(color, &colorVal);
+
+		gs_technique_begin(tech);
+		gs_technique_begin_pass(tech, 0);
+		gs_matrix_push();
+		gs_matrix_identity();
+		gs_matrix_scale3f(float(cx), float(cy), 1.0f);
+
+		gs_render_start(false);
+		gs_vertex2f(0.0f, 0.0f);
+		gs_vertex2f(0.0f, 1.0f);
+		gs_vertex2f(1.0f, 1.0f);
+		gs_vertex2f(1.0f, 0.0f);
+		gs_vertex2f(0.0f, 0.0f);
+		gs_render_stop(GS_TRISTRIP);
+
+		gs_matrix_pop();
+		gs_technique_end_pass(tech);
+		gs_technique_end(tech);
+
+		gs_load_vertexbuffer(nullptr);
+
+		obs_view_render(view);
+
+		gs_texrender_end(tr);
+		return boost::none;
+	}
+
+	gs_texrender_t *Level(size_t i)
+	{
+		while (levels.size() <= i) {
+			auto level = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+			if (!level)
+				return nullptr;
+			levels.push_back(level);
 		}
+		return levels[i];
+	}
+
+	// draws `texture` into the given area of a black target_cx x target_cy
+	// texrender; the default effect samples bilinearly, so halving the size
+	// averages 2x2 texels
+	bool DrawScaled(gs_texrender_t *target, gs_texture_t *texture, uint32_t target_cx, uint32_t target_cy, int x, int y, int width, int height)
+	{
+		gs_texrender_reset(target);
+		if (!gs_texrender_begin(target, target_cx, target_cy))
+			return false;
+
+		vec4 black;
+		vec4_set(&black, 0.0f, 0.0f, 0.0f, 1.0f);
+		gs_clear(GS_CLEAR_COLOR, &black, 0.0f, 0);
+
+		gs_ortho(0.0f, float(width), 0.0f, float(height), -100.0f, 100.0f);
+		gs_set_viewport(x, y, width, height);
+
+		gs_effect_t    *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+		gs_technique_t *tech = gs_effect_get_technique(effect, "Draw");
+		gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), texture);
+
+		gs_enable_blending(false);
+		gs_technique_begin(tech);
+		gs_technique_begin_pass(tech, 0);
+		gs_draw_sprite(texture, 0, width, height);
+		gs_technique_end_pass(tech);
+		gs_technique_end(tech);
+		gs_enable_blending(true);
+
+		gs_texrender_end(target);
+		return true;
+	}
+
+	// renders at source size and halves until less than twice the target
+	// size is left, which filters like a mip chain instead of skipping
+	// most source pixels like a direct render at thumbnail size does
+	boost::optional<string> RenderThumbnail(const OBSSource &source, uint32_t draw_cx, uint32_t draw_cy, gs_texture_t *&texture)
+	{
+		auto cx = obs_source_get_width(source);
+		auto cy = obs_source_get_height(source);
+
+		if (auto error = RenderSource(source, cx, cy))
+			return error;
+
+		int x, y, width, height;
+		Letterbox(cx, cy, draw_cx, draw_cy, x, y, width, height);
+
+		texture = gs_texrender_get_texture(tr);
+
+		auto target_cx = static_cast<uint32_t>(max(width, 1));
+		auto target_cy = static_cast<uint32_t>(max(height, 1));
+
+		size_t i = 0;
+		for (; cx / 2 >= target_cx && cy / 2 >= target_cy; i++) {
+			cx /= 2;
+			cy /= 2;
+
+			auto level = Level(i);
+			if (!level || !DrawScaled(level, texture, cx, cy, 0, 0, cx, cy))
+				return "internal screenshot provider error: could not reduce thumbnail"s;
+
+			texture = gs_texrender_get_texture(level);
+		}
+
+		auto level = Level(i);
+		if (!level || !DrawScaled(level, texture, draw_cx, draw_cy, x, y, width, height))
+			return "internal screenshot provider error: could not scale thumbnail"s;
+
+		texture = gs_texrender_get_texture(level);
+		return boost::none;
+	}
 
-		void Complete(boost::optional<std::string> error)
+	boost::optional<string> Render(const OBSSource &source, uint32_t draw_cx, uint32_t draw_cy, const Screenshot::Options &options, gs_stagesurf_t *stage)
+	{
+		gs_texture_t *texture = nullptr;
+		if (options.thumbnail) {
+			if (auto error = RenderThumbnail(source, draw_cx, draw_cy, texture))
+				return error;
+		} else {
+			if (auto error = RenderSource(source, draw_cx, draw_cy))
+				return error;
+			texture = gs_texrender_get_texture(tr);
+		}
+
+		// the copy is queued behind the render, so the texrenders can be
+		// reused for the next request right away
+		gs_stage_texture(stage, texture);
+		return boost::none;
+	}
+
+	// stage surfaces are RGBA, WIC wants BGRA
+	boost::optional<string> Read(gs_stagesurf_t *stage, uint32_t cx, uint32_t cy, vector<uint8_t> &image)
+	{
+		uint8_t *data = nullptr;
+		uint32_t linesize = 0;
+		if (!gs_stagesurface_map(stage, &data, &linesize))
+			return "internal screenshot provider error: could not map stagesurface"s;
+
+		DEFER
 		{
-			if (callback)
-				callback(error, cx, cy, filename);
+			gs_stagesurface_unmap(stage);
+		};
+
+		image.resize(size_t(cx) * cy * 4);
+		PitchedCopy::Copy(image.data(), cx * 4, data, linesize, cx * 4, cy, PitchedCopy::SWIZZLE_BGRA_RGBA);
+		return boost::none;
+	}
+
+	boost::optional<string> Save(const vector<uint8_t> &image, uint32_t cx, uint32_t cy, const string &filename, const Screenshot::Options &options)
+	{
+		if (auto error = ImageEncoder::EncodeToFile(image.data(), cx, cy, filename, options.encoder)) {
+			blog(LOG_WARNING, "screenshot: encoding \"%s\" failed: %s", filename.c_str(), error->c_str());
+			return "failed to save screenshot to file"s;
+		}
+
+		if (options.thumbnail_filename.empty())
+			return boost::none;
+
+		uint32_t thumbnail_cx, thumbnail_cy;
+		ImageScale::Fit(cx, cy, options.thumbnail_size, thumbnail_cx, thumbnail_cy);
+
+		vector<uint8_t> thumbnail;
+		ImageScale::Resize(image.data(), cx * 4, cx, cy, thumbnail, thumbnail_cx, thumbnail_cy);
+
+		if (auto error = ImageEncoder::EncodeToFile(thumbnail.data(), thumbnail_cx, thumbnail_cy, options.thumbnail_filename, options.encoder)) {
+			blog(LOG_WARNING, "screenshot: encoding \"%s\" failed: %s", options.thumbnail_filename.c_str(), error->c_str());
+			return "failed to save screenshot thumbnail to file"s;
 		}
-	};
 
+		return boost::none;
+	}
+
+	void Submit(function<void()> func)
+	{
+		encoders.Submit(move(func));
+	}
+};
+
+struct ScreenshotProvider
+{
 	OBSDisplay display;
-	OBSView view;
-	
-	deque<ScreenshotRequest> pending_request;
-	
-	bool requested = false;
-	bool copied = false;
-	bool staged = false;
-	bool saving = false;
-	bool saved = false;
-	boost::optional<std::string> error;
-	mutex save_mutex;
 
-	gs_texrender_t *tr = nullptr;
-	gs_stagesurf_t *stage = nullptr;
+	OBSScreenshotBackend backend;
+	ScreenshotPipeline<OBSScreenshotBackend> pipeline{ backend };
+
+	bool shut_down = false;
 
 	~ScreenshotProvider()
 	{
-		pending_request.clear();
+		Shutdown();
+	}
 
-		// todo: kill the save thread
+	// fails pending requests and waits for running encodes; the display goes
+	// first so Draw() can't run concurrently or afterwards
+	void Shutdown()
+	{
+		OBSDisplay old_display;
+		{
+			LOCK(draw_mutex);
+			if (shut_down)
+				return;
 
-		obs_enter_graphics();
-			
-		if (tr)
-			gs_texrender_destroy(tr);
-		
-		if (stage)
-			gs_stagesurface_destroy(stage);
+			shut_down = true;
+			old_display = move(display);
+		}
+
+		// not under draw_mutex, destroying waits for a running Draw()
+		old_display = nullptr;
 
+		obs_enter_graphics();
+		pipeline.Shutdown();
 		obs_leave_graphics();
 	}
 
@@ -111,201 +381,55 @@ struct ScreenshotProvider
 
 		Create();
 
-		if (!view)
-			view = obs_view_create();
+		if (!backend.view)
+			backend.view = obs_view_create();
 	}
 
-	void Request(OBSSource source, uint32_t cx, uint32_t cy, const string &filename, request_completion_t callback)
+	uint64_t Request(OBSSource source, uint32_t cx, uint32_t cy, const string &filename, request_completion_t callback, const Screenshot::Options &options, chrono::milliseconds timeout)
 	{
-		pending_request.push_back(ScreenshotRequest(source, cx, cy, filename, callback));
-		requested = true;
-		Enable(true);
+		auto id = pipeline.Request(source, cx, cy, filename, options, timeout, [callback](boost::optional<string> error, uint32_t cx_, uint32_t cy_, const string filename_)
+		{
+			if (error)
+				blog(LOG_WARNING, "screenshot: %s", error->c_str());
+
+			if (callback)
+				callback(error, cx_, cy_, filename_);
+		});
+
+		// the pipeline completed the request already
+		LOCK(draw_mutex);
+		if (!shut_down)
+			Enable(true);
+		return id;
 	}
 
 	std::recursive_mutex draw_mutex;
 	void Draw()
 	{
-		auto finish_request = [&]
-		{
-			auto request = pending_request.front();
-			request.Complete(error);
-			
-			pending_request.pop_front();
-
-			gs_stagesurface_destroy(stage);
-			stage = nullptr;
-			requested = !pending_request.empty();
-			copied = false;
-			staged = false;
-			saving = false;
-			saved = false;
-			error.reset();
-
-			Enable(requested);
-		};
-
-		auto cancel_request = [&](boost::optional<std::string> err)
-		{
-			blog(LOG_WARNING, "screenshot: %s", err ? err->c_str() : "unknown error");
-			error = std::move(err);
-			finish_request();
-		};
-
-		if (saved)
-			finish_request();
-		
-		if (staged && !saving) {
-			auto work = CreateThreadpoolWork([](PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_WORK work)
-			{
-				auto self = reinterpret_cast<ScreenshotProvider*>(context);
-				auto request = self->pending_request.front();
-
-				obs_enter_graphics();
-				if (!gs_stagesurface_save_to_file(self->stage, request.filename.c_str())) {
-					blog(LOG_WARNING, "screenshot: gs_stagesurface_save_to_file failed for \"%s\"", request.filename.c_str());
-					self->error = "failed to save screenshot to file";
-				}
-				obs_leave_graphics();
-				
-				self->saved = true;
-			}, this, nullptr);
-
-			SubmitThreadpoolWork(work);
-			CloseThreadpoolWork(work);
-
-			saving = true;
-		}
-	
-		if (copied && !staged) {
-			auto tex = gs_texrender_get_texture(tr);
-			if (!stage) {
-				auto& request = pending_request.front();
-				stage = gs_stagesurface_create(request.cx, request.cy, GS_RGBA);
-				if (!stage) {
-					cancel_request("internal screenshot provider error: could not create stagesurface (cx=" + to_string(request.cx) + ", cy=" + to_string(request.cy) + ")");
-					return;
-				}
-			}
-
-			gs_stage_texture(stage, tex);
-			staged = true;
-		}
-
-		if (requested && !copied) {
-			auto& request = pending_request.front();
-
-			uint32_t draw_cx = request.cx;
-			uint32_t draw_cy = request.cy;
-
-			uint32_t cx = 0;
-			uint32_t cy = 0;
-			{
-				LOCK(draw_mutex);
-				if (!view) {
-					cancel_request("internal screenshot provider error: missing view"s);
-					return;
-				}
-
-				cx = obs_source_get_width(request.source);
-				cy = obs_source_get_height(request.source);
-				obs_view_set_source(view, 0, request.source);
-
-				if (!draw_cx || !draw_cy) {
-					draw_cx = cx;
-					draw_cy = cy;
-					request.UpdateSize(cx, cy);
-				}
-			}
-
-			DEFER
-			{
-				if (request.source)
-					obs_view_set_source(view, 0, nullptr);
-			};
+		LOCK(draw_mutex);
+		if (shut_down)
+			return;
 
-			if (!cx || !cy) {
-				cancel_request("invalid screenshot dimensions (cx=" + to_string(cx) + ", cy=" + to_string(cy) + ")");
-				return;
-			}
-
-			do {
-				if (!tr) {
-					tr = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
-					if (!tr) {
-						cancel_request("internal screenshot provider error: could not create texrender"s);
-						break;
-					}
-				}
-
-				auto display_aspect = draw_cx / static_cast<double>(draw_cy);
-				auto source_aspect = cx / static_cast<double>(cy);
-
-				int x, y, width, height;
-				double scale;
-				if (display_aspect > source_aspect) {
-					scale = draw_cy / static_cast<double>(cy);
-					width = static_cast<int>(draw_cy * source_aspect);
-					height = draw_cy;
-				}
-				else {
-					scale = draw_cx / static_cast<double>(cx);
-					width = draw_cx;
-					height = static_cast<int>(draw_cx / source_aspect);
-				}
-				x = draw_cx / 2 - width / 2;
-				y = draw_cy / 2 - height / 2;
-				width = static_cast<int>(scale * cx);
-				height = static_cast<int>(scale * cy);
-
-				gs_texrender_reset(tr);
-				if (gs_texrender_begin(tr, draw_cx, draw_cy)) {
-					gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
-					gs_set_viewport(x, y, width, height);
-
-					gs_effect_t    *solid = obs_get_base_effect(OBS_EFFECT_SOLID);
-					gs_eparam_t    *color = gs_effect_get_param_by_name(solid, "color");
-					gs_technique_t *tech = gs_effect_get_technique(solid, "Solid");
-
-					vec4 colorVal;
-					vec4_set(&colorVal, 0.0f, 0.0f, 0.0f, 1.0f);
-					gs_effect_set_vec4(color, &colorVal);
-
-					gs_technique_begin(tech);
-					gs_technique_begin_pass(tech, 0);
-					gs_matrix_push();
-					gs_matrix_identity();
-					gs_matrix_scale3f(float(cx), float(cy), 1.0f);
-
-					gs_render_start(false);
-					gs_vertex2f(0.0f, 0.0f);
-					gs_vertex2f(0.0f, 1.0f);
-					gs_vertex2f(1.0f, 1.0f);
-					gs_vertex2f(1.0f, 0.0f);
-					gs_vertex2f(0.0f, 0.0f);
-					gs_render_stop(GS_TRISTRIP);
-
-					gs_matrix_pop();
-					gs_technique_end_pass(tech);
-					gs_technique_end(tech);
-
-					gs_load_vertexbuffer(nullptr);
-
-					obs_view_render(view);
-
-					gs_texrender_end(tr);
-
-					copied = true;
-				}
-			} while (false);
-		}
+		if (!pipeline.Tick())
+			Enable(false);
 	}
 };
 
 static ScreenshotProvider provider;
 
 namespace Screenshot {
-	void Request(OBSSource source, uint32_t cx, uint32_t cy, const string &filename, request_completion_t callback)
+	uint64_t Request(OBSSource source, uint32_t cx, uint32_t cy, const string &filename, request_completion_t callback, const Screenshot::Options &options, chrono::milliseconds timeout)
+	{
+		return provider.Request(source, cx, cy, filename, callback, options, timeout);
+	}
+
+	void Cancel(uint64_t id)
+	{
+		provider.pipeline.Cancel(id);
+	}
+
+	void Shutdown()
 	{
-		provider.Request(source, cx, cy, filename, callback);
+		provider.Shutdown();
 	}
 };
\ No newline at end of file
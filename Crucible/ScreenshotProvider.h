@@ -1,9 +1,32 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <boost/optional.hpp>
 
+#include "ImageEncoder.hpp"
+
 typedef std::function<void(boost::optional<std::string> error, uint32_t cx, uint32_t cy, const std::string filename)> request_completion_t;
 namespace Screenshot {
-	void Request(OBSSource source, uint32_t cx, uint32_t cy, const std::string &filename, request_completion_t callback);
+	struct Options {
+		ImageEncoder::Options encoder;
+
+		// render at source size and reduce with 2x2 box passes on the GPU
+		// before readback; requests without a size fit into thumbnail_size
+		bool thumbnail = false;
+		uint32_t thumbnail_size = 320;
+
+		// also write a copy of the read back image, downscaled on the CPU
+		// to fit into thumbnail_size
+		std::string thumbnail_filename;
+	};
+
+	// requests that haven't started encoding after `timeout` fail with an error
+	uint64_t Request(OBSSource source, uint32_t cx, uint32_t cy, const std::string &filename, request_completion_t callback,
+		const Options &options = {}, std::chrono::milliseconds timeout = std::chrono::seconds(30));
+	void Cancel(uint64_t id);
+
+	// fails pending requests and waits for running encodes, so no callback
+	// runs afterwards; later requests fail immediately
+	void Shutdown();
 };
\ No newline at end of file
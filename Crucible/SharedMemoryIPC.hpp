@@ -0,0 +1,830 @@
+#pragma once
+
+// Single producer/single consumer message ring in named shared memory.
+//
+// SharedMemoryIPCServer/SharedMemoryIPCClient mirror IPCServer/IPCClient
+// (Start(name, func)/Open(name)/Write(data, size)), but messages are copied
+// once into the mapping by the writer and handed to the server callback in
+// place, instead of going through the kernel pipe buffers.
+//
+// Windows uses a pagefile-backed file mapping plus named auto-reset events for
+// wakeups, POSIX uses shm_open and futexes on the sequence counters in the
+// ring header.
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "IPCBuffer.hpp"
+
+namespace SharedMemoryIPC {
+
+static const uint32_t ring_magic = 0x474e5243; // "CRNG"
+static const uint32_t ring_version = 1;
+
+static const uint32_t default_capacity = 4 * 1024 * 1024;
+static const uint32_t min_capacity = 64 * 1024;
+
+static const uint32_t record_pad = 1;
+
+struct RecordHeader {
+	uint32_t size;
+	uint32_t flags;
+};
+
+// positions are free running byte counters, offsets into the ring are
+// `pos & (capacity - 1)`; reader and writer state live on separate cache lines
+struct RingHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t data_offset;
+
+	std::atomic<uint32_t> reader_pid;
+	std::atomic<uint32_t> writer_pid;
+	uint8_t pad0[40];
+
+	std::atomic<uint32_t> write_pos;
+	std::atomic<uint32_t> data_seq;
+	std::atomic<uint32_t> reader_waiting;
+	uint8_t pad1[52];
+
+	std::atomic<uint32_t> read_pos;
+	std::atomic<uint32_t> space_seq;
+	std::atomic<uint32_t> writer_waiting;
+	uint8_t pad2[52];
+};
+
+static_assert(sizeof(RingHeader) == 192, "RingHeader layout is shared between processes");
+
+inline uint32_t AlignRecord(size_t size)
+{
+	return static_cast<uint32_t>((size + 7) & ~size_t(7));
+}
+
+inline uint32_t CurrentProcessId()
+{
+#ifdef _WIN32
+	return GetCurrentProcessId();
+#else
+	return static_cast<uint32_t>(getpid());
+#endif
+}
+
+inline bool ProcessAlive(uint32_t pid)
+{
+#ifdef _WIN32
+	auto process = OpenProcess(SYNCHRONIZE, false, pid);
+	if (!process)
+		return GetLastError() == ERROR_ACCESS_DENIED;
+
+	bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return alive;
+#else
+	return kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+#endif
+}
+
+struct Mapping {
+	uint8_t *data = nullptr;
+	size_t size = 0;
+
+	Mapping() = default;
+	Mapping(const Mapping &) = delete;
+	Mapping &operator=(const Mapping &) = delete;
+
+	~Mapping()
+	{
+		Close();
+	}
+
+	bool Create(const std::string &name, size_t size_)
+	{
+		Close();
+
+#ifdef _WIN32
+		handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(static_cast<uint64_t>(size_) >> 32), static_cast<DWORD>(size_), name.c_str());
+		if (!handle)
+			return false;
+
+		if (GetLastError() == ERROR_ALREADY_EXISTS) {
+			Close();
+			return false;
+		}
+
+		data = static_cast<uint8_t*>(MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size_));
+#else
+		auto shm_name = "/" + name;
+		auto fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd < 0 && errno == EEXIST) {
+			// left behind by a crashed server, names include the pid so it can't be live
+			shm_unlink(shm_name.c_str());
+			fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		}
+		if (fd < 0)
+			return false;
+
+		unlink_name = shm_name;
+
+		if (ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+			close(fd);
+			Close();
+			return false;
+		}
+
+		auto ptr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		data = ptr == MAP_FAILED ? nullptr : static_cast<uint8_t*>(ptr);
+#endif
+
+		if (!data) {
+			Close();
+			return false;
+		}
+
+		size = size_;
+		return true;
+	}
+
+	bool Open(const std::string &name)
+	{
+		Close();
+
+#ifdef _WIN32
+		handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, false, name.c_str());
+		if (!handle)
+			return false;
+
+		data = static_cast<uint8_t*>(MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+		MEMORY_BASIC_INFORMATION info = {};
+		if (data && VirtualQuery(data, &info, sizeof(info)))
+			size = info.RegionSize;
+#else
+		auto fd = shm_open(("/" + name).c_str(), O_RDWR, 0);
+		if (fd < 0)
+			return false;
+
+		struct stat st = {};
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			auto ptr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (ptr != MAP_FAILED) {
+				data = static_cast<uint8_t*>(ptr);
+				size = static_cast<size_t>(st.st_size);
+			}
+		}
+		close(fd);
+#endif
+
+		if (!data || !size) {
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (handle)
+			CloseHandle(handle);
+		handle = nullptr;
+#else
+		if (data)
+			munmap(data, size);
+		if (!unlink_name.empty())
+			shm_unlink(unlink_name.c_str());
+		unlink_name.clear();
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+protected:
+#ifdef _WIN32
+	HANDLE handle = nullptr;
+#else
+	std::string unlink_name;
+#endif
+};
+
+// wakeup primitive for a sequence counter living in the mapping; Notify must
+// be called after the counter has been bumped
+struct Signal {
+	Signal() = default;
+	Signal(const Signal &) = delete;
+	Signal &operator=(const Signal &) = delete;
+
+	~Signal()
+	{
+#ifdef _WIN32
+		if (event)
+			CloseHandle(event);
+#endif
+	}
+
+	bool Create(const std::string &name)
+	{
+#ifdef _WIN32
+		event = CreateEventA(nullptr, false, false, name.c_str());
+		return !!event;
+#else
+		(void)name;
+		return true;
+#endif
+	}
+
+	bool Open(const std::string &name)
+	{
+#ifdef _WIN32
+		event = OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, false, name.c_str());
+		return !!event;
+#else
+		(void)name;
+		return true;
+#endif
+	}
+
+	void Notify(std::atomic<uint32_t> &seq)
+	{
+#ifdef _WIN32
+		(void)seq;
+		SetEvent(event);
+#else
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#endif
+	}
+
+	// returns false on timeout
+	bool Wait(std::atomic<uint32_t> &seq, uint32_t expected, uint32_t timeout_ms)
+	{
+#ifdef _WIN32
+		(void)seq;
+		(void)expected;
+		return WaitForSingleObject(event, timeout_ms) == WAIT_OBJECT_0;
+#else
+		timespec ts = {};
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		if (syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq), FUTEX_WAIT, expected, &ts, nullptr, 0) == 0)
+			return true;
+		return errno != ETIMEDOUT;
+#endif
+	}
+
+protected:
+#ifdef _WIN32
+	HANDLE event = nullptr;
+#endif
+};
+
+struct Ring {
+	Mapping mapping;
+	Signal data_signal;
+	Signal space_signal;
+
+	RingHeader *header = nullptr;
+	uint8_t *data = nullptr;
+	uint32_t mask = 0;
+
+	bool Create(const std::string &name, uint32_t capacity)
+	{
+		uint32_t size = min_capacity;
+		while (size < capacity && size < 0x40000000u)
+			size <<= 1;
+
+		if (!mapping.Create(name, sizeof(RingHeader) + size) ||
+			!data_signal.Create(name + "-data") ||
+			!space_signal.Create(name + "-space"))
+			return false;
+
+		header = new (mapping.data) RingHeader{};
+		header->capacity = size;
+		header->data_offset = sizeof(RingHeader);
+		header->version = ring_version;
+		header->reader_pid = CurrentProcessId();
+		std::atomic_thread_fence(std::memory_order_release);
+		header->magic = ring_magic;
+
+		return Attach();
+	}
+
+	bool Open(const std::string &name)
+	{
+		if (!mapping.Open(name) || mapping.size < sizeof(RingHeader))
+			return false;
+
+		header = reinterpret_cast<RingHeader*>(mapping.data);
+		if (header->magic != ring_magic || header->version != ring_version)
+			return false;
+
+		if (header->data_offset < sizeof(RingHeader) || header->data_offset + uint64_t(header->capacity) > mapping.size)
+			return false;
+
+		if (!data_signal.Open(name + "-data") || !space_signal.Open(name + "-space"))
+			return false;
+
+		return Attach();
+	}
+
+	// reader side; hands the ring up to `pos` back to the writer
+	void Consume(uint32_t pos)
+	{
+		header->read_pos.store(pos);
+		header->space_seq += 1;
+		if (header->writer_waiting.load())
+			space_signal.Notify(header->space_seq);
+	}
+
+protected:
+	bool Attach()
+	{
+		auto capacity = header->capacity;
+		if (capacity < min_capacity || (capacity & (capacity - 1)))
+			return false;
+
+		data = mapping.data + header->data_offset;
+		mask = capacity - 1;
+		return true;
+	}
+};
+
+// Hands out records as IPCBufferLeases pointing into the ring, without
+// copying them. read_pos only moves past a record once it and every record
+// before it were released, so held leases keep their ring space and a writer
+// that gets ahead of the receiver waits in Reserve; the ring stays mapped
+// until the last lease is gone
+struct RingLeases : std::enable_shared_from_this<RingLeases> {
+	static const size_t max_free = 8;
+
+	explicit RingLeases(std::shared_ptr<Ring> ring)
+		: ring(std::move(ring))
+	{}
+
+	// reader thread; the record at data ends at ring position `next`
+	IPCBufferLease Lease(uint8_t *data, size_t size, uint32_t next)
+	{
+		std::unique_ptr<Entry> entry;
+		Entry *raw;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!free.empty()) {
+				entry = std::move(free.back());
+				free.pop_back();
+			} else {
+				entry.reset(new Entry);
+			}
+
+			entry->data = data;
+			entry->size = size;
+			entry->next = next;
+			entry->released = false;
+			entry->owner = shared_from_this();
+
+			raw = entry.get();
+			outstanding.push_back(std::move(entry));
+		}
+
+		return IPCBufferLease{ raw };
+	}
+
+	// reader thread; a record that isn't handed out (padding)
+	void Skip(uint32_t next)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (outstanding.empty()) {
+			ring->Consume(next);
+			return;
+		}
+
+		std::unique_ptr<Entry> entry{ new Entry };
+		entry->next = next;
+		entry->released = true;
+		outstanding.push_back(std::move(entry));
+	}
+
+protected:
+	struct Entry : IPCBufferEntry {
+		std::shared_ptr<RingLeases> owner; // set while leased
+		uint32_t next = 0;
+		bool released = false;
+
+		Entry()
+		{
+			recycle = Recycle;
+		}
+	};
+
+	std::shared_ptr<Ring> ring;
+	std::mutex mutex;
+	std::deque<std::unique_ptr<Entry>> outstanding; // ring order
+	std::vector<std::unique_ptr<Entry>> free;
+
+	static void Recycle(IPCBufferEntry *entry_)
+	{
+		auto entry = static_cast<Entry*>(entry_);
+		auto owner = std::move(entry->owner); // may be the last reference, outlives the lock
+
+		std::lock_guard<std::mutex> lock(owner->mutex);
+		entry->released = true;
+
+		bool consumed = false;
+		uint32_t pos = 0;
+		auto &outstanding = owner->outstanding;
+		while (!outstanding.empty() && outstanding.front()->released) {
+			pos = outstanding.front()->next;
+			if (owner->free.size() < max_free)
+				owner->free.push_back(std::move(outstanding.front()));
+			outstanding.pop_front();
+			consumed = true;
+		}
+
+		if (consumed)
+			owner->ring->Consume(pos);
+	}
+};
+
+struct Reader {
+	std::shared_ptr<Ring> shared_ring; // shared with leases that outlive the reader
+	Ring &ring;
+	std::function<void(uint8_t*, size_t)> func;
+	// set instead of func to get records as leases, see RingLeases
+	std::function<void(IPCBufferLease)> leased_func;
+	std::atomic<bool> stop;
+	std::thread thread;
+
+	Reader()
+		: shared_ring(std::make_shared<Ring>()), ring(*shared_ring), stop(false)
+	{}
+
+	~Reader()
+	{
+		stop = true;
+		if (ring.header) {
+			ring.header->reader_pid = 0;
+			ring.header->space_seq += 1;
+			ring.space_signal.Notify(ring.header->space_seq);
+			ring.header->data_seq += 1;
+			ring.data_signal.Notify(ring.header->data_seq);
+		}
+
+		if (thread.joinable())
+			thread.join();
+	}
+
+	bool Start(const std::string &name, uint32_t capacity)
+	{
+		if (!ring.Create(name, capacity))
+			return false;
+
+		if (leased_func)
+			leases = std::make_shared<RingLeases>(shared_ring);
+
+		thread = std::thread([this] { Run(); });
+		return true;
+	}
+
+protected:
+	std::shared_ptr<RingLeases> leases;
+
+	// waits for data or a state change, returns false if the writer went away
+	bool WaitForData(uint32_t read_pos, bool connected)
+	{
+		auto &header = *ring.header;
+
+		auto seq = header.data_seq.load();
+		header.reader_waiting = 1;
+		if (header.write_pos.load() != read_pos || stop) {
+			header.reader_waiting = 0;
+			return true;
+		}
+
+		bool signaled = ring.data_signal.Wait(header.data_seq, seq, 250);
+		header.reader_waiting = 0;
+
+		if (signaled || !connected)
+			return true;
+
+		auto pid = header.writer_pid.load();
+		return pid && ProcessAlive(pid);
+	}
+
+	void Run()
+	{
+		auto &header = *ring.header;
+		auto capacity = header.capacity;
+
+		// read position of the next record; read_pos trails it while leases are held
+		auto r = header.read_pos.load(std::memory_order_relaxed);
+		bool connected = false;
+		while (!stop) {
+			if (header.write_pos.load(std::memory_order_acquire) == r) {
+				// only report a disconnect once everything the writer committed was delivered
+				if (header.writer_pid.load())
+					connected = true;
+				else if (connected)
+					break;
+
+				if (WaitForData(r, connected))
+					continue;
+
+				break;
+			}
+
+			RecordHeader record;
+			memcpy(&record, ring.data + (r & ring.mask), sizeof(record));
+
+			auto next = r + AlignRecord(sizeof(record) + record.size);
+			bool valid = record.size <= capacity / 2 && (record.flags & ~record_pad) == 0 &&
+				(r & ring.mask) + uint64_t(next - r) <= capacity;
+			if (!valid)
+				break;
+
+			auto data = ring.data + (r & ring.mask) + sizeof(record);
+			if (leases) {
+				if (record.flags & record_pad)
+					leases->Skip(next);
+				else
+					leased_func(leases->Lease(data, record.size, next));
+			} else {
+				if (!(record.flags & record_pad))
+					func(data, record.size);
+
+				ring.Consume(next);
+			}
+
+			r = next;
+		}
+
+		if (stop)
+			return;
+
+		if (leases)
+			leased_func(IPCBufferLease{});
+		else
+			func(nullptr, 0);
+	}
+};
+
+struct Writer {
+	Ring ring;
+
+	Writer()
+	{}
+
+	~Writer()
+	{
+		if (!ring.header)
+			return;
+
+		auto pid = CurrentProcessId();
+		ring.header->writer_pid.compare_exchange_strong(pid, 0);
+		ring.header->data_seq += 1;
+		ring.data_signal.Notify(ring.header->data_seq);
+	}
+
+	bool Open(const std::string &name)
+	{
+		if (!ring.Open(name))
+			return false;
+
+		uint32_t expected = 0;
+		if (!ring.header->writer_pid.compare_exchange_strong(expected, CurrentProcessId())) {
+			ring.header = nullptr;
+			return false;
+		}
+
+		ring.header->data_seq += 1;
+		ring.data_signal.Notify(ring.header->data_seq);
+		return true;
+	}
+
+	bool Valid() const
+	{
+		return ring.header && ring.header->reader_pid.load() != 0;
+	}
+
+	// returns a pointer to `size` contiguous bytes inside the ring, the message
+	// becomes visible to the reader on Commit; a Reserve without a matching
+	// Commit is discarded by the next Reserve
+	uint8_t *Reserve(size_t size, uint32_t timeout_ms)
+	{
+		if (!Valid())
+			return nullptr;
+
+		auto &header = *ring.header;
+		auto capacity = header.capacity;
+
+		auto need = AlignRecord(sizeof(RecordHeader) + size);
+		if (size > capacity / 2 || need > capacity / 2)
+			return nullptr;
+
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+		for (;;) {
+			auto w = header.write_pos.load(std::memory_order_relaxed);
+			auto r = header.read_pos.load(std::memory_order_acquire);
+
+			auto offset = w & ring.mask;
+			auto tail = capacity - offset;
+			auto total = tail < need ? tail + need : need;
+
+			if (capacity - (w - r) >= total) {
+				if (tail < need) {
+					RecordHeader pad = { tail - static_cast<uint32_t>(sizeof(RecordHeader)), record_pad };
+					memcpy(ring.data + offset, &pad, sizeof(pad));
+					w += tail;
+					offset = 0;
+				}
+
+				pending_record = ring.data + offset;
+				pending_size = static_cast<uint32_t>(size);
+				pending_pos = w + need;
+				return pending_record + sizeof(RecordHeader);
+			}
+
+			auto now = std::chrono::steady_clock::now();
+			if (now >= deadline)
+				return nullptr;
+
+			auto seq = header.space_seq.load();
+			header.writer_waiting = 1;
+			if (header.read_pos.load() == r) {
+				auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+				bool signaled = ring.space_signal.Wait(header.space_seq, seq, static_cast<uint32_t>(remaining < 100 ? remaining + 1 : 100));
+				if (!signaled) {
+					auto pid = header.reader_pid.load();
+					if (!pid || !ProcessAlive(pid)) {
+						header.writer_waiting = 0;
+						return nullptr;
+					}
+				}
+			}
+			header.writer_waiting = 0;
+
+			if (!Valid())
+				return nullptr;
+		}
+	}
+
+	bool Commit()
+	{
+		if (!pending_record)
+			return false;
+
+		auto &header = *ring.header;
+
+		RecordHeader record = { pending_size, 0 };
+		memcpy(pending_record, &record, sizeof(record));
+		pending_record = nullptr;
+
+		header.write_pos.store(pending_pos);
+		header.data_seq += 1;
+		if (header.reader_waiting.load())
+			ring.data_signal.Notify(header.data_seq);
+
+		return true;
+	}
+
+protected:
+	uint8_t *pending_record = nullptr;
+	uint32_t pending_size = 0;
+	uint32_t pending_pos = 0;
+};
+
+}
+
+struct SharedMemoryIPCServer {
+	std::unique_ptr<SharedMemoryIPC::Reader> server;
+
+	SharedMemoryIPCServer() = default;
+	SharedMemoryIPCServer(SharedMemoryIPCServer &&) = default;
+	SharedMemoryIPCServer &operator=(SharedMemoryIPCServer &&) = default;
+
+	template <typename Func>
+	SharedMemoryIPCServer(const std::string &name, Func &&func, uint32_t capacity = SharedMemoryIPC::default_capacity)
+	{
+		Start(name, std::forward<Func>(func), capacity);
+	}
+
+	// func gets called on the reader thread with a pointer into the ring that
+	// is valid for the duration of the call, and with (nullptr, 0) once the
+	// client disconnected; messages may be at most capacity / 2 bytes
+	template <typename Func>
+	bool Start(const std::string &name, Func &&func, uint32_t capacity = SharedMemoryIPC::default_capacity)
+	{
+		server.reset();
+
+		std::unique_ptr<SharedMemoryIPC::Reader> reader{ new SharedMemoryIPC::Reader };
+		reader->func = std::forward<Func>(func);
+		if (!reader->Start(name, capacity))
+			return false;
+
+		server = std::move(reader);
+		return true;
+	}
+
+	// see IPCServer::StartLeased; leases point into the ring, no copy is
+	// made. The ring space of a message is only reused once its lease (and
+	// the leases of all earlier messages) were released, so the writer waits
+	// while the receiver holds on to messages totalling the ring capacity
+	template <typename Func>
+	bool StartLeased(const std::string &name, Func &&func, uint32_t capacity = SharedMemoryIPC::default_capacity)
+	{
+		server.reset();
+
+		std::unique_ptr<SharedMemoryIPC::Reader> reader{ new SharedMemoryIPC::Reader };
+		reader->leased_func = std::forward<Func>(func);
+		if (!reader->Start(name, capacity))
+			return false;
+
+		server = std::move(reader);
+		return true;
+	}
+};
+
+struct SharedMemoryIPCClient {
+	std::unique_ptr<SharedMemoryIPC::Writer> client;
+
+	SharedMemoryIPCClient() = default;
+	SharedMemoryIPCClient(SharedMemoryIPCClient &&) = default;
+	SharedMemoryIPCClient &operator=(SharedMemoryIPCClient &&) = default;
+
+	SharedMemoryIPCClient(const std::string &name)
+	{
+		Open(name);
+	}
+
+	bool Open(const std::string &name)
+	{
+		client.reset(new SharedMemoryIPC::Writer);
+		if (client->Open(name))
+			return true;
+
+		client.reset();
+		return false;
+	}
+
+	void Close()
+	{
+		client.reset();
+	}
+
+	// Reserve/Commit let callers assemble a message directly in the ring
+	uint8_t *Reserve(size_t size, uint32_t timeout_ms = 1000)
+	{
+		return client ? client->Reserve(size, timeout_ms) : nullptr;
+	}
+
+	bool Commit()
+	{
+		return client && client->Commit();
+	}
+
+	bool Write(const void *data, size_t size)
+	{
+		auto ptr = Reserve(size);
+		if (!ptr)
+			return false;
+
+		memcpy(ptr, data, size);
+		return Commit();
+	}
+
+	bool Write(const std::string &str)
+	{
+		return Write(str.c_str(), str.length() + 1);
+	}
+
+	explicit operator bool()
+	{
+		return client && client->Valid();
+	}
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+// Single producer/single consumer mailbox that always hands the consumer the
+// newest complete value without either side blocking: the producer fills
+// Back() and publishes it, the consumer picks up the latest published value
+// with Consume() and reads it through Front() until the next Consume().
+// Values the consumer never saw are overwritten (and thus released) by the
+// producer, so the consumer only ever drops the value it is replacing.
+template <typename T>
+struct TripleBuffer {
+	TripleBuffer() = default;
+	TripleBuffer(const TripleBuffer &) = delete;
+	TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+	// producer side
+	T &Back()
+	{
+		return slots[back];
+	}
+
+	void Publish()
+	{
+		auto prev = middle.exchange(static_cast<uint8_t>(back | fresh_bit), std::memory_order_acq_rel);
+		back = prev & index_mask;
+	}
+
+	void Publish(T &&value)
+	{
+		Back() = std::move(value);
+		Publish();
+	}
+
+	// consumer side; returns false if nothing was published since the last call
+	bool Consume()
+	{
+		if (!HasNew())
+			return false;
+
+		auto prev = middle.exchange(front, std::memory_order_acq_rel);
+		front = prev & index_mask;
+		return true;
+	}
+
+	bool HasNew() const
+	{
+		return (middle.load(std::memory_order_acquire) & fresh_bit) != 0;
+	}
+
+	T &Front()
+	{
+		return slots[front];
+	}
+
+protected:
+	static const uint8_t index_mask = 0x3;
+	static const uint8_t fresh_bit = 0x4;
+
+	T slots[3];
+
+	// index of the slot between producer and consumer, fresh_bit set if it
+	// was published after the consumer last swapped
+	std::atomic<uint8_t> middle{ 1 };
+
+	uint8_t front = 0; // consumer only
+	uint8_t back = 2;  // producer only
+};
@@ -0,0 +1,88 @@
+// Samples per second of every AudioConvert kernel set, for typical game audio
+// packet sizes (480 frames = 10 ms at 48 kHz) and larger blocks
+
+#include "AudioConvert.hpp"
+
+#include "Bench.hpp"
+
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Buffers {
+	vector<int16_t> s16;
+	vector<float> f32;
+	vector<vector<float>> planes;
+	vector<float*> out;
+	vector<const float*> in;
+
+	Buffers(size_t channels, size_t frames)
+		: s16(channels * frames), f32(channels * frames), planes(channels, vector<float>(frames))
+	{
+		for (size_t i = 0; i < s16.size(); i++) {
+			s16[i] = static_cast<int16_t>(i * 2654435761u >> 16);
+			f32[i] = s16[i] / 32768.f;
+		}
+
+		for (auto &plane : planes) {
+			out.push_back(plane.data());
+			in.push_back(plane.data());
+		}
+	}
+};
+
+void Run(const AudioConvert::Kernels &kernels, size_t frames)
+{
+	auto iterations = 2000000 / frames;
+
+	for (size_t channels : { 1, 2, 6 }) {
+		Buffers buffers{ channels, frames };
+		char label[64];
+
+		snprintf(label, sizeof(label), "  s16 -> planar, %zu ch", channels);
+		Bench(label, iterations, [&]
+		{
+			kernels.s16_to_planar(buffers.s16.data(), buffers.out.data(), channels, frames);
+			ClobberMemory();
+		}, "Msamples", double(channels * frames));
+
+		snprintf(label, sizeof(label), "  f32 -> planar, %zu ch", channels);
+		Bench(label, iterations, [&]
+		{
+			kernels.f32_to_planar(buffers.f32.data(), buffers.out.data(), channels, frames);
+			ClobberMemory();
+		}, "Msamples", double(channels * frames));
+	}
+
+	Buffers surround{ 6, frames };
+	vector<float> left(frames), right(frames);
+	Bench("  downmix 5.1 -> stereo", iterations, [&]
+	{
+		kernels.downmix_5_1(surround.in.data(), left.data(), right.data(), frames);
+		ClobberMemory();
+	}, "Msamples", double(6 * frames));
+}
+
+}
+
+int main()
+{
+	vector<const AudioConvert::Kernels*> kernels = { &AudioConvert::ScalarKernels() };
+	if (auto sse2 = AudioConvert::SSE2Kernels())
+		kernels.push_back(sse2);
+	if (auto avx2 = AudioConvert::AVX2Kernels())
+		kernels.push_back(avx2);
+
+	printf("best kernels on this CPU: %s\n", AudioConvert::BestKernels().name);
+
+	for (size_t frames : { 480, 4096 }) {
+		for (auto k : kernels) {
+			printf("%s, %zu frames per call\n", k->name, frames);
+			Run(*k, frames);
+		}
+	}
+
+	return 0;
+}
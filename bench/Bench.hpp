@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// runs `func` `iterations` times per round and reports the fastest and the
+// median round, in ns per iteration; BENCH_ROUNDS overrides the round count.
+// With a `unit` the rate of the fastest round is printed as well, in millions
+// of units per second (e.g. "Msamples" for units_per_iteration samples)
+template <typename Func>
+double Bench(const char *name, size_t iterations, Func &&func, const char *unit, double units_per_iteration)
+{
+	size_t rounds = 7;
+	if (auto env = getenv("BENCH_ROUNDS"))
+		rounds = std::max<size_t>(1, strtoul(env, nullptr, 10));
+
+	std::vector<double> results;
+	results.reserve(rounds);
+	for (size_t round = 0; round < rounds; round++) {
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; i++)
+			func();
+		auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		results.push_back(elapsed / iterations);
+	}
+
+	std::sort(begin(results), end(results));
+	auto best = results.front();
+	auto median = results[results.size() / 2];
+
+	if (unit)
+		printf("%-48s %12.1f ns  (median %12.1f ns)  %8.2f %s/s\n", name, best, median, units_per_iteration / best * 1000., unit);
+	else
+		printf("%-48s %12.1f ns  (median %12.1f ns)\n", name, best, median);
+	fflush(stdout);
+
+	return best;
+}
+
+template <typename Func>
+double Bench(const char *name, size_t iterations, Func &&func, double bytes_per_iteration = 0.)
+{
+	return bytes_per_iteration > 0. ?
+		Bench(name, iterations, std::forward<Func>(func), "MB", bytes_per_iteration) :
+		Bench(name, iterations, std::forward<Func>(func), nullptr, 0.);
+}
+
+// keeps the optimizer from discarding results
+template <typename T>
+inline void DoNotOptimize(T const &value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+inline void ClobberMemory()
+{
+	asm volatile("" : : : "memory");
+}
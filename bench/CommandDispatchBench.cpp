@@ -0,0 +1,144 @@
+// Replays a command trace through the old map<string, ...> lookup and the
+// CommandDispatch table.
+//
+// A trace has one JSON command per line; "got: " prefixes are stripped, so
+// the command lines of a Crucible log can be replayed directly:
+//
+//   CommandDispatchBench [trace]
+//
+// Without an argument traces/forge_session.trace is used, a synthetic session
+// with the command mix of a streaming Forge client (mostly get_webrtc_stats,
+// set_source_volume, set_cursor and resize_display)
+
+#include "CommandDispatch.hpp"
+#include "CrucibleCommands.hpp"
+#include "OBSHelpers.hpp"
+
+#include "Bench.hpp"
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+using Handler_t = void(*)(OBSData&);
+
+size_t handled = 0;
+
+void Handle(OBSData&)
+{
+	handled += 1;
+}
+
+#define COMMAND_ENTRY(name) CommandDispatch::Command(#name, Handle),
+static constexpr CommandDispatch::Entry<Handler_t> commands[] = {
+	CRUCIBLE_COMMANDS(COMMAND_ENTRY)
+};
+#undef COMMAND_ENTRY
+
+static_assert(CommandDispatch::HandlersValid(commands), "commands contains a command without handler");
+static_assert(CommandDispatch::HashesUnique(commands), "commands contains duplicate commands or a hash collision");
+static_assert(CommandDispatch::HasPerfectLayout(commands), "no collision free bucket layout for commands");
+
+const auto commands_table = CommandDispatch::MakeTable(commands);
+
+// the table HandleCommand used before CommandDispatch
+using KnownCommands_t = map<string, pair<bool, Handler_t>>;
+
+KnownCommands_t MakeMap()
+{
+	KnownCommands_t known_commands;
+	for (auto &command : commands_table)
+		known_commands[command.name] = { false, command.handler };
+	return known_commands;
+}
+
+vector<string> LoadTrace(const char *path)
+{
+	vector<string> messages;
+	ifstream file{ path };
+	string line;
+	while (getline(file, line)) {
+		auto start = line.find("got: ");
+		if (start != string::npos)
+			line.erase(0, start + 5);
+		if (!line.empty() && line.front() == '{')
+			messages.push_back(line);
+	}
+	return messages;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	auto path = argc > 1 ? argv[1] : CRUCIBLE_BENCH_TRACE;
+	auto messages = LoadTrace(path);
+	if (messages.empty()) {
+		fprintf(stderr, "no commands in %s\n", path);
+		return 1;
+	}
+
+	vector<OBSData> parsed; // owns the strings in names
+	vector<const char*> names;
+	size_t unknown = 0;
+	for (auto &message : messages) {
+		auto obj = OBSDataCreate(message);
+		if (!obj)
+			continue;
+
+		parsed.push_back(obj);
+		names.push_back(obs_data_get_string(obj, "command"));
+		unknown += !commands_table.Find(names.back());
+	}
+
+	// times are per replay of the whole trace
+	printf("%s: %zu commands, %zu unknown\n", path, names.size(), unknown);
+
+	auto known_commands = MakeMap();
+
+	Bench("  lookup, map<string>", 2000, [&]
+	{
+		for (auto name : names) {
+			auto elem = known_commands.find(name);
+			if (elem != end(known_commands))
+				DoNotOptimize(elem->second.second);
+		}
+	});
+
+	Bench("  lookup, CommandDispatch", 2000, [&]
+	{
+		for (auto name : names) {
+			auto command = commands_table.Find(name);
+			if (command)
+				DoNotOptimize(command->handler);
+		}
+	});
+
+	// parse + lookup + call, obs_data being the tests/stub implementation
+	Bench("  parse + dispatch, map<string>", 20, [&]
+	{
+		for (auto &message : messages) {
+			auto obj = OBSDataCreate(message);
+			auto elem = known_commands.find(obs_data_get_string(obj, "command"));
+			if (elem != end(known_commands))
+				elem->second.second(obj);
+		}
+	});
+
+	Bench("  parse + dispatch, CommandDispatch", 20, [&]
+	{
+		for (auto &message : messages) {
+			auto obj = OBSDataCreate(message);
+			auto command = commands_table.Find(obs_data_get_string(obj, "command"));
+			if (command)
+				command->handler(obj);
+		}
+	});
+
+	return handled ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+// Parse + dispatch latency of JSON vs binary command frames for the high
+// frequency commands, following HandleCommand up to the point where the
+// handler would be queued.
+//
+// obs_data is the stub from tests/stub (std::map backed, with a small JSON
+// parser), so the absolute JSON numbers differ from libobs/jansson; the
+// dispatch table is the real CommandDispatch table over Crucible's commands
+
+#include "CommandDispatch.hpp"
+#include "CommandProtocol.hpp"
+#include "CommandFrameWriter.hpp"
+#include "CrucibleCommands.hpp"
+
+#include "Bench.hpp"
+
+#include <memory>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+using Handler_t = void(*)(OBSData&);
+
+size_t handled = 0;
+
+void Handle(OBSData &obj)
+{
+	handled += !!obj;
+}
+
+#define COMMAND_ENTRY(name) CommandDispatch::Command(#name, Handle),
+static constexpr CommandDispatch::Entry<Handler_t> commands[] = {
+	CRUCIBLE_COMMANDS(COMMAND_ENTRY)
+};
+#undef COMMAND_ENTRY
+
+static_assert(CommandDispatch::HasPerfectLayout(commands), "no collision free bucket layout for commands");
+
+const auto commands_table = CommandDispatch::MakeTable(commands);
+
+uint16_t CommandId(const char *name)
+{
+	return static_cast<uint16_t>(commands_table.IndexOf(*commands_table.Find(name)));
+}
+
+bool DispatchJson(const string &message)
+{
+	auto obj = OBSDataCreate(message);
+
+	unique_ptr<obs_data_item_t> item{ obs_data_item_byname(obj, "command") };
+	if (!item)
+		return false;
+
+	auto str = obs_data_item_get_string(item.get());
+	if (!str)
+		return false;
+
+	auto command = commands_table.Find(str);
+	if (!command)
+		return false;
+
+	command->handler(obj);
+	return true;
+}
+
+bool DispatchBinary(const vector<uint8_t> &frame)
+{
+	uint16_t id;
+	OBSData obj;
+	if (!CommandProtocol::DecodeCommand(frame.data(), frame.size(), id, obj) || id >= commands_table.size())
+		return false;
+
+	auto &command = commands_table.begin()[id];
+	obs_data_set_string(obj, "command", command.name);
+	command.handler(obj);
+	return true;
+}
+
+void Compare(const char *label, const string &json, const vector<uint8_t> &binary)
+{
+	if (!DispatchJson(json) || !DispatchBinary(binary)) {
+		printf("%s: invalid message\n", label);
+		return;
+	}
+
+	printf("%s (json %zu bytes, binary %zu bytes)\n", label, json.size(), binary.size());
+	Bench("  json", 100000, [&] { DispatchJson(json); });
+	Bench("  binary", 100000, [&] { DispatchBinary(binary); });
+}
+
+}
+
+int main()
+{
+	{
+		CommandFrameWriter frame{ CommandId("get_webrtc_stats") };
+		frame.Count(0);
+		Compare("get_webrtc_stats", R"({"command":"get_webrtc_stats"})", frame.data);
+	}
+
+	{
+		CommandFrameWriter frame{ CommandId("set_source_volume") };
+		frame.Count(3);
+		frame.String("source", "Microphone");
+		frame.Double("volume", 0.75);
+		frame.Bool("mute", false);
+		Compare("set_source_volume", R"({"command":"set_source_volume","source":"Microphone","volume":0.75,"mute":false})", frame.data);
+	}
+
+	{
+		string png(2048, 'A');
+		CommandFrameWriter frame{ CommandId("set_cursor") };
+		frame.Count(6);
+		frame.Bool("visible", true);
+		frame.Int("hotspot_x", 4);
+		frame.Int("hotspot_y", 4);
+		frame.Int("width", 32);
+		frame.Int("height", 32);
+		frame.String("png", png);
+		Compare("set_cursor", R"({"command":"set_cursor","visible":true,"hotspot_x":4,"hotspot_y":4,"width":32,"height":32,"png":")" + png + R"("})", frame.data);
+	}
+
+	return handled ? 0 : 1;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+// command names of known_commands in Crucible.cpp, in table order (the order
+// defines the binary command ids)
+#define CRUCIBLE_COMMANDS(X) \
+	X(connect) \
+	X(capture_new_process) \
+	X(query_mics) \
+	X(update_settings) \
+	X(save_recording_buffer) \
+	X(create_bookmark) \
+	X(stop_recording) \
+	X(injector_result) \
+	X(monitored_process_exit) \
+	X(update_video_settings) \
+	X(set_cursor) \
+	X(dismiss_overlay) \
+	X(clip_accepted) \
+	X(clip_finished) \
+	X(forge_will_close) \
+	X(create_webrtc_output) \
+	X(remote_webrtc_offer) \
+	X(get_webrtc_stats) \
+	X(stop_webrtc_output) \
+	X(add_remote_ice_candidate) \
+	X(start_recording_stream) \
+	X(stop_recording_stream) \
+	X(start_streaming) \
+	X(stop_streaming) \
+	X(save_game_screenshot) \
+	X(query_webcams) \
+	X(query_desktop_audio_devices) \
+	X(query_windows) \
+	X(capture_window) \
+	X(select_scene) \
+	X(connect_display) \
+	X(resize_display) \
+	X(query_canvas_size) \
+	X(query_scene_info) \
+	X(update_scenes) \
+	X(set_source_volume) \
+	X(enable_source_level_meters) \
+	X(save_screenshot) \
+	X(update_recording_buffer_settings) \
+	X(query_hardware_encoders) \
+	X(update_disallowed_hardware_encoders) \
+	X(screenshot_uploading) \
+	X(show_first_time_tutorial) \
+	X(screenshot_saved) \
+	X(start_forward_buffer) \
+	X(stop_forward_buffer) \
+	X(dismiss_quick_select) \
+	X(begin_quick_select_timeout) \
+	X(shared_texture_incompatible) \
+	X(query_operation_queue_stats) \
+	X(cancel_screenshot)
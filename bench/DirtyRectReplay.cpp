@@ -0,0 +1,289 @@
+// Replays an overlay sequence through the framebuffer channel once with full
+// frames and once with dirty rects, and reports the bytes transferred and the
+// time the receiver spends patching its persistent frame.
+//
+// The sender side diffs consecutive frames in 32x32 tiles, merges changed
+// tiles per tile row into rects and falls back to a full frame when the rects
+// cover more than half of it; the receiver side is FramebufferProtocol::Parse
+// + ApplyDirtyRects, as in CrucibleFramebufferServer. Every patched frame is
+// compared against the source frame.
+//
+//   DirtyRectReplay [--frames n]
+//   DirtyRectReplay <capture.raw> <width> <height>
+//
+// A capture is headerless BGRA rawvideo, e.g. from
+//   ffmpeg -i overlay.webm -f rawvideo -pix_fmt bgra capture.raw
+// Without one a synthetic 1080p overlay is replayed (progress bar, counter,
+// blinking cursor, a toast sliding in and fading out)
+
+#include "FramebufferProtocol.hpp"
+
+#include "Bench.hpp"
+
+#include <fstream>
+#include <string>
+
+using namespace std;
+using namespace FramebufferProtocol;
+
+namespace {
+
+const uint32_t tile_size = 32;
+
+// produces the frames of the sequence one at a time, a 1080p capture doesn't
+// fit into memory as a whole
+struct Frames {
+	uint32_t width = 1920;
+	uint32_t height = 1080;
+
+	ifstream capture;
+	size_t count = 0;
+	size_t index = 0;
+
+	uint32_t Stride() const { return width * bytes_per_pixel; }
+	size_t Size() const { return static_cast<size_t>(Stride()) * height; }
+
+	bool Next(vector<uint8_t> &frame);
+	void Draw(vector<uint8_t> &frame);
+};
+
+void Fill(vector<uint8_t> &frame, uint32_t stride, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color)
+{
+	for (uint32_t row = y; row < y + height; row++)
+		for (uint32_t col = x; col < x + width; col++)
+			memcpy(&frame[row * stride + col * bytes_per_pixel], &color, sizeof(color));
+}
+
+uint32_t Alpha(uint32_t color, uint32_t alpha)
+{
+	return (color & 0xffffff) | (alpha << 24);
+}
+
+bool Frames::Next(vector<uint8_t> &frame)
+{
+	if (capture.is_open()) {
+		frame.resize(Size());
+		if (!capture.read(reinterpret_cast<char*>(frame.data()), frame.size()))
+			return false;
+
+		index += 1;
+		return true;
+	}
+
+	if (index >= count)
+		return false;
+
+	// synthetic frames are drawn over the previous one
+	if (frame.size() != Size())
+		frame.assign(Size(), 0);
+	Draw(frame);
+	index += 1;
+	return true;
+}
+
+void Frames::Draw(vector<uint8_t> &frame)
+{
+	auto stride = Stride();
+	auto i = index;
+
+	// static panel
+	if (!i)
+		Fill(frame, stride, 40, 40, 420, 140, 0xc0202020);
+
+	// progress bar grows by 1 px per frame
+	Fill(frame, stride, 60, 150, 1 + i % 380, 8, 0xff30c030);
+
+	// counter redraws every 10 frames
+	if (i % 10 == 0)
+		Fill(frame, stride, 60, 60, 96, 32, 0xff000000 | static_cast<uint32_t>(i * 2654435761u));
+
+	// cursor blinks every 15 frames
+	Fill(frame, stride, 170, 64, 2, 24, (i / 15) % 2 ? 0xffffffff : 0xc0202020);
+
+	// toast slides in from the right, stays, fades out
+	const uint32_t toast_w = 480, toast_h = 96, toast_y = 920;
+	auto phase = i % 240;
+	Fill(frame, stride, width - toast_w - 40, toast_y, toast_w + 40, toast_h, 0);
+	if (phase < 30) {
+		auto x = width - static_cast<uint32_t>((toast_w + 40) * (phase + 1) / 30);
+		Fill(frame, stride, x, toast_y, min(toast_w, width - x), toast_h, 0xe0303080);
+	} else if (phase < 180) {
+		Fill(frame, stride, width - toast_w - 40, toast_y, toast_w, toast_h, 0xe0303080);
+	} else if (phase < 210) {
+		auto alpha = 0xe0 * (210 - static_cast<uint32_t>(phase)) / 30;
+		Fill(frame, stride, width - toast_w - 40, toast_y, toast_w, toast_h, Alpha(0x303080, alpha));
+	}
+}
+
+// changed tiles of `cur` against `prev`, merged into one rect per run of
+// changed tiles in a tile row
+vector<Rect> Diff(const Frames &seq, const vector<uint8_t> &prev, const vector<uint8_t> &cur)
+{
+	vector<Rect> rects;
+	auto stride = seq.Stride();
+	for (uint32_t ty = 0; ty < seq.height; ty += tile_size) {
+		auto th = min(tile_size, seq.height - ty);
+		Rect run = {};
+		for (uint32_t tx = 0; tx < seq.width; tx += tile_size) {
+			auto tw = min(tile_size, seq.width - tx);
+			bool changed = false;
+			for (uint32_t row = ty; row < ty + th && !changed; row++) {
+				auto offset = static_cast<size_t>(row) * stride + tx * bytes_per_pixel;
+				changed = memcmp(&prev[offset], &cur[offset], tw * bytes_per_pixel) != 0;
+			}
+
+			if (changed && run.width) {
+				run.width += tw;
+			} else if (changed) {
+				run = { tx, ty, tw, th };
+			} else if (run.width) {
+				rects.push_back(run);
+				run = {};
+			}
+		}
+		if (run.width)
+			rects.push_back(run);
+	}
+	return rects;
+}
+
+void Append(vector<uint8_t> &message, const void *data, size_t size)
+{
+	auto offset = message.size();
+	message.resize(offset + size);
+	memcpy(message.data() + offset, data, size);
+}
+
+vector<uint8_t> Encode(const Frames &seq, const vector<uint8_t> &frame, const vector<Rect> &rects, uint64_t sequence)
+{
+	auto header = MakeHeader(seq.width, seq.height, seq.Stride(), FORMAT_BGRA, sequence, 0);
+	header.dirty_rect_count = static_cast<uint32_t>(rects.size());
+
+	vector<uint8_t> message;
+	Append(message, &header, sizeof(header));
+	if (rects.empty()) {
+		Append(message, frame.data(), frame.size());
+		return message;
+	}
+
+	Append(message, rects.data(), rects.size() * sizeof(Rect));
+	for (auto &rect : rects)
+		for (uint32_t row = rect.y; row < rect.y + rect.height; row++)
+			Append(message, &frame[static_cast<size_t>(row) * seq.Stride() + rect.x * bytes_per_pixel], rect.width * bytes_per_pixel);
+	return message;
+}
+
+// what the receiver does per message; false if the message was rejected
+bool Receive(const vector<uint8_t> &message, vector<uint8_t> &frame, vector<Rect> &rects)
+{
+	Header header;
+	const uint8_t *payload;
+	size_t payload_size;
+	if (!Parse(message.data(), message.size(), header, rects, payload, payload_size))
+		return false;
+
+	if (rects.empty())
+		memcpy(frame.data(), payload, static_cast<size_t>(header.stride) * header.height);
+	else
+		ApplyDirtyRects(frame.data(), header.stride, rects, payload);
+	return true;
+}
+
+// receiver side of one channel
+struct Receiver {
+	vector<uint8_t> frame;
+	vector<Rect> rects;
+
+	uint64_t bytes = 0;
+	size_t full_frames = 0;
+	size_t rect_count = 0;
+	double patch_ns = 0.;
+	double max_patch_ns = 0.;
+	size_t mismatches = 0;
+
+	void Replay(const vector<uint8_t> &message, const vector<uint8_t> &source)
+	{
+		if (frame.size() != source.size())
+			frame.assign(source.size(), 0);
+
+		bytes += message.size();
+
+		auto start = chrono::steady_clock::now();
+		auto ok = Receive(message, frame, rects);
+		ClobberMemory();
+		auto ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+
+		patch_ns += ns;
+		max_patch_ns = max(max_patch_ns, ns);
+		full_frames += rects.empty();
+		rect_count += rects.size();
+		mismatches += !ok || frame != source;
+	}
+
+	void Print(const char *label, size_t frames) const
+	{
+		printf("%-12s %10.2f MB  %8.1f KB/frame  %5zu full frames  %6zu rects  patch %8.1f us/frame (max %8.1f us)\n",
+			label, bytes / 1e6, bytes / 1e3 / frames, full_frames, rect_count,
+			patch_ns / 1e3 / frames, max_patch_ns / 1e3);
+	}
+};
+
+}
+
+int main(int argc, char **argv)
+{
+	Frames seq;
+	const char *source = "synthetic overlay";
+	if (argc == 4) {
+		source = argv[1];
+		seq.width = stoul(argv[2]);
+		seq.height = stoul(argv[3]);
+		seq.capture.open(argv[1], ios::binary);
+	} else {
+		seq.count = 600;
+		if (argc == 3 && string(argv[1]) == "--frames")
+			seq.count = max<size_t>(1, stoul(argv[2]));
+	}
+
+	Receiver full, dirty;
+	vector<uint8_t> prev, cur;
+	const vector<Rect> none;
+	for (uint64_t i = 0; seq.Next(cur); i++) {
+		full.Replay(Encode(seq, cur, none, i), cur);
+
+		// first frame, and frames that changed too much, go out whole
+		vector<Rect> rects;
+		if (i) {
+			rects = Diff(seq, prev, cur);
+			uint64_t size = 0;
+			DirtyRectsSize(rects, seq.width, seq.height, size);
+			if (rects.size() > max_dirty_rects || size * 2 > cur.size())
+				rects.clear();
+
+			// an unchanged frame still goes out as a zero sized rect, so the
+			// receiver sees the sequence/timestamp
+			else if (rects.empty())
+				rects.push_back(Rect{ 0, 0, 0, 0 });
+		}
+
+		dirty.Replay(Encode(seq, cur, rects, i), cur);
+		prev = cur;
+	}
+
+	if (!seq.index) {
+		fprintf(stderr, "no %ux%u frames in %s\n", seq.width, seq.height, source);
+		return 1;
+	}
+
+	printf("%s: %zu frames, %ux%u\n", source, seq.index, seq.width, seq.height);
+	full.Print("full frames", seq.index);
+	dirty.Print("dirty rects", seq.index);
+	printf("%.1fx fewer bytes\n", double(full.bytes) / dirty.bytes);
+
+	if (full.mismatches || dirty.mismatches) {
+		fprintf(stderr, "%zu full / %zu dirty rect frames didn't match the source\n", full.mismatches, dirty.mismatches);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,230 @@
+// Bytes per frame and CPU time per frame for the RemoteDisplay compression
+// options (connect_display's "codec"): none, lossless (FrameCodec delta RLE)
+// and jpeg, on short synthetic 720p sequences shaped like what a game client
+// shows:
+//
+//   menu       static backdrop, a pulsing button and a moving cursor
+//   loading    black screen, spinner and progress bar
+//   gameplay   shaded terrain panning under a static HUD, every pixel of the
+//              3D view changes every frame
+//   cutscene   letterboxed video, grain over the whole picture area
+//
+// Frames are encoded in order, the delta encoder is reset at the start of
+// every pass like after connect_display. jpeg is libjpeg(-turbo) instead of
+// WIC (see JpegStandIn.hpp), including the BGRA to RGBA copy RemoteDisplay
+// does first; without libjpeg the column is left out.
+//
+//   FrameCodecBench [frames per sequence]
+
+#include "FrameCodec.hpp"
+#include "PitchedCopy.hpp"
+
+#include "Bench.hpp"
+#ifdef CRUCIBLE_BENCH_JPEG
+#include "JpegStandIn.hpp"
+#endif
+
+#include <cmath>
+#include <functional>
+#include <random>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+const uint32_t cx = 1280;
+const uint32_t cy = 720;
+const size_t frame_size = size_t(cx) * cy * 4;
+
+uint32_t Bgra(int b, int g, int r)
+{
+	auto clamp = [](int v) { return static_cast<uint32_t>(min(max(v, 0), 255)); };
+	return clamp(b) | clamp(g) << 8 | clamp(r) << 16 | 0xff000000u;
+}
+
+struct Canvas {
+	uint8_t *data;
+
+	void Set(uint32_t x, uint32_t y, uint32_t px)
+	{
+		memcpy(data + (size_t(y) * cx + x) * 4, &px, 4);
+	}
+
+	void Fill(uint32_t x0, uint32_t y0, uint32_t w, uint32_t h, uint32_t px)
+	{
+		for (auto y = y0; y < min(y0 + h, cy); y++)
+			for (auto x = x0; x < min(x0 + w, cx); x++)
+				Set(x, y, px);
+	}
+};
+
+// smooth shading with a little dither, like a rendered scene after
+// tonemapping; `u` scrolls it horizontally
+uint32_t Terrain(uint32_t u, uint32_t y, uint32_t noise)
+{
+	auto fu = u * 0.013, fy = y * 0.021;
+	auto height = sin(fu) * cos(fy * 0.7) + 0.5 * sin(fu * 2.3 + fy * 1.9) + 0.25 * cos(fu * 5.1 - fy * 4.3);
+	auto shade = static_cast<int>(height * 40);
+	auto d = static_cast<int>(noise & 7) - 4;
+	return Bgra(50 + shade / 2 + d, 110 + shade + d, 70 + shade / 3 + d);
+}
+
+void Hud(Canvas c)
+{
+	c.Fill(20, cy - 80, 300, 60, Bgra(30, 30, 30));
+	c.Fill(30, cy - 70, 200, 12, Bgra(40, 40, 200));
+	c.Fill(30, cy - 50, 150, 12, Bgra(200, 120, 40));
+	c.Fill(cx - 220, 20, 200, 200, Bgra(20, 40, 20));
+	c.Fill(cx - 125, 115, 10, 10, Bgra(255, 255, 255));
+}
+
+void Menu(Canvas c, uint32_t frame, mt19937 &)
+{
+	// the backdrop doesn't change, it only has to be drawn once but that
+	// isn't worth special casing here
+	for (uint32_t y = 0; y < cy; y++)
+		for (uint32_t x = 0; x < cx; x++)
+			c.Set(x, y, Bgra(60 + y / 12, 30 + x / 20, 20 + (x + y) / 30));
+
+	for (uint32_t i = 0; i < 5; i++)
+		c.Fill(540, 240 + i * 70, 200, 50, Bgra(70, 70, 70));
+
+	auto glow = static_cast<int>(40 * sin(frame * 0.3));
+	c.Fill(540, 240, 200, 50, Bgra(120 + glow, 120 + glow, 140 + glow));
+
+	auto cursor_x = 300 + frame * 9, cursor_y = 200 + frame * 5;
+	c.Fill(cursor_x, cursor_y, 12, 18, Bgra(255, 255, 255));
+}
+
+void Loading(Canvas c, uint32_t frame, mt19937 &)
+{
+	c.Fill(0, 0, cx, cy, Bgra(0, 0, 0));
+	c.Fill(340, 600, 600 * (frame + 1) / 64, 8, Bgra(200, 200, 200));
+
+	auto angle = frame * 0.4;
+	for (int i = 0; i < 8; i++) {
+		auto a = angle + i * 0.785;
+		auto x = static_cast<uint32_t>(640 + 30 * cos(a));
+		auto y = static_cast<uint32_t>(520 + 30 * sin(a));
+		c.Fill(x - 4, y - 4, 8, 8, Bgra(255 - i * 28, 255 - i * 28, 255 - i * 28));
+	}
+}
+
+void Gameplay(Canvas c, uint32_t frame, mt19937 &rng)
+{
+	for (uint32_t y = 0; y < cy; y++)
+		for (uint32_t x = 0; x < cx; x++)
+			c.Set(x, y, y < cy / 3 ? Bgra(230 - y / 3, 170 - y / 6, 120) : Terrain(x + frame * 6, y, rng()));
+	Hud(c);
+}
+
+void Cutscene(Canvas c, uint32_t frame, mt19937 &rng)
+{
+	const uint32_t bar = 88;
+	c.Fill(0, 0, cx, bar, Bgra(0, 0, 0));
+	c.Fill(0, cy - bar, cx, bar, Bgra(0, 0, 0));
+	for (uint32_t y = bar; y < cy - bar; y++)
+		for (uint32_t x = 0; x < cx; x++) {
+			auto px = Terrain(x * 2 + frame * 3, y * 2, 0);
+			auto grain = static_cast<int>(rng() % 17) - 8;
+			c.Set(x, y, Bgra((px & 0xff) + grain, ((px >> 8) & 0xff) + grain, ((px >> 16) & 0xff) + grain));
+		}
+}
+
+struct Codec {
+	string name;
+	function<void(const uint8_t*, vector<uint8_t>&)> encode;
+	function<bool(const vector<uint8_t>&)> decode;
+	function<void()> reset;
+};
+
+void BenchScene(const char *label, void (*draw)(Canvas, uint32_t, mt19937&), uint32_t frames, vector<Codec> &codecs)
+{
+	vector<vector<uint8_t>> sequence(frames, vector<uint8_t>(frame_size));
+	mt19937 rng{ 9 };
+	for (uint32_t i = 0; i < frames; i++)
+		draw(Canvas{ sequence[i].data() }, i, rng);
+
+	printf("%s (%ux%u, %u frames)\n", label, cx, cy, frames);
+
+	vector<vector<uint8_t>> encoded(frames);
+	for (auto &codec : codecs) {
+		char name[64];
+		snprintf(name, sizeof(name), "  %s, encode", codec.name.c_str());
+		auto encode_ns = Bench(name, 1, [&]
+		{
+			codec.reset();
+			for (uint32_t i = 0; i < frames; i++) {
+				encoded[i].clear();
+				codec.encode(sequence[i].data(), encoded[i]);
+			}
+		}, "kframes", frames * 1000.);
+
+		bool ok = true;
+		snprintf(name, sizeof(name), "  %s, decode", codec.name.c_str());
+		auto decode_ns = Bench(name, 1, [&]
+		{
+			for (uint32_t i = 0; i < frames; i++)
+				ok = codec.decode(encoded[i]) && ok;
+		}, "kframes", frames * 1000.);
+
+		size_t bytes = 0;
+		for (auto &e : encoded)
+			bytes += e.size();
+		auto per_frame = double(bytes) / frames;
+		printf("    %10.0f bytes/frame (%5.1f%% of raw), %.2f ms encode + %.2f ms decode per frame, %.1f MB/s at 60 fps%s\n",
+			per_frame, per_frame * 100. / frame_size, encode_ns / frames / 1e6, decode_ns / frames / 1e6, per_frame * 60 / 1e6,
+			ok ? "" : "  DECODE FAILED");
+	}
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t frames = 16;
+	if (argc > 1)
+		frames = max(1ul, strtoul(argv[1], nullptr, 10));
+
+	vector<Codec> codecs;
+
+	// the frame copied into the send buffer as it is
+	codecs.push_back({ "none", [](const uint8_t *src, vector<uint8_t> &out)
+	{
+		out.resize(frame_size);
+		memcpy(out.data(), src, frame_size);
+	}, [](const vector<uint8_t> &data) { return data.size() == frame_size; }, [] {} });
+
+	FrameCodec::Encoder encoder;
+	FrameCodec::Decoder decoder;
+	codecs.push_back({ "lossless", [&](const uint8_t *src, vector<uint8_t> &out)
+	{
+		encoder.Encode(src, cx * 4, cx, cy, out);
+	}, [&](const vector<uint8_t> &data)
+	{
+		return decoder.Decode(data.data(), data.size(), cx, cy);
+	}, [&] { encoder.Reset(); } });
+
+#ifdef CRUCIBLE_BENCH_JPEG
+	vector<uint8_t> jpeg_input(frame_size), jpeg_output;
+	for (auto quality : { 80, 50 }) {
+		codecs.push_back({ "jpeg, jpeg_quality " + to_string(quality), [&, quality](const uint8_t *src, vector<uint8_t> &out)
+		{
+			PitchedCopy::Copy(jpeg_input.data(), cx * 4, src, cx * 4, cx * 4, cy, PitchedCopy::SWIZZLE_BGRA_RGBA);
+			EncodeJpeg(jpeg_input.data(), cx, cy, quality, out, JCS_EXT_RGBA);
+		}, [&](const vector<uint8_t> &data)
+		{
+			uint32_t width, height;
+			return DecodeJpeg(data.data(), data.size(), jpeg_output, width, height) && width == cx && height == cy;
+		}, [] {} });
+	}
+#endif
+
+	BenchScene("menu", Menu, frames, codecs);
+	BenchScene("loading", Loading, frames, codecs);
+	BenchScene("gameplay", Gameplay, frames, codecs);
+	BenchScene("cutscene", Cutscene, frames, codecs);
+
+	return 0;
+}
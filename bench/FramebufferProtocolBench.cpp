@@ -0,0 +1,252 @@
+// Framebuffer channel round trip with the "FramebufferInfo" JSON + payload
+// message pair against a single framed message, sender and receiver doing
+// what RemoteDisplay and CrucibleFramebufferServer do per frame.
+//
+// Messages go through the shared memory ring, since ipc-util's pipe backend
+// is Windows only. obs_data is the stub from tests/stub and has no
+// obs_data_get_json, the info JSON is formatted the way jansson prints it
+
+#include "FramebufferProtocol.hpp"
+#include "OBSHelpers.hpp"
+#include "SharedMemoryIPC.hpp"
+
+#include "Bench.hpp"
+
+#include <condition_variable>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const string info_header_fragment = "FramebufferInfo";
+
+struct Frame {
+	uint32_t width;
+	uint32_t height;
+	uint32_t line_size;
+	vector<uint8_t> data;
+
+	Frame(uint32_t width, uint32_t height)
+		: width(width), height(height), line_size(width * 4 + 64), data(static_cast<size_t>(line_size) * height, 0x5a)
+	{}
+};
+
+string InfoJson(OBSData &data)
+{
+	char json[256];
+	snprintf(json, sizeof(json), "{\"line_size\": %lld, \"width\": %lld, \"height\": %lld}",
+		obs_data_get_int(data, "line_size"), obs_data_get_int(data, "width"), obs_data_get_int(data, "height"));
+	return info_header_fragment + json;
+}
+
+// RemoteDisplay, per frame
+struct JsonSender {
+	OBSData data = OBSDataCreate();
+
+	void Send(const Frame &frame, SharedMemoryIPCClient &client)
+	{
+		obs_data_set_int(data, "line_size", frame.line_size);
+		obs_data_set_int(data, "width", frame.width);
+		obs_data_set_int(data, "height", frame.height);
+
+		auto info = InfoJson(data);
+		client.Write(reinterpret_cast<const uint8_t*>(info.data()), info.size() + 1);
+		client.Write(frame.data.data(), frame.data.size());
+	}
+};
+
+// header and tightly packed rows, assembled in send_buffer as RemoteDisplay
+// does, or directly in the ring
+template <bool InPlace>
+struct FramedSender {
+	vector<uint8_t> send_buffer;
+	uint64_t sequence = 0;
+
+	void Send(const Frame &frame, SharedMemoryIPCClient &client)
+	{
+		auto row_size = frame.width * FramebufferProtocol::bytes_per_pixel;
+		auto header = FramebufferProtocol::MakeHeader(frame.width, frame.height, row_size, FramebufferProtocol::FORMAT_RGBA, ++sequence, 0);
+		auto size = sizeof(header) + static_cast<size_t>(row_size) * frame.height;
+
+		uint8_t *message;
+		if (InPlace) {
+			message = client.Reserve(size);
+			if (!message)
+				return;
+		} else {
+			send_buffer.resize(size);
+			message = send_buffer.data();
+		}
+
+		memcpy(message, &header, sizeof(header));
+
+		auto dst = message + sizeof(header);
+		auto src = frame.data.data();
+		for (uint32_t y = 0; y < frame.height; y++) {
+			memcpy(dst, src, row_size);
+			dst += row_size;
+			src += frame.line_size;
+		}
+
+		if (InPlace)
+			client.Commit();
+		else
+			client.Write(send_buffer.data(), send_buffer.size());
+	}
+};
+
+// CrucibleFramebufferServer, per message; both formats are accepted, as in
+// the server
+struct Receiver {
+	bool have_metadata = false;
+	uint32_t width = 0, height = 0, line_size = 0;
+	vector<FramebufferProtocol::Rect> dirty_rects;
+
+	mutex m;
+	condition_variable cv;
+	size_t frames = 0;
+	uint64_t checksum = 0;
+
+	void Handle(const uint8_t *data, size_t size)
+	{
+		if (FramebufferProtocol::IsFramed(data, size)) {
+			have_metadata = false;
+
+			FramebufferProtocol::Header header;
+			const uint8_t *payload;
+			size_t payload_size;
+			if (!FramebufferProtocol::Parse(data, size, header, dirty_rects, payload, payload_size))
+				return;
+
+			Deliver(payload, payload_size);
+			return;
+		}
+
+		if (!have_metadata) {
+			if (size < info_header_fragment.size() + 2 || memcmp(info_header_fragment.data(), data, info_header_fragment.size()) != 0)
+				return;
+
+			auto info = OBSDataCreate({ data + info_header_fragment.size(), data + size - 1 });
+			width = static_cast<uint32_t>(obs_data_get_int(info, "width"));
+			height = static_cast<uint32_t>(obs_data_get_int(info, "height"));
+			line_size = static_cast<uint32_t>(obs_data_get_int(info, "line_size"));
+			have_metadata = true;
+			return;
+		}
+
+		have_metadata = false;
+		if (size >= static_cast<size_t>(line_size) * height)
+			Deliver(data, size);
+	}
+
+	void Deliver(const uint8_t *data, size_t size)
+	{
+		// the consumer touches both ends of the payload
+		lock_guard<mutex> lock(m);
+		checksum += data[0] + data[size - 1];
+		frames += 1;
+		cv.notify_all();
+	}
+
+	void Wait(size_t count)
+	{
+		unique_lock<mutex> lock(m);
+		cv.wait(lock, [&] { return frames >= count; });
+	}
+};
+
+template <typename Sender>
+void BenchRoundTrip(const char *name, const Frame &frame, size_t count)
+{
+	auto ring_name = "crucible-bench-" + to_string(getpid());
+	uint32_t capacity = SharedMemoryIPC::default_capacity;
+	while (capacity / 2 < frame.data.size() + sizeof(FramebufferProtocol::Header) + sizeof(SharedMemoryIPC::RecordHeader) + 8)
+		capacity *= 2;
+
+	Receiver receiver;
+	SharedMemoryIPCServer server{ ring_name, [&](uint8_t *data, size_t size)
+	{
+		if (data)
+			receiver.Handle(data, size);
+	}, capacity };
+
+	SharedMemoryIPCClient client{ ring_name };
+	if (!client) {
+		printf("%-48s failed to open ring\n", name);
+		return;
+	}
+
+	Sender sender;
+
+	size_t sent = 0;
+	Bench(name, 1, [&]
+	{
+		for (size_t i = 0; i < count; i++)
+			sender.Send(frame, client);
+		sent += count;
+		receiver.Wait(sent);
+	}, "kframes", count * 1000.);
+}
+
+// header handling alone, without payload copies or transport
+void BenchHeaders()
+{
+	Frame frame{ 1920, 1080 };
+	Receiver receiver;
+
+	JsonSender json;
+	string info;
+	Bench("  json info, serialize + parse", 100000, [&]
+	{
+		obs_data_set_int(json.data, "line_size", frame.line_size);
+		obs_data_set_int(json.data, "width", frame.width);
+		obs_data_set_int(json.data, "height", frame.height);
+		info = InfoJson(json.data);
+		receiver.have_metadata = false;
+		receiver.Handle(reinterpret_cast<const uint8_t*>(info.data()), info.size() + 1);
+		DoNotOptimize(receiver.width);
+	});
+
+	vector<uint8_t> message(sizeof(FramebufferProtocol::Header) + static_cast<size_t>(frame.width) * 4 * frame.height);
+	uint64_t sequence = 0;
+	Bench("  binary header, build + parse", 100000, [&]
+	{
+		auto header = FramebufferProtocol::MakeHeader(frame.width, frame.height, frame.width * 4, FramebufferProtocol::FORMAT_RGBA, ++sequence, 0);
+		memcpy(message.data(), &header, sizeof(header));
+
+		FramebufferProtocol::Header parsed;
+		const uint8_t *payload;
+		size_t payload_size;
+		DoNotOptimize(FramebufferProtocol::Parse(message.data(), message.size(), parsed, receiver.dirty_rects, payload, payload_size));
+	});
+}
+
+}
+
+int main()
+{
+	printf("per frame header handling, 1080p\n");
+	BenchHeaders();
+
+	struct {
+		const char *label;
+		uint32_t width, height;
+		size_t count;
+	} cases[] = {
+		{ "cursor sized 64x64", 64, 64, 20000 },
+		{ "overlay 720p", 1280, 720, 100 },
+		{ "overlay 1080p", 1920, 1080, 50 },
+	};
+
+	for (auto &c : cases) {
+		Frame frame{ c.width, c.height };
+		printf("%s round trip, %zu frames per run\n", c.label, c.count);
+		BenchRoundTrip<JsonSender>("  json info + payload", frame, c.count);
+		BenchRoundTrip<FramedSender<false>>("  framed message", frame, c.count);
+		BenchRoundTrip<FramedSender<true>>("  framed message, assembled in the ring", frame, c.count);
+	}
+
+	return 0;
+}
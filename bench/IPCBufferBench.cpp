@@ -0,0 +1,146 @@
+// Per-frame cost of handing a received framebuffer to the render thread,
+// copying into a vector (the old ForgeFramebufferServer path) vs leasing.
+//
+// "pipe" cases start from a buffer owned by the transport, like ipc-util's
+// read buffer, so the lease path still has to copy once into a pool buffer;
+// the "ring" cases run the shared memory ring end to end, where the lease
+// points into the ring
+
+#include "IPCBuffer.hpp"
+#include "SharedMemoryIPC.hpp"
+
+#include "Bench.hpp"
+
+#include <condition_variable>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+void PipeCopy(const char *name, const vector<uint8_t> &received)
+{
+	vector<uint8_t> incoming_data, shared_data, read_data;
+	Bench(name, 200, [&]
+	{
+		incoming_data.assign(received.data(), received.data() + received.size());
+		swap(incoming_data, shared_data);
+		swap(shared_data, read_data);
+		DoNotOptimize(read_data.data());
+	}, double(received.size()));
+}
+
+void PipeLease(const char *name, const vector<uint8_t> &received)
+{
+	IPCBufferPool pool;
+	IPCBufferLease shared_data, read_data;
+	Bench(name, 200, [&]
+	{
+		shared_data = pool.Copy(received.data(), received.size());
+		read_data = move(shared_data);
+		DoNotOptimize(read_data.data());
+	}, double(received.size()));
+}
+
+struct Frames {
+	mutex m;
+	condition_variable cv;
+	size_t count = 0;
+
+	void Add()
+	{
+		lock_guard<mutex> lock(m);
+		count += 1;
+		cv.notify_all();
+	}
+
+	void Wait(size_t target)
+	{
+		unique_lock<mutex> lock(m);
+		cv.wait(lock, [&] { return count >= target; });
+	}
+};
+
+void RingCopy(const char *name, size_t size)
+{
+	auto ring_name = "crucible-bench-copy-" + to_string(getpid());
+
+	Frames frames;
+	vector<uint8_t> incoming_data, shared_data;
+	SharedMemoryIPCServer server{ ring_name, [&](uint8_t *data, size_t size)
+	{
+		if (!data)
+			return;
+		incoming_data.assign(data, data + size);
+		swap(incoming_data, shared_data);
+		frames.Add();
+	}, static_cast<uint32_t>(size * 4) };
+
+	SharedMemoryIPCClient client{ ring_name };
+	vector<uint8_t> frame(size, 0x40);
+	size_t sent = 0;
+	Bench(name, 1, [&]
+	{
+		for (int i = 0; i < 50; i++)
+			client.Write(frame.data(), frame.size());
+		frames.Wait(sent += 50);
+	}, double(size) * 50);
+}
+
+void RingLease(const char *name, size_t size)
+{
+	auto ring_name = "crucible-bench-lease-" + to_string(getpid());
+
+	Frames frames;
+	IPCBufferLease shared_data;
+	SharedMemoryIPCServer server;
+	server.StartLeased(ring_name, [&](IPCBufferLease data)
+	{
+		if (!data)
+			return;
+		shared_data = move(data);
+		frames.Add();
+	}, static_cast<uint32_t>(size * 4));
+
+	SharedMemoryIPCClient client{ ring_name };
+	vector<uint8_t> frame(size, 0x40);
+	size_t sent = 0;
+	Bench(name, 1, [&]
+	{
+		for (int i = 0; i < 50; i++)
+			client.Write(frame.data(), frame.size());
+		frames.Wait(sent += 50);
+	}, double(size) * 50);
+
+	server = SharedMemoryIPCServer{};
+	shared_data.Release();
+}
+
+}
+
+int main()
+{
+	struct {
+		const char *label;
+		size_t width, height;
+	} sizes[] = {
+		{ "1080p BGRA", 1920, 1080 },
+		{ "1440p BGRA", 2560, 1440 },
+	};
+
+	for (auto &s : sizes) {
+		auto size = s.width * s.height * 4;
+		vector<uint8_t> received(size, 0x7f);
+
+		printf("%s, per frame\n", s.label);
+		PipeCopy("  pipe, copy into vector", received);
+		PipeLease("  pipe, lease from pool", received);
+
+		printf("%s, per 50 frames\n", s.label);
+		RingCopy("  ring, copy into vector", size);
+		RingLease("  ring, lease in place", size);
+	}
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+// The screenshot encoder stage on synthetic 1080p and 4K frames: the copy
+// out of the mapped staging surface (all that still happens with graphics
+// entered), the encode on its own and a burst of screenshots through a
+// worker pool.
+//
+// ImageEncoder itself is WIC, so it doesn't build here; libpng and libjpeg
+// stand in for it with the same option mapping (png_compression as the
+// deflate level and filter choice, jpeg_quality). Absolute encode times
+// differ from WIC, the ratio between copy and encode is what matters
+
+#include "PitchedCopy.hpp"
+
+#include "Bench.hpp"
+#include "JpegStandIn.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include <png.h>
+
+using namespace std;
+
+namespace {
+
+struct Frame {
+	uint32_t cx, cy;
+	vector<uint8_t> bgra;
+};
+
+// gradient sky, noisy terrain and flat HUD boxes, so neither encoder gets a
+// trivially compressible image
+Frame Synthetic(uint32_t cx, uint32_t cy)
+{
+	Frame frame{ cx, cy, vector<uint8_t>(static_cast<size_t>(cx) * cy * 4) };
+	mt19937 rng{ 7 };
+	for (uint32_t y = 0; y < cy; y++)
+		for (uint32_t x = 0; x < cx; x++) {
+			auto px = &frame.bgra[(static_cast<size_t>(y) * cx + x) * 4];
+			bool hud = (y > cy * 9 / 10 && x < cx / 3) || (y < cy / 12 && x > cx * 3 / 4);
+			if (hud) {
+				px[0] = 40; px[1] = 40; px[2] = 40;
+			} else if (y < cy / 2) {
+				px[0] = static_cast<uint8_t>(255 - y * 128 / cy);
+				px[1] = static_cast<uint8_t>(160 + x * 64 / cx);
+				px[2] = static_cast<uint8_t>(90 + y * 64 / cy);
+			} else {
+				auto n = rng();
+				px[0] = static_cast<uint8_t>(40 + (n & 31));
+				px[1] = static_cast<uint8_t>(90 + ((n >> 8) & 63) + x * 32 / cx);
+				px[2] = static_cast<uint8_t>(60 + ((n >> 16) & 31));
+			}
+			px[3] = 255;
+		}
+	return frame;
+}
+
+// same mapping as ImageEncoder's PngFilter
+int PngFilter(int compression)
+{
+	if (compression == 0)
+		return PNG_FILTER_NONE;
+	if (compression <= 5)
+		return PNG_FILTER_SUB;
+	return PNG_ALL_FILTERS;
+}
+
+bool EncodePng(const Frame &frame, int compression, vector<uint8_t> &out)
+{
+	out.clear();
+	auto png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+	auto info = png ? png_create_info_struct(png) : nullptr;
+	if (!info) {
+		png_destroy_write_struct(&png, nullptr);
+		return false;
+	}
+
+	if (setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, &info);
+		return false;
+	}
+
+	png_set_write_fn(png, &out, [](png_structp png, png_bytep data, png_size_t size)
+	{
+		auto out = static_cast<vector<uint8_t>*>(png_get_io_ptr(png));
+		out->insert(end(*out), data, data + size);
+	}, nullptr);
+
+	png_set_IHDR(png, info, frame.cx, frame.cy, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_set_compression_level(png, compression);
+	png_set_filter(png, PNG_FILTER_TYPE_BASE, PngFilter(compression));
+	png_write_info(png, info);
+	png_set_bgr(png);
+
+	for (uint32_t y = 0; y < frame.cy; y++)
+		png_write_row(png, const_cast<png_bytep>(&frame.bgra[static_cast<size_t>(y) * frame.cx * 4]));
+
+	png_write_end(png, nullptr);
+	png_destroy_write_struct(&png, &info);
+	return true;
+}
+
+// same shape as ImageEncoder::WorkerPool, minus COM
+struct WorkerPool {
+	explicit WorkerPool(size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+			threads.emplace_back([this] { Run(); });
+	}
+
+	~WorkerPool()
+	{
+		{
+			lock_guard<mutex> lock(m);
+			exit = true;
+		}
+		cv.notify_all();
+		for (auto &t : threads)
+			t.join();
+	}
+
+	void Submit(function<void()> job)
+	{
+		{
+			lock_guard<mutex> lock(m);
+			jobs.push_back(move(job));
+		}
+		cv.notify_one();
+	}
+
+protected:
+	mutex m;
+	condition_variable cv;
+	deque<function<void()>> jobs;
+	bool exit = false;
+	vector<thread> threads;
+
+	void Run()
+	{
+		for (;;) {
+			function<void()> job;
+			{
+				unique_lock<mutex> lock(m);
+				cv.wait(lock, [&] { return exit || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+};
+
+void BenchSize(const char *label, uint32_t cx, uint32_t cy)
+{
+	auto frame = Synthetic(cx, cy);
+	auto bytes = double(frame.bgra.size());
+	printf("%s (%ux%u)\n", label, cx, cy);
+
+	// staging surface mapping with a padded RowPitch, copied out tightly
+	auto pitch = (cx * 4 + 255) & ~255u;
+	vector<uint8_t> mapped(static_cast<size_t>(pitch) * cy);
+	PitchedCopy::Copy(mapped.data(), pitch, frame.bgra.data(), cx * 4, cx * 4, cy);
+
+	Frame copy{ cx, cy, vector<uint8_t>(frame.bgra.size()) };
+	Bench("  copy out of the staging surface", 20, [&]
+	{
+		PitchedCopy::Copy(copy.bgra.data(), cx * 4, mapped.data(), pitch, cx * 4, cy);
+		ClobberMemory();
+	}, bytes);
+
+	vector<uint8_t> out;
+	for (auto compression : { 1, 6, 9 }) {
+		char name[64];
+		snprintf(name, sizeof(name), "  png, png_compression %d", compression);
+		Bench(name, 1, [&] { EncodePng(frame, compression, out); }, bytes);
+		printf("    %.2f MB\n", out.size() / 1e6);
+	}
+
+	for (auto quality : { 90, 75 }) {
+		char name[64];
+		snprintf(name, sizeof(name), "  jpeg, jpeg_quality %d", quality);
+		Bench(name, 2, [&] { EncodeJpeg(frame.bgra.data(), cx, cy, quality, out); }, bytes);
+		printf("    %.2f MB\n", out.size() / 1e6);
+	}
+
+	// burst of screenshots (bookmark + save_game_screenshot and friends)
+	const size_t burst = 8;
+	auto hardware = max<size_t>(1, thread::hardware_concurrency());
+	for (auto workers : { size_t(1), min<size_t>(hardware, 4) }) {
+		char name[64];
+		snprintf(name, sizeof(name), "  burst of %zu png, %zu worker(s)", burst, workers);
+		Bench(name, 1, [&]
+		{
+			WorkerPool pool{ workers };
+			for (size_t i = 0; i < burst; i++)
+				pool.Submit([&]
+				{
+					vector<uint8_t> encoded;
+					EncodePng(frame, 6, encoded);
+					DoNotOptimize(encoded.size());
+				});
+		}, "screenshots", burst * 1e6);
+
+		if (workers == hardware)
+			break;
+	}
+}
+
+}
+
+int main()
+{
+	BenchSize("1080p", 1920, 1080);
+	BenchSize("4K", 3840, 2160);
+
+	return 0;
+}
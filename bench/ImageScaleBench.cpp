@@ -0,0 +1,115 @@
+// Thumbnails from read back 1080p to 4K frames through ImageScale::Resize,
+// against the same box + bilinear passes in plain C++ (what the non-SSE2
+// build does) and against just copying the full frame out, which is what a
+// full size capture costs on the CPU side at the least
+
+#include "ImageScale.hpp"
+
+#include "Bench.hpp"
+
+#include <random>
+
+using namespace std;
+
+namespace {
+
+void HalveScalar(uint8_t *dst, const uint8_t *src, size_t pitch, uint32_t cx, uint32_t cy)
+{
+	for (uint32_t y = 0; y < cy / 2; y++)
+		for (uint32_t x = 0; x < cx / 2; x++) {
+			auto px = ImageScale::Detail::BoxPixel(src + 2 * y * pitch + x * 8, src + (2 * y + 1) * pitch + x * 8);
+			memcpy(dst + (y * (cx / 2) + x) * 4, &px, 4);
+		}
+}
+
+void BilinearScalar(uint8_t *dst, uint32_t dst_cx, uint32_t dst_cy, const uint8_t *src, size_t pitch, uint32_t src_cx, uint32_t src_cy)
+{
+	ImageScale::Detail::Axis ax(src_cx, dst_cx);
+	ImageScale::Detail::Axis ay(src_cy, dst_cy);
+	for (uint32_t y = 0; y < dst_cy; y++) {
+		uint32_t sy, wy;
+		ay.At(y, sy, wy);
+		auto row0 = src + sy * pitch;
+		auto row1 = sy < src_cy - 1 ? row0 + pitch : row0;
+		for (uint32_t x = 0; x < dst_cx; x++) {
+			uint32_t sx, wx;
+			ax.At(x, sx, wx);
+			auto next = sx < src_cx - 1 ? 4 : 0;
+			for (int c = 0; c < 4; c++) {
+				auto top = (row0[sx * 4 + c] * (256 - wx) + row0[sx * 4 + next + c] * wx) >> 8;
+				auto bottom = (row1[sx * 4 + c] * (256 - wx) + row1[sx * 4 + next + c] * wx) >> 8;
+				dst[(y * dst_cx + x) * 4 + c] = static_cast<uint8_t>((top * (256 - wy) + bottom * wy + 128) >> 8);
+			}
+		}
+	}
+}
+
+void ResizeScalar(const uint8_t *src, size_t pitch, uint32_t cx, uint32_t cy, vector<uint8_t> &dst, uint32_t dst_cx, uint32_t dst_cy)
+{
+	vector<uint8_t> levels[2];
+	size_t level = 0;
+	while (cx / 2 >= dst_cx && cy / 2 >= dst_cy) {
+		auto &next = levels[level];
+		next.resize(size_t(cx / 2) * (cy / 2) * 4);
+		HalveScalar(next.data(), src, pitch, cx, cy);
+		src = next.data();
+		cx /= 2;
+		cy /= 2;
+		pitch = cx * 4;
+		level ^= 1;
+	}
+
+	dst.resize(size_t(dst_cx) * dst_cy * 4);
+	BilinearScalar(dst.data(), dst_cx, dst_cy, src, pitch, cx, cy);
+}
+
+void BenchSize(const char *label, uint32_t cx, uint32_t cy)
+{
+	vector<uint8_t> frame(size_t(cx) * cy * 4);
+	mt19937 rng{ 3 };
+	for (auto &b : frame)
+		b = static_cast<uint8_t>(rng());
+
+	// rates are source pixels per second
+	auto pixels = double(cx) * cy;
+	printf("%s (%ux%u)\n", label, cx, cy);
+
+	vector<uint8_t> full(frame.size());
+	Bench("  full size copy", 10, [&]
+	{
+		memcpy(full.data(), frame.data(), frame.size());
+		ClobberMemory();
+	}, "Mpixels", pixels);
+
+	for (auto edge : { 320u, 480u }) {
+		uint32_t thumb_cx, thumb_cy;
+		ImageScale::Fit(cx, cy, edge, thumb_cx, thumb_cy);
+
+		vector<uint8_t> thumbnail;
+		char name[64];
+		snprintf(name, sizeof(name), "  %ux%u, scalar", thumb_cx, thumb_cy);
+		Bench(name, 5, [&]
+		{
+			ResizeScalar(frame.data(), cx * 4, cx, cy, thumbnail, thumb_cx, thumb_cy);
+			DoNotOptimize(thumbnail.data());
+		}, "Mpixels", pixels);
+
+		snprintf(name, sizeof(name), "  %ux%u, ImageScale::Resize", thumb_cx, thumb_cy);
+		Bench(name, 5, [&]
+		{
+			ImageScale::Resize(frame.data(), cx * 4, cx, cy, thumbnail, thumb_cx, thumb_cy);
+			DoNotOptimize(thumbnail.data());
+		}, "Mpixels", pixels);
+	}
+}
+
+}
+
+int main()
+{
+	BenchSize("1080p", 1920, 1080);
+	BenchSize("1440p", 2560, 1440);
+	BenchSize("4K", 3840, 2160);
+
+	return 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+// libjpeg(-turbo) in place of the WIC JPEG codec ImageEncoder uses, which
+// doesn't exist outside Windows; same input (tightly packed BGRA) and
+// quality scale. Input is BGRA unless `space` says otherwise (RemoteDisplay
+// swizzles to RGBA for WIC first)
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <jpeglib.h>
+
+inline bool EncodeJpeg(const uint8_t *bgra, uint32_t cx, uint32_t cy, int quality, std::vector<uint8_t> &out, J_COLOR_SPACE space = JCS_EXT_BGRA)
+{
+	jpeg_compress_struct cinfo;
+	jpeg_error_mgr jerr;
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+
+	unsigned char *buffer = nullptr;
+	unsigned long size = 0;
+	jpeg_mem_dest(&cinfo, &buffer, &size);
+
+	cinfo.image_width = cx;
+	cinfo.image_height = cy;
+	cinfo.input_components = 4;
+	cinfo.in_color_space = space;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality, TRUE);
+
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		auto row = const_cast<JSAMPROW>(bgra + static_cast<size_t>(cinfo.next_scanline) * cx * 4);
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	out.assign(buffer, buffer + size);
+	free(buffer);
+	return true;
+}
+
+// decodes to tightly packed BGRA
+inline bool DecodeJpeg(const uint8_t *data, size_t size, std::vector<uint8_t> &bgra, uint32_t &cx, uint32_t &cy)
+{
+	jpeg_decompress_struct cinfo;
+	jpeg_error_mgr jerr;
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_decompress(&cinfo);
+
+	jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data), static_cast<unsigned long>(size));
+	if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	cinfo.out_color_space = JCS_EXT_BGRA;
+	jpeg_start_decompress(&cinfo);
+	cx = cinfo.output_width;
+	cy = cinfo.output_height;
+	bgra.resize(static_cast<size_t>(cx) * cy * 4);
+	while (cinfo.output_scanline < cinfo.output_height) {
+		auto row = bgra.data() + static_cast<size_t>(cinfo.output_scanline) * cx * 4;
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	return true;
+}
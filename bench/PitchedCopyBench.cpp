@@ -0,0 +1,76 @@
+// Overlay uploads from 720p to 4K: a tightly packed BGRA frame into a mapped
+// texture whose RowPitch is padded to 256 bytes, as the renderers did before
+// (memcpy per row) and through PitchedCopy, with and without swizzle.
+//
+// Destinations here are ordinary cached memory, the streaming stores pay off
+// more on write-combined mappings than this shows
+
+#include "PitchedCopy.hpp"
+
+#include "Bench.hpp"
+
+#include <string>
+
+using namespace std;
+
+namespace {
+
+void BenchSize(const char *label, size_t width, size_t height)
+{
+	auto row_size = width * 4;
+	auto dst_pitch = (row_size + 255) & ~size_t(255);
+
+	vector<uint8_t> src(row_size * height, 0x5a);
+	vector<uint8_t> dst(dst_pitch * height + 16);
+	auto dst_ptr = dst.data() + (-reinterpret_cast<uintptr_t>(dst.data()) & 15);
+
+	auto bytes = double(row_size * height);
+	size_t iterations = max<size_t>(1, 200000000 / (row_size * height));
+	printf("%s (%zux%zu, dst pitch %zu)\n", label, width, height, dst_pitch);
+
+	Bench("  memcpy per row", iterations, [&]
+	{
+		for (size_t y = 0; y < height; y++)
+			memcpy(dst_ptr + y * dst_pitch, src.data() + y * row_size, row_size);
+		ClobberMemory();
+	}, bytes);
+
+#ifdef PITCHED_COPY_SSE2
+	Bench("  sse2, regular stores", iterations, [&]
+	{
+		PitchedCopy::Detail::CopyRows<false, false>(dst_ptr, dst_pitch, src.data(), row_size, row_size, height);
+		ClobberMemory();
+	}, bytes);
+#endif
+
+	Bench("  PitchedCopy::Copy", iterations, [&]
+	{
+		PitchedCopy::Copy(dst_ptr, dst_pitch, src.data(), row_size, row_size, height);
+		ClobberMemory();
+	}, bytes);
+
+	Bench("  swizzle, scalar", iterations, [&]
+	{
+		for (size_t y = 0; y < height; y++)
+			PitchedCopy::Detail::SwizzleRow(dst_ptr + y * dst_pitch, src.data() + y * row_size, row_size);
+		ClobberMemory();
+	}, bytes);
+
+	Bench("  swizzle, PitchedCopy::Copy", iterations, [&]
+	{
+		PitchedCopy::Copy(dst_ptr, dst_pitch, src.data(), row_size, row_size, height, PitchedCopy::SWIZZLE_BGRA_RGBA);
+		ClobberMemory();
+	}, bytes);
+}
+
+}
+
+int main()
+{
+	BenchSize("720p", 1280, 720);
+	BenchSize("1080p", 1920, 1080);
+	BenchSize("1440p", 2560, 1440);
+	BenchSize("4K", 3840, 2160);
+
+	return 0;
+}
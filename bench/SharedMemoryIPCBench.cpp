@@ -0,0 +1,157 @@
+// Message throughput of the shared memory ring against a kernel pipe.
+//
+// ipc-util's pipe backend is Windows only, the pipe path is approximated by
+// an anonymous POSIX pipe carrying a length prefix per message, with the
+// reader assembling each message in a buffer before handing it on, like
+// ipc_pipe_server does
+
+#include "SharedMemoryIPC.hpp"
+
+#include "Bench.hpp"
+
+#include <condition_variable>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+struct Counter {
+	mutex m;
+	condition_variable cv;
+	size_t messages = 0;
+	uint64_t checksum = 0;
+
+	void Add(const uint8_t *data, size_t size)
+	{
+		// the consumer touches both ends of the message
+		lock_guard<mutex> lock(m);
+		checksum += data[0] + data[size - 1];
+		messages += 1;
+		cv.notify_all();
+	}
+
+	void Wait(size_t count)
+	{
+		unique_lock<mutex> lock(m);
+		cv.wait(lock, [&] { return messages >= count; });
+	}
+};
+
+bool ReadAll(int fd, void *data, size_t size)
+{
+	auto ptr = static_cast<uint8_t*>(data);
+	while (size) {
+		auto res = read(fd, ptr, size);
+		if (res <= 0)
+			return false;
+		ptr += res;
+		size -= res;
+	}
+	return true;
+}
+
+bool WriteAll(int fd, const void *data, size_t size)
+{
+	auto ptr = static_cast<const uint8_t*>(data);
+	while (size) {
+		auto res = write(fd, ptr, size);
+		if (res <= 0)
+			return false;
+		ptr += res;
+		size -= res;
+	}
+	return true;
+}
+
+void BenchPipe(const char *name, size_t size, size_t count)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+		return;
+
+	Counter counter;
+	thread reader([&]
+	{
+		vector<uint8_t> buffer;
+		uint32_t length;
+		while (ReadAll(fds[0], &length, sizeof(length))) {
+			buffer.resize(length);
+			if (!ReadAll(fds[0], buffer.data(), length))
+				break;
+			counter.Add(buffer.data(), length);
+		}
+	});
+
+	vector<uint8_t> message(size, 0x5a);
+	size_t sent = 0;
+	Bench(name, 1, [&]
+	{
+		for (size_t i = 0; i < count; i++) {
+			uint32_t length = static_cast<uint32_t>(size);
+			WriteAll(fds[1], &length, sizeof(length));
+			WriteAll(fds[1], message.data(), size);
+		}
+		sent += count;
+		counter.Wait(sent);
+	}, double(size) * count);
+
+	close(fds[1]);
+	reader.join();
+	close(fds[0]);
+}
+
+void BenchRing(const char *name, size_t size, size_t count)
+{
+	auto ring_name = "crucible-bench-" + to_string(getpid());
+	uint32_t capacity = SharedMemoryIPC::default_capacity;
+	while (capacity / 2 < size + sizeof(SharedMemoryIPC::RecordHeader) + 8)
+		capacity *= 2;
+
+	Counter counter;
+	SharedMemoryIPCServer server{ ring_name, [&](uint8_t *data, size_t size)
+	{
+		if (data)
+			counter.Add(data, size);
+	}, capacity };
+
+	SharedMemoryIPCClient client{ ring_name };
+	if (!client) {
+		printf("%-48s failed to open ring\n", name);
+		return;
+	}
+
+	vector<uint8_t> message(size, 0x5a);
+	size_t sent = 0;
+	Bench(name, 1, [&]
+	{
+		for (size_t i = 0; i < count; i++)
+			client.Write(message.data(), size);
+		sent += count;
+		counter.Wait(sent);
+	}, double(size) * count);
+}
+
+}
+
+int main()
+{
+	struct {
+		const char *label;
+		size_t size;
+		size_t count;
+	} cases[] = {
+		{ "audio packet 4 KiB", 4096, 20000 },
+		{ "overlay 720p BGRA", 1280 * 720 * 4, 100 },
+		{ "overlay 1080p BGRA", 1920 * 1080 * 4, 50 },
+	};
+
+	for (auto &c : cases) {
+		printf("%s, %zu messages per run\n", c.label, c.count);
+		BenchPipe("  pipe", c.size, c.count);
+		BenchRing("  shared memory ring", c.size, c.count);
+	}
+
+	return 0;
+}
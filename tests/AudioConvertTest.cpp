@@ -0,0 +1,174 @@
+#include "AudioConvert.hpp"
+
+#include "Check.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+mt19937 rng{ 7 };
+
+struct Planes {
+	vector<vector<float>> storage;
+	vector<float*> ptrs;
+
+	// `offset` misaligns the planes
+	Planes(size_t channels, size_t frames, size_t offset = 0)
+		: storage(channels, vector<float>(frames + offset, -1.f))
+	{
+		for (auto &plane : storage)
+			ptrs.push_back(plane.data() + offset);
+	}
+
+	bool operator==(const Planes &other) const
+	{
+		if (storage.size() != other.storage.size())
+			return false;
+
+		for (size_t c = 0; c < storage.size(); c++)
+			if (storage[c].size() != other.storage[c].size() ||
+				memcmp(storage[c].data(), other.storage[c].data(), storage[c].size() * sizeof(float)) != 0)
+				return false;
+
+		return true;
+	}
+};
+
+vector<const AudioConvert::Kernels*> SimdKernels()
+{
+	vector<const AudioConvert::Kernels*> kernels;
+	if (auto sse2 = AudioConvert::SSE2Kernels())
+		kernels.push_back(sse2);
+	if (auto avx2 = AudioConvert::AVX2Kernels())
+		kernels.push_back(avx2);
+	return kernels;
+}
+
+vector<int16_t> RandomS16(size_t count)
+{
+	vector<int16_t> samples(count);
+	uniform_int_distribution<int> dist{ numeric_limits<int16_t>::min(), numeric_limits<int16_t>::max() };
+	for (auto &sample : samples)
+		sample = static_cast<int16_t>(dist(rng));
+
+	// extremes somewhere in every buffer
+	if (count > 1) {
+		samples[0] = numeric_limits<int16_t>::min();
+		samples[count - 1] = numeric_limits<int16_t>::max();
+	}
+	return samples;
+}
+
+vector<float> RandomF32(size_t count, bool special)
+{
+	vector<float> samples(count);
+	uniform_real_distribution<float> dist{ -1.5f, 1.5f };
+	for (auto &sample : samples)
+		sample = dist(rng);
+
+	if (special) {
+		const float values[] = { -0.f, numeric_limits<float>::denorm_min(), numeric_limits<float>::infinity(),
+			-numeric_limits<float>::infinity(), numeric_limits<float>::quiet_NaN(), numeric_limits<float>::max() };
+		for (size_t i = 0; i < count && i < sizeof(values) / sizeof(values[0]); i++)
+			samples[(i * 7) % count] = values[i];
+	}
+	return samples;
+}
+
+void Scalar()
+{
+	auto &scalar = AudioConvert::ScalarKernels();
+
+	const int16_t s16[] = { -32768, 0, 16384, 32767 };
+	Planes out{ 2, 2 };
+	scalar.s16_to_planar(s16, out.ptrs.data(), 2, 2);
+	CHECK(out.ptrs[0][0] == -1.f);
+	CHECK(out.ptrs[1][0] == 0.f);
+	CHECK(out.ptrs[0][1] == 0.5f);
+	CHECK(out.ptrs[1][1] == 32767.f / 32768.f);
+
+	const float f32[] = { 1.f, 2.f, 3.f, 4.f, 5.f, 6.f };
+	Planes planar{ 3, 2 };
+	scalar.f32_to_planar(f32, planar.ptrs.data(), 3, 2);
+	CHECK(planar.ptrs[0][1] == 4.f);
+	CHECK(planar.ptrs[2][0] == 3.f);
+
+	float fl = 0.5f, fr = 0.25f, fc = 1.f, lfe = 100.f, rl = 0.5f, rr = -0.5f;
+	const float *in[] = { &fl, &fr, &fc, &lfe, &rl, &rr };
+	float left, right;
+	scalar.downmix_5_1(in, &left, &right, 1);
+	CHECK(fabs(left - (0.5f + 0.70710678f + 0.5f * 0.70710678f)) < 1e-6f);
+	CHECK(fabs(right - (0.25f + 0.70710678f - 0.5f * 0.70710678f)) < 1e-6f);
+
+	CHECK(&AudioConvert::BestKernels() != nullptr);
+}
+
+void BitExact(const AudioConvert::Kernels &kernels)
+{
+	auto &scalar = AudioConvert::ScalarKernels();
+
+	for (size_t channels : { 1, 2, 3, 6, 8 }) {
+		for (size_t frames = 0; frames < 70; frames++) {
+			for (size_t offset : { 0, 1, 3 }) {
+				auto s16 = RandomS16(channels * frames + offset);
+				Planes expected{ channels, frames, offset }, actual{ channels, frames, offset };
+				scalar.s16_to_planar(s16.data() + offset, expected.ptrs.data(), channels, frames);
+				kernels.s16_to_planar(s16.data() + offset, actual.ptrs.data(), channels, frames);
+				CHECK(expected == actual);
+
+				auto f32 = RandomF32(channels * frames + offset, true);
+				Planes expected_f{ channels, frames, offset }, actual_f{ channels, frames, offset };
+				scalar.f32_to_planar(f32.data() + offset, expected_f.ptrs.data(), channels, frames);
+				kernels.f32_to_planar(f32.data() + offset, actual_f.ptrs.data(), channels, frames);
+				CHECK(expected_f == actual_f);
+			}
+		}
+	}
+
+	for (size_t frames = 0; frames < 70; frames++) {
+		Planes surround{ 6, frames };
+		for (auto &plane : surround.storage) {
+			auto samples = RandomF32(frames, false);
+			copy(begin(samples), end(samples), begin(plane));
+		}
+
+		const float *in[6];
+		for (int c = 0; c < 6; c++)
+			in[c] = surround.ptrs[c];
+
+		Planes expected{ 2, frames }, actual{ 2, frames };
+		scalar.downmix_5_1(in, expected.ptrs[0], expected.ptrs[1], frames);
+		kernels.downmix_5_1(in, actual.ptrs[0], actual.ptrs[1], frames);
+		CHECK(expected == actual);
+
+		// in place, left/right aliasing FL/FR
+		kernels.downmix_5_1(in, surround.ptrs[0], surround.ptrs[1], frames);
+		CHECK(memcmp(surround.ptrs[0], expected.ptrs[0], frames * sizeof(float)) == 0);
+		CHECK(memcmp(surround.ptrs[1], expected.ptrs[1], frames * sizeof(float)) == 0);
+	}
+}
+
+}
+
+int main()
+{
+	Scalar();
+
+	auto kernels = SimdKernels();
+	for (auto k : kernels) {
+		printf("checking %s against scalar\n", k->name);
+		BitExact(*k);
+	}
+
+	if (kernels.empty())
+		printf("no SIMD kernels on this CPU, only the scalar reference was checked\n");
+
+	return TEST_RESULT();
+}
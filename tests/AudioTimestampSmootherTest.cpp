@@ -0,0 +1,222 @@
+#include "AudioTimestampSmoother.hpp"
+
+#include "Check.hpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const uint32_t rate = 48000;
+const uint32_t frames = 480; // 10 ms packets
+const uint64_t packet_ns = 10000000;
+const uint64_t ms = 1000000;
+
+// synthetic trace: packet i is complete at sender time (i + 1) * packet_ns
+// scaled by `drift`, and arrives after `delay` plus per packet jitter
+struct Trace {
+	uint64_t start_ns = 1000 * ms;
+	uint64_t delay_ns = 2 * ms;
+	double drift = 1.;
+	uint64_t jitter_ns = 0;
+	mt19937_64 rng{ 42 };
+
+	uint64_t Receive(uint64_t i)
+	{
+		auto jitter = jitter_ns ? rng() % jitter_ns : 0;
+		return start_ns + static_cast<uint64_t>((i + 1) * packet_ns * drift) + delay_ns + jitter;
+	}
+};
+
+struct Deltas {
+	double max_error = 0.;
+	double sum_sq = 0.;
+	size_t count = 0;
+	bool monotonic = true;
+	uint64_t last = 0;
+
+	void Add(uint64_t timestamp, double expected_delta)
+	{
+		if (count++ && last) {
+			if (timestamp <= last)
+				monotonic = false;
+			auto err = fabs(double(timestamp - last) - expected_delta);
+			max_error = max(max_error, err);
+			sum_sq += err * err;
+		}
+		last = timestamp;
+	}
+
+	double Rms() const
+	{
+		return count > 1 ? sqrt(sum_sq / (count - 1)) : 0.;
+	}
+};
+
+void SteadyClock()
+{
+	AudioTimestampSmoother smoother;
+	Trace trace;
+
+	Deltas deltas;
+	for (uint64_t i = 0; i < 1000; i++) {
+		auto receive = trace.Receive(i);
+		auto ts = smoother.Timestamp(receive, frames, rate);
+		deltas.Add(ts, packet_ns);
+
+		// the first frame of a packet is timestamped `latency` after it was produced
+		CHECK_EQ(ts, receive - packet_ns + smoother.config.latency_ns);
+	}
+
+	CHECK(deltas.monotonic);
+	CHECK(deltas.max_error == 0.);
+	CHECK_EQ(smoother.stats.packets, 1000);
+	CHECK_EQ(smoother.stats.underruns, 0);
+	CHECK_EQ(smoother.stats.overruns, 0);
+	CHECK_EQ(smoother.stats.resyncs, 0);
+}
+
+void Jitter()
+{
+	AudioTimestampSmoother smoother;
+	Trace trace;
+	trace.jitter_ns = 8 * ms;
+
+	Deltas deltas;
+	uint64_t receive_jitter_sq = 0;
+	uint64_t last_receive = 0;
+	for (uint64_t i = 0; i < 6000; i++) {
+		auto receive = trace.Receive(i);
+		auto ts = smoother.Timestamp(receive, frames, rate);
+		deltas.Add(ts, packet_ns);
+
+		if (i) {
+			auto err = static_cast<int64_t>(receive - last_receive) - static_cast<int64_t>(packet_ns);
+			receive_jitter_sq += err * err;
+		}
+		last_receive = receive;
+
+		// jitter stays within the jitter buffer, timestamps are never ahead of the packet
+		CHECK(ts + packet_ns >= receive - smoother.config.latency_ns);
+	}
+
+	auto receive_rms = sqrt(double(receive_jitter_sq) / 5999);
+	CHECK(deltas.monotonic);
+	CHECK(deltas.max_error <= double(smoother.config.max_correction_ns));
+	CHECK(deltas.Rms() * 10 < receive_rms);
+	CHECK_EQ(smoother.stats.underruns, 0);
+	CHECK_EQ(smoother.stats.overruns, 0);
+	CHECK_EQ(smoother.stats.resyncs, 0);
+	CHECK(smoother.stats.max_jitter_ns <= 8 * ms);
+}
+
+void Drift()
+{
+	// sender clock 0.1% slow and 0.1% fast, over 10 minutes each
+	for (auto drift : { 1.001, 0.999 }) {
+		AudioTimestampSmoother smoother;
+		Trace trace;
+		trace.drift = drift;
+		trace.jitter_ns = 2 * ms;
+
+		Deltas deltas;
+		for (uint64_t i = 0; i < 60000; i++) {
+			auto receive = trace.Receive(i);
+			auto ts = smoother.Timestamp(receive, frames, rate);
+			deltas.Add(ts, packet_ns * drift);
+
+			// timestamps follow the receive clock instead of running away from it
+			auto lag = static_cast<int64_t>(receive) - static_cast<int64_t>(ts + packet_ns);
+			CHECK(lag > -static_cast<int64_t>(smoother.config.latency_ns) - 5 * int64_t(ms));
+			CHECK(lag < static_cast<int64_t>(smoother.config.latency_ns) + 5 * int64_t(ms));
+		}
+
+		CHECK(deltas.monotonic);
+		CHECK(deltas.max_error <= double(smoother.config.max_correction_ns));
+		CHECK_EQ(smoother.stats.resyncs, 0);
+		CHECK_EQ(smoother.stats.underruns, 0);
+	}
+}
+
+void Gap()
+{
+	AudioTimestampSmoother smoother;
+	Trace trace;
+
+	for (uint64_t i = 0; i < 100; i++)
+		smoother.Timestamp(trace.Receive(i), frames, rate);
+
+	// short stall, within resync_ns: late packet, timestamps stay sample based
+	trace.start_ns += 50 * ms;
+	auto late = smoother.Timestamp(trace.Receive(100), frames, rate);
+	auto later = smoother.Timestamp(trace.Receive(101), frames, rate);
+	CHECK_EQ(smoother.stats.underruns, 2);
+	CHECK_EQ(smoother.stats.resyncs, 0);
+	CHECK(later > late);
+	CHECK(later - late < packet_ns + smoother.config.max_correction_ns);
+
+	// sender stopped for a second: resync onto the receive clock
+	trace.start_ns += 1000 * ms;
+	auto receive = trace.Receive(102);
+	auto resynced = smoother.Timestamp(receive, frames, rate);
+	CHECK_EQ(smoother.stats.resyncs, 1);
+	CHECK_EQ(resynced, receive - packet_ns + smoother.config.latency_ns);
+
+	auto next = smoother.Timestamp(trace.Receive(103), frames, rate);
+	CHECK_EQ(next - resynced, packet_ns);
+}
+
+void Burst()
+{
+	AudioTimestampSmoother smoother;
+	Trace trace;
+
+	uint64_t i = 0;
+	for (; i < 100; i++)
+		smoother.Timestamp(trace.Receive(i), frames, rate);
+
+	// 100 ms stall followed by the sender flushing its backlog at once
+	auto flush = trace.Receive(i + 10);
+	for (auto end = i + 40; i < end; i++)
+		smoother.Timestamp(flush, frames, rate);
+
+	CHECK(smoother.stats.overruns > 0);
+	CHECK_EQ(smoother.stats.resyncs, 1);
+}
+
+void StreamChanges()
+{
+	AudioTimestampSmoother smoother;
+	Trace trace;
+
+	CHECK_EQ(smoother.Timestamp(12345, frames, 0), 12345);
+
+	for (uint64_t i = 0; i < 10; i++)
+		smoother.Timestamp(trace.Receive(i), frames, rate);
+
+	// format change and Reset resync without counting it as a gap
+	auto receive = trace.Receive(10);
+	CHECK_EQ(smoother.Timestamp(receive, 441, 44100), receive - packet_ns + smoother.config.latency_ns);
+
+	smoother.Reset();
+	receive = trace.Receive(11);
+	CHECK_EQ(smoother.Timestamp(receive, 441, 44100), receive - packet_ns + smoother.config.latency_ns);
+	CHECK_EQ(smoother.stats.resyncs, 0);
+}
+
+}
+
+int main()
+{
+	SteadyClock();
+	Jitter();
+	Drift();
+	Gap();
+	Burst();
+	StreamChanges();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdio>
+
+// minimal assertion helpers, a test executable returns the number of failed
+// checks from main via TEST_RESULT
+static int check_failures = 0;
+
+#define CHECK(x) do { \
+		if (!(x)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); \
+			check_failures += 1; \
+		} \
+	} while (false)
+
+#define CHECK_EQ(a, b) do { \
+		auto check_a = (a); \
+		auto check_b = (b); \
+		if (!(check_a == check_b)) { \
+			fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, \
+				static_cast<long long>(check_a), static_cast<long long>(check_b)); \
+			check_failures += 1; \
+		} \
+	} while (false)
+
+#define TEST_RESULT() (check_failures ? (fprintf(stderr, "%d check(s) failed\n", check_failures), 1) : 0)
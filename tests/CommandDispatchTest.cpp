@@ -0,0 +1,122 @@
+#include "CommandDispatch.hpp"
+
+#include "Check.hpp"
+
+#include <string>
+
+using namespace std;
+
+namespace {
+
+int last_handled = -1;
+
+void Handle0() { last_handled = 0; }
+void Handle1() { last_handled = 1; }
+void Handle2() { last_handled = 2; }
+
+using Handler_t = void(*)();
+
+// AnvilRendering's command names
+constexpr CommandDispatch::Entry<Handler_t> handlers[] = {
+	CommandDispatch::Command("indicator", Handle0),
+	CommandDispatch::Command("disable_native_indicators", Handle1),
+	CommandDispatch::Command("forge_info", Handle2, 3),
+	CommandDispatch::Command("update_settings", Handle0),
+	CommandDispatch::Command("set_cursor", Handle1, 0, "name"),
+	CommandDispatch::Command("dismiss_overlay", Handle2),
+	CommandDispatch::Command("stream_status", Handle0),
+	CommandDispatch::Command("update_forward_buffer_indicator", Handle1),
+	CommandDispatch::Command("dismiss_quick_select", Handle2),
+	CommandDispatch::Command("begin_quick_select_timeout", Handle0),
+	CommandDispatch::Command("shared_texture_incompatible", Handle1),
+};
+
+static_assert(CommandDispatch::HandlersValid(handlers), "handlers contains a command without handler");
+static_assert(CommandDispatch::HashesUnique(handlers), "handlers contains duplicate commands or a hash collision");
+static_assert(CommandDispatch::HasPerfectLayout(handlers), "no collision free bucket layout for handlers");
+
+constexpr CommandDispatch::Entry<Handler_t> missing_handler[] = {
+	CommandDispatch::Command("first", Handle0),
+	CommandDispatch::Command<Handler_t>("second", nullptr),
+};
+static_assert(!CommandDispatch::HandlersValid(missing_handler), "missing handler not detected");
+
+constexpr CommandDispatch::Entry<Handler_t> empty_name[] = {
+	CommandDispatch::Command("", Handle0),
+};
+static_assert(!CommandDispatch::HandlersValid(empty_name), "empty command name not detected");
+
+constexpr CommandDispatch::Entry<Handler_t> duplicate[] = {
+	CommandDispatch::Command("first", Handle0),
+	CommandDispatch::Command("second", Handle1),
+	CommandDispatch::Command("first", Handle2),
+};
+static_assert(!CommandDispatch::HashesUnique(duplicate), "duplicate command not detected");
+
+static_assert(CommandDispatch::Hash("") == CommandDispatch::fnv_offset, "FNV-1a offset basis");
+static_assert(CommandDispatch::Hash("a") == 0xe40c292cu, "FNV-1a test vector");
+static_assert(CommandDispatch::Hash("foobar") == 0xbf9cf968u, "FNV-1a test vector");
+static_assert(CommandDispatch::Length("set_cursor") == 10, "Length");
+
+const auto handlers_table = CommandDispatch::MakeTable(handlers);
+
+void Lookup()
+{
+	CHECK_EQ(handlers_table.size(), 11);
+
+	size_t index = 0;
+	for (auto &entry : handlers_table) {
+		CHECK_EQ(entry.hash, CommandDispatch::Hash(entry.name, strlen(entry.name)));
+		CHECK(handlers_table.Find(entry.name) == &entry);
+		CHECK_EQ(handlers_table.IndexOf(entry), index++);
+	}
+
+	auto forge_info = handlers_table.Find("forge_info");
+	CHECK(forge_info);
+	CHECK_EQ(forge_info->flags, 3);
+	forge_info->handler();
+	CHECK_EQ(last_handled, 2);
+
+	auto set_cursor = handlers_table.Find("set_cursor");
+	CHECK(set_cursor && string(set_cursor->key) == "name");
+	CHECK(!handlers_table.Find("indicator")->key);
+
+	// names that aren't NUL terminated, as parsed from a message
+	string message = "dismiss_overlay_and_more";
+	CHECK(handlers_table.Find(message.c_str(), 15) == handlers_table.Find("dismiss_overlay"));
+	CHECK(!handlers_table.Find(message.c_str(), 14));
+	CHECK(!handlers_table.Find(message.c_str(), message.size()));
+}
+
+void Misses()
+{
+	const char *unknown[] = {
+		"",
+		"indicato",
+		"indicators",
+		"Indicator",
+		"set_cursor ",
+		"connect",
+		"get_webrtc_stats",
+	};
+
+	for (auto name : unknown)
+		CHECK(!handlers_table.Find(name));
+
+	// every name that lands in an occupied bucket but isn't a command
+	string name = "x";
+	for (int i = 0; i < 100000; i++) {
+		name = "cmd_" + to_string(i);
+		CHECK(!handlers_table.Find(name.c_str(), name.size()));
+	}
+}
+
+}
+
+int main()
+{
+	Lookup();
+	Misses();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,178 @@
+#include "CommandProtocol.hpp"
+#include "CommandFrameWriter.hpp"
+
+#include "Check.hpp"
+
+#include <random>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+CommandFrameWriter FullFrame()
+{
+	CommandFrameWriter frame{ 42 };
+	frame.Count(8);
+	frame.Bool("enabled", true);
+	frame.Int("quality", -1234567890123LL);
+	frame.Double("volume", 0.75);
+	frame.String("source", "Microphone");
+	frame.String("empty", "");
+	frame.Null("ignored");
+
+	frame.Object("settings");
+	frame.Count(1);
+	frame.Int("fps", 60);
+
+	frame.Array("items", 2);
+	frame.Count(1);
+	frame.String("name", "first");
+	frame.Count(0);
+
+	return frame;
+}
+
+void RoundTrip()
+{
+	auto frame = FullFrame();
+	CHECK(CommandProtocol::IsBinary(frame.data.data(), frame.data.size()));
+
+	uint16_t id = 0;
+	OBSData obj;
+	CHECK(CommandProtocol::DecodeCommand(frame.data.data(), frame.data.size(), id, obj));
+	CHECK_EQ(id, 42);
+	CHECK(obs_data_get_bool(obj, "enabled"));
+	CHECK_EQ(obs_data_get_int(obj, "quality"), -1234567890123LL);
+	CHECK(obs_data_get_double(obj, "volume") == 0.75);
+	CHECK(string(obs_data_get_string(obj, "source")) == "Microphone");
+	CHECK(string(obs_data_get_string(obj, "empty")).empty());
+	CHECK(!obs_data_item_byname(obj, "ignored"));
+
+	auto settings = OBSDataGetObj(obj, "settings");
+	CHECK(settings);
+	CHECK_EQ(obs_data_get_int(settings, "fps"), 60);
+
+	auto items = OBSDataGetArray(obj, "items");
+	CHECK_EQ(obs_data_array_count(items), 2);
+	auto first = OBSDataArrayItem(items, 0);
+	CHECK(string(obs_data_get_string(first, "name")) == "first");
+}
+
+void EmptyCommand()
+{
+	CommandFrameWriter frame{ 7 };
+	frame.Count(0);
+
+	uint16_t id = 0;
+	OBSData obj;
+	CHECK(CommandProtocol::DecodeCommand(frame.data.data(), frame.data.size(), id, obj));
+	CHECK_EQ(id, 7);
+	CHECK(obj);
+}
+
+void Rejects()
+{
+	uint16_t id;
+	OBSData obj;
+
+	const char json[] = "{\"command\":\"connect\"}";
+	CHECK(!CommandProtocol::IsBinary(reinterpret_cast<const uint8_t*>(json), sizeof(json)));
+	CHECK(!CommandProtocol::IsBinary(nullptr, 0));
+
+	// version mismatch
+	CommandFrameWriter other_version{ 1, CommandProtocol::binary_version + 1 };
+	other_version.Count(0);
+	CHECK(!CommandProtocol::DecodeCommand(other_version.data.data(), other_version.data.size(), id, obj));
+
+	// trailing bytes
+	auto trailing = FullFrame();
+	trailing.Put(uint8_t(0));
+	CHECK(!CommandProtocol::DecodeCommand(trailing.data.data(), trailing.data.size(), id, obj));
+
+	// every truncation of a valid frame
+	auto frame = FullFrame();
+	for (size_t size = 0; size < frame.data.size(); size++)
+		CHECK(!CommandProtocol::DecodeCommand(frame.data.data(), size, id, obj));
+
+	// names and strings have to be NUL terminated
+	CommandFrameWriter name{ 1 };
+	name.Count(1);
+	name.Put(uint8_t(CommandProtocol::FIELD_INT));
+	name.Put(uint8_t(3));
+	name.data.insert(end(name.data), { 'a', 'b', 'c' });
+	name.Put(int64_t(1));
+	CHECK(!CommandProtocol::DecodeCommand(name.data.data(), name.data.size(), id, obj));
+
+	CommandFrameWriter str{ 1 };
+	str.Count(1);
+	str.Name(CommandProtocol::FIELD_STRING, "source");
+	str.Put(uint32_t(3));
+	str.data.insert(end(str.data), { 'a', 'b', 'c' });
+	CHECK(!CommandProtocol::DecodeCommand(str.data.data(), str.data.size(), id, obj));
+
+	// unknown field type
+	CommandFrameWriter type{ 1 };
+	type.Count(1);
+	type.Name(static_cast<CommandProtocol::FieldType>(CommandProtocol::FIELD_ARRAY + 1), "x");
+	CHECK(!CommandProtocol::DecodeCommand(type.data.data(), type.data.size(), id, obj));
+}
+
+void Depth()
+{
+	auto Nested = [](int depth)
+	{
+		CommandFrameWriter frame{ 1 };
+		for (int i = 0; i < depth; i++) {
+			frame.Count(1);
+			frame.Object("child");
+		}
+		frame.Count(0);
+		return frame;
+	};
+
+	uint16_t id;
+	OBSData obj;
+	auto ok = Nested(CommandProtocol::max_depth);
+	CHECK(CommandProtocol::DecodeCommand(ok.data.data(), ok.data.size(), id, obj));
+
+	auto deep = Nested(CommandProtocol::max_depth + 1);
+	CHECK(!CommandProtocol::DecodeCommand(deep.data.data(), deep.data.size(), id, obj));
+}
+
+void Fuzz()
+{
+	// mutated frames must be rejected or decoded without reading out of
+	// bounds (run under ASan to catch the latter)
+	auto frame = FullFrame();
+	mt19937 rng{ 1234 };
+	size_t decoded = 0;
+	for (int i = 0; i < 200000; i++) {
+		auto data = frame.data;
+		auto mutations = 1 + rng() % 4;
+		for (unsigned j = 0; j < mutations; j++)
+			data[2 + rng() % (data.size() - 2)] = static_cast<uint8_t>(rng());
+
+		if (rng() % 4 == 0)
+			data.resize(rng() % data.size());
+
+		uint16_t id;
+		OBSData obj;
+		if (CommandProtocol::DecodeCommand(data.data(), data.size(), id, obj))
+			decoded += 1;
+	}
+	CHECK(decoded < 200000);
+}
+
+}
+
+int main()
+{
+	RoundTrip();
+	EmptyCommand();
+	Rejects();
+	Depth();
+	Fuzz();
+
+	return TEST_RESULT();
+}
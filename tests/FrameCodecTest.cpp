@@ -0,0 +1,316 @@
+#include "FrameCodec.hpp"
+
+#include "Check.hpp"
+
+#include <random>
+
+using namespace std;
+using namespace FrameCodec;
+
+namespace {
+
+mt19937 rng{ 11 };
+
+struct Image {
+	uint32_t cx, cy;
+	size_t pitch;
+	vector<uint8_t> data;
+
+	Image(uint32_t cx, uint32_t cy, size_t padding = 0)
+		: cx(cx), cy(cy), pitch(size_t(cx) * 4 + padding), data(pitch * cy, 0xcd)
+	{}
+
+	uint8_t *Pixel(uint32_t x, uint32_t y)
+	{
+		return data.data() + y * pitch + x * 4;
+	}
+
+	void Set(uint32_t x, uint32_t y, uint32_t px)
+	{
+		memcpy(Pixel(x, y), &px, 4);
+	}
+
+	void Fill(uint32_t x0, uint32_t y0, uint32_t w, uint32_t h, uint32_t px)
+	{
+		for (auto y = y0; y < y0 + h && y < cy; y++)
+			for (auto x = x0; x < x0 + w && x < cx; x++)
+				Set(x, y, px);
+	}
+
+	void Noise(uint32_t x0, uint32_t y0, uint32_t w, uint32_t h)
+	{
+		for (auto y = y0; y < y0 + h && y < cy; y++)
+			for (auto x = x0; x < x0 + w && x < cx; x++)
+				Set(x, y, rng());
+	}
+
+	// the frame the decoder is expected to produce
+	vector<uint8_t> Packed() const
+	{
+		vector<uint8_t> packed(size_t(cx) * cy * 4);
+		for (uint32_t y = 0; y < cy; y++)
+			memcpy(&packed[y * size_t(cx) * 4], &data[y * pitch], size_t(cx) * 4);
+		return packed;
+	}
+};
+
+uint32_t Flags(const vector<uint8_t> &encoded)
+{
+	uint32_t flags;
+	memcpy(&flags, encoded.data(), sizeof(flags));
+	return flags;
+}
+
+// encodes the frame, decodes it again and compares; returns the encoded size
+size_t RoundTrip(Encoder &encoder, Decoder &decoder, const Image &image, vector<uint8_t> &encoded)
+{
+	encoded.clear();
+	encoder.Encode(image.data.data(), image.pitch, image.cx, image.cy, encoded);
+	CHECK(decoder.Decode(encoded.data(), encoded.size(), image.cx, image.cy));
+	CHECK(decoder.Frame() == image.Packed());
+	return encoded.size();
+}
+
+void Varint()
+{
+	for (auto val : { uint64_t(0), uint64_t(0x7f), uint64_t(0x80), uint64_t(0x3fff), uint64_t(1) << 35, ~uint64_t(0) }) {
+		vector<uint8_t> out;
+		Detail::PutVarint(out, val);
+		auto ptr = static_cast<const uint8_t*>(out.data());
+		uint64_t read;
+		CHECK(Detail::GetVarint(ptr, out.data() + out.size(), read));
+		CHECK(read == val);
+		CHECK(ptr == out.data() + out.size());
+
+		// cut short
+		ptr = out.data();
+		CHECK(!Detail::GetVarint(ptr, out.data() + out.size() - 1, read));
+	}
+
+	// more than 64 bits of continuation bytes
+	vector<uint8_t> endless(11, 0x80);
+	auto ptr = static_cast<const uint8_t*>(endless.data());
+	uint64_t read;
+	CHECK(!Detail::GetVarint(ptr, endless.data() + endless.size(), read));
+}
+
+// static UI, a moving element and full motion, with a padded source pitch
+void Sequence()
+{
+	Encoder encoder;
+	Decoder decoder;
+	vector<uint8_t> encoded;
+
+	Image image(320, 180, 64);
+	image.Fill(0, 0, 320, 180, 0xff202020);
+	image.Fill(10, 10, 100, 20, 0xff8080ff);
+
+	auto raw = size_t(320) * 180 * 4;
+	auto size = RoundTrip(encoder, decoder, image, encoded);
+	CHECK(Flags(encoded) & flag_keyframe);
+	CHECK(size < raw / 100);
+
+	// nothing changed: one skip
+	size = RoundTrip(encoder, decoder, image, encoded);
+	CHECK(!(Flags(encoded) & flag_keyframe));
+	CHECK(size <= sizeof(uint32_t) + 4);
+
+	// something animating on top of the UI
+	for (uint32_t x = 0; x < 300; x += 7) {
+		image.Noise(x, 90, 12, 12);
+		size = RoundTrip(encoder, decoder, image, encoded);
+		CHECK(!(Flags(encoded) & flag_keyframe));
+		CHECK(size < 12 * 12 * 4 + 12 * 16 + 16);
+	}
+
+	// full motion: every pixel changes, literals cost a bit more than raw
+	for (int i = 0; i < 3; i++) {
+		image.Noise(0, 0, 320, 180);
+		size = RoundTrip(encoder, decoder, image, encoded);
+		CHECK(size > raw);
+		CHECK(size < raw + raw / 64);
+	}
+
+	// back to flat
+	image.Fill(0, 0, 320, 180, 0xff000000);
+	size = RoundTrip(encoder, decoder, image, encoded);
+	CHECK(size < 16);
+}
+
+// runs of every length around min_run and the SSE2 scan block, at every
+// offset, against both the previous frame and a single color
+void Runs()
+{
+	Encoder encoder;
+	Decoder decoder;
+	vector<uint8_t> encoded;
+
+	for (uint32_t len = 1; len <= 70; len++)
+		for (uint32_t offset = 0; offset < 8; offset++) {
+			Image image(97, 3);
+			image.Noise(0, 0, 97, 3);
+			encoder.Reset();
+			RoundTrip(encoder, decoder, image, encoded);
+
+			// fill run in a keyframe
+			image.Fill(offset, 1, len, 1, 0xff00ff00);
+			encoder.Reset();
+			RoundTrip(encoder, decoder, image, encoded);
+
+			// only the run changes, everything else is skipped
+			image.Noise(offset, 1, len, 1);
+			RoundTrip(encoder, decoder, image, encoded);
+
+			// everything but the run changes
+			auto run = vector<uint8_t>(image.Pixel(offset, 1), image.Pixel(offset, 1) + min<uint32_t>(len, 97 - offset) * 4);
+			image.Noise(0, 0, 97, 3);
+			memcpy(image.Pixel(offset, 1), run.data(), run.size());
+			RoundTrip(encoder, decoder, image, encoded);
+		}
+}
+
+void Sizes()
+{
+	Encoder encoder;
+	Decoder decoder;
+	vector<uint8_t> encoded;
+
+	// down to fewer pixels than a run, and a scan block plus a few
+	for (auto size : { make_pair(1u, 1u), make_pair(3u, 1u), make_pair(1u, 5u), make_pair(36u, 1u), make_pair(37u, 1u), make_pair(41u, 2u), make_pair(1920u, 2u) }) {
+		Image image(size.first, size.second, 12);
+		image.Noise(0, 0, size.first, size.second);
+		RoundTrip(encoder, decoder, image, encoded);
+		CHECK(Flags(encoded) & flag_keyframe);
+		RoundTrip(encoder, decoder, image, encoded);
+		CHECK(!(Flags(encoded) & flag_keyframe));
+	}
+
+	// same pixel count, different shape is still a new size
+	Image wide(64, 16), tall(16, 64);
+	wide.Noise(0, 0, 64, 16);
+	tall.data = wide.data;
+	RoundTrip(encoder, decoder, wide, encoded);
+	RoundTrip(encoder, decoder, tall, encoded);
+	CHECK(Flags(encoded) & flag_keyframe);
+
+	// after Reset
+	RoundTrip(encoder, decoder, tall, encoded);
+	CHECK(!(Flags(encoded) & flag_keyframe));
+	encoder.Reset();
+	RoundTrip(encoder, decoder, tall, encoded);
+	CHECK(Flags(encoded) & flag_keyframe);
+
+	// empty frames are a keyframe with no tokens
+	Image empty(0, 0);
+	encoded.clear();
+	encoder.Encode(empty.data.data(), 0, 0, 0, encoded);
+	CHECK_EQ(encoded.size(), sizeof(uint32_t));
+	CHECK(decoder.Decode(encoded.data(), encoded.size(), 0, 0));
+}
+
+vector<uint8_t> Payload(uint32_t flags, initializer_list<uint64_t> tokens)
+{
+	vector<uint8_t> out(sizeof(flags));
+	memcpy(out.data(), &flags, sizeof(flags));
+	for (auto token : tokens)
+		Detail::PutVarint(out, token);
+	return out;
+}
+
+void Rejects()
+{
+	Decoder decoder;
+	auto fill = Payload(flag_keyframe, { 16 << 2 | OP_FILL, 0x11, 0x22, 0x33, 0x7f });
+	CHECK(decoder.Decode(fill.data(), fill.size(), 4, 4));
+
+	auto skip = Payload(0, { 16 << 2 | OP_SKIP });
+	CHECK(decoder.Decode(skip.data(), skip.size(), 4, 4));
+
+	// delta frames need a frame of the same size
+	CHECK(!decoder.Decode(skip.data(), skip.size(), 8, 2));
+	CHECK(!decoder.Decode(skip.data(), skip.size(), 4, 4));
+	CHECK(decoder.Decode(fill.data(), fill.size(), 4, 4));
+
+	// and a successful previous frame
+	Decoder fresh;
+	CHECK(!fresh.Decode(skip.data(), skip.size(), 4, 4));
+
+	auto bad = [&](const vector<uint8_t> &payload)
+	{
+		CHECK(decoder.Decode(fill.data(), fill.size(), 4, 4));
+		CHECK(!decoder.Decode(payload.data(), payload.size(), 4, 4));
+		// a failed frame invalidates the previous one
+		CHECK(!decoder.Decode(skip.data(), skip.size(), 4, 4));
+	};
+
+	bad(Payload(flag_keyframe, { 16 << 2 | OP_SKIP }));
+	bad(Payload(0, { 8 << 2 | OP_SKIP }));
+	bad(Payload(0, { 17 << 2 | OP_SKIP }));
+	bad(Payload(0, { 0 << 2 | OP_SKIP, 16 << 2 | OP_SKIP }));
+	bad(Payload(0, { 16 << 2 | 3 }));
+	bad(Payload(0, { 16 << 2 | OP_FILL, 1, 2, 3 }));
+	bad(Payload(0, { 2 << 2 | OP_LITERAL, 1, 2, 3, 4, 5, 6, 7 }));
+	bad(Payload(0, { ~uint64_t(0) }));
+	bad(Payload(0, { 8 << 2 | OP_SKIP, uint64_t(1) << 62 | OP_SKIP }));
+	bad(vector<uint8_t>(3));
+	CHECK(!decoder.Decode(nullptr, 0, 4, 4));
+}
+
+// random damage to encoded frames: decoding may fail but must stay in bounds,
+// and whatever it accepts has the right size
+void Fuzz()
+{
+	Encoder encoder;
+	vector<vector<uint8_t>> frames;
+	Image image(33, 7);
+	image.Fill(0, 0, 33, 7, 0xff102030);
+	for (int i = 0; i < 6; i++) {
+		image.Noise(rng() % 33, rng() % 7, 9, 2);
+		frames.emplace_back();
+		encoder.Encode(image.data.data(), image.pitch, 33, 7, frames.back());
+	}
+
+	size_t accepted = 0;
+	for (int i = 0; i < 100000; i++) {
+		Decoder decoder;
+		auto &base = frames[rng() % frames.size()];
+		CHECK(decoder.Decode(frames[0].data(), frames[0].size(), 33, 7));
+
+		auto damaged = base;
+		switch (rng() % 3) {
+		case 0:
+			damaged.resize(rng() % (damaged.size() + 1));
+			break;
+		case 1:
+			for (auto flips = rng() % 4 + 1; flips; flips--)
+				damaged[rng() % damaged.size()] ^= static_cast<uint8_t>(1 << rng() % 8);
+			break;
+		case 2:
+			damaged.insert(damaged.begin() + rng() % damaged.size(), static_cast<uint8_t>(rng()));
+			break;
+		}
+
+		// exact size, so overreads show up under ASan
+		vector<uint8_t> exact(damaged);
+		exact.shrink_to_fit();
+		if (decoder.Decode(exact.data(), exact.size(), 33, 7)) {
+			CHECK_EQ(decoder.Frame().size(), 33 * 7 * 4);
+			accepted += 1;
+		}
+	}
+	CHECK(accepted > 0);
+}
+
+}
+
+int main()
+{
+	Varint();
+	Sequence();
+	Runs();
+	Sizes();
+	Rejects();
+	Fuzz();
+
+	return TEST_RESULT();
+}
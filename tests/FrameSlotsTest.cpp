@@ -0,0 +1,314 @@
+#include "FrameSlots.hpp"
+
+#include "Check.hpp"
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using namespace FrameSlots;
+
+namespace {
+
+// messages go through bytes like they would through the pipe
+template <typename T>
+vector<uint8_t> Bytes(const T &msg)
+{
+	vector<uint8_t> bytes(sizeof(T));
+	memcpy(bytes.data(), &msg, sizeof(T));
+	return bytes;
+}
+
+int PublishFrame(Producer &producer, uint32_t width, uint32_t height, uint64_t sequence, Ready &ready)
+{
+	auto slot = producer.Acquire();
+	if (slot < 0)
+		return slot;
+
+	memset(producer.Data(slot), static_cast<int>(sequence & 0xff), size_t(width) * 4 * height);
+	ready = producer.Publish(slot, width, height, width * 4, 0, sequence, sequence * 1000);
+	return slot;
+}
+
+void Handshake()
+{
+	Producer producer;
+	Consumer consumer;
+
+	Announce announce;
+	CHECK(producer.Prepare(64 * 4 * 32, announce));
+	CHECK(producer.Valid());
+	CHECK_EQ(announce.slot_count, default_slots);
+
+	auto announce_bytes = Bytes(announce);
+	Announce received;
+	CHECK(Parse(announce_bytes.data(), announce_bytes.size(), announce_magic, received));
+	CHECK(!Is(ready_magic, announce_bytes.data(), announce_bytes.size()));
+	CHECK(consumer.Open(received));
+
+	for (uint64_t sequence = 1; sequence <= 10; sequence++) {
+		Ready ready;
+		CHECK(PublishFrame(producer, 64, 32, sequence, ready) >= 0);
+
+		auto ready_bytes = Bytes(ready);
+		Ready parsed;
+		CHECK(Parse(ready_bytes.data(), ready_bytes.size(), ready_magic, parsed));
+
+		Consumer::Frame frame;
+		CHECK(consumer.Read(parsed, frame));
+		CHECK_EQ(frame.width, 64);
+		CHECK_EQ(frame.height, 32);
+		CHECK_EQ(frame.sequence, sequence);
+		CHECK_EQ(frame.timestamp, sequence * 1000);
+		CHECK_EQ(frame.data[0], sequence);
+		CHECK_EQ(frame.data[64 * 4 * 32 - 1], sequence);
+
+		// a Ready is only good once
+		Consumer::Frame again;
+		CHECK(!consumer.Read(parsed, again));
+
+		consumer.Release(frame.slot);
+	}
+
+	// same size or a bit smaller keeps the mapping, larger or much smaller doesn't
+	CHECK(!producer.Prepare(64 * 4 * 32, announce));
+	CHECK(!producer.Prepare(64 * 4 * 20, announce));
+	CHECK(producer.Prepare(128 * 4 * 64, announce));
+	CHECK(producer.Prepare(16, announce));
+	CHECK_EQ(producer.mappings_created, 3);
+	CHECK_EQ(producer.frames_published, 10);
+	CHECK_EQ(producer.frames_replaced, 0);
+}
+
+void Generations()
+{
+	Producer producer;
+	Consumer consumer;
+
+	Announce first;
+	CHECK(producer.Prepare(4096, first));
+	CHECK(consumer.Open(first));
+
+	Ready stale;
+	CHECK(PublishFrame(producer, 16, 16, 1, stale) >= 0);
+
+	// the producer switched to a new mapping before the consumer read the frame
+	Announce second;
+	CHECK(producer.Prepare(1 << 20, second));
+	CHECK(second.generation != first.generation);
+	CHECK(consumer.Open(second));
+
+	Consumer::Frame frame;
+	CHECK(!consumer.Read(stale, frame));
+
+	Ready ready;
+	CHECK(PublishFrame(producer, 256, 256, 2, ready) >= 0);
+	CHECK(consumer.Read(ready, frame));
+	CHECK_EQ(frame.data[0], 2);
+	consumer.Release(frame.slot);
+
+	// the old mapping is gone once the producer dropped it
+	Consumer late;
+	CHECK(!late.Open(first));
+}
+
+void Replace()
+{
+	Producer producer;
+	Consumer consumer;
+	Announce announce;
+	CHECK(producer.Prepare(4096, announce));
+	CHECK(consumer.Open(announce));
+
+	// nobody reads: the fourth frame takes over the oldest unread slot
+	Ready ready[4];
+	for (int i = 0; i < 3; i++)
+		CHECK(PublishFrame(producer, 8, 8, i + 1, ready[i]) >= 0);
+	auto replaced = PublishFrame(producer, 8, 8, 4, ready[3]);
+	CHECK_EQ(replaced, static_cast<int>(ready[0].slot));
+	CHECK_EQ(producer.frames_replaced, 1);
+
+	// the replaced frame's Ready finds a newer sequence and leaves it alone
+	Consumer::Frame frame;
+	CHECK(!consumer.Read(ready[0], frame));
+	CHECK(consumer.Read(ready[3], frame));
+	CHECK_EQ(frame.sequence, 4);
+
+	// the consumer holds slots: only unclaimed ones are replaced, then frames drop
+	Consumer::Frame held[2];
+	CHECK(consumer.Read(ready[1], held[0]));
+	CHECK(consumer.Read(ready[2], held[1]));
+	Ready dropped;
+	CHECK_EQ(PublishFrame(producer, 8, 8, 5, dropped), -1);
+	CHECK_EQ(producer.frames_dropped, 1);
+
+	consumer.Release(held[0].slot);
+	Ready next;
+	CHECK_EQ(PublishFrame(producer, 8, 8, 6, next), static_cast<int>(held[0].slot));
+
+	// a Ready that couldn't be sent gives its slot back
+	producer.Abort(next.slot);
+	CHECK(!consumer.Read(next, frame));
+	CHECK_EQ(PublishFrame(producer, 8, 8, 7, next), static_cast<int>(held[0].slot));
+	CHECK_EQ(producer.frames_replaced, 1);
+}
+
+void Rejects()
+{
+	Ready ready = {};
+	ready.magic = ready_magic;
+	ready.version = version;
+	ready.size = sizeof(Ready);
+
+	auto bytes = Bytes(ready);
+	Ready parsed;
+	CHECK(Parse(bytes.data(), bytes.size(), ready_magic, parsed));
+	CHECK(!Parse(bytes.data(), bytes.size() - 1, ready_magic, parsed));
+	CHECK(!Parse(bytes.data(), bytes.size(), announce_magic, parsed));
+	CHECK(!Parse<Ready>(nullptr, 0, ready_magic, parsed));
+
+	bytes[4] = version + 1;
+	CHECK(!Parse(bytes.data(), bytes.size(), ready_magic, parsed));
+
+	ready.size = sizeof(Ready) + 8;
+	bytes = Bytes(ready);
+	CHECK(!Parse(bytes.data(), bytes.size(), ready_magic, parsed));
+
+	// nothing mapped, unknown mapping
+	Consumer consumer;
+	Consumer::Frame frame;
+	CHECK(!consumer.Read(ready, frame));
+
+	Announce announce = {};
+	strcpy(announce.name, "CrucibleFrameSlots-does-not-exist");
+	CHECK(!consumer.Open(announce));
+
+	// a slot whose header claims more than the slot holds
+	Producer producer;
+	CHECK(producer.Prepare(4096, announce));
+	CHECK(consumer.Open(announce));
+	auto slot = producer.Acquire();
+	auto bad = producer.Publish(slot, 64, 64, 64 * 4, 0, 1, 0);
+	CHECK(!consumer.Read(bad, frame));
+	CHECK(producer.Acquire() >= 0);
+}
+
+bool ReadAll(int fd, void *data, size_t size)
+{
+	auto ptr = static_cast<uint8_t*>(data);
+	while (size) {
+		auto res = read(fd, ptr, size);
+		if (res <= 0)
+			return false;
+		ptr += res;
+		size -= res;
+	}
+	return true;
+}
+
+void WriteMessage(int fd, const vector<uint8_t> &msg)
+{
+	uint32_t size = static_cast<uint32_t>(msg.size());
+	if (write(fd, &size, sizeof(size)) != sizeof(size) || write(fd, msg.data(), msg.size()) != static_cast<ssize_t>(msg.size()))
+		_exit(2);
+}
+
+// producer in a child process, Announce/Ready over a pipe, sizes changing
+// along the way; the consumer checks every frame it gets is complete
+void CrossProcess()
+{
+	// fds carries the messages, done tells the producer to let go of its mapping
+	int fds[2], done[2];
+	CHECK(pipe(fds) == 0 && pipe(done) == 0);
+
+	const uint64_t frames = 3000;
+	auto pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		close(done[1]);
+		{
+			Producer producer;
+			for (uint64_t sequence = 1; sequence <= frames; sequence++) {
+				uint32_t width = sequence < frames / 2 ? 320 : 640;
+				uint32_t height = sequence < frames / 2 ? 180 : 360;
+
+				Announce announce;
+				if (producer.Prepare(size_t(width) * 4 * height, announce))
+					WriteMessage(fds[1], Bytes(announce));
+
+				Ready ready;
+				if (PublishFrame(producer, width, height, sequence, ready) >= 0)
+					WriteMessage(fds[1], Bytes(ready));
+			}
+
+			uint32_t end = 0;
+			if (write(fds[1], &end, sizeof(end)) != sizeof(end))
+				_exit(2);
+
+			char c;
+			while (read(done[0], &c, 1) > 0)
+				;
+		}
+		_exit(0);
+	}
+
+	close(done[0]);
+	close(fds[1]);
+
+	Consumer consumer;
+	size_t announces = 0, frames_read = 0, torn = 0, out_of_order = 0;
+	uint64_t last = 0;
+	uint32_t size;
+	vector<uint8_t> msg;
+	while (ReadAll(fds[0], &size, sizeof(size)) && size) {
+		msg.resize(size);
+		if (!ReadAll(fds[0], msg.data(), size))
+			break;
+
+		Announce announce;
+		Ready ready;
+		if (Parse(msg.data(), msg.size(), announce_magic, announce)) {
+			CHECK(consumer.Open(announce));
+			announces += 1;
+		} else if (Parse(msg.data(), msg.size(), ready_magic, ready)) {
+			Consumer::Frame frame;
+			if (!consumer.Read(ready, frame))
+				continue;
+
+			auto expected = static_cast<uint8_t>(frame.sequence & 0xff);
+			auto bytes = size_t(frame.stride) * frame.height;
+			torn += frame.data[0] != expected || frame.data[bytes / 2] != expected || frame.data[bytes - 1] != expected;
+			out_of_order += frame.sequence <= last;
+			last = frame.sequence;
+			frames_read += 1;
+
+			consumer.Release(frame.slot);
+		}
+	}
+
+	close(fds[0]);
+	close(done[1]);
+	int status = 0;
+	CHECK_EQ(waitpid(pid, &status, 0), pid);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	CHECK_EQ(announces, 2);
+	CHECK(frames_read > 0);
+	CHECK_EQ(torn, 0);
+	CHECK_EQ(out_of_order, 0);
+	CHECK_EQ(last, frames);
+}
+
+}
+
+int main()
+{
+	Handshake();
+	Generations();
+	Replace();
+	Rejects();
+	CrossProcess();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,190 @@
+#include "FramebufferProtocol.hpp"
+
+#include "Check.hpp"
+
+#include <random>
+
+using namespace std;
+using namespace FramebufferProtocol;
+
+namespace {
+
+vector<uint8_t> Message(Header header, const vector<Rect> &rects, size_t payload_size)
+{
+	header.dirty_rect_count = static_cast<uint32_t>(rects.size());
+	vector<uint8_t> message(sizeof(Header) + rects.size() * sizeof(Rect));
+	memcpy(message.data(), &header, sizeof(Header));
+	if (!rects.empty())
+		memcpy(message.data() + sizeof(Header), rects.data(), rects.size() * sizeof(Rect));
+	for (size_t i = 0; i < payload_size; i++)
+		message.push_back(static_cast<uint8_t>(i * 7 + 1));
+	return message;
+}
+
+void DirtyRects()
+{
+	uint64_t size = 1;
+	CHECK(DirtyRectsSize({}, 16, 8, size));
+	CHECK_EQ(size, 0);
+
+	CHECK(DirtyRectsSize({ { 0, 0, 16, 8 } }, 16, 8, size));
+	CHECK_EQ(size, 16 * 8 * 4);
+
+	CHECK(DirtyRectsSize({ { 2, 1, 3, 2 }, { 16, 8, 0, 0 } }, 16, 8, size));
+	CHECK_EQ(size, 3 * 2 * 4);
+
+	CHECK(!DirtyRectsSize({ { 0, 0, 17, 1 } }, 16, 8, size));
+	CHECK(!DirtyRectsSize({ { 15, 0, 2, 1 } }, 16, 8, size));
+	CHECK(!DirtyRectsSize({ { 0, 7, 1, 2 } }, 16, 8, size));
+	CHECK(!DirtyRectsSize({ { 1, 0, 0xffffffff, 1 } }, 16, 8, size));
+	CHECK(!DirtyRectsSize({ { 0, 1, 1, 0xffffffff } }, 16, 8, size));
+}
+
+void Apply()
+{
+	// 4x3 frame with padded rows
+	const uint32_t stride = 4 * 4 + 8;
+	vector<uint8_t> frame(stride * 3, 0xee);
+
+	vector<Rect> rects = { { 1, 0, 2, 2 }, { 3, 2, 1, 1 } };
+	vector<uint8_t> data;
+	for (uint8_t i = 0; i < (2 * 2 + 1) * 4; i++)
+		data.push_back(i);
+
+	ApplyDirtyRects(frame.data(), stride, rects, data.data());
+
+	for (uint32_t y = 0; y < 3; y++)
+		for (uint32_t x = 0; x < stride; x++) {
+			auto value = frame[y * stride + x];
+			auto px = x / 4, byte = x % 4;
+			if (y < 2 && px >= 1 && px < 3)
+				CHECK_EQ(value, (y * 2 + px - 1) * 4 + byte);
+			else if (y == 2 && px == 3)
+				CHECK_EQ(value, 16 + byte);
+			else
+				CHECK_EQ(value, 0xee);
+		}
+}
+
+void ParseRects()
+{
+	auto header = MakeHeader(16, 8, 16 * 4, FORMAT_BGRA, 1, 2);
+
+	Header parsed;
+	vector<Rect> rects;
+	const uint8_t *payload;
+	size_t payload_size;
+
+	auto full = Message(header, {}, 16 * 4 * 8);
+	CHECK(Parse(full.data(), full.size(), parsed, rects, payload, payload_size));
+	CHECK(rects.empty());
+	CHECK_EQ(payload_size, 16 * 4 * 8);
+	CHECK(!Parse(full.data(), full.size() - 1, parsed, rects, payload, payload_size));
+
+	auto partial = Message(header, { { 2, 1, 3, 2 }, { 0, 7, 16, 1 } }, (3 * 2 + 16) * 4);
+	CHECK(Parse(partial.data(), partial.size(), parsed, rects, payload, payload_size));
+	CHECK_EQ(rects.size(), 2);
+	CHECK_EQ(rects[1].width, 16);
+	CHECK_EQ(payload - partial.data(), sizeof(Header) + 2 * sizeof(Rect));
+	CHECK(!Parse(partial.data(), partial.size() - 1, parsed, rects, payload, payload_size));
+
+	auto outside = Message(header, { { 0, 8, 1, 1 } }, 4);
+	CHECK(!Parse(outside.data(), outside.size(), parsed, rects, payload, payload_size));
+}
+
+// Parse on mutated valid messages and random data; a message it accepts has
+// to describe a payload that fits, which ApplyDirtyRects/the full frame copy
+// then rely on. Copies are sized exactly so ASan catches overreads
+void Fuzz()
+{
+	auto header = MakeHeader(16, 8, 16 * 4 + 8, FORMAT_RGBA, 1, 2);
+	vector<vector<uint8_t>> seeds = {
+		Message(header, {}, (16 * 4 + 8) * 8),
+		Message(header, { { 2, 1, 3, 2 }, { 0, 7, 16, 1 }, { 16, 8, 0, 0 } }, (3 * 2 + 16) * 4),
+	};
+	header.compression = COMPRESSION_DELTA_RLE;
+	seeds.push_back(Message(header, {}, 37));
+
+	const uint32_t interesting[] = { 0, 1, 4, 7, 8, 16, 64, 0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff, max_dirty_rects, max_dirty_rects + 1 };
+
+	mt19937 rng{ 1234 };
+	size_t accepted = 0;
+	for (int i = 0; i < 200000; i++) {
+		auto message = seeds[rng() % seeds.size()];
+
+		switch (rng() % 4) {
+		case 0: // random bytes
+			for (int n = rng() % 8 + 1; n; n--)
+				message[rng() % message.size()] = static_cast<uint8_t>(rng());
+			break;
+		case 1: { // header/rect fields
+			auto fields = min<size_t>(message.size(), sizeof(Header) + 3 * sizeof(Rect)) / 4;
+			auto value = interesting[rng() % (sizeof(interesting) / sizeof(interesting[0]))];
+			memcpy(&message[(rng() % fields) * 4], &value, sizeof(value));
+			break;
+		}
+		case 2: // truncated
+			message.resize(rng() % message.size());
+			break;
+		default: // random data after a header prefix
+			message.resize(rng() % (2 * message.size()));
+			for (size_t j = rng() % 16; j < message.size(); j++)
+				message[j] = static_cast<uint8_t>(rng());
+			break;
+		}
+
+		vector<uint8_t> exact(message);
+		exact.shrink_to_fit();
+
+		Header parsed;
+		vector<Rect> rects;
+		const uint8_t *payload = nullptr;
+		size_t payload_size = 0;
+		if (!Parse(exact.data(), exact.size(), parsed, rects, payload, payload_size))
+			continue;
+
+		accepted += 1;
+		CHECK(payload >= exact.data() + sizeof(Header));
+		CHECK(payload + payload_size == exact.data() + exact.size());
+		CHECK(parsed.width && parsed.height);
+
+		if (parsed.compression != COMPRESSION_NONE) {
+			CHECK(rects.empty());
+			CHECK(payload_size > 0);
+			continue;
+		}
+
+		CHECK_EQ(rects.size(), parsed.dirty_rect_count);
+		CHECK(parsed.stride >= static_cast<uint64_t>(parsed.width) * 4);
+
+		if (rects.empty()) {
+			CHECK(payload_size >= static_cast<uint64_t>(parsed.stride) * parsed.height);
+			continue;
+		}
+
+		uint64_t needed = 0;
+		CHECK(DirtyRectsSize(rects, parsed.width, parsed.height, needed));
+		CHECK(needed <= payload_size);
+
+		// only frames a test can afford to allocate
+		if (static_cast<uint64_t>(parsed.stride) * parsed.height <= (1 << 24)) {
+			vector<uint8_t> frame(static_cast<size_t>(parsed.stride) * parsed.height);
+			ApplyDirtyRects(frame.data(), parsed.stride, rects, payload);
+		}
+	}
+
+	// mutations have to leave enough valid messages to get past the checks
+	CHECK(accepted > 1000);
+}
+
+}
+
+int main()
+{
+	DirtyRects();
+	Apply();
+	ParseRects();
+	Fuzz();
+
+	return TEST_RESULT();
+}
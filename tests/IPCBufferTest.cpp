@@ -0,0 +1,132 @@
+#include "IPCBuffer.hpp"
+
+#include "Check.hpp"
+
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+void Recycling()
+{
+	IPCBufferPool pool;
+
+	for (int i = 0; i < 100; i++) {
+		auto lease = pool.Acquire(1920 * 1080 * 4);
+		CHECK(!!lease);
+		CHECK_EQ(lease.size(), 1920 * 1080 * 4);
+	}
+	CHECK_EQ(pool.Allocated(), 1);
+
+	// a buffer that is still leased isn't handed out again
+	auto held = pool.Acquire(16);
+	auto other = pool.Acquire(16);
+	CHECK(held.data() != other.data());
+	CHECK_EQ(pool.Allocated(), 2);
+}
+
+void References()
+{
+	IPCBufferPool pool;
+
+	uint8_t message[] = { 1, 2, 3, 4, 5 };
+	auto lease = pool.Copy(message, sizeof(message));
+	CHECK_EQ(lease.size(), sizeof(message));
+	CHECK(memcmp(lease.data(), message, sizeof(message)) == 0);
+
+	auto copy = lease;
+	auto data = lease.data();
+	lease.Release();
+	CHECK(!lease);
+	CHECK(!lease.data());
+	CHECK_EQ(lease.size(), 0);
+
+	// the copy keeps the buffer out of the free list
+	auto next = pool.Acquire(5);
+	CHECK(next.data() != data);
+	CHECK(memcmp(copy.data(), message, sizeof(message)) == 0);
+
+	auto moved = move(copy);
+	CHECK(!copy);
+	CHECK(moved.data() == data);
+
+	moved = moved;
+	CHECK(moved.data() == data);
+
+	moved = IPCBufferLease{};
+	CHECK(!moved);
+
+	// released now, reused by the next acquire
+	next.Release();
+	auto reused = pool.Acquire(5);
+	auto reused2 = pool.Acquire(5);
+	CHECK(reused.data() == data || reused2.data() == data);
+	CHECK_EQ(pool.Allocated(), 2);
+}
+
+void FreeListLimit()
+{
+	IPCBufferPool pool{ 2 };
+
+	vector<IPCBufferLease> leases;
+	for (int i = 0; i < 5; i++)
+		leases.push_back(pool.Acquire(64));
+	leases.clear();
+
+	for (int i = 0; i < 5; i++)
+		leases.push_back(pool.Acquire(64));
+	CHECK_EQ(pool.Allocated(), 8);
+}
+
+void OutlivesPool()
+{
+	IPCBufferLease lease;
+	{
+		IPCBufferPool pool;
+		lease = pool.Copy(reinterpret_cast<const uint8_t*>("frame"), 5);
+	}
+	CHECK(memcmp(lease.data(), "frame", 5) == 0);
+}
+
+void Threads()
+{
+	// receive thread hands leases to a render thread that releases them
+	IPCBufferPool pool;
+	mutex m;
+	IPCBufferLease shared;
+	atomic<bool> done{ false };
+
+	thread render([&]
+	{
+		IPCBufferLease read;
+		while (!done) {
+			lock_guard<mutex> lock(m);
+			read = move(shared);
+		}
+	});
+
+	for (int i = 0; i < 20000; i++) {
+		auto lease = pool.Acquire(256);
+		memset(lease.data(), i, lease.size());
+		lock_guard<mutex> lock(m);
+		shared = move(lease);
+	}
+
+	done = true;
+	render.join();
+	CHECK(pool.Allocated() <= 4);
+}
+
+}
+
+int main()
+{
+	Recycling();
+	References();
+	FreeListLimit();
+	OutlivesPool();
+	Threads();
+
+	return TEST_RESULT();
+}
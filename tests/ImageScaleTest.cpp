@@ -0,0 +1,165 @@
+#include "ImageScale.hpp"
+
+#include "Check.hpp"
+
+#include <random>
+
+using namespace std;
+
+namespace {
+
+mt19937 rng{ 5 };
+
+vector<uint8_t> Random(uint32_t cx, uint32_t cy, size_t pitch)
+{
+	vector<uint8_t> image(pitch * cy);
+	for (auto &b : image)
+		b = static_cast<uint8_t>(rng());
+	return image;
+}
+
+// scalar versions of the filters, the SSE2 paths have to match them exactly
+vector<uint8_t> HalveReference(const uint8_t *src, size_t pitch, uint32_t cx, uint32_t cy)
+{
+	vector<uint8_t> dst(size_t(cx / 2) * (cy / 2) * 4);
+	for (uint32_t y = 0; y < cy / 2; y++)
+		for (uint32_t x = 0; x < cx / 2; x++)
+			for (int c = 0; c < 4; c++) {
+				auto a = src + 2 * y * pitch + x * 8 + c;
+				auto b = a + pitch;
+				dst[(y * (cx / 2) + x) * 4 + c] = static_cast<uint8_t>((a[0] + a[4] + b[0] + b[4] + 2) >> 2);
+			}
+	return dst;
+}
+
+vector<uint8_t> BilinearReference(const uint8_t *src, size_t pitch, uint32_t src_cx, uint32_t src_cy, uint32_t dst_cx, uint32_t dst_cy)
+{
+	ImageScale::Detail::Axis ax(src_cx, dst_cx);
+	ImageScale::Detail::Axis ay(src_cy, dst_cy);
+
+	vector<uint8_t> dst(size_t(dst_cx) * dst_cy * 4);
+	for (uint32_t y = 0; y < dst_cy; y++) {
+		uint32_t sy, wy;
+		ay.At(y, sy, wy);
+		auto row0 = src + sy * pitch;
+		auto row1 = sy < src_cy - 1 ? row0 + pitch : row0;
+
+		for (uint32_t x = 0; x < dst_cx; x++) {
+			uint32_t sx, wx;
+			ax.At(x, sx, wx);
+			auto next = sx < src_cx - 1 ? 4 : 0;
+			for (int c = 0; c < 4; c++) {
+				auto top = (row0[sx * 4 + c] * (256 - wx) + row0[sx * 4 + next + c] * wx) >> 8;
+				auto bottom = (row1[sx * 4 + c] * (256 - wx) + row1[sx * 4 + next + c] * wx) >> 8;
+				dst[(y * dst_cx + x) * 4 + c] = static_cast<uint8_t>((top * (256 - wy) + bottom * wy + 128) >> 8);
+			}
+		}
+	}
+	return dst;
+}
+
+void Fit()
+{
+	uint32_t cx, cy;
+	ImageScale::Fit(1920, 1080, 320, cx, cy);
+	CHECK_EQ(cx, 320);
+	CHECK_EQ(cy, 180);
+
+	ImageScale::Fit(1080, 1920, 320, cx, cy);
+	CHECK_EQ(cx, 180);
+	CHECK_EQ(cy, 320);
+
+	// never upscales, never collapses to 0
+	ImageScale::Fit(200, 100, 320, cx, cy);
+	CHECK_EQ(cx, 200);
+	CHECK_EQ(cy, 100);
+
+	ImageScale::Fit(10000, 2, 320, cx, cy);
+	CHECK_EQ(cx, 320);
+	CHECK_EQ(cy, 1);
+}
+
+void Halve()
+{
+	for (auto size : { make_pair(2u, 2u), make_pair(9u, 5u), make_pair(16u, 4u), make_pair(37u, 21u), make_pair(1920u, 1080u) }) {
+		auto pitch = size.first * 4 + rng() % 3 * 4;
+		auto src = Random(size.first, size.second, pitch);
+
+		vector<uint8_t> dst(size_t(size.first / 2) * (size.second / 2) * 4);
+		ImageScale::Detail::Halve(dst.data(), (size.first / 2) * 4, src.data(), pitch, size.first, size.second);
+		CHECK(dst == HalveReference(src.data(), pitch, size.first, size.second));
+	}
+}
+
+void Bilinear()
+{
+	struct {
+		uint32_t src_cx, src_cy, dst_cx, dst_cy;
+	} cases[] = {
+		{ 7, 5, 3, 2 },
+		{ 100, 60, 77, 41 },
+		{ 1, 9, 1, 4 },
+		{ 64, 64, 100, 100 }, // upscale
+		{ 639, 359, 320, 180 },
+	};
+
+	for (auto &c : cases) {
+		auto pitch = c.src_cx * 4 + 8;
+		auto src = Random(c.src_cx, c.src_cy, pitch);
+
+		vector<uint8_t> dst(size_t(c.dst_cx) * c.dst_cy * 4);
+		ImageScale::Detail::Bilinear(dst.data(), c.dst_cx * 4, c.dst_cx, c.dst_cy, src.data(), pitch, c.src_cx, c.src_cy);
+		CHECK(dst == BilinearReference(src.data(), pitch, c.src_cx, c.src_cy, c.dst_cx, c.dst_cy));
+	}
+}
+
+void Resize()
+{
+	vector<uint8_t> dst;
+
+	// flat images stay flat through the box and bilinear passes
+	vector<uint8_t> flat(1920 * 1080 * 4);
+	for (size_t i = 0; i < flat.size(); i += 4) {
+		flat[i] = 10;
+		flat[i + 1] = 20;
+		flat[i + 2] = 30;
+		flat[i + 3] = 255;
+	}
+	ImageScale::Resize(flat.data(), 1920 * 4, 1920, 1080, dst, 320, 180);
+	CHECK_EQ(dst.size(), 320 * 180 * 4);
+	size_t off = 0;
+	for (size_t i = 0; i < dst.size(); i += 4)
+		off += dst[i] != 10 || dst[i + 1] != 20 || dst[i + 2] != 30 || dst[i + 3] != 255;
+	CHECK_EQ(off, 0);
+
+	// same size is a copy, exact power of two reductions are box filters only
+	auto src = Random(64, 32, 64 * 4 + 16);
+	ImageScale::Resize(src.data(), 64 * 4 + 16, 64, 32, dst, 64, 32);
+	for (uint32_t y = 0; y < 32; y++)
+		CHECK(memcmp(&dst[y * 64 * 4], &src[y * (64 * 4 + 16)], 64 * 4) == 0);
+
+	ImageScale::Resize(src.data(), 64 * 4 + 16, 64, 32, dst, 16, 8);
+	auto half = HalveReference(src.data(), 64 * 4 + 16, 64, 32);
+	CHECK(dst == HalveReference(half.data(), 32 * 4, 32, 16));
+
+	// every source pixel counts: a single bright pixel survives a 6x reduction
+	vector<uint8_t> dot(1920 * 1080 * 4, 0);
+	memset(&dot[(540 * 1920 + 960) * 4], 255, 4);
+	ImageScale::Resize(dot.data(), 1920 * 4, 1920, 1080, dst, 320, 180);
+	CHECK(*max_element(begin(dst), end(dst)) > 0);
+
+	ImageScale::Resize(src.data(), 64 * 4, 64, 32, dst, 0, 10);
+	CHECK(dst.empty());
+}
+
+}
+
+int main()
+{
+	Fit();
+	Halve();
+	Bilinear();
+	Resize();
+
+	return TEST_RESULT();
+}
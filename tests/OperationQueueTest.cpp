@@ -0,0 +1,218 @@
+#include "OperationQueue.hpp"
+
+#include "Check.hpp"
+
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+atomic<int> alive{ 0 };
+
+// tracks copies/destruction so leaked or double destroyed operations show up
+struct Tracked {
+	Tracked() { alive += 1; }
+	Tracked(const Tracked &) { alive += 1; }
+	Tracked(Tracked &&) { alive += 1; }
+	~Tracked() { alive -= 1; }
+};
+
+void Inplace()
+{
+	int calls = 0;
+	{
+		InplaceFunction<32> small;
+		CHECK(!small);
+		CHECK(!small.Emplace([&calls, t = Tracked{}] { calls += 1; }));
+		CHECK(!!small);
+		small();
+		CHECK_EQ(calls, 1);
+
+		char large_capture[64] = {};
+		InplaceFunction<32> large;
+		CHECK(large.Emplace([&calls, large_capture, t = Tracked{}] { calls += 1 + large_capture[0]; }));
+		large();
+		CHECK_EQ(calls, 2);
+		CHECK_EQ(alive.load(), 2);
+
+		large.Reset();
+		CHECK(!large);
+		CHECK_EQ(alive.load(), 1);
+	}
+	CHECK_EQ(alive.load(), 0);
+}
+
+void Histogram()
+{
+	LatencyHistogram histogram;
+	CHECK_EQ(histogram.Percentile(50), 0);
+
+	CHECK_EQ(LatencyHistogram::Bucket(0), 0);
+	CHECK_EQ(LatencyHistogram::Bucket(1), 0);
+	CHECK_EQ(LatencyHistogram::Bucket(2), 1);
+	CHECK_EQ(LatencyHistogram::Bucket(1023), 9);
+	CHECK_EQ(LatencyHistogram::Bucket(1024), 10);
+	CHECK_EQ(LatencyHistogram::Bucket(~0ULL), LatencyHistogram::bucket_count - 1);
+
+	for (int i = 0; i < 90; i++)
+		histogram.Add(100);
+	for (int i = 0; i < 10; i++)
+		histogram.Add(100000);
+
+	CHECK_EQ(histogram.Percentile(50), 127);
+	CHECK_EQ(histogram.Percentile(89), 127);
+	CHECK_EQ(histogram.Percentile(95), 131071);
+}
+
+void Priorities()
+{
+	int wakes = 0;
+	OperationQueue queue{ [&] { wakes += 1; } };
+
+	vector<int> order;
+	queue.Push([&] { order.push_back(3); }, OPERATION_PRIORITY_LOW);
+	queue.Push([&] { order.push_back(2); });
+	queue.Push([&] { order.push_back(1); }, OPERATION_PRIORITY_HIGH);
+	queue.Push([&] { order.push_back(4); }, OPERATION_PRIORITY_LOW);
+	CHECK_EQ(wakes, 1);
+
+	CHECK(!queue.Run());
+	CHECK(order == (vector<int>{ 1, 2, 3, 4 }));
+
+	// a Run that hits max_ops asks to be called again
+	for (int i = 0; i < 5; i++)
+		queue.Push([] {});
+	CHECK_EQ(wakes, 2);
+	CHECK(queue.Run(3));
+	CHECK_EQ(wakes, 3);
+	CHECK(!queue.Run(3));
+}
+
+void Overflow()
+{
+	OperationLane lane{ 4 };
+	CHECK_EQ(lane.Capacity(), 4);
+
+	vector<int> order;
+	for (int i = 0; i < 10; i++)
+		lane.Push([&order, i, t = Tracked{}] { order.push_back(i); });
+
+	// pushes keep going to the overflow list until it was drained
+	CHECK(lane.RunOne());
+	lane.Push([&order] { order.push_back(10); });
+
+	while (lane.RunOne())
+		;
+
+	CHECK_EQ(order.size(), 11);
+	for (int i = 0; i < 11; i++)
+		CHECK_EQ(order[i], i);
+
+	auto &stats = lane.GetStats();
+	CHECK_EQ(stats.pushed.load(), 11);
+	CHECK_EQ(stats.executed.load(), 11);
+	CHECK_EQ(stats.overflowed.load(), 7);
+	CHECK_EQ(alive.load(), 0);
+
+	// ring is used again once the overflow list is empty
+	lane.Push([] {});
+	CHECK(lane.RunOne());
+	CHECK_EQ(stats.overflowed.load(), 7);
+}
+
+// many producers against one consumer that sleeps until woken, with a ring
+// small enough to overflow regularly and captures that don't fit inline
+void Stress(size_t capacity, size_t producers, size_t per_producer)
+{
+	mutex m;
+	condition_variable cv;
+	bool woken = false;
+
+	OperationQueue queue{ [&]
+	{
+		lock_guard<mutex> lock(m);
+		woken = true;
+		cv.notify_one();
+	}, capacity };
+
+	vector<size_t> next(producers, 0);
+	size_t out_of_order = 0;
+	size_t executed = 0;
+	const size_t total = producers * per_producer;
+
+	thread consumer([&]
+	{
+		while (executed < total) {
+			{
+				unique_lock<mutex> lock(m);
+				if (!cv.wait_for(lock, chrono::seconds(10), [&] { return woken; }))
+					break;
+				woken = false;
+			}
+
+			while (queue.Run())
+				;
+		}
+	});
+
+	vector<thread> threads;
+	for (size_t p = 0; p < producers; p++) {
+		threads.emplace_back([&, p]
+		{
+			for (size_t i = 0; i < per_producer; i++) {
+				auto op = [&, p, i]
+				{
+					// consumer thread only
+					if (next[p] != i)
+						out_of_order += 1;
+					next[p] = i + 1;
+					executed += 1;
+				};
+
+				auto priority = static_cast<OperationPriority>(p % OPERATION_PRIORITY_COUNT);
+				if (i % 5 == 0) {
+					char padding[OperationLane::inline_size] = {};
+					queue.Push([op, padding, t = Tracked{}] { op(); (void)padding; }, priority);
+				} else {
+					queue.Push(op, priority);
+				}
+			}
+		});
+	}
+
+	for (auto &t : threads)
+		t.join();
+	consumer.join();
+
+	CHECK_EQ(executed, total);
+	CHECK_EQ(out_of_order, 0);
+	CHECK_EQ(alive.load(), 0);
+
+	uint64_t pushed = 0, ran = 0, heap = 0;
+	for (int i = 0; i < OPERATION_PRIORITY_COUNT; i++) {
+		auto &stats = queue.GetStats(static_cast<OperationPriority>(i));
+		pushed += stats.pushed;
+		ran += stats.executed;
+		heap += stats.heap_allocated;
+	}
+	CHECK_EQ(pushed, total);
+	CHECK_EQ(ran, total);
+	CHECK(heap >= total / 5);
+}
+
+}
+
+int main()
+{
+	Inplace();
+	Histogram();
+	Priorities();
+	Overflow();
+	Stress(8, 16, 20000);
+	Stress(OperationLane::default_capacity, 32, 10000);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,76 @@
+#include "PitchedCopy.hpp"
+
+#include "Check.hpp"
+
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+mt19937 rng{ 99 };
+
+// copies rows of row_size bytes from a buffer with src_pitch to a buffer with
+// dst_pitch, the destination starting `offset` bytes past a 16 byte boundary,
+// and compares against a byte wise copy, padding included
+void Compare(size_t row_size, size_t rows, size_t src_pitch, size_t dst_pitch, size_t offset, PitchedCopy::Swizzle swizzle)
+{
+	vector<uint8_t> src(src_pitch * rows + 1);
+	for (auto &b : src)
+		b = static_cast<uint8_t>(rng());
+
+	vector<uint8_t> dst_storage(dst_pitch * rows + 32, 0xcd);
+	auto dst = dst_storage.data() + (-reinterpret_cast<uintptr_t>(dst_storage.data()) & 15) + offset;
+	vector<uint8_t> expected(dst_storage);
+	auto expected_dst = expected.data() + (dst - dst_storage.data());
+
+	for (size_t y = 0; y < rows; y++)
+		for (size_t x = 0; x < row_size; x++) {
+			auto sx = x;
+			if (swizzle == PitchedCopy::SWIZZLE_BGRA_RGBA && x % 4 != 1 && x % 4 != 3)
+				sx = x ^ 2;
+			expected_dst[y * dst_pitch + x] = src[y * src_pitch + sx];
+		}
+
+	PitchedCopy::Copy(dst, dst_pitch, src.data(), src_pitch, row_size, rows, swizzle);
+
+	if (dst_storage != expected) {
+		fprintf(stderr, "row_size %zu rows %zu src_pitch %zu dst_pitch %zu offset %zu swizzle %d\n", row_size, rows, src_pitch, dst_pitch, offset, swizzle);
+		CHECK(dst_storage == expected);
+	}
+}
+
+void Small()
+{
+	for (auto swizzle : { PitchedCopy::SWIZZLE_NONE, PitchedCopy::SWIZZLE_BGRA_RGBA })
+		for (size_t row_size = 0; row_size <= 160; row_size += swizzle ? 4 : 1)
+			for (size_t offset = 0; offset < 16; offset++) {
+				auto pad = rng() % 3 == 0 ? 0 : rng() % 70;
+				Compare(row_size, 3, row_size + rng() % 40, row_size + pad, offset, swizzle);
+			}
+}
+
+// tight pitches take the single memcpy path, large surfaces the streaming one
+void Large()
+{
+	for (auto swizzle : { PitchedCopy::SWIZZLE_NONE, PitchedCopy::SWIZZLE_BGRA_RGBA }) {
+		Compare(1280 * 4, 240, 1280 * 4, 1280 * 4, 0, swizzle);
+		Compare(1280 * 4, 240, 1280 * 4, 1280 * 4 + 256, 0, swizzle);
+		Compare(1000 * 4, 300, 1000 * 4, 1024 * 4, 4, swizzle);
+		Compare(1000 * 4, 300, 1003 * 4, 1000 * 4, 8, swizzle);
+		Compare(999 * 4, 300, 999 * 4 + 1, 1024 * 4 + 6, 6, swizzle);
+	}
+
+	CHECK(1000 * 4 * 300 >= PitchedCopy::streaming_threshold);
+}
+
+}
+
+int main()
+{
+	Small();
+	Large();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,404 @@
+#include "ScreenshotPipeline.hpp"
+
+#include "Check.hpp"
+
+#include <map>
+#include <set>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// graphics backend that records what the pipeline does with it; encodes are
+// queued until RunWork() unless `threaded`, then each one gets a thread
+struct FakeBackend {
+	using Source = int;     // index into sizes, -1 for a source without size
+	using Stagesurf = int;  // 0 is no surface
+	using Image = vector<uint32_t>;
+	struct Options {
+		uint32_t scale = 2;
+	};
+
+	map<int, pair<uint32_t, uint32_t>> sizes = { { 0, { 1920, 1080 } }, { 1, { 1280, 720 } } };
+
+	int next_surface = 1;
+	set<int> live;
+	map<int, pair<uint32_t, uint32_t>> surface_sizes;
+	map<int, int> rendered; // surface -> source rendered into it
+	bool fail_create = false;
+	int fail_render_source = -2;
+	bool fail_read = false;
+
+	size_t renders = 0;
+	size_t reads = 0;
+	vector<string> saved;
+	mutex saved_mutex;
+
+	bool threaded = false;
+	vector<function<void()>> work;
+	vector<thread> threads;
+
+	~FakeBackend()
+	{
+		for (auto &t : threads)
+			t.join();
+	}
+
+	bool SourceSize(const Source &source, uint32_t &cx, uint32_t &cy)
+	{
+		auto it = sizes.find(source);
+		if (it == end(sizes))
+			return false;
+		cx = it->second.first;
+		cy = it->second.second;
+		return true;
+	}
+
+	void DefaultSize(const Options &options, uint32_t source_cx, uint32_t source_cy, uint32_t &cx, uint32_t &cy)
+	{
+		cx = source_cx / options.scale;
+		cy = source_cy / options.scale;
+	}
+
+	Stagesurf CreateStagesurf(uint32_t cx, uint32_t cy)
+	{
+		if (fail_create)
+			return 0;
+		auto surface = next_surface++;
+		live.insert(surface);
+		surface_sizes[surface] = { cx, cy };
+		return surface;
+	}
+
+	void DestroyStagesurf(Stagesurf surface)
+	{
+		CHECK_EQ(live.erase(surface), 1);
+	}
+
+	boost::optional<string> Render(const Source &source, uint32_t cx, uint32_t cy, const Options&, Stagesurf surface)
+	{
+		CHECK(live.count(surface));
+		CHECK(surface_sizes[surface] == make_pair(cx, cy));
+		renders += 1;
+		if (source == fail_render_source)
+			return string("render failed");
+		rendered[surface] = source;
+		return boost::none;
+	}
+
+	boost::optional<string> Read(Stagesurf surface, uint32_t cx, uint32_t cy, Image &image)
+	{
+		CHECK(live.count(surface));
+		reads += 1;
+		if (fail_read)
+			return string("map failed");
+		image.assign(static_cast<size_t>(cx) * cy, static_cast<uint32_t>(rendered[surface]));
+		return boost::none;
+	}
+
+	boost::optional<string> Save(const Image &image, uint32_t cx, uint32_t cy, const string &filename, const Options&)
+	{
+		CHECK_EQ(image.size(), static_cast<size_t>(cx) * cy);
+		if (filename == "fail.png")
+			return string("save failed");
+		lock_guard<mutex> lock(saved_mutex);
+		saved.push_back(filename);
+		return boost::none;
+	}
+
+	void Submit(function<void()> func)
+	{
+		if (threaded)
+			threads.emplace_back(move(func));
+		else
+			work.push_back(move(func));
+	}
+
+	void RunWork(size_t index)
+	{
+		auto func = move(work[index]);
+		work.erase(begin(work) + index);
+		func();
+	}
+
+	void RunWork()
+	{
+		auto pending = move(work);
+		work.clear();
+		for (auto &func : pending)
+			func();
+	}
+};
+
+using Pipeline = ScreenshotPipeline<FakeBackend>;
+
+// callback results by filename
+struct Results {
+	struct Result {
+		size_t calls = 0;
+		boost::optional<string> error;
+		uint32_t cx = 0, cy = 0;
+	};
+
+	mutex m;
+	map<string, Result> results;
+
+	Pipeline::Callback Callback()
+	{
+		return [this](boost::optional<string> error, uint32_t cx, uint32_t cy, const string filename)
+		{
+			lock_guard<mutex> lock(m);
+			auto &result = results[filename];
+			result.calls += 1;
+			result.error = error;
+			result.cx = cx;
+			result.cy = cy;
+		};
+	}
+
+	Result &operator[](const string &filename)
+	{
+		return results[filename];
+	}
+};
+
+const auto timeout = chrono::milliseconds(60000);
+
+void Burst()
+{
+	FakeBackend backend;
+	Results results;
+	{
+		Pipeline pipeline{ backend };
+		for (int i = 0; i < 6; i++)
+			pipeline.Request(0, 640, 360, "burst" + to_string(i) + ".png", {}, timeout, results.Callback());
+
+		// render -> stage for the first max_in_flight, nothing read back yet
+		CHECK(pipeline.Tick());
+		CHECK_EQ(backend.renders, 4);
+		CHECK_EQ(backend.reads, 0);
+		CHECK_EQ(pipeline.InFlight(), 4);
+
+		// map a tick later, encodes go to the workers
+		CHECK(pipeline.Tick());
+		CHECK_EQ(backend.reads, 4);
+		CHECK_EQ(backend.work.size(), 4);
+		CHECK_EQ(pipeline.ring.Idle(), 4);
+
+		// encoded requests complete, the rest reuse the staging surfaces
+		backend.RunWork();
+		CHECK(pipeline.Tick());
+		CHECK_EQ(results.results.size(), 4);
+		CHECK_EQ(backend.renders, 6);
+		CHECK_EQ(pipeline.ring.created, 4);
+		CHECK_EQ(pipeline.ring.reused, 2);
+
+		CHECK(pipeline.Tick());
+		backend.RunWork();
+		CHECK(!pipeline.Tick());
+	}
+
+	for (int i = 0; i < 6; i++) {
+		auto &result = results["burst" + to_string(i) + ".png"];
+		CHECK_EQ(result.calls, 1);
+		CHECK(!result.error);
+		CHECK_EQ(result.cx, 640);
+		CHECK_EQ(result.cy, 360);
+	}
+	CHECK_EQ(backend.saved.size(), 6);
+	CHECK(backend.live.empty());
+}
+
+void Sizes()
+{
+	FakeBackend backend;
+	Results results;
+	{
+		Pipeline pipeline{ backend };
+		pipeline.ring.max_idle = 1;
+
+		Pipeline::Options half;
+		Pipeline::Options quarter;
+		quarter.scale = 4;
+		pipeline.Request(0, 0, 0, "default.png", half, timeout, results.Callback());
+		pipeline.Request(1, 0, 0, "quarter.png", quarter, timeout, results.Callback());
+		pipeline.Request(-1, 0, 0, "nosource.png", half, timeout, results.Callback());
+		pipeline.Request(0, 100, 100, "explicit.png", half, timeout, results.Callback());
+
+		while (pipeline.Tick())
+			backend.RunWork();
+
+		// surfaces of different sizes aren't shared, idle ones are capped
+		CHECK_EQ(pipeline.ring.created, 3);
+		CHECK_EQ(pipeline.ring.Idle(), 1);
+	}
+
+	CHECK_EQ(results["default.png"].cx, 960);
+	CHECK_EQ(results["default.png"].cy, 540);
+	CHECK_EQ(results["quarter.png"].cx, 320);
+	CHECK_EQ(results["quarter.png"].cy, 180);
+	CHECK(!results["explicit.png"].error);
+	CHECK(!!results["nosource.png"].error);
+	CHECK(backend.live.empty());
+}
+
+void Errors()
+{
+	FakeBackend backend;
+	Results results;
+	{
+		Pipeline pipeline{ backend };
+
+		backend.fail_create = true;
+		pipeline.Request(0, 64, 64, "create.png", {}, timeout, results.Callback());
+		pipeline.Tick();
+		backend.fail_create = false;
+
+		backend.fail_render_source = 1;
+		pipeline.Request(1, 64, 64, "render.png", {}, timeout, results.Callback());
+		pipeline.Tick();
+
+		backend.fail_read = true;
+		pipeline.Request(0, 64, 64, "read.png", {}, timeout, results.Callback());
+		pipeline.Tick();
+		pipeline.Tick();
+		backend.fail_read = false;
+
+		pipeline.Request(0, 64, 64, "fail.png", {}, timeout, results.Callback());
+		while (pipeline.Tick())
+			backend.RunWork();
+	}
+
+	for (auto name : { "create.png", "render.png", "read.png", "fail.png" }) {
+		CHECK_EQ(results[name].calls, 1);
+		CHECK(!!results[name].error);
+	}
+	CHECK(*results["fail.png"].error == "save failed");
+	CHECK(backend.live.empty());
+}
+
+void Cancel()
+{
+	FakeBackend backend;
+	Results results;
+	{
+		Pipeline pipeline{ backend };
+		pipeline.max_in_flight = 3;
+
+		auto saving = pipeline.Request(0, 64, 64, "saving.png", {}, timeout, results.Callback());
+		auto encoding = pipeline.Request(0, 64, 64, "encoding.png", {}, timeout, results.Callback());
+		pipeline.Tick();
+		pipeline.Tick();
+
+		auto staged = pipeline.Request(0, 64, 64, "staged.png", {}, timeout, results.Callback());
+		auto queued = pipeline.Request(0, 64, 64, "queued.png", {}, timeout, results.Callback());
+		pipeline.Request(0, 64, 64, "kept.png", {}, timeout, results.Callback());
+		pipeline.Tick();
+		CHECK_EQ(pipeline.InFlight(), 3);
+
+		// the encode of `encoding` already started, cancelling it is too late
+		backend.RunWork(1);
+		pipeline.Cancel(saving);
+		pipeline.Cancel(encoding);
+		pipeline.Cancel(staged);
+		pipeline.Cancel(queued);
+		pipeline.Cancel(12345);
+		pipeline.Tick();
+
+		// the cancelled encode doesn't save anything once the worker gets to it
+		backend.RunWork();
+		while (pipeline.Tick())
+			backend.RunWork();
+	}
+
+	for (auto name : { "saving.png", "staged.png", "queued.png" }) {
+		CHECK_EQ(results[name].calls, 1);
+		CHECK(results[name].error && *results[name].error == "screenshot request cancelled");
+	}
+	CHECK_EQ(results["encoding.png"].calls, 1);
+	CHECK(!results["encoding.png"].error);
+	CHECK_EQ(results["kept.png"].calls, 1);
+	CHECK(!results["kept.png"].error);
+	CHECK(backend.saved == (vector<string>{ "encoding.png", "kept.png" }));
+	CHECK(backend.live.empty());
+}
+
+void Timeout()
+{
+	FakeBackend backend;
+	Results results;
+	{
+		Pipeline pipeline{ backend };
+		pipeline.Request(0, 64, 64, "expired.png", {}, chrono::milliseconds(0), results.Callback());
+		pipeline.Request(0, 64, 64, "ok.png", {}, timeout, results.Callback());
+		while (pipeline.Tick())
+			backend.RunWork();
+	}
+
+	CHECK(results["expired.png"].error && *results["expired.png"].error == "screenshot request timed out");
+	CHECK(!results["ok.png"].error);
+	CHECK_EQ(results["ok.png"].calls, 1);
+}
+
+// requests from other threads, encodes on their own threads, shutdown with
+// requests in every state
+void Shutdown()
+{
+	FakeBackend backend;
+	backend.threaded = true;
+	Results results;
+
+	const int per_thread = 50;
+	{
+		Pipeline pipeline{ backend };
+
+		atomic<bool> stop{ false };
+		thread graphics([&]
+		{
+			while (!stop)
+				pipeline.Tick();
+		});
+
+		vector<thread> clients;
+		for (int t = 0; t < 4; t++)
+			clients.emplace_back([&, t]
+			{
+				for (int i = 0; i < per_thread; i++) {
+					auto id = pipeline.Request(i % 2, 32, 32, to_string(t) + "-" + to_string(i) + ".png", {}, timeout, results.Callback());
+					if (i % 7 == 0)
+						pipeline.Cancel(id);
+				}
+			});
+
+		for (auto &t : clients)
+			t.join();
+		stop = true;
+		graphics.join();
+
+		pipeline.Shutdown();
+		CHECK_EQ(pipeline.InFlight(), 0);
+
+		pipeline.Request(0, 32, 32, "late.png", {}, timeout, results.Callback());
+		CHECK(results["late.png"].error && *results["late.png"].error == "screenshot provider is shutting down");
+	}
+
+	CHECK_EQ(results.results.size(), 4 * per_thread + 1);
+	for (auto &result : results.results)
+		CHECK_EQ(result.second.calls, 1);
+	CHECK(backend.live.empty());
+}
+
+}
+
+int main()
+{
+	Burst();
+	Sizes();
+	Errors();
+	Cancel();
+	Timeout();
+	Shutdown();
+
+	return TEST_RESULT();
+}
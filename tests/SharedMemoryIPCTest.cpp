@@ -0,0 +1,228 @@
+#include "SharedMemoryIPC.hpp"
+
+#include "Check.hpp"
+
+#include <condition_variable>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+string RingName(const char *test)
+{
+	return "crucible-test-" + to_string(getpid()) + "-" + test;
+}
+
+void Fill(uint8_t *data, size_t size, uint32_t seed)
+{
+	for (size_t i = 0; i < size; i++)
+		data[i] = static_cast<uint8_t>(seed * 31 + i);
+}
+
+bool Matches(const uint8_t *data, size_t size, uint32_t seed)
+{
+	for (size_t i = 0; i < size; i++)
+		if (data[i] != static_cast<uint8_t>(seed * 31 + i))
+			return false;
+	return true;
+}
+
+struct Received {
+	mutex m;
+	condition_variable cv;
+	size_t messages = 0;
+	size_t bad = 0;
+	bool disconnected = false;
+
+	void Wait(size_t count)
+	{
+		unique_lock<mutex> lock(m);
+		cv.wait_for(lock, chrono::seconds(10), [&] { return messages >= count || disconnected; });
+	}
+
+	void WaitForDisconnect()
+	{
+		unique_lock<mutex> lock(m);
+		cv.wait_for(lock, chrono::seconds(10), [&] { return disconnected; });
+	}
+};
+
+size_t MessageSize(uint32_t i)
+{
+	return 1 + (i * 7919) % 12000;
+}
+
+void RoundTrip()
+{
+	Received received;
+	SharedMemoryIPCServer server;
+	auto ok = server.Start(RingName("roundtrip"), [&](uint8_t *data, size_t size)
+	{
+		lock_guard<mutex> lock(received.m);
+		if (!data) {
+			received.disconnected = true;
+		} else {
+			auto index = static_cast<uint32_t>(received.messages++);
+			if (size != MessageSize(index) || !Matches(data, size, index))
+				received.bad += 1;
+		}
+		received.cv.notify_all();
+	}, SharedMemoryIPC::min_capacity);
+	CHECK(ok);
+
+	SharedMemoryIPCClient client{ RingName("roundtrip") };
+	CHECK(!!client);
+
+	// 64k ring with up to 12k messages wraps and applies backpressure many times over
+	const uint32_t count = 2000;
+	vector<uint8_t> buffer;
+	for (uint32_t i = 0; i < count; i++) {
+		buffer.resize(MessageSize(i));
+		Fill(buffer.data(), buffer.size(), i);
+		CHECK(client.Write(buffer.data(), buffer.size()));
+	}
+
+	received.Wait(count);
+	{
+		lock_guard<mutex> lock(received.m);
+		CHECK_EQ(received.messages, count);
+		CHECK_EQ(received.bad, 0);
+		CHECK(!received.disconnected);
+	}
+
+	client.Close();
+	received.WaitForDisconnect();
+	lock_guard<mutex> lock(received.m);
+	CHECK(received.disconnected);
+}
+
+void ReserveCommit()
+{
+	Received received;
+	string payload;
+	SharedMemoryIPCServer server{ RingName("reserve"), [&](uint8_t *data, size_t size)
+	{
+		lock_guard<mutex> lock(received.m);
+		if (data) {
+			payload.assign(reinterpret_cast<char*>(data), size);
+			received.messages += 1;
+		}
+		received.cv.notify_all();
+	}, SharedMemoryIPC::min_capacity };
+
+	SharedMemoryIPCClient client{ RingName("reserve") };
+
+	// an abandoned reservation is dropped by the next one
+	auto ptr = client.Reserve(16);
+	CHECK(ptr);
+	memcpy(ptr, "abandoned", 9);
+
+	ptr = client.Reserve(5);
+	CHECK(ptr);
+	memcpy(ptr, "hello", 5);
+	CHECK(client.Commit());
+	CHECK(!client.Commit());
+
+	received.Wait(1);
+	lock_guard<mutex> lock(received.m);
+	CHECK_EQ(received.messages, 1);
+	CHECK(payload == "hello");
+}
+
+void Limits()
+{
+	SharedMemoryIPCServer server{ RingName("limits"), [](uint8_t*, size_t) {}, SharedMemoryIPC::min_capacity };
+
+	SharedMemoryIPCClient client{ RingName("limits") };
+	CHECK(!!client);
+
+	// only one writer per ring
+	SharedMemoryIPCClient second{ RingName("limits") };
+	CHECK(!second);
+
+	// messages are limited to half the ring
+	vector<uint8_t> large(SharedMemoryIPC::min_capacity / 2 + 1);
+	CHECK(!client.Write(large.data(), large.size()));
+
+	SharedMemoryIPCClient missing{ RingName("missing") };
+	CHECK(!missing);
+	CHECK(!missing.Write("x", 1));
+
+	// writes fail once the server is gone
+	server = SharedMemoryIPCServer{};
+	CHECK(!client);
+	CHECK(!client.Write("x", 1));
+}
+
+void Leased()
+{
+	Received received;
+	vector<IPCBufferLease> held;
+	SharedMemoryIPCServer server;
+	server.StartLeased(RingName("leased"), [&](IPCBufferLease lease)
+	{
+		lock_guard<mutex> lock(received.m);
+		if (!lease) {
+			received.disconnected = true;
+		} else {
+			auto index = static_cast<uint32_t>(received.messages++);
+			if (lease.size() != MessageSize(index))
+				received.bad += 1;
+			held.push_back(move(lease));
+		}
+		received.cv.notify_all();
+	}, SharedMemoryIPC::min_capacity);
+
+	SharedMemoryIPCClient client{ RingName("leased") };
+
+	// held leases keep their ring space, so the writer runs out of room
+	vector<uint8_t> buffer;
+	uint32_t written = 0;
+	for (; written < 64; written++) {
+		buffer.resize(MessageSize(written));
+		Fill(buffer.data(), buffer.size(), written);
+		auto ptr = client.Reserve(buffer.size(), 50);
+		if (!ptr)
+			break;
+		memcpy(ptr, buffer.data(), buffer.size());
+		client.Commit();
+	}
+	CHECK(written > 0);
+	CHECK(written < 64);
+
+	received.Wait(written);
+	{
+		lock_guard<mutex> lock(received.m);
+		CHECK_EQ(received.messages, written);
+		CHECK_EQ(received.bad, 0);
+
+		// leases still point at the original contents
+		for (uint32_t i = 0; i < held.size(); i++)
+			CHECK(Matches(held[i].data(), held[i].size(), i));
+
+		// releasing out of order only frees space once the oldest lease is gone
+		for (size_t i = 1; i < held.size(); i++)
+			held[i].Release();
+	}
+	CHECK(!client.Reserve(SharedMemoryIPC::min_capacity / 4, 50));
+
+	{
+		lock_guard<mutex> lock(received.m);
+		held.clear();
+	}
+	CHECK(client.Reserve(SharedMemoryIPC::min_capacity / 4, 1000));
+}
+
+}
+
+int main()
+{
+	RoundTrip();
+	ReserveCommit();
+	Limits();
+	Leased();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,452 @@
+// SurfaceQueue and ReadBitstream against a fake NVENC: nvEncEncodePicture
+// holds b-frames back with NV_ENC_ERR_NEED_MORE_INPUT and fills the output
+// buffers in submission order with pictures in coded order; in async mode a
+// "GPU" thread completes them in random order. The encode and output threads
+// do what Encode and RetrieveOutput in NVENC/Encoder.cpp do
+
+#include "NVENC/SurfaceQueue.hpp"
+
+#include "Check.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+struct Bitstream {
+	vector<uint8_t> data;
+	uint64_t pts = 0;
+	bool pending = false; // submitted, no picture assigned or not complete yet
+	bool complete = false;
+	bool locked = false;
+};
+
+struct Surface {
+	Bitstream bitstream;
+	bool in_flight = false;
+};
+
+// pictures are numbered in coded order, the payload is a pattern derived
+// from that number and the pts
+void Fill(Bitstream &bitstream, uint64_t coded, uint64_t pts)
+{
+	bitstream.data.resize(16 + (coded * 37) % 200);
+	memcpy(&bitstream.data[0], &coded, 8);
+	memcpy(&bitstream.data[8], &pts, 8);
+	for (size_t i = 16; i < bitstream.data.size(); i++)
+		bitstream.data[i] = static_cast<uint8_t>(coded + i);
+	bitstream.pts = pts;
+}
+
+bool Valid(const vector<uint8_t> &data, uint64_t &coded, uint64_t &pts)
+{
+	if (data.size() < 16)
+		return false;
+
+	memcpy(&coded, &data[0], 8);
+	memcpy(&pts, &data[8], 8);
+	if (data.size() != 16 + (coded * 37) % 200)
+		return false;
+
+	for (size_t i = 16; i < data.size(); i++)
+		if (data[i] != static_cast<uint8_t>(coded + i))
+			return false;
+	return true;
+}
+
+struct FakeEncoder {
+	bool async = false;
+	uint32_t b_frames = 0;
+	// every nth nvEncLockBitstream fails, 0 for never
+	uint32_t fail_lock_every = 0;
+
+	mutex m;
+	condition_variable cv;
+	bool stopping = false;
+
+	uint64_t submitted = 0;
+	uint64_t coded = 0;
+	deque<Bitstream*> outputs; // submitted, in order, waiting for a picture
+	deque<uint64_t> held; // b-frames waiting for the next anchor
+	vector<Bitstream*> gpu; // async: pictures assigned, not complete yet
+
+	uint64_t locks = 0;
+	atomic<uint64_t> errors{ 0 };
+
+	NV_ENCODE_API_FUNCTION_LIST funcs = {};
+
+	FakeEncoder()
+	{
+		funcs.nvEncEncodePicture = [](void *encoder, NV_ENC_PIC_PARAMS *pic)
+		{
+			return static_cast<FakeEncoder*>(encoder)->EncodePicture(pic);
+		};
+		funcs.nvEncLockBitstream = [](void *encoder, NV_ENC_LOCK_BITSTREAM *lock)
+		{
+			return static_cast<FakeEncoder*>(encoder)->LockBitstream(lock);
+		};
+		funcs.nvEncUnlockBitstream = [](void *encoder, NV_ENC_OUTPUT_PTR output)
+		{
+			return static_cast<FakeEncoder*>(encoder)->UnlockBitstream(output);
+		};
+	}
+
+	NVENCSTATUS EncodePicture(NV_ENC_PIC_PARAMS *pic)
+	{
+		lock_guard<mutex> lock(m);
+		auto output = static_cast<Bitstream*>(pic->outputBitstream);
+		if (output->pending || output->locked)
+			errors += 1;
+
+		output->pending = true;
+		output->complete = false;
+		outputs.push_back(output);
+
+		// every b_frames + 1th picture is an anchor, the b-frames before it
+		// are coded after it
+		if (submitted++ % (b_frames + 1)) {
+			held.push_back(pic->inputTimeStamp);
+			return NV_ENC_ERR_NEED_MORE_INPUT;
+		}
+
+		held.push_front(pic->inputTimeStamp);
+		for (auto pts : held) {
+			auto bitstream = outputs.front();
+			outputs.pop_front();
+			Fill(*bitstream, coded++, pts);
+			if (async) {
+				gpu.push_back(bitstream);
+			} else {
+				bitstream->pending = false;
+				bitstream->complete = true;
+			}
+		}
+		held.clear();
+		cv.notify_all();
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS LockBitstream(NV_ENC_LOCK_BITSTREAM *params)
+	{
+		lock_guard<mutex> lock(m);
+		auto bitstream = static_cast<Bitstream*>(params->outputBitstream);
+		// sync mode would block here, nothing gets retrieved before its output
+		if (!bitstream->complete || bitstream->locked)
+			errors += 1;
+
+		if (fail_lock_every && ++locks % fail_lock_every == 0) {
+			bitstream->complete = false;
+			return NV_ENC_ERR_GENERIC;
+		}
+
+		bitstream->locked = true;
+		params->bitstreamBufferPtr = bitstream->data.data();
+		params->bitstreamSizeInBytes = static_cast<uint32_t>(bitstream->data.size());
+		params->outputTimeStamp = bitstream->pts;
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS UnlockBitstream(NV_ENC_OUTPUT_PTR output)
+	{
+		lock_guard<mutex> lock(m);
+		auto bitstream = static_cast<Bitstream*>(output);
+		if (!bitstream->locked)
+			errors += 1;
+
+		bitstream->locked = false;
+		bitstream->complete = false;
+		return NV_ENC_SUCCESS;
+	}
+
+	// async: completes one assigned picture, not necessarily the oldest
+	bool Complete(mt19937 &rng)
+	{
+		lock_guard<mutex> lock(m);
+		if (gpu.empty())
+			return false;
+
+		auto index = rng() % min<size_t>(gpu.size(), 3);
+		gpu[index]->pending = false;
+		gpu[index]->complete = true;
+		gpu.erase(gpu.begin() + index);
+		cv.notify_all();
+		return true;
+	}
+
+	// WaitForCompletion: the completion event or the stop event
+	bool Wait(Bitstream *bitstream)
+	{
+		unique_lock<mutex> lock(m);
+		cv.wait(lock, [&] { return stopping || bitstream->complete; });
+		return !stopping;
+	}
+
+	void Stop()
+	{
+		lock_guard<mutex> lock(m);
+		stopping = true;
+		cv.notify_all();
+	}
+};
+
+void Basics()
+{
+	SurfaceQueue<Surface> queue;
+	Surface surfaces[2];
+	queue.Configure(false, false);
+	queue.Add(&surfaces[0]);
+	queue.Add(&surfaces[1]);
+
+	auto a = queue.Acquire(chrono::milliseconds(0));
+	auto b = queue.Acquire(chrono::milliseconds(0));
+	CHECK(a == &surfaces[0]);
+	CHECK(b == &surfaces[1]);
+	CHECK(!queue.Acquire(chrono::milliseconds(10)));
+
+	// not submitted after all, it's the next one handed out
+	queue.Return(b);
+	CHECK(queue.Acquire(chrono::milliseconds(0)) == b);
+	queue.Return(b);
+
+	queue.Submit(a, 100, true);
+	CHECK(queue.Next() == a);
+
+	// only the surface from Next finishes
+	EncodedPacket packet;
+	packet.data.assign(1000, 1);
+	queue.Finish(b, packet, true);
+	EncodedPacket popped;
+	CHECK(!queue.Pop(popped));
+
+	auto buffer = packet.data.data();
+	queue.Finish(a, packet, true);
+	CHECK(packet.data.empty());
+	CHECK(queue.Pop(popped));
+	CHECK_EQ(popped.dts, 100);
+	CHECK(popped.data.data() == buffer);
+
+	// buffers go back through Pop into spare and out again through Finish
+	CHECK(queue.Acquire(chrono::milliseconds(0)) == b);
+	queue.Submit(b, 101, true);
+	CHECK(queue.Next() == b);
+	packet.data.assign(10, 2);
+	queue.Finish(b, packet, true);
+	CHECK(queue.Pop(popped));
+	CHECK_EQ(popped.dts, 101);
+	CHECK(popped.data.size() == 10);
+	CHECK(!queue.Pop(popped));
+
+	queue.Submit(queue.Acquire(chrono::milliseconds(0)), 102, true);
+	CHECK(queue.Next() != nullptr);
+	queue.Finish(a, packet, true);
+	CHECK(packet.data.data() == buffer);
+
+	// failed packets consume their timestamp but aren't queued
+	auto surface = queue.Acquire(chrono::milliseconds(0));
+	queue.Submit(surface, 103, true);
+	queue.Next();
+	queue.Finish(surface, packet, false);
+	CHECK(queue.Pop(popped));
+	CHECK_EQ(popped.dts, 102);
+	CHECK(!queue.Pop(popped));
+
+	surface = queue.Acquire(chrono::milliseconds(0));
+	queue.Submit(surface, 104, true);
+	queue.Next();
+	queue.Finish(surface, packet, true);
+	CHECK(queue.Pop(popped));
+	CHECK_EQ(popped.dts, 104);
+
+	// with b-frames the first packet waits for a second timestamp
+	queue.Configure(false, true);
+	queue.Submit(queue.Acquire(chrono::milliseconds(0)), 0, true);
+	thread stopper([&]
+	{
+		this_thread::sleep_for(chrono::milliseconds(20));
+		queue.Stop();
+	});
+	CHECK(!queue.Next());
+	CHECK(!queue.Acquire(chrono::seconds(1)));
+	stopper.join();
+
+	queue.Clear();
+	queue.Configure(false, false);
+	CHECK(!queue.Acquire(chrono::milliseconds(0)));
+	CHECK(!queue.Pop(popped));
+}
+
+struct Run {
+	bool async;
+	uint32_t b_frames;
+	size_t surfaces;
+	uint32_t fail_lock_every;
+	bool stop_early;
+};
+
+void Stream(const Run &run)
+{
+	FakeEncoder fake;
+	fake.async = run.async;
+	fake.b_frames = run.b_frames;
+	fake.fail_lock_every = run.fail_lock_every;
+
+	vector<Surface> surfaces(run.surfaces);
+	SurfaceQueue<Surface> queue;
+	queue.Configure(run.async, run.b_frames != 0);
+	for (auto &surface : surfaces)
+		queue.Add(&surface);
+
+	atomic<bool> done{ false };
+	thread gpu;
+	if (run.async)
+		gpu = thread([&]
+		{
+			mt19937 rng{ 3 };
+			while (!done)
+				if (!fake.Complete(rng))
+					this_thread::yield();
+		});
+
+	atomic<uint64_t> failed{ 0 };
+	thread output([&]
+	{
+		EncodedPacket packet;
+		vector<uint32_t> slice_offsets(1);
+		for (;;) {
+			auto surface = queue.Next();
+			if (!surface)
+				return;
+
+			if (run.async && !fake.Wait(&surface->bitstream))
+				return;
+
+			NVENCSTATUS unlock_sts;
+			auto sts = ReadBitstream(fake.funcs, &fake, &surface->bitstream, slice_offsets, packet, unlock_sts);
+			failed += sts != NV_ENC_SUCCESS;
+			if (unlock_sts)
+				fake.errors += 1;
+
+			surface->in_flight = false;
+			queue.Finish(surface, packet, !sts);
+		}
+	});
+
+	// encode thread
+	const uint64_t frames = 600;
+	const int64_t interval = 2;
+	vector<int64_t> submitted;
+	vector<EncodedPacket> packets;
+	EncodedPacket packet;
+	size_t reused = 0;
+	for (uint64_t i = 0; i < frames; i++) {
+		auto surface = queue.Acquire(chrono::seconds(2));
+		CHECK(surface);
+		if (!surface)
+			break;
+
+		reused += surface->in_flight;
+		surface->in_flight = true;
+
+		// copy/upload failed, the frame is skipped
+		if (i % 13 == 5) {
+			surface->in_flight = false;
+			queue.Return(surface);
+			continue;
+		}
+
+		NV_ENC_PIC_PARAMS pic = {};
+		pic.version = NV_ENC_PIC_PARAMS_VER;
+		pic.outputBitstream = &surface->bitstream;
+		pic.inputTimeStamp = i * interval;
+
+		auto sts = fake.funcs.nvEncEncodePicture(&fake, &pic);
+		CHECK(sts == NV_ENC_SUCCESS || sts == NV_ENC_ERR_NEED_MORE_INPUT);
+		submitted.push_back(static_cast<int64_t>(pic.inputTimeStamp));
+		queue.Submit(surface, pic.inputTimeStamp, sts == NV_ENC_SUCCESS);
+
+		while (queue.Pop(packet))
+			packets.push_back(packet);
+
+		if (run.stop_early && i == frames / 2)
+			break;
+	}
+
+	// trailing b-frames never get coded without EOS
+	uint64_t coded;
+	{
+		lock_guard<mutex> lock(fake.m);
+		coded = fake.coded;
+	}
+
+	if (!run.stop_early) {
+		auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+		while (packets.size() + failed < coded && chrono::steady_clock::now() < deadline) {
+			if (queue.Pop(packet))
+				packets.push_back(packet);
+			else
+				this_thread::sleep_for(chrono::milliseconds(1));
+		}
+	}
+
+	queue.Stop();
+	fake.Stop();
+	output.join();
+	done = true;
+	if (gpu.joinable())
+		gpu.join();
+
+	while (queue.Pop(packet))
+		packets.push_back(packet);
+
+	CHECK_EQ(fake.errors.load(), 0);
+	CHECK_EQ(reused, 0);
+	if (!run.stop_early)
+		CHECK_EQ(packets.size() + failed, coded);
+	if (run.fail_lock_every && !run.stop_early)
+		CHECK(failed > 0);
+
+	// packets in coded order, dts in submission order, never past pts
+	uint64_t last_coded = 0;
+	bool first = true;
+	for (auto &p : packets) {
+		uint64_t index, pts;
+		CHECK(Valid(p.data, index, pts));
+		CHECK_EQ(p.pts, pts);
+		CHECK(first || index > last_coded);
+		CHECK(p.dts <= p.pts);
+		last_coded = index;
+		first = false;
+	}
+
+	for (size_t i = 1; i < packets.size(); i++)
+		CHECK(packets[i].dts > packets[i - 1].dts);
+
+	if (!packets.empty() && run.b_frames && !run.fail_lock_every)
+		CHECK_EQ(packets[0].dts, submitted[0] - (submitted[1] - submitted[0]));
+	if (!packets.empty() && !run.b_frames && !run.fail_lock_every)
+		CHECK_EQ(packets[0].dts, submitted[0]);
+}
+
+}
+
+int main()
+{
+	Basics();
+
+	for (auto async : { false, true })
+		for (auto b_frames : { 0u, 2u, 3u }) {
+			// normal and the fewest surfaces that still make progress
+			for (auto surfaces : { size_t(b_frames + 4), size_t(b_frames + 1) })
+				Stream({ async, b_frames, surfaces, 0, false });
+
+			Stream({ async, b_frames, b_frames + 4, 7, false });
+			Stream({ async, b_frames, b_frames + 4, 0, true });
+		}
+
+	return TEST_RESULT();
+}
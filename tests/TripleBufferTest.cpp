@@ -0,0 +1,128 @@
+#include "TripleBuffer.hpp"
+
+#include "Check.hpp"
+
+#include <memory>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+void Basic()
+{
+	TripleBuffer<int> buffer;
+	CHECK(!buffer.HasNew());
+	CHECK(!buffer.Consume());
+
+	buffer.Publish(1);
+	CHECK(buffer.HasNew());
+	CHECK(buffer.Consume());
+	CHECK_EQ(buffer.Front(), 1);
+	CHECK(!buffer.Consume());
+	CHECK_EQ(buffer.Front(), 1);
+
+	// the consumer only sees the newest value
+	buffer.Publish(2);
+	buffer.Publish(3);
+	buffer.Publish(4);
+	CHECK(buffer.Consume());
+	CHECK_EQ(buffer.Front(), 4);
+
+	// producer filling Back() in place
+	buffer.Back() = 5;
+	CHECK(!buffer.HasNew());
+	buffer.Publish();
+	CHECK(buffer.Consume());
+	CHECK_EQ(buffer.Front(), 5);
+}
+
+void Ownership()
+{
+	// published values the consumer never saw are released by the producer
+	auto value = make_shared<int>(1);
+	TripleBuffer<shared_ptr<int>> buffer;
+	buffer.Publish(shared_ptr<int>(value));
+	CHECK(buffer.Consume());
+	buffer.Publish(make_shared<int>(2));
+	buffer.Publish(make_shared<int>(3));
+	CHECK_EQ(value.use_count(), 2);
+	buffer.Publish(make_shared<int>(4));
+	CHECK_EQ(value.use_count(), 2);
+
+	CHECK(buffer.Consume());
+	CHECK_EQ(*buffer.Front(), 4);
+	buffer.Publish(make_shared<int>(5));
+	buffer.Publish(make_shared<int>(6));
+	CHECK_EQ(value.use_count(), 1);
+}
+
+// a frame-like value, written without atomics so a slot shared between both
+// sides shows up as a torn frame, and as a data race under TSAN
+struct Frame {
+	uint64_t sequence = 0;
+	uint64_t words[64] = {};
+};
+
+void Stress(uint64_t frames)
+{
+	TripleBuffer<Frame> buffer;
+
+	size_t torn = 0;
+	size_t out_of_order = 0;
+	size_t consumed = 0;
+	uint64_t last = 0;
+	atomic<bool> done{ false };
+
+	thread consumer([&]
+	{
+		for (;;) {
+			// done has to be read before the last Consume, or the final
+			// frame could be missed
+			auto finished = done.load();
+			if (!buffer.Consume()) {
+				if (finished)
+					break;
+				this_thread::yield();
+				continue;
+			}
+
+			auto &frame = buffer.Front();
+			for (auto word : frame.words)
+				torn += word != frame.sequence;
+			out_of_order += frame.sequence <= last;
+			last = frame.sequence;
+			consumed += 1;
+		}
+	});
+
+	for (uint64_t i = 1; i <= frames; i++) {
+		auto &frame = buffer.Back();
+		frame.sequence = i;
+		for (auto &word : frame.words)
+			word = i;
+		buffer.Publish();
+
+		if (i % 1024 == 0)
+			this_thread::yield();
+	}
+	done = true;
+	consumer.join();
+
+	CHECK_EQ(torn, 0);
+	CHECK_EQ(out_of_order, 0);
+	CHECK_EQ(last, frames);
+	CHECK(consumed > 0);
+	CHECK(consumed <= frames);
+}
+
+}
+
+int main()
+{
+	Basic();
+	Ownership();
+	Stress(200000);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+// Forge side of CommandProtocol.hpp, builds binary command frames for the
+// tests and benchmarks
+
+#include "CommandProtocol.hpp"
+
+#include <string>
+#include <vector>
+
+struct CommandFrameWriter {
+	std::vector<uint8_t> data;
+
+	explicit CommandFrameWriter(uint16_t id, uint8_t version = CommandProtocol::binary_version)
+	{
+		Put(CommandProtocol::binary_magic);
+		Put(version);
+		Put(id);
+	}
+
+	template <typename T>
+	void Put(const T &val)
+	{
+		auto ptr = reinterpret_cast<const uint8_t*>(&val);
+		data.insert(end(data), ptr, ptr + sizeof(T));
+	}
+
+	void Count(uint16_t count) { Put(count); }
+
+	void Name(CommandProtocol::FieldType type, const char *name)
+	{
+		Put(static_cast<uint8_t>(type));
+		Put(static_cast<uint8_t>(strlen(name) + 1));
+		data.insert(end(data), name, name + strlen(name) + 1);
+	}
+
+	void Bool(const char *name, bool val) { Name(CommandProtocol::FIELD_BOOL, name); Put(static_cast<uint8_t>(val)); }
+	void Int(const char *name, int64_t val) { Name(CommandProtocol::FIELD_INT, name); Put(val); }
+	void Double(const char *name, double val) { Name(CommandProtocol::FIELD_DOUBLE, name); Put(val); }
+	void Null(const char *name) { Name(CommandProtocol::FIELD_NULL, name); }
+
+	void String(const char *name, const std::string &val)
+	{
+		Name(CommandProtocol::FIELD_STRING, name);
+		Put(static_cast<uint32_t>(val.size() + 1));
+		data.insert(end(data), val.c_str(), val.c_str() + val.size() + 1);
+	}
+
+	// followed by Count() and the object's fields
+	void Object(const char *name) { Name(CommandProtocol::FIELD_OBJECT, name); }
+
+	// followed by `count` times Count() and the item's fields
+	void Array(const char *name, uint32_t count) { Name(CommandProtocol::FIELD_ARRAY, name); Put(count); }
+};
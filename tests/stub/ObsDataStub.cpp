@@ -0,0 +1,432 @@
+#include "obs.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+enum ValueType {
+	VALUE_NULL,
+	VALUE_BOOL,
+	VALUE_INT,
+	VALUE_DOUBLE,
+	VALUE_STRING,
+	VALUE_OBJECT,
+	VALUE_ARRAY,
+};
+
+struct Value {
+	ValueType type = VALUE_NULL;
+	bool b = false;
+	long long i = 0;
+	double d = 0.;
+	string s;
+	OBSData obj;
+	OBSDataArray arr;
+};
+
+}
+
+struct obs_data {
+	atomic<long> refs{ 1 };
+	map<string, Value> items;
+};
+
+struct obs_data_array {
+	atomic<long> refs{ 1 };
+	vector<OBSData> items;
+};
+
+struct obs_data_item {
+	OBSData data;
+	string name;
+};
+
+namespace {
+
+const Value *Find(obs_data_t *data, const char *name)
+{
+	if (!data || !name)
+		return nullptr;
+
+	auto it = data->items.find(name);
+	return it == end(data->items) ? nullptr : &it->second;
+}
+
+Value &Set(obs_data_t *data, const char *name, ValueType type)
+{
+	auto &val = data->items[name];
+	val = Value{};
+	val.type = type;
+	return val;
+}
+
+// just enough JSON for command messages: no \u escapes beyond ASCII
+struct JsonParser {
+	const char *ptr;
+
+	void SkipSpace()
+	{
+		while (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r')
+			ptr++;
+	}
+
+	bool Literal(const char *lit)
+	{
+		auto len = strlen(lit);
+		if (strncmp(ptr, lit, len) != 0)
+			return false;
+		ptr += len;
+		return true;
+	}
+
+	bool ParseString(string &out)
+	{
+		if (*ptr != '"')
+			return false;
+		ptr++;
+
+		out.clear();
+		while (*ptr && *ptr != '"') {
+			if (*ptr != '\\') {
+				out.push_back(*ptr++);
+				continue;
+			}
+
+			ptr++;
+			switch (*ptr) {
+			case 'n': out.push_back('\n'); break;
+			case 't': out.push_back('\t'); break;
+			case 'r': out.push_back('\r'); break;
+			case 'b': out.push_back('\b'); break;
+			case 'f': out.push_back('\f'); break;
+			case 'u': {
+				char hex[5] = {};
+				for (int i = 0; i < 4; i++) {
+					if (!ptr[i + 1])
+						return false;
+					hex[i] = ptr[i + 1];
+				}
+				out.push_back(static_cast<char>(strtol(hex, nullptr, 16)));
+				ptr += 4;
+				break;
+			}
+			case 0: return false;
+			default: out.push_back(*ptr); break;
+			}
+			ptr++;
+		}
+
+		if (*ptr != '"')
+			return false;
+		ptr++;
+		return true;
+	}
+
+	bool ParseValue(obs_data_t *obj, const string &name)
+	{
+		SkipSpace();
+		auto key = name.c_str();
+
+		switch (*ptr) {
+		case '"': {
+			string str;
+			if (!ParseString(str))
+				return false;
+			obs_data_set_string(obj, key, str.c_str());
+			return true;
+		}
+
+		case '{': {
+			auto child = obs_data_create();
+			auto ok = ParseObject(child);
+			if (ok)
+				obs_data_set_obj(obj, key, child);
+			obs_data_release(child);
+			return ok;
+		}
+
+		case '[': {
+			ptr++;
+			auto arr = obs_data_array_create();
+			SkipSpace();
+			bool ok = true;
+			if (*ptr == ']') {
+				ptr++;
+			} else {
+				for (;;) {
+					SkipSpace();
+					auto item = obs_data_create();
+					ok = ParseObject(item);
+					if (ok)
+						obs_data_array_push_back(arr, item);
+					obs_data_release(item);
+					SkipSpace();
+					if (!ok || *ptr != ',')
+						break;
+					ptr++;
+				}
+				ok = ok && *ptr++ == ']';
+			}
+			if (ok)
+				obs_data_set_array(obj, key, arr);
+			obs_data_array_release(arr);
+			return ok;
+		}
+
+		case 't':
+			if (!Literal("true"))
+				return false;
+			obs_data_set_bool(obj, key, true);
+			return true;
+
+		case 'f':
+			if (!Literal("false"))
+				return false;
+			obs_data_set_bool(obj, key, false);
+			return true;
+
+		case 'n':
+			if (!Literal("null"))
+				return false;
+			Set(obj, key, VALUE_NULL);
+			return true;
+		}
+
+		auto start = ptr;
+		char *num_end = nullptr;
+		auto integral = strtoll(start, &num_end, 10);
+		if (num_end == start)
+			return false;
+
+		if (*num_end == '.' || *num_end == 'e' || *num_end == 'E') {
+			auto val = strtod(start, &num_end);
+			obs_data_set_double(obj, key, val);
+		} else {
+			obs_data_set_int(obj, key, integral);
+		}
+		ptr = num_end;
+		return true;
+	}
+
+	bool ParseObject(obs_data_t *obj)
+	{
+		SkipSpace();
+		if (*ptr != '{')
+			return false;
+		ptr++;
+
+		SkipSpace();
+		if (*ptr == '}') {
+			ptr++;
+			return true;
+		}
+
+		string name;
+		for (;;) {
+			SkipSpace();
+			if (!ParseString(name))
+				return false;
+
+			SkipSpace();
+			if (*ptr++ != ':')
+				return false;
+
+			if (!ParseValue(obj, name))
+				return false;
+
+			SkipSpace();
+			if (*ptr == ',') {
+				ptr++;
+				continue;
+			}
+
+			if (*ptr++ != '}')
+				return false;
+			return true;
+		}
+	}
+};
+
+}
+
+obs_data_t *obs_data_create()
+{
+	return new obs_data;
+}
+
+obs_data_t *obs_data_create_from_json(const char *json_string)
+{
+	if (!json_string)
+		return nullptr;
+
+	auto data = obs_data_create();
+	JsonParser parser{ json_string };
+	if (!parser.ParseObject(data)) {
+		obs_data_release(data);
+		return nullptr;
+	}
+	return data;
+}
+
+void obs_data_addref(obs_data_t *data)
+{
+	if (data)
+		data->refs += 1;
+}
+
+void obs_data_release(obs_data_t *data)
+{
+	if (data && --data->refs == 0)
+		delete data;
+}
+
+void obs_data_set_string(obs_data_t *data, const char *name, const char *val)
+{
+	Set(data, name, VALUE_STRING).s = val ? val : "";
+}
+
+void obs_data_set_int(obs_data_t *data, const char *name, long long val)
+{
+	Set(data, name, VALUE_INT).i = val;
+}
+
+void obs_data_set_double(obs_data_t *data, const char *name, double val)
+{
+	Set(data, name, VALUE_DOUBLE).d = val;
+}
+
+void obs_data_set_bool(obs_data_t *data, const char *name, bool val)
+{
+	Set(data, name, VALUE_BOOL).b = val;
+}
+
+void obs_data_set_obj(obs_data_t *data, const char *name, obs_data_t *obj)
+{
+	Set(data, name, VALUE_OBJECT).obj = obj;
+}
+
+void obs_data_set_array(obs_data_t *data, const char *name, obs_data_array_t *array)
+{
+	Set(data, name, VALUE_ARRAY).arr = array;
+}
+
+const char *obs_data_get_string(obs_data_t *data, const char *name)
+{
+	auto val = Find(data, name);
+	return val && val->type == VALUE_STRING ? val->s.c_str() : "";
+}
+
+long long obs_data_get_int(obs_data_t *data, const char *name)
+{
+	auto val = Find(data, name);
+	if (!val)
+		return 0;
+	return val->type == VALUE_INT ? val->i : val->type == VALUE_DOUBLE ? static_cast<long long>(val->d) : 0;
+}
+
+double obs_data_get_double(obs_data_t *data, const char *name)
+{
+	auto val = Find(data, name);
+	if (!val)
+		return 0.;
+	return val->type == VALUE_DOUBLE ? val->d : val->type == VALUE_INT ? static_cast<double>(val->i) : 0.;
+}
+
+bool obs_data_get_bool(obs_data_t *data, const char *name)
+{
+	auto val = Find(data, name);
+	return val && val->type == VALUE_BOOL && val->b;
+}
+
+obs_data_t *obs_data_get_obj(obs_data_t *data, const char *name)
+{
+	auto val = Find(data, name);
+	if (!val || val->type != VALUE_OBJECT)
+		return nullptr;
+
+	obs_data_addref(val->obj);
+	return val->obj;
+}
+
+obs_data_array_t *obs_data_get_array(obs_data_t *data, const char *name)
+{
+	auto val = Find(data, name);
+	if (!val || val->type != VALUE_ARRAY)
+		return nullptr;
+
+	obs_data_array_addref(val->arr);
+	return val->arr;
+}
+
+obs_data_item_t *obs_data_item_byname(obs_data_t *data, const char *name)
+{
+	if (!Find(data, name))
+		return nullptr;
+
+	return new obs_data_item{ data, name };
+}
+
+void obs_data_item_release(obs_data_item_t **item)
+{
+	if (!item)
+		return;
+
+	delete *item;
+	*item = nullptr;
+}
+
+const char *obs_data_item_get_string(obs_data_item_t *item)
+{
+	if (!item)
+		return nullptr;
+
+	auto val = Find(item->data, item->name.c_str());
+	return val && val->type == VALUE_STRING ? val->s.c_str() : nullptr;
+}
+
+obs_data_array_t *obs_data_array_create()
+{
+	return new obs_data_array;
+}
+
+void obs_data_array_addref(obs_data_array_t *array)
+{
+	if (array)
+		array->refs += 1;
+}
+
+void obs_data_array_release(obs_data_array_t *array)
+{
+	if (array && --array->refs == 0)
+		delete array;
+}
+
+size_t obs_data_array_count(obs_data_array_t *array)
+{
+	return array ? array->items.size() : 0;
+}
+
+obs_data_t *obs_data_array_item(obs_data_array_t *array, size_t idx)
+{
+	if (!array || idx >= array->items.size())
+		return nullptr;
+
+	obs_data_addref(array->items[idx]);
+	return array->items[idx];
+}
+
+size_t obs_data_array_push_back(obs_data_array_t *array, obs_data_t *obj)
+{
+	if (!array || !obj)
+		return 0;
+
+	array->items.emplace_back(obj);
+	return array->items.size() - 1;
+}
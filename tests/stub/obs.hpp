@@ -0,0 +1,112 @@
+#pragma once
+
+// Minimal stand-in for libobs' obs.hpp so headers that pass settings around
+// as obs_data (CommandProtocol.hpp, OBSHelpers.hpp) build on Linux without
+// libobs. Only obs_data/obs_data_array are implemented (ObsDataStub.cpp,
+// including a small JSON parser for obs_data_create_from_json); the other
+// types are declared so OBSHelpers.hpp compiles, using them fails to link.
+
+#include <cstddef>
+#include <cstdint>
+
+typedef struct obs_data obs_data_t;
+typedef struct obs_data_array obs_data_array_t;
+typedef struct obs_data_item obs_data_item_t;
+typedef struct obs_properties obs_properties_t;
+typedef struct obs_volmeter obs_volmeter_t;
+typedef struct obs_encoder obs_encoder_t;
+typedef struct obs_source obs_source_t;
+typedef struct obs_hotkey obs_hotkey_t;
+typedef size_t obs_hotkey_id;
+
+enum obs_fader_type {
+	OBS_FADER_CUBIC,
+	OBS_FADER_IEC,
+	OBS_FADER_LOG,
+};
+
+typedef bool (*obs_hotkey_enum_func)(void *data, obs_hotkey_id id, obs_hotkey_t *key);
+
+obs_data_t *obs_data_create();
+obs_data_t *obs_data_create_from_json(const char *json_string);
+void obs_data_addref(obs_data_t *data);
+void obs_data_release(obs_data_t *data);
+
+void obs_data_set_string(obs_data_t *data, const char *name, const char *val);
+void obs_data_set_int(obs_data_t *data, const char *name, long long val);
+void obs_data_set_double(obs_data_t *data, const char *name, double val);
+void obs_data_set_bool(obs_data_t *data, const char *name, bool val);
+void obs_data_set_obj(obs_data_t *data, const char *name, obs_data_t *obj);
+void obs_data_set_array(obs_data_t *data, const char *name, obs_data_array_t *array);
+
+const char *obs_data_get_string(obs_data_t *data, const char *name);
+long long obs_data_get_int(obs_data_t *data, const char *name);
+double obs_data_get_double(obs_data_t *data, const char *name);
+bool obs_data_get_bool(obs_data_t *data, const char *name);
+obs_data_t *obs_data_get_obj(obs_data_t *data, const char *name);
+obs_data_array_t *obs_data_get_array(obs_data_t *data, const char *name);
+
+obs_data_item_t *obs_data_item_byname(obs_data_t *data, const char *name);
+void obs_data_item_release(obs_data_item_t **item);
+const char *obs_data_item_get_string(obs_data_item_t *item);
+
+obs_data_array_t *obs_data_array_create();
+void obs_data_array_addref(obs_data_array_t *array);
+void obs_data_array_release(obs_data_array_t *array);
+size_t obs_data_array_count(obs_data_array_t *array);
+obs_data_t *obs_data_array_item(obs_data_array_t *array, size_t idx);
+size_t obs_data_array_push_back(obs_data_array_t *array, obs_data_t *obj);
+
+void obs_properties_destroy(obs_properties_t *props);
+obs_volmeter_t *obs_volmeter_create(enum obs_fader_type type);
+void obs_volmeter_destroy(obs_volmeter_t *volmeter);
+void obs_encoder_addref(obs_encoder_t *encoder);
+void obs_encoder_release(obs_encoder_t *encoder);
+void obs_source_addref(obs_source_t *source);
+void obs_source_release(obs_source_t *source);
+obs_source_t *obs_get_output_source(uint32_t channel);
+void obs_enum_hotkeys(obs_hotkey_enum_func func, void *data);
+
+template <typename T, void addref(T), void release(T)>
+class OBSRef {
+	T val = nullptr;
+
+	OBSRef &Replace(T valIn)
+	{
+		addref(valIn);
+		release(val);
+		val = valIn;
+		return *this;
+	}
+
+public:
+	OBSRef() = default;
+	OBSRef(T val_) : val(val_) { addref(val); }
+	OBSRef(const OBSRef &ref) : val(ref.val) { addref(val); }
+	OBSRef(OBSRef &&ref) : val(ref.val) { ref.val = nullptr; }
+	~OBSRef() { release(val); }
+
+	OBSRef &operator=(T valIn) { return Replace(valIn); }
+	OBSRef &operator=(const OBSRef &ref) { return Replace(ref.val); }
+
+	OBSRef &operator=(OBSRef &&ref)
+	{
+		if (this != &ref) {
+			release(val);
+			val = ref.val;
+			ref.val = nullptr;
+		}
+		return *this;
+	}
+
+	operator T() const { return val; }
+	T Get() const { return val; }
+
+	bool operator==(T p) const { return val == p; }
+	bool operator!=(T p) const { return val != p; }
+};
+
+using OBSData = OBSRef<obs_data_t*, obs_data_addref, obs_data_release>;
+using OBSDataArray = OBSRef<obs_data_array_t*, obs_data_array_addref, obs_data_array_release>;
+using OBSEncoder = OBSRef<obs_encoder_t*, obs_encoder_addref, obs_encoder_release>;
+using OBSSource = OBSRef<obs_source_t*, obs_source_addref, obs_source_release>;
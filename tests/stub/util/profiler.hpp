@@ -0,0 +1,10 @@
+#pragma once
+
+// declarations OBSHelpers.hpp refers to, nothing here is implemented
+
+typedef struct profiler_name_store profiler_name_store_t;
+typedef struct profiler_snapshot profiler_snapshot_t;
+
+void profiler_name_store_free(profiler_name_store_t *store);
+profiler_snapshot_t *profile_snapshot_create(void);
+void profile_snapshot_free(profiler_snapshot_t *snap);